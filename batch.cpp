@@ -0,0 +1,104 @@
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "scene.hpp"
+#include "image.hpp"
+#include "threadPool.hpp"
+#include "png.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio> //snprintf
+#include <cstdlib> //strtoul
+#include <stdexcept> //domain_error
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+
+/********************************************************************************************************************************
+* Headless batch rendering of a scene file.
+*
+* The scene file holds any number of scenes made of three lines "red= exp", "green= exp" and "blue= exp" (empty lines and
+* lines starting with '#' are skipped). The file is mapped in memory, then every scene is parsed and rendered in parallel
+* and written to <prefix><number>.ppm (or .png), the scenes being numbered from 1 in the order of the file.
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	if(argc < 4 || argc > 7){
+		cerr << "Usage : " << argv[0] << " <scene file> <width> <height> [output prefix] [threads] [ppm|png|png-fast|png-stored]" << endl;
+		return 2;
+	}
+
+	size_t width = std::strtoul(argv[2], nullptr, 10);
+	size_t height = std::strtoul(argv[3], nullptr, 10);
+	string prefix = (argc > 4) ? argv[4] : "scene";
+	size_t threads = (argc > 5) ? std::strtoul(argv[5], nullptr, 10) : 0;
+	string format = (argc > 6) ? argv[6] : "ppm";
+
+	if(width == 0 || height == 0){
+		cerr << "ERROR : Width or height can't be negative." << endl;
+		return 2;
+	}
+
+	PngMode mode = PNG_DEFAULT;
+	if(format == "png-fast")
+		mode = PNG_FAST;
+	else if(format == "png-stored")
+		mode = PNG_STORED;
+	else if(format != "png" && format != "ppm"){
+		cerr << "ERROR : Unknown image format " << format << "." << endl;
+		return 2;
+	}
+
+	try{
+		SceneFile file(argv[1]);
+		vector<SceneText> scenes = file.split();
+		vector<string> errors(scenes.size());
+
+		ThreadPool pool(threads);
+
+		pool.run(scenes.size(), [&](size_t i){
+
+			try{
+				ColorExpression red, green, blue;
+				parse_scene(scenes[i], red, green, blue);
+
+				vector<unsigned char> buffer(3*width*height);
+				Martist martist(buffer.data(), width, height, 0, 0, 0);
+				martist.draw(red, green, blue);
+
+				char number[32];
+				std::snprintf(number, sizeof(number), "%06zu", i+1);
+				if(format == "ppm")
+					write_ppm(prefix + number + ".ppm", buffer.data(), width, height);
+				else
+					write_png(prefix + number + ".png", buffer.data(), width, height, RGB8, mode);
+			}
+			catch(std::exception& e){
+				errors[i] = e.what();
+			}
+		});
+
+		//Report the failed scenes in the order of the file
+		size_t failed = 0;
+		for(size_t i = 0; i < scenes.size(); i++){
+			if(!errors[i].empty()){
+				cerr << "scene " << i+1 << " (line " << scenes[i].line << ") : " << errors[i] << endl;
+				failed++;
+			}
+		}
+
+		cout << scenes.size() - failed << " scene(s) rendered, " << failed << " failed." << endl;
+
+		return failed == 0 ? 0 : 1;
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 2;
+	}
+}
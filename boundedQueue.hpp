@@ -0,0 +1,110 @@
+#ifndef GUARD_boundedQueue_h
+#define GUARD_boundedQueue_h
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <utility>
+
+
+template <class T>
+class BoundedQueue // Bounded lock-free queue for many producers and many consumers (D. Vyukov's algorithm)
+{
+
+public:
+
+	explicit BoundedQueue(size_t capacity) : mask(1){ // Constructor (the capacity is rounded up to a power of two)
+
+		while(mask < capacity)
+			mask <<= 1;
+
+		cells.reset(new Cell[mask]);
+		for(size_t i = 0; i < mask; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+
+		mask--;
+		head.store(0, std::memory_order_relaxed);
+		tail.store(0, std::memory_order_relaxed);
+	}
+
+	bool try_push(T&& value){ // Returns false if the queue is full
+
+		size_t pos = tail.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		while(true){
+			cell = &cells[pos & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+
+			if(diff == 0){
+				if(tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				return false;
+			else
+				pos = tail.load(std::memory_order_relaxed);
+		}
+
+		cell->value = std::move(value);
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool try_pop(T& value){ // Returns false if the queue is empty
+
+		size_t pos = head.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		while(true){
+			cell = &cells[pos & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(pos + 1);
+
+			if(diff == 0){
+				if(head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if(diff < 0)
+				return false;
+			else
+				pos = head.load(std::memory_order_relaxed);
+		}
+
+		value = std::move(cell->value);
+		cell->sequence.store(pos + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t size() const{ // Approximate number of values in the queue
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t t = tail.load(std::memory_order_relaxed);
+		return t > h ? t - h : 0;
+	}
+
+	size_t capacity() const{ // Maximum number of values in the queue
+		return mask + 1;
+	}
+
+
+private:
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	size_t mask;
+
+	alignas(64) std::atomic<size_t> head; // Next cell to pop
+	alignas(64) std::atomic<size_t> tail; // Next cell to push
+
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+};
+
+#endif
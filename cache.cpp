@@ -0,0 +1,178 @@
+#include "cache.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "program.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm> //std::all_of
+#include <cctype> //isspace
+#include <cstring> //memcpy
+
+
+using std::string;
+using std::vector;
+using std::shared_ptr;
+
+
+
+/********************************************************************************************************************************
+* Constructor
+*
+* ARGUMENTS :
+*	- capacity is the maximum number of compiled expressions kept (as many texts are remembered)
+**********************************************************************************************************************************/
+ProgramCache::ProgramCache(size_t capacity) : texts(capacity), programs(capacity){}
+
+
+
+/********************************************************************************************************************************
+* Returns the compiled expression written in text, parsing it only if neither the text nor an equivalent expression is cached.
+* An empty text gives the expression of depth 0, like a "red=" line without expression.
+*
+* ARGUMENTS :
+*	- text is the expression in infix notation
+*	- hash is set to the hash of the canonical form of the expression
+**********************************************************************************************************************************/
+shared_ptr<const ColorExpression> ProgramCache::get(const string& text, uint64_t& hash){
+
+	CachedProgram cached = find(text);
+	hash = cached.hash;
+
+	return cached.exp;
+}
+
+
+
+/********************************************************************************************************************************
+* Returns the compiled expression written in text with its canonical form, parsing it only if neither the text nor an equivalent
+* expression is cached. The hash only finds the equivalent expressions : the texts come from the clients of the render server, so
+* an expression of the same hash is only shared if its canonical opcodes are the same too (else it is a miss, and replaced).
+*
+* ARGUMENTS :
+*	- text is the expression in infix notation
+**********************************************************************************************************************************/
+CachedProgram ProgramCache::find(const string& text){
+
+	CachedProgram cached;
+
+	if(texts.find(text, cached))
+		return cached;
+
+	shared_ptr<ColorExpression> parsed = std::make_shared<ColorExpression>();
+
+	if(std::all_of(text.begin(), text.end(), [](char c){ return isspace((unsigned char)c) != 0; }))
+		parsed->new_exp(0);
+	else
+		parsed->new_exp(text.data(), text.data() + text.size());
+
+	const Program canonical = parsed->compiled().canonical();
+	CachedProgram compiled = {parsed, std::make_shared<const vector<Opcode> >(canonical.code()), canonical.hash()};
+
+	//An equivalent expression may have been compiled from another text
+	if(programs.find(compiled.hash, cached) && *cached.canonical == *compiled.canonical)
+		compiled = cached;
+	else
+		programs.insert(compiled.hash, compiled);
+
+	texts.insert(text, compiled);
+
+	return compiled;
+}
+
+
+
+/********************************************************************************************************************************
+* Hit, miss and eviction counters of the compiled expressions : a text already parsed is a hit, else the hit or the miss of its
+* canonical form
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+CacheStats ProgramCache::stats() const{
+
+	CacheStats counters = programs.stats();
+	counters.hits += texts.stats().hits;
+
+	return counters;
+}
+
+
+
+/********************************************************************************************************************************
+* Comparison of two render keys (the viewports are compared exactly, and the canonical forms only when the hashes are equal)
+*
+* ARGUMENTS :
+*	- other is the key to compare with
+**********************************************************************************************************************************/
+bool RenderKey::operator==(const RenderKey& other) const{
+	if(hash != other.hash || width != other.width || height != other.height
+		|| viewport.x_min != other.viewport.x_min || viewport.x_max != other.viewport.x_max
+		|| viewport.y_min != other.viewport.y_min || viewport.y_max != other.viewport.y_max)
+		return false;
+
+	for(int c = 0; c < 3; c++)
+		if(canonical[c] != other.canonical[c] && *canonical[c] != *other.canonical[c])
+			return false;
+
+	return true;
+}
+
+
+
+/********************************************************************************************************************************
+* Hash of a render key
+*
+* ARGUMENTS :
+*	- key is the key to hash
+**********************************************************************************************************************************/
+size_t RenderKeyHash::operator()(const RenderKey& key) const{
+
+	double bounds[4] = {key.viewport.x_min, key.viewport.x_max, key.viewport.y_min, key.viewport.y_max};
+	uint64_t h = hash_combine(key.hash, key.width);
+	h = hash_combine(h, key.height);
+
+	for(int i = 0; i < 4; i++){
+		uint64_t bits;
+		std::memcpy(&bits, &bounds[i], sizeof(bits));
+		h = hash_combine(h, bits);
+	}
+
+	return (size_t)h;
+}
+
+
+
+/********************************************************************************************************************************
+* Returns the image of the three expressions, rendering it only if it is not cached yet. Equivalent expressions (same
+* canonical form) share the same image.
+*
+* ARGUMENTS :
+*	- programs is the cache of compiled expressions
+*	- images is the cache of rendered images
+*	- red, green and blue are the expressions in infix notation
+*	- width and height are the dimensions of the image (in pixels)
+*	- viewport is the part of the domain to draw
+**********************************************************************************************************************************/
+Image cached_render(ProgramCache& programs, RenderCache& images, const string& red, const string& green, const string& blue,
+	size_t width, size_t height, const Viewport& viewport){
+
+	const CachedProgram exps[3] = {programs.find(red), programs.find(green), programs.find(blue)};
+
+	RenderKey key = {hash_combine(hash_combine(exps[0].hash, exps[1].hash), exps[2].hash), width, height, viewport,
+		{exps[0].canonical, exps[1].canonical, exps[2].canonical}};
+	Image image;
+
+	if(images.find(key, image))
+		return image;
+
+	shared_ptr<vector<unsigned char> > buffer = std::make_shared<vector<unsigned char> >(3*width*height);
+
+	Martist martist(buffer->data(), width, height, 0, 0, 0);
+	martist.viewport(viewport);
+	martist.draw(*exps[0].exp, *exps[1].exp, *exps[2].exp);
+
+	images.insert(key, buffer, buffer->size());
+
+	return buffer;
+}
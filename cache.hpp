@@ -0,0 +1,180 @@
+#ifndef GUARD_cache_h
+#define GUARD_cache_h
+
+#include "martist.hpp"
+#include "colorExpression.hpp"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <functional>
+#include <cstddef>
+#include <stdint.h>
+
+
+struct CacheStats // Counters of a cache
+{
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+};
+
+
+
+template <class Key, class Value, class KeyHash = std::hash<Key> >
+class LruCache // Least recently used cache bounded by the total cost of its entries, safe to share between threads
+{
+
+public:
+
+	explicit LruCache(size_t capacity) : capacity(capacity), total_cost(0), counters() {} // Constructor
+
+	bool find(const Key& key, Value& value){ // Look for a key, and make it the most recently used one if it is found
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		typename Index::iterator it = index.find(key);
+		if(it == index.end()){
+			counters.misses++;
+			return false;
+		}
+
+		entries.splice(entries.begin(), entries, it->second);
+		value = it->second->value;
+		counters.hits++;
+		return true;
+	}
+
+	void insert(const Key& key, const Value& value, size_t cost = 1, std::vector<std::pair<Key, Value> >* evicted = nullptr){ // Add or replace an entry, evicting the least recently used ones (returned in evicted if given)
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		typename Index::iterator it = index.find(key);
+		if(it != index.end()){
+			total_cost -= it->second->cost;
+			entries.erase(it->second);
+			index.erase(it);
+		}
+
+		// An entry bigger than the whole cache is not kept
+		if(cost > capacity)
+			return;
+
+		while(total_cost + cost > capacity){
+			if(evicted)
+				evicted->push_back(std::make_pair(entries.back().key, entries.back().value));
+			total_cost -= entries.back().cost;
+			index.erase(entries.back().key);
+			entries.pop_back();
+			counters.evictions++;
+		}
+
+		Entry entry = {key, value, cost};
+		entries.push_front(entry);
+		index[key] = entries.begin();
+		total_cost += cost;
+	}
+
+	void clear(){ // Remove every entry (the counters are kept)
+		std::lock_guard<std::mutex> lock(mutex);
+		entries.clear();
+		index.clear();
+		total_cost = 0;
+	}
+
+	size_t cost() const{ // Total cost of the entries
+		std::lock_guard<std::mutex> lock(mutex);
+		return total_cost;
+	}
+
+	CacheStats stats() const{ // Hit, miss and eviction counters
+		std::lock_guard<std::mutex> lock(mutex);
+		return counters;
+	}
+
+
+private:
+
+	struct Entry
+	{
+		Key key;
+		Value value;
+		size_t cost;
+	};
+
+	typedef std::list<Entry> Entries;
+	typedef std::unordered_map<Key, typename Entries::iterator, KeyHash> Index;
+
+	size_t capacity;
+	size_t total_cost;
+	CacheStats counters;
+	Entries entries; // The most recently used first
+	Index index;
+	mutable std::mutex mutex;
+
+};
+
+
+
+struct CachedProgram // A compiled colour expression and its canonical form
+{
+	std::shared_ptr<const ColorExpression> exp;
+	std::shared_ptr<const std::vector<Opcode> > canonical; // Opcodes of the canonical form, which tell apart the expressions of the same hash
+	uint64_t hash; // Hash of the canonical form
+};
+
+
+
+class ProgramCache // Compiled colour expressions, found by the hash of their canonical form and told apart by its opcodes
+{
+
+public:
+
+	explicit ProgramCache(size_t capacity); // Constructor (capacity is a number of expressions)
+
+	std::shared_ptr<const ColorExpression> get(const std::string& text, uint64_t& hash); // Returns the compiled expression written in text and its hash
+
+	CachedProgram find(const std::string& text); // Returns the compiled expression written in text with its canonical form
+
+	CacheStats stats() const; // Hit, miss and eviction counters of the compiled expressions
+
+
+private:
+
+	LruCache<std::string, CachedProgram> texts; // The expressions already parsed
+	LruCache<uint64_t, CachedProgram> programs; // The expressions by the hash of their canonical form, from any text
+
+};
+
+
+
+struct RenderKey // Identifies a rendered image
+{
+	uint64_t hash; // Hash of the three colour expressions
+	size_t width;
+	size_t height;
+	Viewport viewport;
+	std::shared_ptr<const std::vector<Opcode> > canonical[3]; // Canonical forms of the three colour expressions, compared when the hashes are equal
+
+	bool operator==(const RenderKey& other) const;
+};
+
+struct RenderKeyHash
+{
+	size_t operator()(const RenderKey& key) const;
+};
+
+typedef std::shared_ptr<const std::vector<unsigned char> > Image; // Interleaved RGB buffer shared by the cache and its users
+
+typedef LruCache<RenderKey, Image, RenderKeyHash> RenderCache; // Rendered images, bounded by their size in bytes
+
+
+
+Image cached_render(ProgramCache& programs, RenderCache& images, const std::string& red, const std::string& green, const std::string& blue,
+	size_t width, size_t height, const Viewport& viewport); // Returns the image of the three expressions, rendering it only if it is not cached yet
+
+#endif
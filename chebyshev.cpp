@@ -0,0 +1,314 @@
+#include "chebyshev.hpp"
+#include "martist.hpp"
+#include "program.hpp"
+#include "kernels.hpp"
+
+#include <vector>
+#include <algorithm> //std::min, std::max
+#include <cmath> //std::cos, std::abs
+#include <limits>
+#include <math.h> //M_PI
+
+
+using std::vector;
+
+
+static const int MAX_DEGREE = 64; // Highest degree of a surrogate
+static const int FIRST_DEGREE = 4; // Lowest degree tried by fit_surrogate, the next ones double it
+static const double EXACT_ERROR = 0.1; // Estimated error of a surrogate without tolerance, in quantization steps
+static const double SAFETY = 2.0; // Factor between the largest error measured and the estimated maximum error
+static const size_t FIT_SHARE = 16; // The fits of a surrogate cost at most 1/FIT_SHARE of the evaluation they replace
+static const double STEP_COST = 0.25; // Cost of a step of the Clenshaw recurrence, in nodes of an expression
+static const double CHECK_COST = 6.0; // Cost of checking the byte of a surrogate value, in nodes of an expression
+static const size_t SHARE_GRID = 32; // Samples per axis estimating the share of the pixels a surrogate can't guarantee
+
+
+
+/********************************************************************************************************************************
+* Constructor of an empty surrogate (degree -1)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ChebyshevSurrogate::ChebyshevSurrogate() :
+	my_degree(-1),
+	my_coefficients(),
+	my_error(0.0)
+{}
+
+
+
+/********************************************************************************************************************************
+* Interpolate the program at the (degree+1) x (degree+1) Chebyshev nodes of the viewport, then estimate the maximum error of
+* the interpolation : twice the largest of the error measured on a uniform grid about twice as fine, borders included, and
+* of the sum of the coefficients of the two highest degrees, which bounds the part of the expression the degree misses when the
+* coefficients decrease. It is an estimate, not a proof : an expression oscillating between the samples of both can fool it.
+*
+* ARGUMENTS :
+*	- program is the expression to approximate
+*	- viewport is the part of the domain to approximate, mapped to [-1,1] x [-1,1]
+*	- degree is the degree in x and in y, in [0,64]
+*	- kernel are the kernels of the evaluation (the active ones by default)
+**********************************************************************************************************************************/
+void ChebyshevSurrogate::fit(const Program& program, const Viewport& viewport, int degree, const Kernels& kernel){
+
+	my_degree = std::max(0, std::min(degree, MAX_DEGREE));
+	const size_t m = my_degree + 1;
+
+	// T_i at the k-th node : cos(i*theta_k), with theta_k = pi*(k+1/2)/m
+	vector<double> nodes(m), cosines(m*m);
+	for(size_t k = 0; k < m; k++)
+		nodes[k] = (2*k + 1 == m) ? 0.0 : std::cos(M_PI*(k + 0.5)/m);
+	for(size_t i = 0; i < m; i++)
+		for(size_t k = 0; k < m; k++)
+			cosines[i*m + k] = std::cos(M_PI*i*(k + 0.5)/m);
+
+	vector<double> x(m*m), y(m*m), f(m*m);
+	for(size_t l = 0; l < m; l++){
+		for(size_t k = 0; k < m; k++){
+			x[l*m + k] = viewport_x(viewport, nodes[k]);
+			y[l*m + k] = viewport_y(viewport, nodes[l]);
+		}
+	}
+	program.evaluate(x.data(), y.data(), m*m, f.data(), kernel);
+
+	// Discrete cosine transform in x, then in y
+	vector<double> b(m*m, 0.0);
+	for(size_t l = 0; l < m; l++)
+		for(size_t i = 0; i < m; i++)
+			for(size_t k = 0; k < m; k++)
+				b[l*m + i] += f[l*m + k]*cosines[i*m + k];
+
+	my_coefficients.assign(m*m, 0.0);
+	for(size_t j = 0; j < m; j++){
+		for(size_t i = 0; i < m; i++){
+			double sum = 0;
+			for(size_t l = 0; l < m; l++)
+				sum += b[l*m + i]*cosines[j*m + l];
+			my_coefficients[j*m + i] = sum * (i ? 2.0 : 1.0) * (j ? 2.0 : 1.0) / (m*m);
+		}
+	}
+
+	double tail = 0;
+	for(size_t j = 0; j < m; j++)
+		for(size_t i = 0; i < m; i++)
+			if(my_degree >= 2 && std::max(i, j) + 2 >= m)
+				tail += std::abs(my_coefficients[j*m + i]);
+
+	// Error on the uniform grid
+	const size_t check = 2*m + 1;
+	vector<double> cx_check(check), exact(check), approximation(check), row_coefficients(m);
+	for(size_t k = 0; k < check; k++)
+		cx_check[k] = grid_coordinate(k, check);
+	x.resize(check);
+	y.resize(check);
+
+	double measured = 0;
+	for(size_t l = 0; l < check; l++){
+		const double ty = grid_coordinate(l, check);
+		for(size_t k = 0; k < check; k++){
+			x[k] = viewport_x(viewport, cx_check[k]);
+			y[k] = viewport_y(viewport, ty);
+		}
+		program.evaluate(x.data(), y.data(), check, exact.data(), kernel);
+		row(ty, row_coefficients.data());
+		evaluate_row(row_coefficients.data(), cx_check.data(), check, approximation.data(), kernel);
+		for(size_t k = 0; k < check; k++)
+			measured = std::max(measured, std::abs(exact[k] - approximation[k]));
+	}
+
+	my_error = SAFETY*std::max(measured, tail);
+}
+
+
+
+/********************************************************************************************************************************
+* Degree in x and in y (-1 if nothing is fitted)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+int ChebyshevSurrogate::degree() const{
+	return my_degree;
+}
+
+
+
+/********************************************************************************************************************************
+* Estimated maximum error over the viewport (see fit)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+double ChebyshevSurrogate::error() const{
+	return my_error;
+}
+
+
+
+/********************************************************************************************************************************
+* Coefficients in x of the row at ty : the sums over j of the coefficients times T_j(ty), the polynomials being computed by
+* their recurrence (stable in [-1,1])
+*
+* ARGUMENTS :
+*	- ty is the position of the row in [-1,1]
+*	- coefficients receives the degree+1 coefficients of the row
+**********************************************************************************************************************************/
+void ChebyshevSurrogate::row(double ty, double* coefficients) const{
+
+	const size_t m = my_degree + 1;
+
+	double t[MAX_DEGREE + 1];
+	t[0] = 1.0;
+	if(m > 1)
+		t[1] = ty;
+	for(size_t j = 2; j < m; j++)
+		t[j] = 2*ty*t[j-1] - t[j-2];
+
+	std::fill(coefficients, coefficients + m, 0.0);
+	for(size_t j = 0; j < m; j++)
+		for(size_t i = 0; i < m; i++)
+			coefficients[i] += t[j]*my_coefficients[j*m + i];
+}
+
+
+
+/********************************************************************************************************************************
+* Values of a row at n points with the Clenshaw recurrence (see kernels.hpp). The cost of a point depends on the degree only,
+* not on the expression.
+*
+* ARGUMENTS :
+*	- coefficients are the coefficients of the row (see row())
+*	- tx are the positions of the points in [-1,1]
+*	- n is the number of points
+*	- values receives the n values
+*	- kernel are the kernels of the recurrence (the active ones by default)
+**********************************************************************************************************************************/
+void ChebyshevSurrogate::evaluate_row(const double* coefficients, const double* tx, size_t n, double* values,
+	const Kernels& kernel) const{
+	kernel.clenshaw(coefficients, my_degree, tx, n, values);
+}
+
+
+
+/********************************************************************************************************************************
+* Share of the pixels whose byte a surrogate can't guarantee, estimated on a coarse grid : it depends on the values of the
+* surrogate and its error only, not on the expression
+*
+* ARGUMENTS :
+*	- surrogate is the surrogate fitted
+*	- tolerance is the number of bytes the result may differ by
+*	- kernel are the kernels of the recurrence
+*
+* RETURN : the share of the pixels to evaluate exactly, in [0,1]
+**********************************************************************************************************************************/
+static double uncertain_share(const ChebyshevSurrogate& surrogate, int tolerance, const Kernels& kernel){
+
+	vector<double> t(SHARE_GRID), values(SHARE_GRID), coefficients(surrogate.degree() + 1);
+	for(size_t k = 0; k < SHARE_GRID; k++)
+		t[k] = grid_coordinate(k, SHARE_GRID);
+
+	size_t uncertain = 0;
+	for(size_t l = 0; l < SHARE_GRID; l++){
+		surrogate.row(t[l], coefficients.data());
+		surrogate.evaluate_row(coefficients.data(), t.data(), SHARE_GRID, values.data(), kernel);
+		for(size_t k = 0; k < SHARE_GRID; k++)
+			if(!surrogate_byte_certain(values[k], surrogate.error(), tolerance))
+				uncertain++;
+	}
+
+	return (double)uncertain / (SHARE_GRID*SHARE_GRID);
+}
+
+
+
+/********************************************************************************************************************************
+* Fit the degree of 4, 8, 16... up to max_degree whose surrogate is the cheapest per pixel, if it is cheaper than the expression.
+* A surrogate must have an estimated error under a tenth of a quantization step without tolerance, half the tolerance
+* otherwise. Its cost counts the Clenshaw recurrence (a step costs about a quarter of a node), the check of the byte (about six
+* nodes) and the exact evaluation of the pixels it can't guarantee : a lower degree with a larger error leaves more of them,
+* around the quantization boundaries and wherever the expression nears 0. The fits stop when they cost more than a sixteenth
+* of evaluating the expression on the pixels, and for the expressions whose error grows with the degree : they oscillate too
+* fast for any of them.
+*
+* ARGUMENTS :
+*	- program is the expression to approximate
+*	- viewport is the part of the domain to approximate
+*	- max_degree is the highest degree tried, in [1,64]
+*	- tolerance is the number of bytes the result may differ by
+*	- pixels is the number of points the surrogate would be evaluated at
+*	- surrogate receives the cheapest surrogate
+*	- kernel are the kernels of the fits (the active ones by default)
+*
+* RETURN : true if a surrogate is cheaper than the expression
+**********************************************************************************************************************************/
+bool fit_surrogate(const Program& program, const Viewport& viewport, int max_degree, int tolerance, size_t pixels,
+	ChebyshevSurrogate& surrogate, const Kernels& kernel){
+
+	max_degree = std::min(max_degree, MAX_DEGREE);
+
+	const double max_error = ((tolerance == 0) ? EXACT_ERROR : tolerance/2.0) / (255/2);
+	const double nodes = program.info().nodes;
+
+	double best = nodes;
+	bool found = false;
+	size_t cost = 0;
+	double previous = std::numeric_limits<double>::infinity();
+	ChebyshevSurrogate fitted;
+
+	for(int degree = std::min(FIRST_DEGREE, max_degree); ; degree = std::min(2*degree, max_degree)){
+
+		if((degree + 1)*STEP_COST + CHECK_COST >= best)
+			break;
+
+		// Nodes and uniform grid of the fit
+		const size_t m = degree + 1;
+		cost += m*m + (2*m + 1)*(2*m + 1);
+		if(cost*FIT_SHARE > pixels)
+			break;
+
+		fitted.fit(program, viewport, degree, kernel);
+
+		if(fitted.error() <= max_error){
+			const double share = uncertain_share(fitted, tolerance, kernel);
+			const double per_pixel = (degree + 1)*STEP_COST + CHECK_COST + share*nodes;
+			if(per_pixel < best){
+				best = per_pixel;
+				surrogate = fitted;
+				found = true;
+			}
+			if(share == 0)
+				break;
+		}
+		else if(fitted.error() >= previous)
+			break;
+
+		if(degree >= max_degree)
+			break;
+		previous = fitted.error();
+	}
+
+	return found;
+}
+
+
+
+/********************************************************************************************************************************
+* Whether a surrogate value gives a byte within tolerance of the one of the exact value, knowing that the exact value is within
+* error of it. The bytes are the ones of quantize : 255/2*(value+1) truncated, and 0 for a value of exactly 0, so an interval
+* containing 0 is never certain.
+*
+* ARGUMENTS :
+*	- value is the value of the surrogate
+*	- error is the estimated maximum error of the surrogate
+*	- tolerance is the number of bytes the result may differ by
+*
+* RETURN : true if the surrogate value can be written instead of the exact one
+**********************************************************************************************************************************/
+bool surrogate_byte_certain(double value, double error, int tolerance){
+
+	const double low = value - error;
+	const double high = value + error;
+
+	if(low <= 0.0 && high >= 0.0)
+		return false;
+
+	return (int)((255/2)*(high + 1)) - (int)((255/2)*(low + 1)) <= tolerance;
+}
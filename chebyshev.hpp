@@ -0,0 +1,47 @@
+#ifndef GUARD_chebyshev_h
+#define GUARD_chebyshev_h
+
+#include "program.hpp"
+#include "kernels.hpp"
+
+#include <vector>
+#include <cstddef>
+
+
+struct Viewport;
+
+
+class ChebyshevSurrogate // Tensor Chebyshev expansion of a program over a viewport, mapped to [-1,1] x [-1,1]
+{
+
+public:
+
+	ChebyshevSurrogate(); // Constructor of an empty surrogate (degree -1)
+
+	void fit(const Program& program, const Viewport& viewport, int degree, const Kernels& kernel = kernels()); // Interpolate the program at the Chebyshev nodes, degree in [0,64]
+
+	int degree() const; // Degree in x and in y (-1 if nothing is fitted)
+
+	double error() const; // Estimated maximum error over the viewport
+
+	void row(double ty, double* coefficients) const; // Coefficients in x of the row at ty in [-1,1] (degree+1 of them)
+
+	void evaluate_row(const double* coefficients, const double* tx, size_t n, double* values,
+		const Kernels& kernel = kernels()) const; // Values of a row at n points
+
+
+private:
+
+	int my_degree;
+	std::vector<double> my_coefficients; // (degree+1) x (degree+1) coefficients, the index of y first
+	double my_error;
+
+};
+
+
+bool fit_surrogate(const Program& program, const Viewport& viewport, int max_degree, int tolerance, size_t pixels,
+	ChebyshevSurrogate& surrogate, const Kernels& kernel = kernels()); // Fit the cheapest surrogate within tolerance, if it is cheaper than the expression
+
+bool surrogate_byte_certain(double value, double error, int tolerance); // The byte of the exact value is within tolerance of the byte of value
+
+#endif
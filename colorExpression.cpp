@@ -1,17 +1,50 @@
 #include "colorExpression.hpp"
 #include "parser.hpp"
 
-#include <math.h> //M_PI
+#include <math.h> //M_PI, fabs, floor
 #include <string>
 #include <vector>
 #include <iostream>
+#include <sstream> // std::ostringstream
 #include <cstdlib> // std::rand
+#include <algorithm> // std::find_if, std::max
+#include <cctype> // isspace
+#include <stdexcept> // domain_error
+#include <utility> // std::pair, std::move
 
 
 using std::string;
 using std::vector;
 
 
+static const int COST_ATTEMPTS = 64; // Expressions drawn at most to meet a cost within its tolerance
+static const int SPLIT_STEPS = 1024; // Steps of the random share of the cost of the first operand of avg and *
+
+
+/********************************************************************************************************************************
+* Constructor of the expression "0"
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ColorExpression::ColorExpression() : program(), canonical_hash(program.canonical().hash()){}
+
+
+
+
+/********************************************************************************************************************************
+* Use a compiled expression. The hash of its canonical form is computed here, once, rather than at each call to hash().
+*
+* ARGUMENTS :
+*	- compiled is the compiled expression
+**********************************************************************************************************************************/
+void ColorExpression::use(Program&& compiled){
+	program = std::move(compiled);
+	canonical_hash = program.canonical().hash();
+}
+
+
+
+
 /********************************************************************************************************************************
 * Initialise a new random color expression
 *
@@ -19,12 +52,86 @@ using std::vector;
 *	- depth is the depth of the random expression
 **********************************************************************************************************************************/
 void ColorExpression::new_exp(int depth){
+	new_exp(depth, std::rand);
+}
+
+
+
+
+/********************************************************************************************************************************
+* Initialise a new random color expression with the given random source (e.g. a generator owned by a thread, since
+* std::rand can't be shared between threads)
+*
+* ARGUMENTS :
+*	- depth is the depth of the random expression
+*	- random is the random source
+**********************************************************************************************************************************/
+void ColorExpression::new_exp(int depth, const RandomSource& random){
+	new_exp(depth, UNLIMITED_NODES, random);
+}
+
+
+
+
+/********************************************************************************************************************************
+* Initialise a new random color expression of at most max_nodes nodes : the size of the expressions grows exponentially with
+* their depth, the budget keeps the memory and the evaluation time of deep expressions predictable. Without budget, the same
+* random source gives the same expression as before the budget existed.
+*
+* ARGUMENTS :
+*	- depth is the depth of the random expression
+*	- max_nodes is the maximum number of nodes (opcodes) of the expression, at least minimum_nodes(depth)
+*	- random is the random source
+**********************************************************************************************************************************/
+void ColorExpression::new_exp(int depth, size_t max_nodes, const RandomSource& random){
+
+	vector<Opcode> code;
 
-	//Get rid of previous content
-	rpn_exp.clear();
+	//Create the opcodes
+	make_random_code(depth, max_nodes, code, random);
 
-	//Create rpn_exp
-	make_random_rpn_exp(depth); 
+	use(Program(code.data(), code.size()));
+}
+
+
+
+
+/********************************************************************************************************************************
+* Initialise a new random color expression of a given cost (see expression_cost) : the depth says little about the time an
+* expression takes, two expressions of the same depth can differ a hundredfold in nodes and in calls to sin and cos. The cost
+* aimed at is the nearest one an expression can have (see nearest_expression_cost), and the expressions are drawn until one is
+* within the tolerance of it, from the same random source, so a seed gives the same expression. After COST_ATTEMPTS draws, the
+* nearest one is kept.
+*
+* ARGUMENTS :
+*	- cost is the cost wanted, at least 1 (the cost of x)
+*	- tolerance is the largest relative difference between the cost of the expression and the cost wanted
+*	- random is the random source
+**********************************************************************************************************************************/
+void ColorExpression::new_exp_within_cost(double cost, double tolerance, const RandomSource& random){
+
+	if(!(cost >= 1.0) || !(tolerance >= 0.0))
+		throw std::domain_error("ERROR : Cost must be at least 1 and its tolerance can't be negative.");
+
+	const double target = nearest_expression_cost(cost);
+	vector<Opcode> code;
+	Program best;
+	double nearest = -1.0;
+
+	for(int attempt = 0; attempt < COST_ATTEMPTS && !(nearest >= 0.0 && nearest <= tolerance*target); attempt++){
+
+		code.clear();
+		make_costed_code(target, code, random);
+
+		Program candidate(code.data(), code.size());
+		const double difference = fabs(expression_cost(candidate) - target);
+		if(nearest < 0.0 || difference < nearest){
+			best = std::move(candidate);
+			nearest = difference;
+		}
+	}
+
+	use(std::move(best));
 }
 
 
@@ -38,217 +145,343 @@ void ColorExpression::new_exp(int depth){
 **********************************************************************************************************************************/
 void ColorExpression::new_exp(std::istream& in){
 
-	//Get rid of previous content
-	rpn_exp.clear();
-
 	Parser parser(in);
 
+	parse_exp(parser);
+}
+
+
+
+
+/********************************************************************************************************************************
+* Initialise a new color expression from a character range
+*
+* ARGUMENTS :
+*	- first and last delimit the expression written by the user (no stream is involved)
+**********************************************************************************************************************************/
+void ColorExpression::new_exp(const char* first, const char* last){
+
+	//The expression of depth 0 is written "0" in infix notation (see rpn_to_infix)
+	const char* begin = std::find_if(first, last, [](char c){ return !isspace((unsigned char)c); });
+	const char* end = std::find_if(begin, last, [](char c){ return isspace((unsigned char)c) != 0; });
+	if(end - begin == 1 && *begin == '0' && std::find_if(end, last, [](char c){ return !isspace((unsigned char)c); }) == last){
+		new_exp(0);
+		return;
+	}
+
+	Parser parser(first, last);
+
+	parse_exp(parser);
+}
+
+
+
+
+/********************************************************************************************************************************
+* Initialise a new color expression from its compiled form (for instance loaded from a program library)
+*
+* ARGUMENTS :
+*	- compiled is the compiled expression
+**********************************************************************************************************************************/
+void ColorExpression::new_exp(const Program& compiled){
+	use(Program(compiled));
+}
+
+
+
+/********************************************************************************************************************************
+* Replace a sub-expression by another, without parsing the expression again (see Program::replace)
+*
+* ARGUMENTS :
+*	- node is the last opcode of the sub-expression to replace, in reverse polish notation
+*	- subtree is the expression put in its place
+**********************************************************************************************************************************/
+void ColorExpression::replace_subtree(size_t node, const ColorExpression& subtree){
+	use(program.replace(node, subtree.program));
+}
+
+
+
+
+/********************************************************************************************************************************
+* Compile the expression read by the parser
+*
+* ARGUMENTS :
+*	- parser is the parser reading the expression
+**********************************************************************************************************************************/
+void ColorExpression::parse_exp(Parser& parser){
+
+	static const Opcode opcodes[] = {OP_X, OP_Y, OP_SIN, OP_COS, OP_PI, OP_ZERO, OP_ZERO, OP_TIMES, OP_AVG, OP_ZERO};
+
+	vector<Lexer::token> rpn;
+
 	try{
-		//Create rpn_exp
-		if(!parser.parse(rpn_exp))
+		//Create rpn
+		if(!parser.parse(rpn))
 			std::cout << "Parse failed, incomplete expression." << std::endl;
 	}catch(std::domain_error& e){
 		throw;
 	}
+
+	//The parentheses and commas never reach the reverse polish notation
+	vector<Opcode> code(rpn.size());
+	for(size_t i = 0; i < rpn.size(); i++)
+		code[i] = opcodes[rpn[i]];
+
+	use(Program(code.data(), code.size()));
 }
 
 
 
 
 /********************************************************************************************************************************
-* Create the rpn_exp vector corresponding to an expression of a given depth
+* Create the opcodes of a random expression of a given depth. The sub-expressions still to create are kept on an explicit
+* stack, so the depth is not limited by the call stack, and they are created in the same order as by the recursive version
+* (each operand before the next one), which draws the same random numbers.
+*
+* Each pending sub-expression reserves the smallest number of nodes its depth needs (see minimum_nodes), the nodes left
+* over are spent by the sub-expressions created first : when there are not enough of them, sin and cos (one node more than
+* the cheapest choice) become avg and *, and the random depth of an operand is lowered.
 *
 * ARGUMENTS :
 *	- depth is the depth of the expression we want to create
+*	- max_nodes is the maximum number of opcodes of the expression
+*	- code is the vector the opcodes are appended to
+*	- random is the random source
 **********************************************************************************************************************************/
-void ColorExpression::make_random_rpn_exp(int depth){
-
-	string basic_exp[2] = {"x", "y"};
-	string composed_exp[4] = {"sin","cos","avg","*"};
-	int random_choice, random_nummer, random_depth, depth_exp1, depth_exp2;
-	
-	if(depth > 1){
-
-		random_choice = std::rand()%4;
-		string exp = composed_exp[random_choice];
-
-		// If it's a sin or a cos
-		if(random_choice == 0 || random_choice == 1){
-			//Append pi
-			rpn_exp.push_back("pi");
-			// Append a random expression of depht "depth-1"
-			make_random_rpn_exp(depth-1);
-			//Append pi
-			rpn_exp.push_back("*");
-			//Append sin/cos
-			rpn_exp.push_back(exp);
-		}
+void ColorExpression::make_random_code(int depth, size_t max_nodes, vector<Opcode>& code, const RandomSource& random){
 
-		// If it's an average : one of the exp is of depth "depth-1" and the other has a depth in [1, depth-1]
-		else if(random_choice == 2){
+	static const Opcode composed_exp[4] = {OP_SIN, OP_COS, OP_AVG, OP_TIMES};
 
-			//Get a random depth between [1, depth-1] for one of the expression in average
-			random_depth = std::rand()%(depth-1) + 1;
+	if(max_nodes < minimum_nodes(depth))
+		throw std::domain_error("ERROR : A budget of " + std::to_string(max_nodes) + " nodes is too small for the depth "
+			+ std::to_string(depth) + ".");
 
-			// Choose which is expression is going to be of random_depth
-			random_nummer = std::rand()%2;
-
-			if(random_nummer == 0){
-				depth_exp1 = random_depth;
-				depth_exp2 = depth-1;
-			}else{
-				depth_exp1 = depth-1;
-				depth_exp2 = random_depth;
-			}
+	//Nodes not reserved by the pending sub-expressions
+	size_t spare = max_nodes - minimum_nodes(depth);
+
+	//Work left, the next one at the back : a sub-expression of the given depth, or an operator (negative depth) to append
+	vector<std::pair<int, Opcode> > work(1, std::make_pair(std::max(depth, 0), OP_ZERO));
+
+	while(!work.empty()){
 
-			// Append a random expression of the corresponding depth
-			make_random_rpn_exp(depth_exp1);
-			//Append another expression of the corresponding depth
-			make_random_rpn_exp(depth_exp2);
-			//Append avg
-			rpn_exp.push_back(exp);
+		int exp_depth = work.back().first;
+		Opcode op = work.back().second;
+		work.pop_back();
+
+		if(exp_depth < 0){
+			code.push_back(op);
 		}
 
-		// If it's a product
-		else if(random_choice == 3){
-			//Get a random depth between [1, depth-1] for one of the expression in average
-			random_depth = std::rand()%(depth-1) + 1;
+		else if(exp_depth == 0){
+			code.push_back(OP_ZERO);
+		}
 
-			// Choose which is expression is going to be of random_depth
-			random_nummer = std::rand()%2;
-
-			if(random_nummer == 0){
-				depth_exp1 = random_depth;
-				depth_exp2 = depth-1;
-			}else{
-				depth_exp1 = depth-1;
-				depth_exp2 = random_depth;
+		else if(exp_depth == 1){
+			// Get a random basic expression of depth 1
+			code.push_back((random()%2) ? OP_Y : OP_X);
+		}
+
+		else{
+			int random_choice = random()%4;
+
+			// sin(pi*exp) : pi, a random expression of depth "depth-1", * and sin/cos
+			if(random_choice < 2 && spare >= 1){
+				spare--;
+				code.push_back(OP_PI);
+				work.push_back(std::make_pair(-1, composed_exp[random_choice]));
+				work.push_back(std::make_pair(-1, OP_TIMES));
+				work.push_back(std::make_pair(exp_depth-1, OP_ZERO));
+				continue;
+			}
+			if(random_choice < 2){
+				random_choice += 2;
 			}
-			// Append a random expression of the corresponding depth
-			make_random_rpn_exp(depth_exp1);
-			//Append another expression of the corresponding depth
-			make_random_rpn_exp(depth_exp2);
-			//Append a times
-			rpn_exp.push_back(exp);
 
-		}
-	}
+			// Average or product : one of the exp is of depth "depth-1" and the other has a depth in [1, depth-1]
+			int random_depth = random()%(exp_depth-1) + 1;
 
-	else if(depth == 1){
-		// Get a random basic expression of depth 1
-		random_choice = std::rand()%2;
-		rpn_exp.push_back(basic_exp[random_choice]);
-	}
+			// Choose which is expression is going to be of random_depth
+			int random_nummer = random()%2;
 
-	else{
-		// If depth == 0
-		rpn_exp.push_back("0");
-	}
+			// Each level above 1 costs two nodes more than the smallest expression
+			if(size_t(random_depth-1) > spare/2)
+				random_depth = int(spare/2) + 1;
+			spare -= 2*size_t(random_depth-1);
+
+			int depth_exp1 = (random_nummer == 0) ? random_depth : exp_depth-1;
+			int depth_exp2 = (random_nummer == 0) ? exp_depth-1 : random_depth;
 
+			// The first expression, then the second one, then the operator
+			work.push_back(std::make_pair(-1, composed_exp[random_choice]));
+			work.push_back(std::make_pair(depth_exp2, OP_ZERO));
+			work.push_back(std::make_pair(depth_exp1, OP_ZERO));
+		}
+	}
 }
 
 
 
 
-/***************************************************************************************************************
-* Returns the result of the color expression for a given point (x,y)
+/********************************************************************************************************************************
+* Create the opcodes of a random expression of about a given cost, with the grammar of make_random_code. Each pending
+* sub-expression has a share of the cost : sin(pi*exp) leaves TRIG_COST + 2 less to exp, avg and * split what is left after
+* them at random between their operands. A share below 2 becomes x or y, a larger one at least avg(x, y), and the difference
+* between the share and the cost spent goes to the next sub-expression created, so the expression misses the cost by at most 1.
+* The sub-expressions are kept on an explicit stack, as in make_random_code.
 *
-* ARGUMENTS : 
-*	- x and y the position in the table of pixels
-****************************************************************************************************************/
-double ColorExpression::compute_value(double x, double y){
+* ARGUMENTS :
+*	- cost is the cost of the expression, at least 1
+*	- code is the vector the opcodes are appended to
+*	- random is the random source
+**********************************************************************************************************************************/
+void ColorExpression::make_costed_code(double cost, vector<Opcode>& code, const RandomSource& random){
 
-	vector<double> numbers;
+	static const Opcode composed_exp[4] = {OP_SIN, OP_COS, OP_AVG, OP_TIMES};
 
-	// If expression is of depth 0
-	if(rpn_exp.back() == "0")
-		return 0.0;
+	// Cost not spent by the sub-expressions created, given to the next one
+	double spare = 0.0;
 
-	for(vector<string>::size_type i=0; i != rpn_exp.size(); i++){
+	//Work left, the next one at the back : a sub-expression of the given cost (OP_ZERO), or an operator to append
+	vector<std::pair<double, Opcode> > work(1, std::make_pair(cost, OP_ZERO));
 
-		string tok = rpn_exp[i];
+	while(!work.empty()){
 
-		if(tok == "x" || tok == "y" || tok == "pi"){
+		double exp_cost = work.back().first;
+		Opcode op = work.back().second;
+		work.pop_back();
 
-			if(tok == "x"){
-				numbers.push_back(x);
-			}
-			else if(tok == "y"){
-				numbers.push_back(y);
-			}
-			else if(tok == "pi"){
-				numbers.push_back(M_PI);
-			}
+		if(op != OP_ZERO){
+			code.push_back(op);
+			continue;
 		}
 
-		else if(tok == "sin" || tok == "cos"){
-
-			double op = numbers.back();
-			numbers.pop_back();
+		exp_cost += spare;
+		spare = 0.0;
 
-			if(tok == "sin"){
-				numbers.push_back(sin(op));
-			}
-			else if(tok == "cos"){
-				numbers.push_back(cos(op));
-			}
+		// x or y, the cheapest expression
+		if(exp_cost < 2.0){
+			code.push_back((random()%2) ? OP_Y : OP_X);
+			spare = exp_cost - 1.0;
+			continue;
 		}
-		else{
 
-			double op2 = numbers.back();
-			numbers.pop_back();
-			double op1 = numbers.back();
-			numbers.pop_back();
+		int random_choice = random()%4;
 
-			if(tok == "avg"){
-				numbers.push_back((op1+op2)/2);
-			}
-			else if(tok == "*"){
-				numbers.push_back(op1 * op2);
-			}
+		// sin(pi*exp) : pi, a random expression of the cost left, * and sin/cos
+		if(random_choice < 2 && exp_cost >= TRIG_COST + 3.0){
+			code.push_back(OP_PI);
+			work.push_back(std::make_pair(-1.0, composed_exp[random_choice]));
+			work.push_back(std::make_pair(-1.0, OP_TIMES));
+			work.push_back(std::make_pair(exp_cost - TRIG_COST - 2.0, OP_ZERO));
+			continue;
+		}
+		if(random_choice < 2){
+			random_choice += 2;
 		}
 
+		// Average or product : each operand costs at least 1, the rest is split at random
+		double rest = std::max(exp_cost - 3.0, 0.0);
+		double share = rest*(random()%(SPLIT_STEPS + 1))/SPLIT_STEPS;
+
+		// The first expression, then the second one, then the operator
+		work.push_back(std::make_pair(-1.0, composed_exp[random_choice]));
+		work.push_back(std::make_pair(exp_cost - 2.0 - share, OP_ZERO));
+		work.push_back(std::make_pair(1.0 + share, OP_ZERO));
 	}
+}
+
+
 
-	return numbers.back();
+
+/********************************************************************************************************************************
+* Smallest number of nodes of an expression of a given depth : x or y at depth 1, avg(x, exp) with exp of depth "depth-1" above
+*
+* ARGUMENTS :
+*	- depth is the depth of the expression
+**********************************************************************************************************************************/
+size_t minimum_nodes(int depth){
+	return (depth <= 1) ? 1 : 2*size_t(depth) - 1;
 }
 
 
 
 
-/******************************************************************************************************************************
-* Calculates the depth of the expression the user wrote
+/********************************************************************************************************************************
+* Evaluation cost of an expression, in opcodes : sin and cos cost TRIG_COST each (they take about as long as nine avg or *
+* in the kernels), the other opcodes 1
 *
-* ARGUMENT : /
-*******************************************************************************************************************************/
-int ColorExpression::calculate_depth(){
-	int current_depth = 1;
-	int max_depth = 1;
+* ARGUMENTS :
+*	- program is the compiled expression
+**********************************************************************************************************************************/
+double expression_cost(const Program& program){
 
-	string infix_exp = rpn_to_infix();
-	int size = infix_exp.length();
+	const size_t* counts = program.info().counts;
+	const size_t trig = counts[OP_SIN] + counts[OP_COS];
 
-	if(infix_exp.empty())
-		return 0;
+	return TRIG_COST*trig + (program.info().nodes - trig);
+}
 
-	for(int i = 0; i < size; i++){
 
-		if(infix_exp[i] == '('){
 
-			current_depth++;
 
-			if(current_depth > max_depth)
-				max_depth = current_depth;
-		}
+/********************************************************************************************************************************
+* Cost of an expression that can be built nearest to a cost (the larger one between two). x and y cost 1, avg and * one more
+* than their operands, sin(pi*exp) TRIG_COST + 2 more than exp : below sin(pi*x), only the odd costs can be built, above it
+* every whole cost can.
+*
+* ARGUMENTS :
+*	- cost is the cost wanted, at least 1
+**********************************************************************************************************************************/
+double nearest_expression_cost(double cost){
 
-		else if(infix_exp[i] == ')'){
+	const size_t trig = (size_t)TRIG_COST + 2; // Cost added by sin(pi*exp) around exp
+	const size_t limit = 2*(trig + 1);
 
-			if(current_depth > 1)
-				current_depth--;
-		}
+	if(cost > (double)limit)
+		return floor(cost + 0.5);
+
+	// Costs that can be built, from the ones of the operands
+	vector<char> built(limit + 1, 0);
+	built[1] = 1;
+	for(size_t n = 2; n <= limit; n++){
+		built[n] = (n > trig && built[n - trig]);
+		for(size_t a = 1; a + 2 <= n && !built[n]; a++)
+			built[n] = built[a] && built[n - 1 - a];
 	}
 
-	return max_depth;
+	double nearest = 1.0;
+	for(size_t n = 1; n <= limit; n++)
+		if(built[n] && fabs(n - cost) <= fabs(nearest - cost))
+			nearest = (double)n;
+
+	return nearest;
+}
+
+
+
+
+/***************************************************************************************************************
+* Returns the result of the color expression for a given point (x,y)
+*
+* ARGUMENTS : 
+*	- x and y the position in the table of pixels
+****************************************************************************************************************/
+double ColorExpression::compute_value(double x, double y) const{
+
+	return program.evaluate(x, y);
+}
+
+
+
+
+/******************************************************************************************************************************
+* Calculates the depth of the expression the user wrote
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+int ColorExpression::calculate_depth() const{
+	return program.info().depth;
 }
 
 
@@ -261,57 +494,47 @@ int ColorExpression::calculate_depth(){
 *******************************************************************************************************************************/
 string ColorExpression::rpn_to_infix() const{
 
-	vector<string> infix_exp;
+	std::ostringstream out;
 
-	// If expression is of depth 0
-	if(rpn_exp.back() == "0")
-		return rpn_exp.back();
+	write_infix(out);
 
-	for(vector<string>::size_type i=0; i != rpn_exp.size(); i++){
+	return out.str();
+}
 
-		string tok = rpn_exp[i];
 
-		if(tok == "x" || tok == "y" || tok == "pi")
-				infix_exp.push_back(tok);
 
-		else if(tok == "sin" || tok == "cos"){
-			//Pop the operand of sin/cos
-			string op = infix_exp.back();
-			infix_exp.pop_back();
 
-			//Append it to sin/cos
-			tok.append(op);
-			//Push the expression back onto the stack
-			infix_exp.push_back(tok);
+/******************************************************************************************************************************
+* Writes the color expression in infix notation directly in a stream
+*
+* ARGUMENT :
+*	- out is the output stream
+*******************************************************************************************************************************/
+void ColorExpression::write_infix(std::ostream& out) const{
+	program.write_infix(out);
+}
 
-		}
-		else{
-			//Pop the two last elements
-			string op2 = infix_exp.back();
-			infix_exp.pop_back();
-			string op1 = infix_exp.back();
-			infix_exp.pop_back();
-
-			if(tok == "avg"){
-				tok.append("(");
-				tok.append(op1);
-				tok.append(",");
-				tok.append(op2);
-				tok.append(")");
-				infix_exp.push_back(tok);
-			}
-			else if(tok == "*"){
-				string exp;
-				exp.append("(");
-				exp.append(op1);
-				exp.append(tok);
-				exp.append(op2);
-				exp.append(")");
-				infix_exp.push_back(exp);
-			}
-		}
 
-	}
-	
-	return infix_exp.back();
+
+
+/******************************************************************************************************************************
+* Returns the compiled form of the expression
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+const Program& ColorExpression::compiled() const{
+	return program;
+}
+
+
+
+
+/******************************************************************************************************************************
+* Returns a hash of the canonical form of the expression, where the operands of avg and * are put in a fixed order.
+* Equivalent expressions such as avg(x,y) and avg(y,x) have the same hash.
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+uint64_t ColorExpression::hash() const{
+	return canonical_hash;
 }
\ No newline at end of file
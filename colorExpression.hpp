@@ -1,32 +1,77 @@
 #ifndef GUARD_colorExpression_h
 #define GUARD_colorExpression_h
 
-#include "parser.hpp"//to use typedef Exp
+#include "parser.hpp"//to use Parser
+#include "program.hpp"
 
 #include <iostream>
 #include <string>
+#include <functional>
+#include <vector>
+#include <cstddef>
+#include <limits>
+
+
+typedef std::function<int()> RandomSource; // Returns a random integer in [0, RAND_MAX], like std::rand
+
+const size_t UNLIMITED_NODES = std::numeric_limits<size_t>::max(); // Node budget of the random expressions without limit
+
+const double TRIG_COST = 9.0; // Cost of sin and cos, in opcodes : the other opcodes cost 1
+
+size_t minimum_nodes(int depth); // Smallest number of nodes of an expression of a given depth
+
+double expression_cost(const Program& program); // Evaluation cost of an expression : its opcodes, sin and cos weighing TRIG_COST each
+
+double nearest_expression_cost(double cost); // Cost of an expression that can be built nearest to cost (2 can't : x costs 1, avg(x, y) 3)
 
 class ColorExpression
 {
 
 public :
 
+	ColorExpression(); //Constructor of the expression "0"
+
 	void new_exp(int depth); //Initialise a new random color expression
 
+	void new_exp(int depth, const RandomSource& random); //Initialise a new random color expression with the given random source
+
+	void new_exp(int depth, size_t max_nodes, const RandomSource& random); //Initialise a new random color expression of at most max_nodes nodes
+
+	void new_exp_within_cost(double cost, double tolerance, const RandomSource& random); //Initialise a new random color expression whose cost is within tolerance (relative) of cost
+
 	void new_exp(std::istream& in); //Initialise a new color expression if the user wants to write its own expressions
 
-	int calculate_depth(); //Calculates the depth of the expression the user wrote
+	void new_exp(const char* first, const char* last); //Initialise a new color expression from a character range
+
+	void new_exp(const Program& compiled); //Initialise a new color expression from its compiled form
+
+	void replace_subtree(size_t node, const ColorExpression& subtree); //Replace the sub-expression ending at opcode node, without parsing the expression again
 
-	double compute_value(double x, double y); //Returns the result of the color expression for a given point (x,y)
+	int calculate_depth() const; //Calculates the depth of the expression the user wrote
+
+	double compute_value(double x, double y) const; //Returns the result of the color expression for a given point (x,y)
 
 	std::string rpn_to_infix() const; //Returns a string corresponding to the color expression in infix notation
 
+	void write_infix(std::ostream& out) const; //Writes the color expression in infix notation directly in a stream
+
+	const Program& compiled() const; //Returns the compiled form of the expression
+
+	uint64_t hash() const; //Returns a hash of the canonical form of the expression (same for equivalent expressions)
+
 	
 private :
 
-	Exp rpn_exp;
+	Program program;
+	uint64_t canonical_hash; //Hash of the canonical form of program, computed once it changes
+
+	void use(Program&& compiled); //Use a compiled expression and hash its canonical form
+
+	void make_random_code(int depth, size_t max_nodes, std::vector<Opcode>& code, const RandomSource& random); //Create the opcodes of a random expression of a given depth
+
+	void make_costed_code(double cost, std::vector<Opcode>& code, const RandomSource& random); //Create the opcodes of a random expression of about a given cost
 
-	void make_random_rpn_exp(int depth); //Create the rpn_exp vector corresponding to an expression of a given depth
+	void parse_exp(Parser& parser); //Compile the expression read by the parser
 
 };
 
@@ -0,0 +1,439 @@
+#include "costModel.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "program.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <stdexcept> //domain_error
+#include <algorithm> //std::min, std::max
+#include <cstdlib> //getenv, strtod
+#include <cmath> //std::abs
+#include <chrono>
+#include <mutex>
+
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static const size_t MAX_CALIBRATION_SIDE = 256; // Largest side of the image rendered by the calibration
+static const size_t CHAINS[] = {8, 32}; // Opcodes of the chains of the calibration scenes
+static const double MIN_SECONDS = 0.02; // Shortest duration of a measure, repeating the renders if they are faster
+static const int MEASURES = 3; // Measures of each scene, the fastest one is kept
+static const double RIDGE = 1e-6; // Weight of the ridge of the fit, relative to the average diagonal of the normal equations
+static const Viewport CALIBRATION_VIEWPORT = {-0.9, 1.1, -0.9, 1.1}; // Not centred on 0 : no pixel is mirrored
+
+static const char* OPCODE_KEYS[OPCODES] = {"zero", "x", "y", "pi", "sin", "cos", "avg", "times"};
+
+
+
+/********************************************************************************************************************************
+* Rough costs of a recent x86 core with the AVX2 or AVX-512 kernels, until the machine is calibrated
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+CostModel default_cost_model(){
+
+	CostModel model;
+
+	model.pixel = 6.0;
+	model.opcodes[OP_ZERO] = 0.4;
+	model.opcodes[OP_X] = 0.4;
+	model.opcodes[OP_Y] = 0.4;
+	model.opcodes[OP_PI] = 1.0;
+	model.opcodes[OP_SIN] = 3.8;
+	model.opcodes[OP_COS] = 3.4;
+	model.opcodes[OP_AVG] = 0.05;
+	model.opcodes[OP_TIMES] = 0.05;
+
+	return model;
+}
+
+
+
+/********************************************************************************************************************************
+* Overloading output operator : one "key value" line per cost, in nanoseconds (the format of a cost model file)
+*
+* ARGUMENTS :
+*	- out is the output stream
+*	- model is the cost model to write
+**********************************************************************************************************************************/
+std::ostream& operator<<(std::ostream& out, const CostModel& model){
+
+	out << "pixel " << model.pixel << "\n";
+	for(int op = 0; op < OPCODES; op++)
+		out << OPCODE_KEYS[op] << " " << model.opcodes[op] << "\n";
+
+	return out;
+}
+
+
+
+/********************************************************************************************************************************
+* File of the cost model of the machine : the MARTIST_COSTS environment variable, or .martist_costs in the home directory
+* (in the current directory without home directory)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+string cost_model_path(){
+
+	const char* path = std::getenv("MARTIST_COSTS");
+	if(path != nullptr && *path != '\0')
+		return path;
+
+	const char* home = std::getenv("HOME");
+	if(home != nullptr && *home != '\0')
+		return string(home) + "/.martist_costs";
+
+	return ".martist_costs";
+}
+
+
+
+/********************************************************************************************************************************
+* Read a cost model file : "key value" lines (pixel, then zero, x, y, pi, sin, cos, avg and times), in nanoseconds per pixel.
+* Empty lines and lines starting with '#' are skipped, the missing keys keep their value.
+*
+* ARGUMENTS :
+*	- path is the file to read
+*	- model receives the values of the file
+*
+* RETURN : false if the file can't be opened
+**********************************************************************************************************************************/
+bool load_cost_model(const string& path, CostModel& model){
+
+	std::ifstream in(path.c_str());
+	if(!in)
+		return false;
+
+	CostModel read = model;
+	string line;
+	size_t number = 0;
+
+	while(std::getline(in, line)){
+
+		number++;
+
+		std::istringstream fields(line);
+		string key, value, extra;
+
+		if(!(fields >> key) || key[0] == '#')
+			continue;
+
+		const string where = " at line " + std::to_string(number) + " of " + path + ".";
+
+		if(!(fields >> value) || (fields >> extra))
+			throw std::domain_error("ERROR : Expected \"key value\"" + where);
+
+		double* field = nullptr;
+		if(key == "pixel")
+			field = &read.pixel;
+		for(int op = 0; op < OPCODES; op++)
+			if(key == OPCODE_KEYS[op])
+				field = &read.opcodes[op];
+		if(field == nullptr)
+			throw std::domain_error("ERROR : Unknown key " + key + where);
+
+		char* end = nullptr;
+		const double cost = std::strtod(value.c_str(), &end);
+		if(*end != '\0' || !(cost >= 0.0 && cost < 1e9))
+			throw std::domain_error("ERROR : Bad value " + value + where);
+		*field = cost;
+	}
+
+	model = read;
+
+	return true;
+}
+
+
+
+/********************************************************************************************************************************
+* Write a cost model file
+*
+* ARGUMENTS :
+*	- path is the file to write
+*	- model is the cost model to write
+**********************************************************************************************************************************/
+void save_cost_model(const string& path, const CostModel& model){
+
+	std::ofstream out(path.c_str());
+
+	out << "# Rendering costs of this machine in nanoseconds per pixel, written by the calibration of martist\n"
+		<< std::setprecision(6) << model;
+
+	if(!out)
+		throw std::domain_error("ERROR : Can't write the cost model " + path + ".");
+}
+
+
+
+/********************************************************************************************************************************
+* Cost model of the machine, cached for the whole program
+**********************************************************************************************************************************/
+static std::mutex& machine_mutex(){
+	static std::mutex mutex;
+	return mutex;
+}
+
+static CostModel& machine_model(){
+
+	static CostModel model = []{
+
+		CostModel read = default_cost_model();
+		try{
+			load_cost_model(cost_model_path(), read);
+		}catch(std::domain_error&){
+			//A damaged file only costs the accuracy of the estimates
+			read = default_cost_model();
+		}
+		return read;
+	}();
+
+	return model;
+}
+
+
+
+/********************************************************************************************************************************
+* Cost model of the machine, read from cost_model_path() the first time it is asked for (the default costs if there is no valid
+* file)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+CostModel machine_cost_model(){
+
+	std::lock_guard<std::mutex> lock(machine_mutex());
+	return machine_model();
+}
+
+
+
+/********************************************************************************************************************************
+* Write the cost model of the machine to cost_model_path(), the Martists made from now on use it
+*
+* ARGUMENTS :
+*	- model is the new cost model of the machine
+**********************************************************************************************************************************/
+void save_machine_cost_model(const CostModel& model){
+
+	std::lock_guard<std::mutex> lock(machine_mutex());
+
+	save_cost_model(cost_model_path(), model);
+	machine_model() = model;
+}
+
+
+
+/********************************************************************************************************************************
+* Time of the evaluation of a program at a pixel : the opcodes of each type (see ProgramInfo) times their cost
+*
+* ARGUMENTS :
+*	- model is the cost model
+*	- program is the program
+*
+* RETURN : the time in nanoseconds
+**********************************************************************************************************************************/
+double program_nanoseconds(const CostModel& model, const Program& program){
+
+	double nanoseconds = 0.0;
+	for(int op = 0; op < OPCODES; op++)
+		nanoseconds += program.info().counts[op]*model.opcodes[op];
+
+	return nanoseconds;
+}
+
+
+
+/********************************************************************************************************************************
+* Chain of opcodes of a calibration scene : x followed by length pairs (leaf, binary opcode), or by length sin(pi*...) or
+* cos(pi*...) as in the random expressions (the time of sin and cos depends on the range of their operand)
+*
+* ARGUMENTS :
+*	- leaf is the leaf of the pairs (unused for sin and cos)
+*	- op is the opcode repeated
+*	- length is the number of opcodes op
+**********************************************************************************************************************************/
+static Program chain(Opcode leaf, Opcode op, size_t length){
+
+	vector<Opcode> code(1, OP_X);
+	for(size_t i = 0; i < length; i++){
+		if(op >= OP_AVG)
+			code.push_back(leaf);
+		else{
+			code.push_back(OP_PI);
+			code.push_back(OP_TIMES);
+		}
+		code.push_back(op);
+	}
+
+	return Program(code.data(), code.size());
+}
+
+
+
+/********************************************************************************************************************************
+* Best time of a draw of a scene, in nanoseconds per pixel. The first draw calibrates the number of draws of each measure, so
+* that a measure lasts at least MIN_SECONDS whatever the speed of the machine.
+*
+* ARGUMENTS :
+*	- martist is the Martist drawing
+*	- exp is the colour expression of the three components
+*	- pixels is the number of pixels of the buffer
+**********************************************************************************************************************************/
+static double measure(Martist& martist, const ColorExpression& exp, size_t pixels){
+
+	Clock::time_point start = Clock::now();
+	martist.draw(exp, exp, exp);
+	double best = std::chrono::duration<double>(Clock::now() - start).count();
+
+	const int repeat = std::max(1, (int)(MIN_SECONDS/std::max(best, 1e-6)));
+
+	for(int m = 0; m < MEASURES; m++){
+
+		start = Clock::now();
+		for(int r = 0; r < repeat; r++)
+			martist.draw(exp, exp, exp);
+
+		best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count()/repeat);
+	}
+
+	return best*1e9/pixels;
+}
+
+
+
+/********************************************************************************************************************************
+* Render scenes isolating each opcode and fit the cost model of the machine. A scene draws the same chain in the three
+* components : x alone, x followed by sin(pi*...) or cos(pi*...), or by pairs of a leaf and avg or * (see chain), each at two
+* lengths. The costs are fitted by least squares to the times per pixel, each weighted by its inverse so that the short and
+* the long scenes are fitted with the same relative error. The leaves and the avg and * always come together (an expression
+* has one leaf more than avg and *), so only their sums are measured : a small ridge shares them, moved when needed so that
+* none of the costs is negative, and the estimates of expressions don't depend on how. The scenes are drawn by a Martist with the profile of the machine, on a viewport not
+* centred on 0, so that every pixel is evaluated. It takes a few seconds.
+*
+* ARGUMENTS :
+*	- width and height are the dimensions of the images whose time will be estimated (at most 256 pixels per side are drawn)
+*	- samples receives the time of each scene, measured and predicted by the model (nullptr if not needed)
+*
+* RETURN : the cost model
+**********************************************************************************************************************************/
+CostModel calibrate_cost_model(size_t width, size_t height, vector<CostSample>* samples){
+
+	if(width == 0 || height == 0)
+		throw std::domain_error("ERROR : Width or height can't be negative.");
+
+	width = std::min(width, MAX_CALIBRATION_SIDE);
+	height = std::min(height, MAX_CALIBRATION_SIDE);
+
+	vector<unsigned char> buffer(3*width*height);
+	Martist martist(buffer.data(), width, height, 1, 1, 1);
+	martist.viewport(CALIBRATION_VIEWPORT);
+
+	// The scenes : x alone, then the chains of each opcode
+	vector<Program> programs(1, chain(OP_X, OP_X, 0));
+	vector<string> names(1, "x");
+	const Opcode leaves[4] = {OP_X, OP_Y, OP_ZERO, OP_PI};
+	for(size_t length : CHAINS){
+		for(int l = 0; l < 4; l++){
+			programs.push_back(chain(leaves[l], OP_AVG, length));
+			names.push_back("avg(" + string(OPCODE_KEYS[leaves[l]]) + ") x" + std::to_string(length));
+		}
+		programs.push_back(chain(OP_X, OP_TIMES, length));
+		names.push_back("times x" + std::to_string(length));
+		programs.push_back(chain(OP_X, OP_SIN, length));
+		names.push_back("sin x" + std::to_string(length));
+		programs.push_back(chain(OP_X, OP_COS, length));
+		names.push_back("cos x" + std::to_string(length));
+	}
+
+	// Normal equations of the least squares : the unknowns are the pixel cost, then the costs of the opcodes
+	const int n = OPCODES + 1;
+	vector<vector<double> > features(programs.size(), vector<double>(n));
+	vector<double> times(programs.size());
+	vector<double> a(n*n, 0.0), b(n, 0.0);
+
+	for(size_t s = 0; s < programs.size(); s++){
+
+		ColorExpression exp;
+		exp.new_exp(programs[s]);
+		times[s] = measure(martist, exp, width*height);
+
+		features[s][0] = 1.0;
+		for(int op = 0; op < OPCODES; op++)
+			features[s][op + 1] = 3.0*programs[s].info().counts[op];
+
+		const double weight = 1.0/(times[s]*times[s]);
+		for(int i = 0; i < n; i++){
+			b[i] += weight*features[s][i]*times[s];
+			for(int j = 0; j < n; j++)
+				a[i*n + j] += weight*features[s][i]*features[s][j];
+		}
+	}
+
+	double trace = 0.0;
+	for(int i = 0; i < n; i++)
+		trace += a[i*n + i];
+	for(int i = 0; i < n; i++)
+		a[i*n + i] += RIDGE*trace/n;
+
+	// Gaussian elimination with partial pivoting
+	for(int k = 0; k < n; k++){
+		int pivot = k;
+		for(int i = k + 1; i < n; i++)
+			if(std::abs(a[i*n + k]) > std::abs(a[pivot*n + k]))
+				pivot = i;
+		for(int j = 0; j < n; j++)
+			std::swap(a[k*n + j], a[pivot*n + j]);
+		std::swap(b[k], b[pivot]);
+
+		for(int i = k + 1; i < n; i++){
+			const double factor = a[i*n + k]/a[k*n + k];
+			for(int j = k; j < n; j++)
+				a[i*n + j] -= factor*a[k*n + j];
+			b[i] -= factor*b[k];
+		}
+	}
+
+	vector<double> costs(n);
+	for(int i = n - 1; i >= 0; i--){
+		double sum = b[i];
+		for(int j = i + 1; j < n; j++)
+			sum -= a[i*n + j]*costs[j];
+		costs[i] = sum/a[i*n + i];
+	}
+
+	// Adding s to the leaves, -s to avg and * and -3s to the pixel (the three components) doesn't change any estimate : s is
+	// kept as close to 0 as it can while none of them is negative
+	double low = 0.0, high = costs[0]/3;
+	for(int op = OP_ZERO; op <= OP_PI; op++)
+		low = std::max(low, -costs[op + 1]);
+	for(int op = OP_AVG; op <= OP_TIMES; op++)
+		high = std::min(high, costs[op + 1]);
+	const double shift = (low > 0.0) ? low : std::min(0.0, high);
+	costs[0] -= 3*shift;
+	for(int op = OP_ZERO; op <= OP_PI; op++)
+		costs[op + 1] += shift;
+	for(int op = OP_AVG; op <= OP_TIMES; op++)
+		costs[op + 1] -= shift;
+
+	// The noise may still give a cheap opcode a slightly negative cost
+	CostModel model;
+	model.pixel = std::max(0.0, costs[0]);
+	for(int op = 0; op < OPCODES; op++)
+		model.opcodes[op] = std::max(0.0, costs[op + 1]);
+
+	if(samples != nullptr){
+		for(size_t s = 0; s < programs.size(); s++){
+			CostSample sample = {names[s], times[s], model.pixel + 3*program_nanoseconds(model, programs[s])};
+			samples->push_back(sample);
+		}
+	}
+
+	return model;
+}
@@ -0,0 +1,54 @@
+#ifndef GUARD_costModel_h
+#define GUARD_costModel_h
+
+#include "program.hpp"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstddef>
+
+
+struct CostModel // Time of a render on this machine, in nanoseconds per pixel : a fixed part plus a part per opcode of each type
+{
+	double pixel; // Time of a pixel whatever its expressions : coordinates, quantization and store of the three components
+	double opcodes[OPCODES]; // Time of an opcode of each type evaluated at a pixel
+};
+
+CostModel default_cost_model(); // Rough costs of a recent x86 core, until the machine is calibrated
+
+std::ostream& operator<<(std::ostream& out, const CostModel& model); // "key value" lines, as in a cost model file
+
+std::string cost_model_path(); // File of the cost model of the machine : $MARTIST_COSTS, or ~/.martist_costs
+
+bool load_cost_model(const std::string& path, CostModel& model); // Read a cost model file (false if there is none)
+
+void save_cost_model(const std::string& path, const CostModel& model); // Write a cost model file
+
+CostModel machine_cost_model(); // Cost model of the machine, read once (defaults without a valid file)
+
+void save_machine_cost_model(const CostModel& model); // Write the cost model of the machine and use it from now on
+
+double program_nanoseconds(const CostModel& model, const Program& program); // Time of the evaluation of a program at a pixel
+
+
+
+struct RenderEstimate // Predicted time of a render
+{
+	double nanoseconds_per_pixel; // Average over the pixels of the buffer
+	double seconds; // Whole render
+};
+
+
+
+struct CostSample // One scene rendered by the calibration
+{
+	std::string name;
+	double measured; // Nanoseconds per pixel
+	double predicted; // Nanoseconds per pixel predicted by the fitted model
+};
+
+CostModel calibrate_cost_model(size_t width, size_t height,
+	std::vector<CostSample>* samples = nullptr); // Render scenes isolating each opcode and fit the cost model of the machine
+
+#endif
@@ -0,0 +1,128 @@
+#include "colorExpression.hpp"
+#include "program.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib> //strtoul
+#include <stdexcept> //domain_error
+#include <algorithm> //std::max
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+
+
+/********************************************************************************************************************************
+* Milliseconds elapsed since start
+*
+* ARGUMENTS :
+*	- start is the beginning of the measure
+**********************************************************************************************************************************/
+static double milliseconds(Clock::time_point start){
+	return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+
+
+/********************************************************************************************************************************
+* Memory and time of the random expressions as their depth grows : for each depth, a few expressions are generated within the
+* node budget, written in infix notation, parsed back and evaluated on a grid of points.
+*
+*	depthCurves [max depth] [node budget] [grid size] [expressions per depth]
+*
+* The memory is the one of the compiled program (one byte per node), of its infix text and of the evaluation stack (one row of
+* points per stack level, for a block of points, see Program::evaluation_block).
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	if(argc > 5){
+		cerr << "Usage : " << argv[0] << " [max depth] [node budget] [grid size] [expressions per depth]" << endl;
+		return 2;
+	}
+
+	const int max_depth = (argc > 1) ? std::atoi(argv[1]) : 40;
+	const size_t budget = (argc > 2) ? std::strtoul(argv[2], nullptr, 10) : 1 << 20;
+	const size_t grid = (argc > 3) ? std::strtoul(argv[3], nullptr, 10) : 256;
+	const int count = (argc > 4) ? std::atoi(argv[4]) : 3;
+
+	if(max_depth < 1 || grid < 1 || count < 1 || budget < minimum_nodes(max_depth)){
+		cerr << "ERROR : invalid arguments (the budget needs at least " << minimum_nodes(max_depth) << " nodes)." << endl;
+		return 2;
+	}
+
+	vector<double> x(grid*grid), y(grid*grid), values(grid*grid);
+	for(size_t i = 0; i < grid*grid; i++){
+		x[i] = -1.0 + 2.0*(i%grid)/grid;
+		y[i] = -1.0 + 2.0*(i/grid)/grid;
+	}
+
+	cout << "depth  nodes      stack  program KB  infix KB  stack KB  generate ms  parse ms  evaluate ms  ns/node/point" << endl;
+
+	try{
+		for(int depth = 1; depth <= max_depth; depth++){
+
+			size_t nodes = 0, text = 0, scratch = 0;
+			int stack = 0;
+			double generate = 0.0, parse = 0.0, evaluate = 0.0;
+
+			for(int i = 0; i < count; i++){
+
+				std::seed_seq seeds{depth, i};
+				std::mt19937 generator(seeds);
+				RandomSource random = [&generator](){ return int(generator() & 0x7fffffff); };
+
+				ColorExpression exp;
+				Clock::time_point start = Clock::now();
+				exp.new_exp(depth, budget, random);
+				generate += milliseconds(start);
+
+				const Program& program = exp.compiled();
+				nodes += program.info().nodes;
+				stack = std::max(stack, program.stack_height());
+				scratch = std::max(scratch, program.stack_height()*program.evaluation_block()*sizeof(double));
+
+				std::ostringstream out;
+				exp.write_infix(out);
+				const string infix = out.str();
+				text += infix.size();
+
+				ColorExpression parsed;
+				start = Clock::now();
+				parsed.new_exp(infix.data(), infix.data() + infix.size());
+				parse += milliseconds(start);
+
+				if(parsed.compiled().code() != program.code())
+					throw std::domain_error("ERROR : the expression of depth " + std::to_string(depth) + " is not parsed back.");
+
+				start = Clock::now();
+				program.evaluate(x.data(), y.data(), grid*grid, values.data());
+				evaluate += milliseconds(start);
+			}
+
+			cout << std::setw(5) << depth << "  " << std::setw(9) << nodes/count << "  " << std::setw(5) << stack
+				<< std::fixed << std::setprecision(1)
+				<< "  " << std::setw(10) << nodes/count/1024.0 << "  " << std::setw(8) << text/count/1024.0
+				<< "  " << std::setw(8) << scratch/1024.0
+				<< std::setprecision(3)
+				<< "  " << std::setw(11) << generate/count << "  " << std::setw(8) << parse/count
+				<< "  " << std::setw(11) << evaluate/count
+				<< "  " << std::setw(13) << 1e6*evaluate/(double(nodes)*grid*grid) << endl;
+		}
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,517 @@
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "pixelFormat.hpp"
+#include "kernels.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath> //std::abs, std::sin, std::cos
+#include <cstdlib> //strtoul, atof
+#include <stdint.h>
+#include <stdexcept> //domain_error
+#include <algorithm> //std::max, std::min
+#include <cfloat> //DBL_MIN
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t MAX_FUZZED_SIZE = 1 << 16; // Longest mutated expression, in characters
+
+
+
+/********************************************************************************************************************************
+* An evaluation engine compared to the reference, and what it was found to differ by
+**********************************************************************************************************************************/
+enum EngineKind
+{
+	ENGINE_PROGRAM, // Program::evaluate on the whole grid, then quantize
+	ENGINE_RENDER // Martist::draw in a buffer of the given format (tiles, batches, mirrors and surrogates)
+};
+
+struct Engine
+{
+	string name;
+	EngineKind kind;
+	KernelIsa isa;
+	PixelFormat format;
+	int surrogate_degree; // 0 without surrogates
+	int tolerance; // Units the outputs may differ by (the tolerance of the surrogates or of the fixed point)
+	bool fixed_point; // The expressions are evaluated in fixed point
+
+	double max_difference; // Largest difference of the values (engines giving values only)
+	size_t differing; // Outputs farther than the tolerance from the ones of the values within the threshold of the reference
+	size_t changed; // Outputs differing from the ones of the reference at all
+	size_t max_unit_difference; // Largest difference of the outputs, in bytes (or 16-bit units)
+	size_t outputs; // Outputs compared
+	double seconds;
+	size_t reproducers;
+};
+
+
+
+/********************************************************************************************************************************
+* Outputs of a value : the byte of quantize and the 16-bit value of the RGB16 layout
+**********************************************************************************************************************************/
+static unsigned char scalar_byte(double value){
+	return (value == 0.0) ? 0 : (unsigned char)(255/2 * (value + 1));
+}
+
+static uint16_t scalar_word(double value){
+	return (value == 0.0) ? 0 : (uint16_t)(65535/2.0 * (value + 1));
+}
+
+
+
+/********************************************************************************************************************************
+* Distance of an output to the outputs of the values within margin of the reference value. The reference is only exact to about
+* an ulp per operation (its sin and cos are not the kernels), so an output of any of these values is right : the outputs grow with
+* the values, but for 0 whose output is 0.
+*
+* ARGUMENTS :
+*	- output is the output of an engine
+*	- expected is the reference value
+*	- margin is the largest difference of the values expected from the engines
+*	- convert gives the output of a value (scalar_byte or scalar_word)
+*
+* RETURN : the number of units output is out of the right outputs by (0 if it is one of them)
+**********************************************************************************************************************************/
+template<typename Convert>
+static size_t units_off(int output, double expected, double margin, Convert convert){
+
+	if(output == 0 && std::abs(expected) <= margin)
+		return 0;
+
+	const int low = convert(expected - margin), high = convert(expected + margin);
+	if(output < low)
+		return low - output;
+	return (output > high) ? output - high : 0;
+}
+
+
+
+/********************************************************************************************************************************
+* A value flushed to 0 if it is subnormal, as with flush-to-zero and denormals-are-zero (DenormalFlush)
+**********************************************************************************************************************************/
+static double flushed(double value){
+	return (std::abs(value) < DBL_MIN) ? 0.0 : value;
+}
+
+
+
+/********************************************************************************************************************************
+* Reference value of an expression, independent of the engines : the tree of the opcodes is walked from its root and evaluated with
+* std::sin and std::cos of libm, as ColorExpression::compute_value did before the expressions were compiled. The subnormal values
+* are flushed to 0 in software, as the renders do in hardware (Martist::flushDenormals).
+*
+* ARGUMENTS :
+*	- code are the opcodes of the expression, in reverse polish notation
+*	- start is the first opcode of the sub-expression ending at each opcode (Program::subtree_starts)
+*	- node is the last opcode of the sub-expression to evaluate
+*	- x and y are the coordinates of the point
+*
+* RETURN : the value of the sub-expression at (x,y)
+**********************************************************************************************************************************/
+static double reference_value(const vector<Opcode>& code, const vector<size_t>& start, size_t node, double x, double y){
+
+	switch(code[node]){
+		case OP_ZERO :
+			return 0.0;
+		case OP_X :
+			return flushed(x);
+		case OP_Y :
+			return flushed(y);
+		case OP_PI :
+			return M_PI;
+		case OP_SIN :
+			return flushed(std::sin(reference_value(code, start, node - 1, x, y)));
+		case OP_COS :
+			return flushed(std::cos(reference_value(code, start, node - 1, x, y)));
+		default :
+			break;
+	}
+
+	const double op1 = reference_value(code, start, start[node - 1] - 1, x, y);
+	const double op2 = reference_value(code, start, node - 1, x, y);
+
+	return flushed((code[node] == OP_AVG) ? (op1 + op2)/2 : op1 * op2);
+}
+
+
+
+/********************************************************************************************************************************
+* Mutate the text of an expression : delete, duplicate or swap ranges, insert tokens, replace characters, exchange x and y. Most mutants are
+* invalid and must be rejected by the parser with a domain_error; the others are compared as any expression.
+*
+* ARGUMENTS :
+*	- text is the expression in infix notation
+*	- generator is the random source
+**********************************************************************************************************************************/
+static string mutate(string text, std::mt19937& generator){
+
+	static const char* const TOKENS[] = {"sin(pi*", "cos(pi*", "avg(", "(", ")", ",", "*", "x", "y", "pi", " ", "0.5", "-"};
+	static const size_t TOKEN_COUNT = sizeof(TOKENS)/sizeof(TOKENS[0]);
+
+	const int mutations = 1 + generator() % 3;
+	for(int m = 0; m < mutations && text.size() < MAX_FUZZED_SIZE; m++){
+
+		const size_t size = text.size();
+		const size_t a = size ? generator() % size : 0;
+		const size_t b = size ? generator() % size : 0;
+		const size_t first = std::min(a, b), last = std::max(a, b);
+
+		switch(generator() % 6){
+			case 0 :
+				text.erase(first, last - first + 1);
+				break;
+			case 1 :
+				text.insert(first, text.substr(first, last - first + 1));
+				break;
+			case 2 :
+				text.insert(a, TOKENS[generator() % TOKEN_COUNT]);
+				break;
+			case 3 :
+				if(size)
+					text[a] = TOKENS[generator() % TOKEN_COUNT][0];
+				break;
+			case 4 :
+				// Exchange x and y in a range, which keeps the expression valid
+				for(size_t k = first; k <= last && k < size; k++)
+					text[k] = (text[k] == 'x') ? 'y' : (text[k] == 'y') ? 'x' : text[k];
+				break;
+			default :
+				// Swap the ranges [first, middle) and [middle, last)
+				if(last > first){
+					const size_t middle = first + generator() % (last - first);
+					text = text.substr(0, first) + text.substr(middle, last - middle) + text.substr(first, middle - first) + text.substr(last);
+				}
+				break;
+		}
+	}
+
+	return text;
+}
+
+
+
+/********************************************************************************************************************************
+* Write a scene file reproducing a mismatch, which the batch tool renders again
+*
+* ARGUMENTS :
+*	- path is the name of the file
+*	- engine is the engine found to differ
+*	- exps are the three expressions
+*	- width, height and viewport are the grid
+**********************************************************************************************************************************/
+static void write_reproducer(const string& path, const Engine& engine, const ColorExpression exps[3], size_t width, size_t height,
+	const Viewport& viewport){
+
+	std::ofstream out(path.c_str());
+	if(!out)
+		throw std::domain_error("ERROR : Can't write " + path + ".");
+
+	out << std::setprecision(17);
+	out << "# engine " << engine.name << ", " << width << "x" << height << ", viewport " << viewport.x_min << " " << viewport.x_max
+		<< " " << viewport.y_min << " " << viewport.y_max << endl;
+	out << "# max difference " << engine.max_difference << ", " << engine.differing << " differing output(s) so far" << endl;
+
+	const char* names[3] = {"red", "green", "blue"};
+	for(int c = 0; c < 3; c++){
+		out << names[c] << "= ";
+		exps[c].write_infix(out);
+		out << endl;
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Differential harness of the evaluation engines. Random expressions (ColorExpression::new_exp) and mutants of their infix
+* text, once parsed, are evaluated on a grid by a reference walking their trees with the sin and cos of libm (see
+* reference_value) and by every engine : Program::evaluate and Martist::draw in RGB8 with the kernels of each instruction set of
+* the processor, the RGB16 and RGB_FLOAT32 layouts, the Chebyshev surrogates without and with tolerance, and the fixed point (RGB8). Every
+* engine but the surrogates and the fixed point must give the outputs of a value within the threshold of the reference (1e-10 by
+* default), the reference and the kernels rounding differently. The fixed point is only reported unless given a tolerance (255
+* by default).
+*
+* The values of RGB_FLOAT32 are compared to the ones within the threshold of the reference, rounded to floats.
+*
+*	differential [count] [width] [height] [--depth MIN MAX] [--seed S] [--fuzz N] [--viewport X0 X1 Y0 Y1]
+*		[--surrogates DEGREE TOLERANCE] [--fixed TOLERANCE] [--threshold VALUE] [--outputs N] [--prefix P]
+*
+* For each engine, it prints the largest difference of the values, the number of outputs (bytes, or 16-bit values) farther than
+* the tolerance of the engine from the right ones (see units_off), the share of the outputs differing from the ones of the
+* reference at all, the largest distance of the outputs to the right ones and the speed. A scene file <prefix><number>.txt is written for the expressions of an
+* engine whose values differ by more than the threshold or with more than N outputs differing beyond its tolerance.
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	int positional = 1;
+	while(positional < argc && positional < 4 && argv[positional][0] != '-')
+		positional++;
+
+	const size_t count = (positional > 1) ? std::strtoul(argv[1], nullptr, 10) : 50;
+	const size_t width = (positional > 2) ? std::strtoul(argv[2], nullptr, 10) : 128;
+	const size_t height = (positional > 3) ? std::strtoul(argv[3], nullptr, 10) : 128;
+	int min_depth = 1, max_depth = 12, fuzz = 4, surrogate_degree = 32, surrogate_tolerance = 2, fixed_tolerance = 255;
+	unsigned int seed = 1;
+	Viewport viewport = {-1.0, 1.0, -1.0, 1.0};
+	double threshold = 1e-10;
+	size_t max_outputs = 0;
+	string prefix = "mismatch";
+
+	for(int i = positional; i < argc; i++){
+
+		string option = argv[i];
+		int left = argc - i - 1;
+
+		if(option == "--depth" && left >= 2){
+			min_depth = std::atoi(argv[++i]);
+			max_depth = std::atoi(argv[++i]);
+		}
+		else if(option == "--seed" && left >= 1)
+			seed = std::strtoul(argv[++i], nullptr, 10);
+		else if(option == "--fuzz" && left >= 1)
+			fuzz = std::atoi(argv[++i]);
+		else if(option == "--viewport" && left >= 4){
+			viewport.x_min = std::atof(argv[++i]);
+			viewport.x_max = std::atof(argv[++i]);
+			viewport.y_min = std::atof(argv[++i]);
+			viewport.y_max = std::atof(argv[++i]);
+		}
+		else if(option == "--surrogates" && left >= 2){
+			surrogate_degree = std::atoi(argv[++i]);
+			surrogate_tolerance = std::atoi(argv[++i]);
+		}
+		else if(option == "--fixed" && left >= 1)
+			fixed_tolerance = std::atoi(argv[++i]);
+		else if(option == "--threshold" && left >= 1)
+			threshold = std::atof(argv[++i]);
+		else if(option == "--outputs" && left >= 1)
+			max_outputs = std::strtoul(argv[++i], nullptr, 10);
+		else if(option == "--prefix" && left >= 1)
+			prefix = argv[++i];
+		else{
+			cerr << "Usage : " << argv[0] << " [count] [width] [height] [--depth MIN MAX] [--seed S] [--fuzz N]"
+				<< " [--viewport X0 X1 Y0 Y1] [--surrogates DEGREE TOLERANCE] [--fixed TOLERANCE] [--threshold VALUE] [--outputs N]"
+				<< " [--prefix P]" << endl;
+			return 2;
+		}
+	}
+
+	if(count == 0 || width == 0 || height == 0 || min_depth < 0 || max_depth < min_depth || fuzz < 0 || fixed_tolerance < 0){
+		cerr << "ERROR : invalid arguments." << endl;
+		return 2;
+	}
+
+	// The engines
+	const KernelIsa active = profile_kernel_isa(machine_tuning_profile());
+	vector<Engine> engines;
+	const Engine blank = {"", ENGINE_PROGRAM, ISA_GENERIC, RGB8, 0, 0, false, 0.0, 0, 0, 0, 0, 0.0, 0};
+
+	for(int isa = ISA_GENERIC; isa <= ISA_AVX512; isa++){
+		if(!kernel_isa_supported((KernelIsa)isa))
+			continue;
+		Engine engine = blank;
+		engine.isa = (KernelIsa)isa;
+		engine.name = string("program-") + kernel_isa_name(engine.isa);
+		engines.push_back(engine);
+		engine.kind = ENGINE_RENDER;
+		engine.name = string("rgb8-") + kernel_isa_name(engine.isa);
+		engines.push_back(engine);
+	}
+
+	Engine engine = blank;
+	engine.kind = ENGINE_RENDER;
+	engine.isa = active;
+	engine.format = RGB16;
+	engine.name = "rgb16";
+	engines.push_back(engine);
+	engine.format = RGB_FLOAT32;
+	engine.name = "float32";
+	engines.push_back(engine);
+
+	if(surrogate_degree > 0){
+		engine.format = RGB8;
+		engine.surrogate_degree = surrogate_degree;
+		engine.name = "surrogate-" + std::to_string(surrogate_degree) + "-t0";
+		engines.push_back(engine);
+		if(surrogate_tolerance > 0){
+			engine.tolerance = surrogate_tolerance;
+			engine.name = "surrogate-" + std::to_string(surrogate_degree) + "-t" + std::to_string(surrogate_tolerance);
+			engines.push_back(engine);
+		}
+	}
+
+	engine = blank;
+	engine.kind = ENGINE_RENDER;
+	engine.isa = active;
+	engine.fixed_point = true;
+	engine.tolerance = fixed_tolerance;
+	engine.name = "fixed-t" + std::to_string(fixed_tolerance);
+	engines.push_back(engine);
+
+	const size_t n = width*height;
+	vector<double> x(n), y(n), reference(3*n), values(n);
+	viewport_grid(viewport, width, height, x.data(), y.data());
+
+	vector<unsigned char> buffer(n*bytes_per_pixel(RGB_FLOAT32)), bytes(n);
+	double reference_seconds = 0.0;
+	size_t scenes = 0, mutants = 0, rejected = 0, crashed = 0, written = 0;
+
+	try{
+		std::mt19937 generator(seed);
+		RandomSource random = [&generator](){ return int(generator() & 0x7fffffff); };
+
+		for(size_t s = 0; s < count; s++){
+
+			// A random scene, then fuzz mutants of it
+			ColorExpression exps[3];
+			for(int c = 0; c < 3; c++)
+				exps[c].new_exp(min_depth + generator() % (max_depth - min_depth + 1), random);
+
+			for(int f = 0; f <= fuzz; f++){
+
+				ColorExpression scene[3] = {exps[0], exps[1], exps[2]};
+
+				if(f > 0){
+					const int c = generator() % 3;
+					const string text = mutate(exps[c].rpn_to_infix(), generator);
+					mutants++;
+					try{
+						scene[c].new_exp(text.data(), text.data() + text.size());
+					}
+					catch(std::domain_error&){
+						rejected++;
+						continue;
+					}
+					catch(std::exception& e){
+						// The parser must reject its invalid inputs with a domain_error
+						std::ofstream out((prefix + "-parser" + std::to_string(++crashed) + ".txt").c_str());
+						out << "# " << e.what() << endl << text << endl;
+						continue;
+					}
+				}
+				scenes++;
+
+				// The reference, walking the trees
+				Clock::time_point start = Clock::now();
+				for(int c = 0; c < 3; c++){
+					const vector<Opcode>& code = scene[c].compiled().code();
+					const vector<size_t> starts = scene[c].compiled().subtree_starts();
+					for(size_t k = 0; k < n; k++)
+						reference[c*n + k] = reference_value(code, starts, code.size() - 1, x[k], y[k]);
+				}
+				reference_seconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+				for(Engine& engine : engines){
+
+					const size_t before = engine.differing;
+					double difference = 0.0;
+
+					start = Clock::now();
+					if(engine.kind == ENGINE_PROGRAM){
+						// The renders flush the subnormal values to 0 (Martist::flushDenormals) : Program::evaluate too
+						const Kernels& kernel = kernels(engine.isa);
+						DenormalFlush flush;
+						for(int c = 0; c < 3; c++){
+							scene[c].compiled().evaluate(x.data(), y.data(), n, values.data(), kernel);
+							quantize(values.data(), n, bytes.data(), kernel);
+							engine.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+							for(size_t k = 0; k < n; k++){
+								difference = std::max(difference, std::abs(values[k] - reference[c*n + k]));
+								engine.differing += (units_off(bytes[k], reference[c*n + k], threshold, scalar_byte) > 0);
+								engine.changed += (bytes[k] != scalar_byte(reference[c*n + k]));
+							}
+							start = Clock::now();
+						}
+					}
+					else{
+						Martist martist(buffer.data(), width, height, 0, 0, 0);
+						TuningProfile profile = martist.tuning();
+						profile.isa = engine.isa;
+						martist.tuning(profile);
+						if(profile_kernel_isa(martist.tuning()) != engine.isa)
+							throw std::domain_error(string("ERROR : The engine ") + engine.name + " doesn't render with its kernels"
+								" (MARTIST_KERNELS chose " + kernel_isa_name(profile_kernel_isa(martist.tuning())) + ").");
+						martist.viewport(viewport);
+						martist.format(engine.format);
+						martist.fixedPoint(engine.fixed_point);
+						if(engine.surrogate_degree > 0)
+							martist.surrogates(engine.surrogate_degree, engine.tolerance);
+						martist.draw(scene[0], scene[1], scene[2]);
+						engine.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+						for(size_t k = 0; k < n; k++){
+							for(int c = 0; c < 3; c++){
+								const double expected = reference[c*n + k];
+								size_t units;
+								bool changed;
+								if(engine.format == RGB_FLOAT32){
+									const float value = reinterpret_cast<const float*>(buffer.data())[3*k + c];
+									difference = std::max(difference, (double)std::abs(value - (float)expected));
+									units = (value < (float)(expected - threshold) || value > (float)(expected + threshold));
+									changed = (value != (float)expected);
+								}
+								else if(engine.format == RGB16){
+									const int word = reinterpret_cast<const uint16_t*>(buffer.data())[3*k + c];
+									units = units_off(word, expected, threshold, scalar_word);
+									changed = (word != scalar_word(expected));
+								}
+								else{
+									units = units_off(buffer[3*k + c], expected, threshold, scalar_byte);
+									changed = (buffer[3*k + c] != scalar_byte(expected));
+								}
+
+								engine.max_unit_difference = std::max(engine.max_unit_difference, units);
+								engine.differing += (units > (size_t)engine.tolerance);
+								engine.changed += changed;
+							}
+						}
+					}
+
+					engine.outputs += 3*n;
+					engine.max_difference = std::max(engine.max_difference, difference);
+
+					if(difference > threshold || engine.differing - before > max_outputs){
+						write_reproducer(prefix + std::to_string(++written) + ".txt", engine, scene, width, height, viewport);
+						engine.reproducers++;
+					}
+				}
+			}
+		}
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	cout << scenes << " scene(s) of " << width << "x" << height << " (" << mutants << " mutant(s) : " << rejected << " rejected by the"
+		<< " parser, " << crashed << " with an unexpected error)" << endl;
+	cout << std::fixed << std::setprecision(1) << "reference : " << 3e-6*n*scenes/reference_seconds << " Mvalues/s" << endl << endl;
+	cout << "engine                max difference  differing outputs  changed  max units  Mvalues/s  speedup  reproducers" << endl;
+
+	bool mismatch = crashed > 0;
+	for(const Engine& engine : engines){
+		cout << std::left << std::setw(20) << engine.name << std::right << "  " << std::setw(14) << std::scientific << std::setprecision(2)
+			<< engine.max_difference << "  " << std::setw(17) << engine.differing << std::fixed << std::setprecision(2) << "  " << std::setw(6)
+			<< 100.0*engine.changed/engine.outputs << " %  " << std::setw(9) << engine.max_unit_difference
+			<< std::setprecision(1) << "  " << std::setw(9) << 1e-6*engine.outputs/engine.seconds
+			<< "  " << std::setw(7) << (engine.outputs/engine.seconds)/(3.0*n*scenes/reference_seconds)
+			<< "  " << std::setw(11) << engine.reproducers << endl;
+		mismatch = mismatch || engine.reproducers > 0;
+	}
+
+	return mismatch ? 1 : 0;
+}
@@ -0,0 +1,290 @@
+#include "fixedPoint.hpp"
+#include "program.hpp"
+#include "kernels.hpp"
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <algorithm> //std::min, std::max, std::fill, std::copy
+#include <cstdlib> //std::abs
+#include <math.h> //M_PI, sin, cos, frexp, ldexp
+
+
+using std::vector;
+
+
+static const size_t FIXED_BLOCK = 1024; // Points evaluated at once : the 16-bit stack rows of a block stay in the L1 cache
+static const int MAX_BITS = 30; // Most fraction bits of a value (the values bounded by 0 have them)
+static const size_t TABLE_SIZE = 65536; // One entry per 16-bit value
+
+
+
+/********************************************************************************************************************************
+* Fraction bits of the values bounded by a value : the most bits leaving the 16 bits room for the bound itself
+*
+* ARGUMENTS :
+*	- bound is the largest absolute value
+*
+* RETURN : the fraction bits, negative if the bound doesn't fit in 16 bits
+**********************************************************************************************************************************/
+static int fraction_bits(double bound){
+
+	if(!(bound == bound) || bound > 1e9)
+		return -1;
+
+	if(bound == 0.0)
+		return MAX_BITS;
+
+	int exponent;
+	frexp(bound, &exponent);
+	return std::min(MAX_BITS, 15 - exponent);
+}
+
+
+
+/********************************************************************************************************************************
+* A value in fixed point, rounded to the nearest (the halves away from 0) and saturated
+*
+* ARGUMENTS :
+*	- value is the value
+*	- scale is 2 to the power of the fraction bits
+**********************************************************************************************************************************/
+static inline int16_t to_fixed(double value, double scale){
+
+	double v = value*scale;
+	v = std::max(-32768.0, std::min(32767.0, v + ((v < 0) ? -0.5 : 0.5)));
+	return (int16_t)v;
+}
+
+
+
+/********************************************************************************************************************************
+* Table of the sine or the cosine of every 16-bit operand, shared by all the programs
+*
+* ARGUMENTS :
+*	- op is OP_SIN or OP_COS
+*	- from is the number of fraction bits of the operand
+*	- to is the number of fraction bits of the result
+**********************************************************************************************************************************/
+static std::shared_ptr<const vector<int16_t> > trig_table(Opcode op, int from, int to){
+
+	static std::mutex mutex;
+	static std::map<int, std::shared_ptr<const vector<int16_t> > > tables;
+
+	const int key = (op == OP_SIN)*4096 + from*64 + to;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::shared_ptr<const vector<int16_t> >& table = tables[key];
+	if(!table){
+		std::shared_ptr<vector<int16_t> > values = std::make_shared<vector<int16_t> >(TABLE_SIZE);
+		const double unit = ldexp(1.0, -from), scale = ldexp(1.0, to);
+		for(size_t i = 0; i < TABLE_SIZE; i++){
+			const double x = ((int)i - 32768)*unit;
+			(*values)[i] = to_fixed((op == OP_SIN) ? sin(x) : cos(x), scale);
+		}
+		table = values;
+	}
+
+	return table;
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor of the expression "0"
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+FixedProgram::FixedProgram() : FixedProgram(Program(), 1.0, 1.0){}
+
+
+
+/********************************************************************************************************************************
+* Compile a program. The largest absolute value of each opcode is bounded from the ones of its operands : x and y by the
+* bounds, pi by pi, sin by 1 and by the bound of its operand, cos by 1, avg by the mean of the bounds and * by their product.
+* Each value is then stored with the most fraction bits leaving room for its bound in 16 bits (a bound of 1 leaves 14). sin
+* and cos read a table of their 65536 possible operands. A value bounded by more than 2^15 can't be stored : the program
+* is then evaluated in doubles.
+*
+* ARGUMENTS :
+*	- program is the program to evaluate
+*	- x_bound and y_bound are the largest absolute values of the coordinates of the points evaluated
+**********************************************************************************************************************************/
+FixedProgram::FixedProgram(const Program& program, double x_bound, double y_bound) :
+	program(program),
+	bits(program.code().size()),
+	constants(program.code().size(), 0),
+	tables(program.code().size()),
+	left(program.code().size(), 0),
+	x_bits(fraction_bits(std::abs(x_bound))),
+	y_bits(fraction_bits(std::abs(y_bound))),
+	fits(true),
+	zero(false)
+{
+	const vector<Opcode>& ops = program.code();
+	const vector<size_t> start = program.subtree_starts();
+	vector<double> bound(ops.size());
+
+	for(size_t i = 0; i < ops.size(); i++){
+
+		switch(ops[i]){
+			case OP_ZERO : bound[i] = 0.0;
+				break;
+			case OP_X : bound[i] = std::abs(x_bound);
+				break;
+			case OP_Y : bound[i] = std::abs(y_bound);
+				break;
+			case OP_PI : bound[i] = M_PI;
+				break;
+			case OP_SIN : bound[i] = std::min(1.0, bound[i-1]);
+				break;
+			case OP_COS : bound[i] = 1.0;
+				break;
+			case OP_AVG : left[i] = start[i-1] - 1; bound[i] = (bound[left[i]] + bound[i-1])/2;
+				break;
+			case OP_TIMES : left[i] = start[i-1] - 1; bound[i] = bound[left[i]]*bound[i-1];
+				break;
+		}
+
+		bits[i] = (ops[i] == OP_X) ? x_bits : (ops[i] == OP_Y) ? y_bits : fraction_bits(bound[i]);
+		if(bits[i] < 0)
+			fits = false;
+	}
+
+	zero = (bound.back() == 0.0);
+
+	if(!fits)
+		return;
+
+	for(size_t i = 0; i < ops.size(); i++){
+		if(ops[i] == OP_PI)
+			constants[i] = to_fixed(M_PI, ldexp(1.0, bits[i]));
+		else if(ops[i] == OP_SIN || ops[i] == OP_COS)
+			tables[i] = trig_table(ops[i], bits[i-1], bits[i]);
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* The values fit in 16 bits : otherwise the program is evaluated in doubles
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+bool FixedProgram::supported() const{
+	return fits;
+}
+
+
+
+/********************************************************************************************************************************
+* Evaluate the program at n points in fixed point and quantize the values as quantize() does, by blocks of points whose stack
+* rows stay in the L1 cache. The opcodes round their result to the nearest and saturate it, so the bytes may differ from the
+* ones of the double evaluation, mostly by one (see accuracy()). Only the expressions bounded by 0 give black : the values
+* rounded to 0 are quantized as the small values they most often are.
+*
+* ARGUMENTS :
+*	- x and y are the coordinates of the n points, within the bounds of the constructor
+*	- n is the number of points
+*	- out receives the n bytes
+*	- kernel are the kernels of the evaluation (the active ones by default)
+**********************************************************************************************************************************/
+void FixedProgram::evaluate(const double* x, const double* y, size_t n, unsigned char* out, const Kernels& kernel) const{
+
+	if(!fits){
+		static thread_local vector<double> values;
+		if(values.size() < n)
+			values.resize(n);
+		program.evaluate(x, y, n, values.data(), kernel);
+		kernel.quantize(values.data(), n, out);
+		return;
+	}
+
+	// An expression bounded by 0 is exactly 0, black ; the other values rounded to 0 are quantized as small values
+	if(zero){
+		std::fill(out, out + n, 0);
+		return;
+	}
+
+	const vector<Opcode>& ops = program.code();
+	const ProgramInfo& info = program.info();
+
+	static thread_local vector<int16_t> scratch, xs, ys;
+	if(scratch.size() < info.stack_height*FIXED_BLOCK)
+		scratch.resize(info.stack_height*FIXED_BLOCK);
+	if(xs.size() < FIXED_BLOCK){
+		xs.resize(FIXED_BLOCK);
+		ys.resize(FIXED_BLOCK);
+	}
+
+	const double x_scale = ldexp(1.0, x_bits), y_scale = ldexp(1.0, y_bits);
+
+	for(size_t first = 0; first < n; first += FIXED_BLOCK){
+
+		const size_t m = std::min(FIXED_BLOCK, n - first);
+
+		for(size_t k = 0; k < m && info.uses_x; k++)
+			xs[k] = to_fixed(x[first + k], x_scale);
+		for(size_t k = 0; k < m && info.uses_y; k++)
+			ys[k] = to_fixed(y[first + k], y_scale);
+
+		int16_t* top = scratch.data() - m;
+
+		for(size_t i = 0; i < ops.size(); i++){
+
+			switch(ops[i]){
+				case OP_ZERO : top += m; std::fill(top, top + m, 0);
+					break;
+				case OP_X : top += m; std::copy(xs.data(), xs.data() + m, top);
+					break;
+				case OP_Y : top += m; std::copy(ys.data(), ys.data() + m, top);
+					break;
+				case OP_PI : top += m; std::fill(top, top + m, constants[i]);
+					break;
+				case OP_SIN :
+				case OP_COS : {
+					const int16_t* table = tables[i]->data() + 32768;
+					for(size_t k = 0; k < m; k++)
+						top[k] = table[top[k]];
+					break;
+				}
+				case OP_AVG : kernel.fixed_average(top - m, top, m, bits[left[i]], bits[i-1], bits[i]); top -= m;
+					break;
+				case OP_TIMES : kernel.fixed_times(top - m, top, m, bits[left[i]], bits[i-1], bits[i]); top -= m;
+					break;
+			}
+		}
+
+		kernel.fixed_quantize(top, m, bits.back(), out + first);
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Compare the bytes of the fixed-point evaluation to the ones of the double evaluation (Program::evaluate, then quantize)
+*
+* ARGUMENTS :
+*	- x and y are the coordinates of the n points, within the bounds of the constructor
+*	- n is the number of points
+**********************************************************************************************************************************/
+FixedPointAccuracy FixedProgram::accuracy(const double* x, const double* y, size_t n) const{
+
+	vector<double> values(n);
+	vector<unsigned char> exact(n), fixed(n);
+
+	program.evaluate(x, y, n, values.data());
+	kernels().quantize(values.data(), n, exact.data());
+	evaluate(x, y, n, fixed.data());
+
+	FixedPointAccuracy result = {n, 0, 0};
+	for(size_t k = 0; k < n; k++){
+		const int difference = std::abs((int)fixed[k] - (int)exact[k]);
+		result.differing += (difference != 0);
+		result.max_difference = std::max(result.max_difference, difference);
+	}
+
+	return result;
+}
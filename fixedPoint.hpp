@@ -0,0 +1,52 @@
+#ifndef GUARD_fixedPoint_h
+#define GUARD_fixedPoint_h
+
+#include "program.hpp"
+#include "kernels.hpp"
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <stdint.h>
+
+
+struct FixedPointAccuracy // Bytes of a fixed-point evaluation compared to the ones of the double evaluation
+{
+	size_t bytes; // Bytes compared
+	size_t differing; // Bytes differing
+	int max_difference; // Largest difference of two bytes
+};
+
+
+
+class FixedProgram // Program evaluated in 16-bit fixed point, each opcode with the fraction bits its range of values allows
+{
+
+public:
+
+	FixedProgram(); // Constructor of the expression "0"
+
+	FixedProgram(const Program& program, double x_bound, double y_bound); // Compile a program for the points whose |x| and |y| stay within the bounds
+
+	bool supported() const; // The values fit in 16 bits (otherwise evaluate() uses the doubles)
+
+	void evaluate(const double* x, const double* y, size_t n, unsigned char* out, const Kernels& kernel = kernels()) const; // Evaluate n points and quantize them as quantize()
+
+	FixedPointAccuracy accuracy(const double* x, const double* y, size_t n) const; // Compare the bytes of n points to the ones of the double evaluation
+
+
+private:
+
+	Program program;
+	std::vector<int> bits; // Fraction bits of the value of each opcode
+	std::vector<int16_t> constants; // Value of each leaf opcode (0 for the others)
+	std::vector<std::shared_ptr<const std::vector<int16_t> > > tables; // Sine or cosine of every 16-bit value of the operand, for OP_SIN and OP_COS
+	std::vector<size_t> left; // Left operand of each avg and *
+	int x_bits;
+	int y_bits;
+	bool fits;
+	bool zero; // The expression is bounded by 0
+
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "pipeline.hpp"
+#include "colorExpression.hpp"
+
+#include <iostream>
+#include <string>
+#include <cstdlib> //strtoul
+#include <cmath> //std::abs
+#include <stdexcept> //domain_error
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+
+
+
+/********************************************************************************************************************************
+* Generation of a gallery of random images, the generation, rendering, encoding and writing stages overlapping.
+*
+*	gallery <count> <width> <height> [--prefix P] [--depth MIN MAX] [--nodes N] [--cost C [TOLERANCE]] [--seed S] [--threads G R E W] [--queue N] [--buffers N]
+*		[--png [fast|stored]] [--screen CANDIDATES [CONTRAST ENTROPY VARIANCE]] [--surrogates DEGREE [TOLERANCE]]
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	if(argc < 4){
+		cerr << "Usage : " << argv[0] << " <count> <width> <height> [--prefix P] [--depth MIN MAX] [--nodes N] [--cost C [TOLERANCE]] [--seed S]"
+			<< " [--threads G R E W] [--queue N] [--buffers N] [--png [fast|stored]]"
+			<< " [--screen CANDIDATES [CONTRAST ENTROPY VARIANCE]] [--surrogates DEGREE [TOLERANCE]]" << endl;
+		return 2;
+	}
+
+	GalleryOptions options = default_gallery_options();
+	options.count = std::strtoul(argv[1], nullptr, 10);
+	options.width = std::strtoul(argv[2], nullptr, 10);
+	options.height = std::strtoul(argv[3], nullptr, 10);
+
+	for(int i = 4; i < argc; i++){
+
+		string option = argv[i];
+		int left = argc - i - 1;
+
+		if(option == "--prefix" && left >= 1)
+			options.prefix = argv[++i];
+		else if(option == "--depth" && left >= 2){
+			options.min_depth = std::atoi(argv[++i]);
+			options.max_depth = std::atoi(argv[++i]);
+		}
+		else if(option == "--nodes" && left >= 1)
+			options.max_nodes = std::strtoul(argv[++i], nullptr, 10);
+		else if(option == "--cost" && left >= 1){
+			options.cost = std::atof(argv[++i]);
+			if(left >= 2 && argv[i+1][0] != '-')
+				options.cost_tolerance = std::atof(argv[++i]);
+		}
+		else if(option == "--seed" && left >= 1)
+			options.seed = std::strtoul(argv[++i], nullptr, 10);
+		else if(option == "--threads" && left >= 4){
+			for(int s = 0; s < 4; s++)
+				options.threads[s] = std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if(option == "--queue" && left >= 1)
+			options.queue_capacity = std::strtoul(argv[++i], nullptr, 10);
+		else if(option == "--buffers" && left >= 1)
+			options.buffers = std::strtoul(argv[++i], nullptr, 10);
+		else if(option == "--png"){
+			options.png = true;
+			string mode = (left >= 1) ? argv[i+1] : "";
+			if(mode == "fast" || mode == "stored"){
+				options.png_mode = (mode == "fast") ? PNG_FAST : PNG_STORED;
+				i++;
+			}
+		}
+		else if(option == "--screen" && left >= 1){
+			options.candidates = std::atoi(argv[++i]);
+			if(left >= 4 && argv[i+1][0] != '-'){
+				options.thresholds.contrast = std::atof(argv[++i]);
+				options.thresholds.entropy = std::atof(argv[++i]);
+				options.thresholds.colour_variance = std::atof(argv[++i]);
+			}
+		}
+		else if(option == "--surrogates" && left >= 1){
+			options.surrogate_degree = std::atoi(argv[++i]);
+			if(left >= 2 && argv[i+1][0] != '-')
+				options.surrogate_tolerance = std::atoi(argv[++i]);
+		}
+		else{
+			cerr << "ERROR : bad argument " << option << "." << endl;
+			return 2;
+		}
+	}
+
+	if(options.cost != 0.0){
+		if(!(options.cost >= 1.0) || !(options.cost_tolerance >= 0.0)){
+			cerr << "ERROR : Cost must be at least 1 and its tolerance can't be negative." << endl;
+			return 2;
+		}
+		const double nearest = nearest_expression_cost(options.cost);
+		if(std::abs(nearest - options.cost) > options.cost_tolerance*options.cost)
+			cerr << "No expression costs " << options.cost << ", the expressions cost about " << nearest << "." << endl;
+	}
+
+	try{
+		GalleryStats stats = generate_gallery(options);
+		cout << stats;
+		return stats.errors == 0 ? 0 : 1;
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 2;
+	}
+}
@@ -0,0 +1,75 @@
+#include "image.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring> //memcpy
+#include <stdexcept> //domain_error
+
+
+using std::string;
+using std::vector;
+
+
+
+/********************************************************************************************************************************
+* Write an interleaved RGB buffer as a binary PPM file (P6)
+*
+* ARGUMENTS :
+*	- path is the path of the file to write
+*	- rgb is the buffer of the image (3 bytes per pixel)
+*	- width and height are the dimensions of the image (in pixels)
+**********************************************************************************************************************************/
+void write_ppm(const string& path, const unsigned char* rgb, size_t width, size_t height){
+
+	std::ofstream out(path.c_str(), std::ios::binary);
+	if(!out)
+		throw std::domain_error("ERROR : Can't create " + path + ".");
+
+	out << "P6\n" << width << " " << height << "\n255\n";
+	out.write(reinterpret_cast<const char*>(rgb), 3*width*height);
+
+	if(!out)
+		throw std::domain_error("ERROR : Can't write " + path + ".");
+}
+
+
+
+
+/********************************************************************************************************************************
+* Encode an interleaved RGB buffer as a binary PPM image (P6) in memory
+*
+* ARGUMENTS :
+*	- rgb is the buffer of the image (3 bytes per pixel)
+*	- width and height are the dimensions of the image (in pixels)
+*	- out receives the encoded image
+**********************************************************************************************************************************/
+void encode_ppm(const unsigned char* rgb, size_t width, size_t height, vector<unsigned char>& out){
+
+	string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+
+	out.resize(header.size() + 3*width*height);
+	std::memcpy(out.data(), header.data(), header.size());
+	std::memcpy(out.data() + header.size(), rgb, 3*width*height);
+}
+
+
+
+/********************************************************************************************************************************
+* Write encoded bytes to a file
+*
+* ARGUMENTS :
+*	- path is the path of the file to write
+*	- data are the bytes to write
+**********************************************************************************************************************************/
+void write_file(const string& path, const vector<unsigned char>& data){
+
+	std::ofstream out(path.c_str(), std::ios::binary);
+	if(!out)
+		throw std::domain_error("ERROR : Can't create " + path + ".");
+
+	out.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+	if(!out)
+		throw std::domain_error("ERROR : Can't write " + path + ".");
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef GUARD_image_h
+#define GUARD_image_h
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+
+void encode_ppm(const unsigned char* rgb, size_t width, size_t height, std::vector<unsigned char>& out); // Encode an interleaved RGB buffer as a binary PPM image in memory
+
+void write_file(const std::string& path, const std::vector<unsigned char>& data); // Write encoded bytes to a file
+
+void write_ppm(const std::string& path, const unsigned char* rgb, size_t width, size_t height); // Write an interleaved RGB buffer as a binary PPM file
+
+#endif
@@ -0,0 +1,154 @@
+#include "imageBuffer.hpp"
+#include "pixelFormat.hpp"
+#include "threadPool.hpp"
+
+#include <string>
+#include <stdexcept> //domain_error
+#include <algorithm> //std::min, std::max
+#include <cstring> //memset
+#include <stdint.h>
+
+#include <sys/mman.h> //mmap, madvise
+
+
+static const size_t HUGE_PAGE = 2*1024*1024; // Size of the huge pages of x86-64
+
+
+
+/********************************************************************************************************************************
+* Constructor. The buffer is mapped on huge pages if asked for (see HugePages), then zeroed in parallel, tile by tile, by the
+* thread pool the Martists of the given profile render with : on a machine with several NUMA nodes, the operating system
+* places each page on the node of the thread touching it first, so the pages end up spread over the nodes of the rendering
+* threads instead of all on the node of the thread making the buffer. The tiles are handed out to the threads as they come,
+* so the locality is statistical rather than exact.
+*
+* ARGUMENTS :
+*	- width and height are the dimensions of the image (in pixels)
+*	- format is the layout of the buffer
+*	- pages are the pages to back the buffer with
+*	- profile gives the rows of a tile and the threads of the renders (the profile of the machine by default)
+**********************************************************************************************************************************/
+ImageBuffer::ImageBuffer(size_t width, size_t height, PixelFormat format, HugePages pages, const TuningProfile& profile) :
+	memory(nullptr),
+	bytes(width*height*bytes_per_pixel(format)),
+	mapped(0),
+	obtained(HUGE_PAGES_NONE)
+{
+	if(width == 0 || height == 0)
+		throw std::domain_error("ERROR : Width or height can't be negative.");
+
+	mapped = (bytes + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+
+#ifdef MAP_HUGETLB
+	if(pages == HUGE_PAGES_EXPLICIT){
+		void* map = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(map != MAP_FAILED){
+			memory = static_cast<unsigned char*>(map);
+			obtained = HUGE_PAGES_EXPLICIT;
+		}
+	}
+#endif
+
+	if(memory == nullptr){
+
+		// One huge page more, to start the buffer on a huge page boundary
+		const size_t length = (pages == HUGE_PAGES_NONE) ? mapped : mapped + HUGE_PAGE;
+
+		void* map = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(map == MAP_FAILED)
+			throw std::domain_error("ERROR : Can't allocate an image buffer of " + std::to_string(bytes) + " bytes.");
+
+		memory = static_cast<unsigned char*>(map);
+
+		if(pages != HUGE_PAGES_NONE){
+
+			// Give back the parts before and after the aligned buffer
+			unsigned char* aligned = memory + (HUGE_PAGE - (uintptr_t)memory % HUGE_PAGE) % HUGE_PAGE;
+			if(aligned != memory)
+				munmap(memory, aligned - memory);
+			if(memory + length != aligned + mapped)
+				munmap(aligned + mapped, (memory + length) - (aligned + mapped));
+			memory = aligned;
+
+#ifdef MADV_HUGEPAGE
+			if(madvise(memory, mapped, MADV_HUGEPAGE) == 0)
+				obtained = HUGE_PAGES_TRANSPARENT;
+#endif
+		}
+	}
+
+	first_touch(width, height, format, profile);
+}
+
+
+
+/********************************************************************************************************************************
+* Destructor, unmaps the buffer
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ImageBuffer::~ImageBuffer(){
+	munmap(memory, mapped);
+}
+
+
+
+/********************************************************************************************************************************
+* The buffer, to give to the Martist
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+unsigned char* ImageBuffer::data() const{
+	return memory;
+}
+
+
+
+/********************************************************************************************************************************
+* Size of the buffer in bytes (width*height*bytes_per_pixel)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t ImageBuffer::size() const{
+	return bytes;
+}
+
+
+
+/********************************************************************************************************************************
+* Pages actually obtained : explicit huge pages fall back to transparent ones when none are reserved, and transparent huge
+* pages to the default ones when the kernel doesn't know them
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+HugePages ImageBuffer::pages() const{
+	return obtained;
+}
+
+
+
+/********************************************************************************************************************************
+* Zero the buffer in parallel, with the tiles and the thread pool of the renders (see Martist::Frame::compute)
+*
+* ARGUMENTS :
+*	- width, height and format describe the image
+*	- profile gives the rows of a tile and the threads of the renders
+**********************************************************************************************************************************/
+void ImageBuffer::first_touch(size_t width, size_t height, PixelFormat format, const TuningProfile& profile){
+
+	const size_t tile_rows = std::max<size_t>(profile.tile_rows, 1);
+	const size_t tiles = (height + tile_rows - 1) / tile_rows;
+
+	// A planar buffer has the rows of a tile in each of its three planes
+	const size_t planes = (format == PLANAR_RGB8) ? 3 : 1;
+	const size_t row = width*bytes_per_pixel(format)/planes;
+
+	ThreadPool::sized(profile.threads).run(tiles, [&](size_t tile){
+
+		const size_t first = tile*tile_rows;
+		const size_t last = std::min(height, first + tile_rows);
+
+		for(size_t p = 0; p < planes; p++)
+			std::memset(memory + p*row*height + first*row, 0, (last - first)*row);
+	});
+}
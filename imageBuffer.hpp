@@ -0,0 +1,49 @@
+#ifndef GUARD_imageBuffer_h
+#define GUARD_imageBuffer_h
+
+#include "pixelFormat.hpp"
+#include "tuner.hpp"
+
+#include <cstddef>
+
+
+enum HugePages // Pages backing an image buffer
+{
+	HUGE_PAGES_NONE, // Pages of the default size
+	HUGE_PAGES_TRANSPARENT, // Transparent huge pages : the buffer is aligned on 2 MB and the kernel is asked to use huge pages
+	HUGE_PAGES_EXPLICIT // Huge pages reserved by the administrator (vm.nr_hugepages), transparent ones if there are none left
+};
+
+
+class ImageBuffer // Image buffer for a Martist : backed by huge pages, each page first touched by the threads rendering it
+{
+
+public:
+
+	ImageBuffer(size_t width, size_t height, PixelFormat format = RGB8, HugePages pages = HUGE_PAGES_TRANSPARENT,
+		const TuningProfile& profile = machine_tuning_profile()); // Constructor, the buffer is zeroed
+
+	~ImageBuffer(); // Destructor, unmaps the buffer
+
+	unsigned char* data() const; // The buffer, to give to the Martist
+
+	size_t size() const; // Size of the buffer in bytes (width*height*bytes_per_pixel)
+
+	HugePages pages() const; // Pages actually obtained
+
+
+private:
+
+	unsigned char* memory;
+	size_t bytes;
+	size_t mapped; // Size of the mapping, a multiple of the huge page size
+	HugePages obtained;
+
+	void first_touch(size_t width, size_t height, PixelFormat format, const TuningProfile& profile); // Zero the tiles in parallel
+
+	ImageBuffer(const ImageBuffer&) = delete;
+	ImageBuffer& operator=(const ImageBuffer&) = delete;
+
+};
+
+#endif
@@ -0,0 +1,369 @@
+/********************************************************************************************************************************
+* Kernels for one instruction set. This file is compiled once per instruction set (see the Makefile) with KERNEL_TABLE naming
+* the table of functions, KERNEL_ISA its instruction set and KERNEL_LANES the number of doubles per vector register; GCC
+* vector extensions turn the same code into SSE2, SSE4, AVX2 or AVX-512 instructions.
+*
+* All the variants compute exactly the same bits : they apply the same IEEE operations in the same order on each lane, and
+* they are built with -ffp-contract=off so that no multiplication and addition are fused. The tail of an array is padded to
+* a whole vector for the same reason.
+*
+* Everything is static but the table : inline functions of the standard headers must not be instantiated here, or the linker
+* could pick a copy built for an instruction set the processor lacks.
+**********************************************************************************************************************************/
+#include "kernels.hpp"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h> //memcpy
+#include <math.h> //sin, cos for the out of range values
+
+#if !defined(KERNEL_TABLE) || !defined(KERNEL_ISA) || !defined(KERNEL_LANES)
+#error "KERNEL_TABLE, KERNEL_ISA and KERNEL_LANES must be defined"
+#endif
+
+
+typedef double Vector __attribute__((vector_size(8*KERNEL_LANES)));
+typedef int64_t Mask __attribute__((vector_size(8*KERNEL_LANES)));
+typedef int32_t Words __attribute__((vector_size(8*KERNEL_LANES))); // Fixed-point values widened for the arithmetic
+typedef int16_t Shorts __attribute__((vector_size(4*KERNEL_LANES))); // The same values as stored, 16 bits each
+
+static const size_t LANES = KERNEL_LANES;
+static const size_t WORD_LANES = 2*KERNEL_LANES;
+
+
+
+/********************************************************************************************************************************
+* Sine and cosine of a vector (Cephes' algorithm) : reduction to [-pi/4, pi/4] by multiples of pi/4, subtracted in three parts,
+* then a polynomial of degree 13 or 14. The error stays within 2 ulp of the exact result up to 1e8; beyond it, and for the
+* infinities and NaN, the lanes are computed by the C library.
+**********************************************************************************************************************************/
+static const double FOUR_OVER_PI = 1.27323954473516268615;
+static const double DP1 = 7.85398125648498535156E-1;
+static const double DP2 = 3.77489470793079817668E-8;
+static const double DP3 = 2.69515142907905952645E-15;
+static const double MAX_REDUCED = 1e8;
+static const double ROUND = 6755399441055744.0; // 1.5*2^52 : x + ROUND - ROUND rounds x to an integer
+
+static inline Vector splat(double value){
+
+	Vector v;
+	for(size_t k = 0; k < LANES; k++)
+		v[k] = value;
+	return v;
+}
+
+static inline Vector sine_polynomial(Vector z, Vector zz){
+
+	Vector p = splat(1.58962301576546568060E-10);
+	p = p*zz + splat(-2.50507477628578072866E-8);
+	p = p*zz + splat(2.75573136213857245213E-6);
+	p = p*zz + splat(-1.98412698295895385996E-4);
+	p = p*zz + splat(8.33333333332211858878E-3);
+	p = p*zz + splat(-1.66666666666666307295E-1);
+	return z + z*zz*p;
+}
+
+static inline Vector cosine_polynomial(Vector zz){
+
+	Vector p = splat(-1.13585365213876817300E-11);
+	p = p*zz + splat(2.08757008419747316778E-9);
+	p = p*zz + splat(-2.75573141792967388112E-7);
+	p = p*zz + splat(2.48015872888517045348E-5);
+	p = p*zz + splat(-1.38888888888730564116E-3);
+	p = p*zz + splat(4.16666666666665929218E-2);
+	return splat(1.0) - zz*splat(0.5) + zz*zz*p;
+}
+
+static inline Vector blend(Mask mask, Vector yes, Vector no){
+
+	return (Vector)(((Mask)yes & mask) | ((Mask)no & ~mask));
+}
+
+static inline __attribute__((always_inline)) void sine_cosine(Vector x, Vector* sine, Vector* cosine){
+
+	// The octants are handled with shifts and bitwise operations only, SSE2 having no 64-bit comparison
+	const Mask sign_bit = (Mask)splat(-0.0);
+	Vector ax = (Vector)((Mask)x & ~sign_bit);
+	Mask in_range = ax <= splat(MAX_REDUCED);
+	Vector safe = (Vector)((Mask)ax & in_range); // Out of range lanes are reduced as 0, then replaced
+
+	// j = (int)(|x|*4/pi), made even
+	Vector t = safe*splat(FOUR_OVER_PI);
+	Vector j = (t + splat(ROUND)) - splat(ROUND);
+	j = blend(j > t, j - splat(1.0), j);
+	Mask octant = (Mask)(j + splat(ROUND)) & 7;
+	Mask odd = octant & 1;
+	j = j + (Vector)((Mask)splat(1.0) & -odd);
+	octant = (octant + odd) & 7;
+
+	Mask high = -((octant >> 2) & 1); // Octants 4 to 7 : the sign flips
+	Mask swap = -((octant >> 1) & 1); // Octants 2 and 6 : the polynomials are swapped
+
+	Vector z = ((safe - j*splat(DP1)) - j*splat(DP2)) - j*splat(DP3);
+	Vector zz = z*z;
+	Vector ps = sine_polynomial(z, zz);
+	Vector pc = cosine_polynomial(zz);
+
+	if(sine)
+		*sine = (Vector)((Mask)blend(swap, pc, ps) ^ (((Mask)x ^ high) & sign_bit));
+	if(cosine)
+		*cosine = (Vector)((Mask)blend(swap, ps, pc) ^ ((high ^ swap) & sign_bit));
+
+	Mask out_of_range = ~in_range;
+	int64_t any = 0;
+	for(size_t k = 0; k < LANES; k++)
+		any |= out_of_range[k];
+
+	if(any){
+		for(size_t k = 0; k < LANES; k++){
+			if(out_of_range[k]){
+				if(sine)
+					(*sine)[k] = ::sin(x[k]);
+				if(cosine)
+					(*cosine)[k] = ::cos(x[k]);
+			}
+		}
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Loads and stores of whole vectors, the tail of an array being padded
+**********************************************************************************************************************************/
+static inline Vector load(const double* values, size_t n){
+
+	Vector v = splat(0.0);
+	if(n >= LANES)
+		memcpy(&v, values, sizeof(Vector));
+	else
+		for(size_t k = 0; k < n; k++)
+			v[k] = values[k];
+	return v;
+}
+
+static inline void store(double* values, size_t n, Vector v){
+
+	if(n >= LANES)
+		memcpy(values, &v, sizeof(Vector));
+	else
+		for(size_t k = 0; k < n; k++)
+			values[k] = v[k];
+}
+
+
+static inline Words load_words(const int16_t* values, size_t n){
+
+	Shorts v;
+	if(n >= WORD_LANES)
+		memcpy(&v, values, sizeof(Shorts));
+	else{
+		for(size_t k = 0; k < WORD_LANES; k++)
+			v[k] = (k < n) ? values[k] : 0;
+	}
+	return __builtin_convertvector(v, Words);
+}
+
+// Saturated to 16 bits
+static inline void store_words(int16_t* values, size_t n, Words v){
+
+	v = (v > 32767) ? 32767 : v;
+	v = (v < -32768) ? -32768 : v;
+	Shorts s = __builtin_convertvector(v, Shorts);
+	if(n >= WORD_LANES)
+		memcpy(values, &s, sizeof(Shorts));
+	else
+		for(size_t k = 0; k < n; k++)
+			values[k] = s[k];
+}
+
+// Values of from fraction bits to values of to fraction bits, rounded to the nearest
+static inline Words rescale(Words v, int from, int to){
+
+	const int shift = from - to;
+	if(shift > 30)
+		return v*0;
+	if(shift > 0)
+		return (v + (1 << (shift - 1))) >> shift;
+	return v << ((-shift < 16) ? -shift : 16);
+}
+
+
+
+/********************************************************************************************************************************
+* The kernels
+**********************************************************************************************************************************/
+static void kernel_sin(double* values, size_t n){
+
+	for(size_t k = 0; k < n; k += LANES){
+		Vector s;
+		sine_cosine(load(values + k, n - k), &s, nullptr);
+		store(values + k, n - k, s);
+	}
+}
+
+static void kernel_cos(double* values, size_t n){
+
+	for(size_t k = 0; k < n; k += LANES){
+		Vector c;
+		sine_cosine(load(values + k, n - k), nullptr, &c);
+		store(values + k, n - k, c);
+	}
+}
+
+static void kernel_average(double* a, const double* b, size_t n){
+
+	for(size_t k = 0; k < n; k += LANES)
+		store(a + k, n - k, (load(a + k, n - k) + load(b + k, n - k))/splat(2.0));
+}
+
+static void kernel_times(double* a, const double* b, size_t n){
+
+	for(size_t k = 0; k < n; k += LANES)
+		store(a + k, n - k, load(a + k, n - k)*load(b + k, n - k));
+}
+
+// (sin f)' = cos f * f'
+static void kernel_sin_gradient(double* a, size_t n){
+
+	for(size_t k = 0; k < n; k += LANES){
+		size_t m = n - k;
+		Vector s, c;
+		sine_cosine(load(a + k, m), &s, &c);
+		store(a + k, m, s);
+		store(a + n + k, m, load(a + n + k, m)*c);
+		store(a + 2*n + k, m, load(a + 2*n + k, m)*c);
+	}
+}
+
+// (cos f)' = -sin f * f'
+static void kernel_cos_gradient(double* a, size_t n){
+
+	for(size_t k = 0; k < n; k += LANES){
+		size_t m = n - k;
+		Vector s, c;
+		sine_cosine(load(a + k, m), &s, &c);
+		store(a + k, m, c);
+		store(a + n + k, m, load(a + n + k, m)*-s);
+		store(a + 2*n + k, m, load(a + 2*n + k, m)*-s);
+	}
+}
+
+// (f*g)' = f'*g + f*g'
+static void kernel_times_gradient(double* a, const double* b, size_t n){
+
+	for(size_t k = 0; k < n; k += LANES){
+		size_t m = n - k;
+		Vector f = load(a + k, m), g = load(b + k, m);
+		store(a + n + k, m, load(a + n + k, m)*g + f*load(b + n + k, m));
+		store(a + 2*n + k, m, load(a + 2*n + k, m)*g + f*load(b + 2*n + k, m));
+		store(a + k, m, f*g);
+	}
+}
+
+// 255/2*(value+1) truncated, 0 staying black : the quantization of every render path
+static void kernel_quantize(const double* values, size_t n, unsigned char* out){
+
+	typedef int32_t Integers __attribute__((vector_size(4*KERNEL_LANES)));
+
+	for(size_t k = 0; k < n; k += LANES){
+		Vector v = load(values + k, n - k);
+		Vector s = splat(255/2)*(v + splat(1.0));
+		s = (Vector)((Mask)s & (v != splat(0.0)));
+		Integers q = __builtin_convertvector(s, Integers);
+		for(size_t i = 0; i < LANES && k + i < n; i++)
+			out[k + i] = (unsigned char)q[i];
+	}
+}
+
+
+// Chebyshev series by the Clenshaw recurrence : b_i = c_i + 2t*b_(i+1) - b_(i+2), then c_0 + t*b_1 - b_2. The recurrence of
+// a vector depends on its previous step, so four vectors go at once to hide the latency of the operations.
+static inline void clenshaw_step(Vector coefficient, Vector x, Vector* b1, Vector* b2){
+
+	Vector b0 = coefficient + splat(2.0)*x*(*b1) - *b2;
+	*b2 = *b1;
+	*b1 = b0;
+}
+
+static void kernel_clenshaw(const double* coefficients, int degree, const double* t, size_t n, double* values){
+
+	for(size_t k = 0; k < n; k += 4*LANES){
+
+		const size_t m = n - k;
+		Vector x0 = load(t + k, m);
+		Vector x1 = (m > LANES) ? load(t + k + LANES, m - LANES) : splat(0.0);
+		Vector x2 = (m > 2*LANES) ? load(t + k + 2*LANES, m - 2*LANES) : splat(0.0);
+		Vector x3 = (m > 3*LANES) ? load(t + k + 3*LANES, m - 3*LANES) : splat(0.0);
+		Vector a0 = splat(0.0), a1 = splat(0.0), a2 = splat(0.0), a3 = splat(0.0);
+		Vector b0 = splat(0.0), b1 = splat(0.0), b2 = splat(0.0), b3 = splat(0.0);
+
+		for(int i = degree; i >= 1; i--){
+			const Vector coefficient = splat(coefficients[i]);
+			clenshaw_step(coefficient, x0, &a0, &b0);
+			clenshaw_step(coefficient, x1, &a1, &b1);
+			clenshaw_step(coefficient, x2, &a2, &b2);
+			clenshaw_step(coefficient, x3, &a3, &b3);
+		}
+
+		const Vector first = splat(coefficients[0]);
+		store(values + k, m, first + x0*a0 - b0);
+		if(m > LANES)
+			store(values + k + LANES, m - LANES, first + x1*a1 - b1);
+		if(m > 2*LANES)
+			store(values + k + 2*LANES, m - 2*LANES, first + x2*a2 - b2);
+		if(m > 3*LANES)
+			store(values + k + 3*LANES, m - 3*LANES, first + x3*a3 - b3);
+	}
+}
+
+
+
+// Fixed point : the operands are widened to 32 bits, rescaled, combined, rounded to the nearest and saturated
+static void kernel_fixed_average(int16_t* a, const int16_t* b, size_t n, int fa, int fb, int f){
+
+	for(size_t k = 0; k < n; k += WORD_LANES)
+		store_words(a + k, n - k, (rescale(load_words(a + k, n - k), fa, f) + rescale(load_words(b + k, n - k), fb, f) + 1) >> 1);
+}
+
+static void kernel_fixed_times(int16_t* a, const int16_t* b, size_t n, int fa, int fb, int f){
+
+	for(size_t k = 0; k < n; k += WORD_LANES)
+		store_words(a + k, n - k, rescale(load_words(a + k, n - k)*load_words(b + k, n - k), fa + fb, f));
+}
+
+// 255/2*(value+1) truncated as kernel_quantize, the values of more than 15 fraction bits being rounded down to 15 first. A
+// value rounded to 0 is most often a small value, not an exact 0 : it isn't made black.
+static void kernel_fixed_quantize(const int16_t* values, size_t n, int f, unsigned char* out){
+
+	const int shift = (f > 15) ? f - 15 : 0;
+	const int bits = f - shift;
+
+	for(size_t k = 0; k < n; k += WORD_LANES){
+		Words v = load_words(values + k, n - k);
+		Words t = (255/2)*((v >> shift) + (1 << bits));
+		Words q = (t >= 0) ? (t >> bits) : -((-t) >> bits);
+		for(size_t i = 0; i < WORD_LANES && k + i < n; i++)
+			out[k + i] = (unsigned char)q[i];
+	}
+}
+
+
+
+extern const Kernels KERNEL_TABLE;
+
+const Kernels KERNEL_TABLE = {
+	KERNEL_ISA,
+	kernel_sin,
+	kernel_cos,
+	kernel_average,
+	kernel_times,
+	kernel_sin_gradient,
+	kernel_cos_gradient,
+	kernel_times_gradient,
+	kernel_quantize,
+	kernel_clenshaw,
+	kernel_fixed_average,
+	kernel_fixed_times,
+	kernel_fixed_quantize
+};
@@ -0,0 +1,286 @@
+#include "kernels.hpp"
+
+#include <atomic>
+#include <cstdlib> //getenv
+#include <cstring> //strcmp
+#include <stdexcept> //domain_error
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#ifdef __SSE__
+#include <xmmintrin.h> //_mm_getcsr, _mm_setcsr
+#endif
+
+
+// One table per instruction set, from kernelVariant.cpp
+extern const Kernels KERNELS_GENERIC;
+extern const Kernels KERNELS_SSE4;
+extern const Kernels KERNELS_AVX2;
+extern const Kernels KERNELS_AVX512;
+
+static const Kernels* const TABLES[4] = {&KERNELS_GENERIC, &KERNELS_SSE4, &KERNELS_AVX2, &KERNELS_AVX512};
+static const char* const NAMES[4] = {"generic", "sse4", "avx2", "avx512"};
+
+static const unsigned int FLUSH_TO_ZERO = 0x8000; // Subnormal results are written as 0 (bit 15 of the SSE control register)
+static const unsigned int DENORMALS_ARE_ZERO = 0x0040; // Subnormal operands are read as 0 (bit 6)
+static const unsigned int STATUS_FLAGS = 0x003F; // Exceptions raised so far (bits 0 to 5)
+
+
+
+/********************************************************************************************************************************
+* Instruction sets supported by the processor, read with cpuid. AVX and AVX-512 also need the operating system to save their
+* registers, which xgetbv tells.
+*
+* ARGUMENT : /
+*
+* RETURN : a bit per instruction set of KernelIsa
+**********************************************************************************************************************************/
+static unsigned int supported_isas(){
+
+	unsigned int isas = 1u << ISA_GENERIC;
+
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return isas;
+
+	const bool sse4 = (ecx & bit_SSE4_1) && (ecx & bit_SSE4_2);
+	const bool avx = (ecx & bit_AVX) && (ecx & bit_OSXSAVE);
+	if(sse4)
+		isas |= 1u << ISA_SSE4;
+
+	if(!avx || __get_cpuid_max(0, nullptr) < 7)
+		return isas;
+
+	unsigned int xcr0_low, xcr0_high;
+	__asm__ ("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+
+	if(sse4 && (xcr0_low & 0x6) == 0x6 && (ebx & bit_AVX2)) // SSE and AVX states
+		isas |= 1u << ISA_AVX2;
+	if((isas & (1u << ISA_AVX2)) && (xcr0_low & 0xE6) == 0xE6 && (ebx & bit_AVX512F) && (ebx & bit_AVX512DQ)) // And opmask, ZMM states
+		isas |= 1u << ISA_AVX512;
+#endif
+
+	return isas;
+}
+
+static unsigned int supported(){
+
+	static const unsigned int isas = supported_isas();
+	return isas;
+}
+
+
+
+/********************************************************************************************************************************
+* Active kernels : the best ones the processor supports, or the ones named by the MARTIST_KERNELS environment variable
+* (generic, sse4, avx2 or avx512) if the processor supports them
+**********************************************************************************************************************************/
+static const Kernels* startup_kernels(){
+
+	KernelIsa isa = best_kernel_isa();
+	const char* name = std::getenv("MARTIST_KERNELS");
+
+	KernelIsa wanted;
+	if(name != nullptr && parse_kernel_isa(name, wanted) && kernel_isa_supported(wanted))
+		isa = wanted;
+
+	return TABLES[isa];
+}
+
+
+
+/********************************************************************************************************************************
+* The MARTIST_KERNELS environment variable names kernels the processor supports : the choice of the user then prevails over
+* the tuning profiles
+*
+* ARGUMENTS :
+*	- isa receives the instruction set named, if the variable names one the processor supports (nullptr if not needed)
+**********************************************************************************************************************************/
+bool kernels_from_environment(KernelIsa* isa){
+
+	const char* name = std::getenv("MARTIST_KERNELS");
+	KernelIsa wanted;
+
+	if(name == nullptr || !parse_kernel_isa(name, wanted) || !kernel_isa_supported(wanted))
+		return false;
+
+	if(isa != nullptr)
+		*isa = wanted;
+
+	return true;
+}
+
+static std::atomic<const Kernels*>& active(){
+
+	static std::atomic<const Kernels*> table(startup_kernels());
+	return table;
+}
+
+
+
+/********************************************************************************************************************************
+* Active kernels, used by the evaluation of the programs and by the quantization of the pixels
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const Kernels& kernels(){
+	return *active().load(std::memory_order_relaxed);
+}
+
+
+/********************************************************************************************************************************
+* Kernels built for an instruction set, whatever the active ones : a Martist renders with the kernels of its own profile
+*
+* ARGUMENTS :
+*	- isa is the instruction set, which the processor must support
+**********************************************************************************************************************************/
+const Kernels& kernels(KernelIsa isa){
+
+	if(!kernel_isa_supported(isa))
+		throw std::domain_error(std::string("ERROR : The processor doesn't support the ") + kernel_isa_name(isa) + " kernels.");
+
+	return *TABLES[isa];
+}
+
+
+/********************************************************************************************************************************
+* Newest instruction set supported by the processor (and the operating system)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+KernelIsa best_kernel_isa(){
+
+	for(int isa = ISA_AVX512; isa > ISA_GENERIC; isa--){
+		if(supported() & (1u << isa))
+			return (KernelIsa)isa;
+	}
+
+	return ISA_GENERIC;
+}
+
+
+/********************************************************************************************************************************
+* The processor can run the kernels built for this instruction set
+*
+* ARGUMENTS :
+*	- isa is the instruction set
+**********************************************************************************************************************************/
+bool kernel_isa_supported(KernelIsa isa){
+	return isa >= ISA_GENERIC && isa <= ISA_AVX512 && (supported() & (1u << isa));
+}
+
+
+/********************************************************************************************************************************
+* Override the active kernels, to test or to compare the variants. All the variants compute the same results, so this can be
+* done at any time.
+*
+* ARGUMENTS :
+*	- isa is the instruction set of the kernels to use
+**********************************************************************************************************************************/
+void select_kernels(KernelIsa isa){
+
+	if(!kernel_isa_supported(isa))
+		throw std::domain_error(std::string("ERROR : The processor doesn't support the ") + kernel_isa_name(isa) + " kernels.");
+
+	active().store(TABLES[isa], std::memory_order_relaxed);
+}
+
+
+/********************************************************************************************************************************
+* Name of an instruction set
+*
+* ARGUMENTS :
+*	- isa is the instruction set
+**********************************************************************************************************************************/
+const char* kernel_isa_name(KernelIsa isa){
+	return (isa >= ISA_GENERIC && isa <= ISA_AVX512) ? NAMES[isa] : "unknown";
+}
+
+
+/********************************************************************************************************************************
+* Instruction set of the given name
+*
+* ARGUMENTS :
+*	- name is generic, sse4, avx2 or avx512
+*	- isa receives the instruction set
+*
+* RETURN : false if the name is unknown
+**********************************************************************************************************************************/
+bool parse_kernel_isa(const char* name, KernelIsa& isa){
+
+	for(int k = ISA_GENERIC; k <= ISA_AVX512; k++){
+		if(std::strcmp(name, NAMES[k]) == 0){
+			isa = (KernelIsa)k;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+
+/********************************************************************************************************************************
+* Floating-point control of the calling thread : the SSE control register (rounding, exception masks, flush-to-zero and
+* denormals-are-zero) without its status flags. 0 without SSE.
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+unsigned int float_control(){
+#ifdef __SSE__
+	return _mm_getcsr() & ~STATUS_FLAGS;
+#else
+	return 0;
+#endif
+}
+
+
+/********************************************************************************************************************************
+* Set the floating-point control of the calling thread (see float_control). The status flags are cleared.
+*
+* ARGUMENTS :
+*	- control is the control, as returned by float_control
+**********************************************************************************************************************************/
+void set_float_control(unsigned int control){
+#ifdef __SSE__
+	_mm_setcsr(control & ~STATUS_FLAGS);
+#else
+	(void)control;
+#endif
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor : the subnormal results of the calling thread are flushed to 0 and its subnormal operands read as 0. The
+* operations on subnormals take a hundred cycles on x86, whereas they hardly change the values : only a pixel whose value is
+* itself below 2^-1022 changes, becoming black as the pixels of value 0.
+*
+* ARGUMENTS :
+*	- flush is false to leave the floating-point control as it is
+**********************************************************************************************************************************/
+DenormalFlush::DenormalFlush(bool flush) : saved(float_control()), flushing(flush){
+
+	if(flushing)
+		set_float_control(saved | FLUSH_TO_ZERO | DENORMALS_ARE_ZERO);
+}
+
+
+
+/********************************************************************************************************************************
+* Destructor, restores the floating-point control of the calling thread
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+DenormalFlush::~DenormalFlush(){
+
+	if(flushing)
+		set_float_control(saved);
+}
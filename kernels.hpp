@@ -0,0 +1,84 @@
+#ifndef GUARD_kernels_h
+#define GUARD_kernels_h
+
+#include <cstddef>
+#include <stdint.h>
+
+
+enum KernelIsa // Instruction sets the kernels are built for, from the oldest to the newest
+{
+	ISA_GENERIC, // x86-64 baseline (SSE2)
+	ISA_SSE4, // SSE4.2
+	ISA_AVX2,
+	ISA_AVX512 // AVX-512 F and DQ
+};
+
+
+struct Kernels // Hot loops of the evaluation and the quantization, compiled for one instruction set
+{
+	KernelIsa isa;
+
+	void (*sin)(double* values, size_t n); // values = sin(values)
+	void (*cos)(double* values, size_t n); // values = cos(values)
+	void (*average)(double* a, const double* b, size_t n); // a = (a+b)/2
+	void (*times)(double* a, const double* b, size_t n); // a = a*b
+
+	// Same operations on the values and derivatives of evaluate_gradient : rows of n values, n x derivatives, n y derivatives
+	void (*sin_gradient)(double* a, size_t n);
+	void (*cos_gradient)(double* a, size_t n);
+	void (*times_gradient)(double* a, const double* b, size_t n);
+
+	void (*quantize)(const double* values, size_t n, unsigned char* out); // Scale values in [-1,1] to bytes (0 stays 0)
+
+	void (*clenshaw)(const double* coefficients, int degree, const double* t, size_t n, double* values); // values = sum of coefficients[i]*T_i(t)
+
+	// 16-bit fixed point of the FixedProgram : a value v is stored as v*2^f, rounded and saturated, f being its fraction bits
+	void (*fixed_average)(int16_t* a, const int16_t* b, size_t n, int fa, int fb, int f); // a = (a+b)/2 with f fraction bits
+	void (*fixed_times)(int16_t* a, const int16_t* b, size_t n, int fa, int fb, int f); // a = a*b with f fraction bits
+	void (*fixed_quantize)(const int16_t* values, size_t n, int f, unsigned char* out); // Scale values of f fraction bits to bytes as quantize (0 isn't black)
+};
+
+
+const Kernels& kernels(); // Active kernels : the best ones the processor supports, unless overridden
+
+const Kernels& kernels(KernelIsa isa); // Kernels built for an instruction set the processor supports, whatever the active ones
+
+KernelIsa best_kernel_isa(); // Newest instruction set supported by the processor (and the operating system)
+
+bool kernel_isa_supported(KernelIsa isa); // The processor can run the kernels built for this instruction set
+
+void select_kernels(KernelIsa isa); // Override the active kernels (the MARTIST_KERNELS environment variable does it at startup)
+
+bool kernels_from_environment(KernelIsa* isa = nullptr); // The MARTIST_KERNELS environment variable chose the kernels at startup (and which ones, if isa isn't nullptr)
+
+const char* kernel_isa_name(KernelIsa isa); // Name of an instruction set : generic, sse4, avx2 or avx512
+
+bool parse_kernel_isa(const char* name, KernelIsa& isa); // Instruction set of the given name
+
+
+unsigned int float_control(); // Floating-point control of the calling thread (the SSE control register, 0 without SSE)
+
+void set_float_control(unsigned int control); // Set the floating-point control of the calling thread
+
+
+class DenormalFlush // Flush-to-zero and denormals-are-zero on the calling thread while it lives, its control being restored after
+{
+
+public:
+
+	explicit DenormalFlush(bool flush = true); // Constructor (nothing changes if flush is false)
+
+	~DenormalFlush(); // Destructor, restores the floating-point control
+
+
+private:
+
+	unsigned int saved;
+	bool flushing;
+
+	DenormalFlush(const DenormalFlush&) = delete;
+	DenormalFlush& operator=(const DenormalFlush&) = delete;
+
+};
+
+#endif
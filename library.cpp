@@ -0,0 +1,84 @@
+#include "colorExpression.hpp"
+#include "programLibrary.hpp"
+#include "scene.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdexcept> //domain_error
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+
+/********************************************************************************************************************************
+* Conversion between scene files and binary program libraries.
+*
+*	library pack <scene file> <library>  : parse every scene and write the compiled programs
+*	library unpack <library>             : print the scenes of a library in infix notation (a valid scene file)
+*	library info <library>               : print the depth, stack height and hash of every program
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	string command = (argc > 1) ? argv[1] : "";
+
+	if(!((command == "pack" && argc == 4) || ((command == "unpack" || command == "info") && argc == 3))){
+		cerr << "Usage : " << argv[0] << " pack <scene file> <library>" << endl;
+		cerr << "        " << argv[0] << " unpack <library>" << endl;
+		cerr << "        " << argv[0] << " info <library>" << endl;
+		return 2;
+	}
+
+	try{
+		if(command == "pack"){
+
+			SceneFile file(argv[2]);
+			vector<SceneText> scenes = file.split();
+			vector<ColorExpression> expressions(3*scenes.size());
+
+			for(size_t i = 0; i < scenes.size(); i++){
+				try{
+					parse_scene(scenes[i], expressions[3*i], expressions[3*i+1], expressions[3*i+2]);
+				}catch(std::domain_error& e){
+					cerr << "scene " << i+1 << " (line " << scenes[i].line << ") : " << e.what() << endl;
+					return 1;
+				}
+			}
+
+			write_program_library(argv[3], expressions);
+			cout << scenes.size() << " scene(s) written." << endl;
+		}
+		else{
+
+			ProgramLibrary library(argv[2]);
+			const char* names[3] = {"red", "green", "blue"};
+
+			for(size_t i = 0; i < library.size(); i++){
+
+				ColorExpression exps[3];
+				library.load(i, exps[0], exps[1], exps[2]);
+
+				for(int c = 0; c < 3; c++){
+					if(command == "unpack"){
+						cout << names[c] << "= " << exps[c].rpn_to_infix() << "\n";
+					}else{
+						const ChannelRecord& record = library.record(i, c);
+						cout << i+1 << " " << names[c] << " : " << record.size << " opcodes, depth " << record.depth
+							<< ", stack " << record.stack_height << ", hash " << std::hex << record.hash << std::dec << "\n";
+					}
+				}
+				cout << "\n";
+			}
+		}
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
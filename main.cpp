@@ -1,4 +1,5 @@
 #include "martist.hpp"
+#include "imageBuffer.hpp"
 
 #include <iostream>
 #include <time.h>
@@ -27,7 +28,9 @@ int main(){
 	cout << "\n" << "Enter the height : ";
 	cin >> height;
 
-	unsigned char* buffer = (unsigned char*) malloc(3*width*height*sizeof(unsigned char));
+	//Planar buffer on huge pages, its pages first touched by the threads which render them
+	ImageBuffer image(width, height, PLANAR_RGB8);
+	unsigned char* buffer = image.data();
 
 	/*cout << "\n" <<"Enter the red depth : ";
 	cin >> rdepth;
@@ -40,7 +43,13 @@ int main(){
 	cin.clear();
 
 	
-	Martist martist(buffer,height,width,rdepth,gdepth,bdepth);
+	Martist martist(buffer,width,height,rdepth,gdepth,bdepth);
+
+	//CImg stores its images plane by plane : with a planar buffer, no copy nor permutation is needed
+	martist.format(PLANAR_RGB8);
+
+	//Probe up to 8 candidates per image, so that flat images are regenerated before the full render
+	martist.screening(8, default_probe_thresholds());
 
 	//Seed the randomness
 	martist.seed((int)time(NULL));
@@ -49,8 +58,7 @@ int main(){
 	try{
 	 	cout << "\n" <<"Enter the desired expressions : " << endl;
 		cin >> martist;
-        CImg<unsigned char> boardA(buffer,3,(unsigned int)width,(unsigned int)height);
-        boardA.permute_axes("yzcx");
+        CImg<unsigned char> boardA(buffer,(unsigned int)width,(unsigned int)height,1,3,true);
         boardA.display("Martist");
         cout << martist;
     }
@@ -63,20 +71,17 @@ int main(){
 	 try{
 	 	//Random 1
 		martist.paint();
-        CImg<unsigned char> boardA(buffer,3,(unsigned int)width,(unsigned int)height);
-        boardA.permute_axes("yzcx");
+        CImg<unsigned char> boardA(buffer,(unsigned int)width,(unsigned int)height,1,3,true);
         boardA.display("Martist");
         cout << martist;
         //Random 2
         martist.paint();
-        CImg<unsigned char> boardB(buffer,3,(unsigned int)width,(unsigned int)height);
-        boardB.permute_axes("yzcx");
+        CImg<unsigned char> boardB(buffer,(unsigned int)width,(unsigned int)height,1,3,true);
         boardB.display("Martist");
         cout << martist;
         //Random 3
         martist.paint();
-        CImg<unsigned char> boardC(buffer,3,(unsigned int)width,(unsigned int)height);
-        boardC.permute_axes("yzcx");
+        CImg<unsigned char> boardC(buffer,(unsigned int)width,(unsigned int)height,1,3,true);
         boardC.display("Martist");
         cout << martist;
     }
@@ -86,8 +91,5 @@ int main(){
 
 
 
-	free(buffer);
-
-
 	return 0;
 }
\ No newline at end of file
@@ -1,5 +1,13 @@
 #include "martist.hpp"
 #include "colorExpression.hpp"
+#include "scene.hpp"
+#include "pixelFormat.hpp"
+#include "threadPool.hpp"
+#include "probe.hpp"
+#include "tuner.hpp"
+#include "kernels.hpp"
+#include "chebyshev.hpp"
+#include "fixedPoint.hpp"
 
 #include <iostream>//std::istream, std::ostream
 #include <sstream>//std::istringstream
@@ -8,10 +16,15 @@
 #include <vector>//std::vector
 #include <cstdlib>// std::rand, std::srand
 #include <iterator>//begin(), end()
-#include <algorithm>//std::all_of
+#include <algorithm>//std::all_of, std::fill, std::min
 #include <cctype>//std::isspace
 #include <cstddef>//nullptr
 #include <cstdio> // eof()
+#include <cmath> // std::abs
+#include <atomic>
+#include <future> //std::async
+#include <chrono>
+#include <memory>
 
 
 using std::string;
@@ -20,12 +33,36 @@ using std::istream;
 using std::ostream;
 
 
+static const int MAX_SAMPLES = 16; // Maximum number of samples per axis of a supersampled pixel
+static const int MAX_CANDIDATES = 1000; // Maximum number of candidates probed per random image
+static const size_t MAX_TILE_ROWS = 4096; // Maximum number of rows of a tile
+static const size_t MAX_BATCH = 4096; // Maximum number of pixels evaluated at once
+static const size_t MAX_THREADS = 1024; // Maximum number of threads of a render
+static const size_t STREAMING_BYTES = 32*1024*1024; // Smallest buffer written with non-temporal stores, larger than the caches
+static const int MAX_SURROGATE_DEGREE = 64; // Maximum degree of the Chebyshev surrogates
+static const size_t DEFAULT_TASK_NODES = 1024; // Smallest sub-expression evaluated as a parallel task by default
+
+
+
+/******************************************************************************************************************************
+* Shared state of a render : progress, cancellation and result
+*******************************************************************************************************************************/
+struct RenderHandle::State
+{
+	std::atomic<size_t> done;
+	size_t tiles;
+	std::atomic<bool> cancelled;
+	std::shared_future<bool> result;
+};
+
+
+
 
 /********************************************************************************************************************************
 * Constructor
 *
 * ARGUMENTS :
-*	- buffer is a "passed-in" array to be the buffer containing the image pixels 
+*	- buffer is a "passed-in" array to be the buffer containing the image pixels (3 bytes per pixel, see format())
 *	- width and height are the respective dimensions of the image (in pixels)
 *	- rdepth, gdepth, bdepth are the depths for expressions representing the red, green and blue colour components, respectively
 **********************************************************************************************************************************/
@@ -33,9 +70,27 @@ Martist::Martist(unsigned char* buffer, size_t width, size_t height, int rdepth,
 	my_buffer(buffer),
 	my_width(width),
 	my_height(height),
+	my_viewport({-1.0, 1.0, -1.0, 1.0}),
+	my_format(RGB8),
+	aa_samples(1),
+	aa_threshold(1.0),
+	aa_pixels(0),
+	screen_candidates(1),
+	screen_thresholds(default_probe_thresholds()),
+	screen_stats(),
+	tune_profile(default_tuning_profile()),
+	stream_stores(true),
+	surrogate_degree(0),
+	surrogate_tolerance(0),
+	approximated(0),
+	task_nodes(DEFAULT_TASK_NODES),
+	fixed_point(false),
+	flush_denormals(true),
+	cost_model(machine_cost_model()),
 	rdepth(rdepth), 
 	gdepth(gdepth), 
-	bdepth(bdepth)
+	bdepth(bdepth),
+	auto_cancel(true)
 {
 	if(buffer == nullptr)
 		throw std::domain_error("ERROR : Buffer is empty.");
@@ -45,6 +100,24 @@ Martist::Martist(unsigned char* buffer, size_t width, size_t height, int rdepth,
 
 	if(rdepth < 0 || gdepth < 0 || bdepth < 0)
 		throw std::domain_error("ERROR : Depth of expressions can't be negative.");
+
+	//A profile of another machine is ignored : the default strategy renders the same images
+	try{
+		tuning(machine_tuning_profile());
+	}catch(std::domain_error&){
+	}
+}
+
+
+
+
+/******************************************************************************************************************************
+* Destructor, cancels the render in flight (the buffer may be freed right after)
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+Martist::~Martist(){
+	cancelRender();
 }
 
 
@@ -135,7 +208,7 @@ void Martist::seed(int seed){
 * Change the image buffer
 *
 * ARGUMENTS :
-*	- buffer is a "passed-in" array to be the buffer containing the image pixels 
+*	- buffer is a "passed-in" array to be the buffer containing the image pixels (width*height*bytes_per_pixel(format()) bytes)
 *	- width and height are the respective dimensions of the image (in pixels)
 **********************************************************************************************************************************/
 void Martist::changeBuffer(unsigned char* buffer, size_t width, size_t height){
@@ -154,199 +227,1328 @@ void Martist::changeBuffer(unsigned char* buffer, size_t width, size_t height){
 
 
 
-/******************************************************************************************************************************
-* Generate a new random image 
+/********************************************************************************************************************************
+* Set the part of the domain drawn in the buffer (the whole domain [-1,1]x[-1,1] by default)
+*
+* ARGUMENTS :
+*	- viewport is the rectangle of the domain mapped on the buffer, the first row being drawn at y_min
+**********************************************************************************************************************************/
+void Martist::viewport(const Viewport& viewport){
+
+	if(!(viewport.x_min < viewport.x_max) || !(viewport.y_min < viewport.y_max))
+		throw std::domain_error("ERROR : Viewport is empty.");
+
+	my_viewport = viewport;
+}
+
+
+/********************************************************************************************************************************
+* Get the part of the domain drawn in the buffer
 *
 * ARGUMENT : /
-*******************************************************************************************************************************/
-void Martist::paint(){
+**********************************************************************************************************************************/
+const Viewport& Martist::viewport() const{
+	return my_viewport;
+}
 
-	red_exp.new_exp(rdepth);
-	green_exp.new_exp(gdepth);
-	blue_exp.new_exp(bdepth);
 
-	compute_buffer();
+
+
+/********************************************************************************************************************************
+* Set the layout of the buffer (interleaved 8-bit RGB by default). The buffer must hold width*height*bytes_per_pixel(format)
+* bytes.
+*
+* ARGUMENTS :
+*	- format is the layout of the buffer
+**********************************************************************************************************************************/
+void Martist::format(PixelFormat format){
+	my_format = format;
 }
 
 
-/******************************************************************************************************************************
-* Compute the buffer with the different color expressions
+/********************************************************************************************************************************
+* Get the layout of the buffer
 *
 * ARGUMENT : /
-*******************************************************************************************************************************/
-void Martist::compute_buffer(){
+**********************************************************************************************************************************/
+PixelFormat Martist::format() const{
+	return my_format;
+}
 
-	for(float j = 0; j < my_height; j++){
-		for(float i = 0; i < my_width; i++){
 
-			size_t k = (i + j*my_width)*3;
-			double exp_value;
 
-			double x = (2*i)/(my_width-1) - 1;
-			double y = (2*j)/(my_height-1) - 1;
 
-			// RED
-			exp_value = red_exp.compute_value(x, y);
-			my_buffer[k] = simple_scaling(exp_value);
+/********************************************************************************************************************************
+* Set the adaptive supersampling. Each colour expression is evaluated with its partial derivatives ; the variation of a
+* pixel is estimated as (|df/dx|*dx + |df/dy|*dy) over its footprint, in quantization steps. The pixels whose variation is
+* above the threshold for one of the components are computed as the average of samples x samples values spread over their
+* footprint, the others with a single value.
+*
+* ARGUMENTS :
+*	- samples is the number of samples per axis of a supersampled pixel, in [1,16] (1 disables the supersampling)
+*	- threshold is the variation, in quantization steps, above which a pixel is supersampled
+**********************************************************************************************************************************/
+void Martist::antialiasing(int samples, double threshold){
 
-			// GREEN
-			exp_value = green_exp.compute_value(x, y);
-			my_buffer[k+1] = simple_scaling(exp_value);
+	if(samples < 1 || samples > MAX_SAMPLES)
+		throw std::domain_error("ERROR : Number of samples must be in [1," + std::to_string(MAX_SAMPLES) + "].");
 
-			// BLUE
-			exp_value = blue_exp.compute_value(x, y);
-			my_buffer[k+2] = simple_scaling(exp_value);
+	if(!(threshold >= 0))
+		throw std::domain_error("ERROR : Threshold can't be negative.");
 
-		}
-	}
+	aa_samples = samples;
+	aa_threshold = threshold;
 }
 
-/***************************************************************************************************************
-* Returns an unsigned char [0,255] corresponding to the scaling of the given double value
-* 
-* ARGUMENTS : 
-*	- value is the value to scale
-****************************************************************************************************************/
-unsigned char Martist::simple_scaling(double value){
-	unsigned char result;
 
-	if(value == 0.0)
-		result = 0;
-	else
-		result = 255/2 * (value + 1);
+/********************************************************************************************************************************
+* Get the number of samples per axis of the supersampled pixels
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+int Martist::antialiasingSamples() const{
+	return aa_samples;
+}
 
-	return result;
+
+/********************************************************************************************************************************
+* Get the variation above which a pixel is supersampled
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+double Martist::antialiasingThreshold() const{
+	return aa_threshold;
 }
 
 
 /********************************************************************************************************************************
-* Overloading output operator
+* Get the number of pixels supersampled by the last computation of the buffer
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t Martist::antialiasedPixels() const{
+	return aa_pixels;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set the screening of the random images. Each candidate drawn by paint is first rendered on a small probe grid; the ones whose
+* contrast, entropy or colour variance is under the thresholds are regenerated, so that the full size render is only paid for
+* promising images. If no candidate passes, the best one is kept.
 *
 * ARGUMENTS :
-*	- out is the output stream
-*	- m is an object of the class Martist
+*	- candidates is the maximum number of candidates probed per image, in [1,1000] (1 disables the screening)
+*	- thresholds are the scores a candidate must reach
 **********************************************************************************************************************************/
-ostream& operator<<(ostream &out, const Martist& m){
-    
-    out << "red = " << m.red_exp.rpn_to_infix() << std::endl;
+void Martist::screening(int candidates, const ProbeThresholds& thresholds){
 
-    out << "green = " << m.green_exp.rpn_to_infix() << std::endl;
+	if(candidates < 1 || candidates > MAX_CANDIDATES)
+		throw std::domain_error("ERROR : Number of candidates must be in [1," + std::to_string(MAX_CANDIDATES) + "].");
 
-    out << "blue = " << m.blue_exp.rpn_to_infix() << std::endl;
- 
-    return out;
+	screen_candidates = candidates;
+	screen_thresholds = thresholds;
 }
- 
 
 
 /********************************************************************************************************************************
-* Overloading input operator
+* Get the maximum number of candidates probed per random image
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+int Martist::screeningCandidates() const{
+	return screen_candidates;
+}
+
+
+/********************************************************************************************************************************
+* Get the scores a candidate must reach to be rendered
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const ProbeThresholds& Martist::screeningThresholds() const{
+	return screen_thresholds;
+}
+
+
+/********************************************************************************************************************************
+* Get the counters of the screening since the construction : candidates probed and rejected, pixels computed by the probes and
+* pixels of the full size renders avoided
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const ScreeningStats& Martist::screeningStats() const{
+	return screen_stats;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set the rendering strategy. None of them changes the images, only the time to compute them. The kernels are the ones of
+* this Martist only, the active kernels of the program (see select_kernels) are left as they are, and the MARTIST_KERNELS
+* environment variable prevails over them.
 *
 * ARGUMENTS :
-*	- in is the input stream
-*	- m is an object of the class Martist
+*	- profile is the strategy : kernels, rows of a tile in [1,4096], pixels evaluated at once in [1,4096] and threads of a
+*	  render in [0,1024] (0 for the pool of the library, one thread per core)
 **********************************************************************************************************************************/
-istream& operator>>(istream& in, Martist& m){
+void Martist::tuning(const TuningProfile& profile){
 
-	string red, green, blue;
+	if(profile.tile_rows < 1 || profile.tile_rows > MAX_TILE_ROWS)
+		throw std::domain_error("ERROR : Rows of a tile must be in [1," + std::to_string(MAX_TILE_ROWS) + "].");
 
-	if(in){
+	if(profile.batch < 1 || profile.batch > MAX_BATCH)
+		throw std::domain_error("ERROR : Pixels evaluated at once must be in [1," + std::to_string(MAX_BATCH) + "].");
 
-		// The first line to read is RED : user has to write "red= exp"
-		//Check the whitespaces before string "red"
-		while(isspace(in.peek())){
-			in.get();
-			if(in.eof() || in.peek() == '\n')
-				throw std::domain_error("ERROR : bad argument entered.");
-			continue;
-		}
-		//Check if we have "red="
-		if(in.get() != 'r')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'e')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'd')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != '=')
-			throw std::domain_error("ERROR : bad argument entered.");
-		//Get all the expressions after the '=' till the '\n'
-		std::getline(in, red); 
-		//If the string is full of whitespaces only or empty, make an expression of depth 0
-		if(std::all_of(red.begin(), red.end(), isspace) || red.empty()){
-			m.red_exp.new_exp(0);
-		}
-		else{
-			//Otherwise, make an expression with the input string
-			std::istringstream is_red(red);
-			m.red_exp.new_exp(is_red);
-		}
+	if(profile.threads > MAX_THREADS)
+		throw std::domain_error("ERROR : Threads of a render must be in [0," + std::to_string(MAX_THREADS) + "].");
+
+	if(!kernel_isa_supported(profile.isa))
+		throw std::domain_error(string("ERROR : The processor can't run the ") + kernel_isa_name(profile.isa) + " kernels.");
 
+	tune_profile = profile;
+}
 
 
-		//The second line to read is GREEN : user has to write "green= exp"
-		//Check the whitespaces before string "green"
-		while(isspace(in.peek())){
-			in.get();
-			if(in.eof() || in.peek() == '\n')
-				throw std::domain_error("ERROR : bad argument entered.");
-			continue;
-		}
-		//Check we have "green="
-		if(in.get() != 'g')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'r')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'e')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'e')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'n')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != '=')
-			throw std::domain_error("ERROR : bad argument entered.");
-		//Get all the expressions after the '=' till the '\n'
-		std::getline(in, green);
-		//If the string is full of whitespaces only or empty, make an expression of depth 0
-		if(std::all_of(green.begin(), green.end(), isspace) || green.empty()){
-			m.green_exp.new_exp(0);
-		}
-		else{
-			//Otherwise, make an expression with the input string
-			std::istringstream is_green(green);
-			m.green_exp.new_exp(is_green);
-		}
+/********************************************************************************************************************************
+* Get the rendering strategy (the profile of the machine by default, see machine_tuning_profile)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const TuningProfile& Martist::tuning() const{
+	return tune_profile;
+}
 
 
+/********************************************************************************************************************************
+* Measure the rendering strategies on this machine with expressions as deep as the ones of this Martist, then use the
+* fastest one and save it as the profile of the machine, loaded by the next Martists (see tune_rendering). It takes a few
+* seconds and doesn't touch the buffer.
+*
+* ARGUMENT : /
+*
+* RETURN : the fastest strategy
+**********************************************************************************************************************************/
+TuningProfile Martist::retune(){
 
-		//The third and last line to read is BLUE : user has to write "blue= exp"
-		//Check the whitespaces before string "blue"
-		while(isspace(in.peek())){
-			in.get();
-			if(in.eof() || in.peek() == '\n')
-				throw std::domain_error("ERROR : bad argument entered.");
-			continue;
-		}
-		//Check we have "blue="
-		if(in.get() != 'b')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'l')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'u')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != 'e')
-			throw std::domain_error("ERROR : bad argument entered.");
-		if(in.get() != '=')
-			throw std::domain_error("ERROR : bad argument entered.");
-		//Get all the expressions after the '=' till the '\n'
-		std::getline(in, blue);
-		//If the string is full of whitespaces only or empty, make an expression of depth 0
-		if(std::all_of(blue.begin(),blue.end(),isspace) || blue.empty()){
-			m.blue_exp.new_exp(0);
-		}
-		else{
-			//Otherwise, make an expression with the input string
-			std::istringstream is_blue(blue);
-			m.blue_exp.new_exp(is_blue);
+	TuningProfile profile = tune_rendering(my_width, my_height, std::max(rdepth, std::max(gdepth, bdepth)));
+
+	tuning(profile);
+	save_machine_tuning_profile(profile);
+
+	return profile;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set whether the pixels of the buffers larger than the caches (32 MB) are written with non-temporal stores : the renders
+* never read the buffer back, so its lines are sent to the memory without being read first nor evicting the expressions and
+* stacks of the evaluation from the caches. Enabled by default.
+*
+* ARGUMENTS :
+*	- stream is true to use the non-temporal stores for the large buffers
+**********************************************************************************************************************************/
+void Martist::streamingStores(bool stream){
+	stream_stores = stream;
+}
+
+
+/********************************************************************************************************************************
+* Get whether the pixels of the buffers larger than the caches are written with non-temporal stores
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+bool Martist::streamingStores() const{
+	return stream_stores;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set the Chebyshev surrogates of the smooth expressions. Before a render, each component is interpolated by a polynomial of
+* degree 4, 8, 16... in x and in y (see ChebyshevSurrogate), whose cost per pixel doesn't depend on the size of the expression.
+* The cheapest surrogate whose estimated error is small enough (a tenth of a quantization step without tolerance, half the
+* tolerance otherwise) is used if it is cheaper than the expression (see fit_surrogate). Then each pixel whose byte may differ
+* from the exact one by more than the tolerance, given the estimated error, is evaluated exactly. The error being estimated on
+* samples, a tolerance of 0 gives identical bytes in practice, not by proof. Only the 8-bit formats without supersampling use
+* the surrogates. Disabled by default.
+*
+* ARGUMENTS :
+*	- degree is the maximum degree of the surrogates, in [0,64] (0 disables them)
+*	- tolerance is the number of bytes a component computed by a surrogate may differ by, in [0,255]
+**********************************************************************************************************************************/
+void Martist::surrogates(int degree, int tolerance){
+
+	if(degree < 0 || degree > MAX_SURROGATE_DEGREE)
+		throw std::domain_error("ERROR : Degree of the surrogates must be in [0," + std::to_string(MAX_SURROGATE_DEGREE) + "].");
+
+	if(tolerance < 0 || tolerance > 255)
+		throw std::domain_error("ERROR : Tolerance of the surrogates must be in [0,255].");
+
+	surrogate_degree = degree;
+	surrogate_tolerance = tolerance;
+}
+
+
+/********************************************************************************************************************************
+* Get the maximum degree of the surrogates (0 if they are disabled)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+int Martist::surrogateDegree() const{
+	return surrogate_degree;
+}
+
+
+/********************************************************************************************************************************
+* Get the number of bytes a component computed by a surrogate may differ by
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+int Martist::surrogateTolerance() const{
+	return surrogate_tolerance;
+}
+
+
+/********************************************************************************************************************************
+* Get the number of components (three per pixel) taken from the surrogates by the last computation of the buffer
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t Martist::approximatedValues() const{
+	return approximated;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set the task-parallel evaluation of the images too small to share by tiles. When the image has fewer tiles than the threads
+* of the render and an expression is large, the tiles leave threads idle : the whole image is then evaluated at once, each
+* component as a graph of tasks whose independent operands of avg and * run in parallel (see Program::evaluate_tasks). The
+* images are the same. Only the renders without supersampling nor surrogate use the tasks. Enabled by default (1024 nodes).
+*
+* ARGUMENTS :
+*	- nodes is the smallest number of nodes of a sub-expression evaluated as a task (0 disables the task-parallel evaluation)
+**********************************************************************************************************************************/
+void Martist::taskParallel(size_t nodes){
+	task_nodes = nodes;
+}
+
+
+/********************************************************************************************************************************
+* Get the smallest number of nodes of a sub-expression evaluated as a parallel task (0 if it is disabled)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t Martist::taskParallelNodes() const{
+	return task_nodes;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set whether the renders in an 8-bit layout without supersampling evaluate the expressions in 16-bit fixed point (see
+* FixedProgram) : much less memory is moved and the sine and cosine are read from tables, for previews and thumbnails. Some
+* bytes in a hundred differ from the exact render, mostly by one (FixedProgram::accuracy measures it). The surrogates and
+* the mirrored rows aren't used. Disabled by default.
+*
+* ARGUMENTS :
+*	- fixed is true to evaluate the expressions in fixed point
+**********************************************************************************************************************************/
+void Martist::fixedPoint(bool fixed){
+	fixed_point = fixed;
+}
+
+
+/********************************************************************************************************************************
+* Get whether the 8-bit renders evaluate the expressions in fixed point
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+bool Martist::fixedPoint() const{
+	return fixed_point;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set whether the renders flush the subnormal values to 0 : every thread of a render computes with flush-to-zero and
+* denormals-are-zero, its floating-point control being restored after (see DenormalFlush). The deep products of small values
+* otherwise fall below 2^-1022 near the axes (see subnormalProne), where each operation is a hundred times slower. Only the
+* pixels whose value is itself subnormal change, becoming black as the pixels of value 0. Enabled by default.
+*
+* ARGUMENTS :
+*	- flush is true to flush the subnormal values to 0
+**********************************************************************************************************************************/
+void Martist::flushDenormals(bool flush){
+	flush_denormals = flush;
+}
+
+
+/********************************************************************************************************************************
+* Get whether the renders flush the subnormal values to 0
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+bool Martist::flushDenormals() const{
+	return flush_denormals;
+}
+
+
+/********************************************************************************************************************************
+* Get whether the colour expressions may fall below 2^-1022 on the pixels of the buffer (see Program::subnormal_prone) : their
+* renders are then much slower without flushDenormals.
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+bool Martist::subnormalProne() const{
+
+	// Smallest non-zero |x| and |y| of the grid : half a step when it crosses 0
+	const double step_x = (my_viewport.x_max - my_viewport.x_min) / (my_width > 1 ? my_width - 1 : 1);
+	const double step_y = (my_viewport.y_max - my_viewport.y_min) / (my_height > 1 ? my_height - 1 : 1);
+	const double small_x = (my_viewport.x_min <= 0 && my_viewport.x_max >= 0) ? step_x/2 :
+		std::min(std::abs(my_viewport.x_min), std::abs(my_viewport.x_max));
+	const double small_y = (my_viewport.y_min <= 0 && my_viewport.y_max >= 0) ? step_y/2 :
+		std::min(std::abs(my_viewport.y_min), std::abs(my_viewport.y_max));
+	const double smallest = std::min(small_x, small_y);
+
+	return red_exp.compiled().subnormal_prone(smallest) || green_exp.compiled().subnormal_prone(smallest)
+		|| blue_exp.compiled().subnormal_prone(smallest);
+}
+
+
+
+
+/********************************************************************************************************************************
+* Set the costs of the opcodes used by estimate (see CostModel)
+*
+* ARGUMENTS :
+*	- model is the cost model, in nanoseconds per pixel
+**********************************************************************************************************************************/
+void Martist::costModel(const CostModel& model){
+
+	if(!(model.pixel >= 0.0))
+		throw std::domain_error("ERROR : Costs can't be negative.");
+	for(int op = 0; op < OPCODES; op++)
+		if(!(model.opcodes[op] >= 0.0))
+			throw std::domain_error("ERROR : Costs can't be negative.");
+
+	cost_model = model;
+}
+
+
+/********************************************************************************************************************************
+* Get the costs of the opcodes used by estimate (the cost model of the machine by default, see machine_cost_model)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const CostModel& Martist::costModel() const{
+	return cost_model;
+}
+
+
+/********************************************************************************************************************************
+* Calibrate the cost model on this machine (see calibrate_cost_model), then use it and save it as the cost model of the
+* machine, loaded by the next Martists. It takes a few seconds and doesn't touch the buffer.
+*
+* ARGUMENT : /
+*
+* RETURN : the cost model
+**********************************************************************************************************************************/
+CostModel Martist::recalibrate(){
+
+	CostModel model = calibrate_cost_model(my_width, my_height);
+
+	costModel(model);
+	save_machine_cost_model(model);
+
+	return model;
+}
+
+
+/********************************************************************************************************************************
+* Predict the time of a draw of the expressions with the current settings, without rendering them : the opcodes of each type
+* of the three components times their cost (see costModel), plus the cost of a pixel. A component mirrored in x evaluates half
+* of each row, one mirrored in y half of the rows (see compute_rows), which the estimate counts. The estimate assumes the
+* strategy the costs were calibrated with (the profile of the machine), and doesn't count the supersampled pixels, the
+* surrogates nor the fixed point.
+*
+* ARGUMENTS :
+*	- red, green and blue are the colour expressions
+*
+* RETURN : the time per pixel and of the whole draw
+**********************************************************************************************************************************/
+RenderEstimate Martist::estimate(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue) const{
+
+	const ColorExpression* expressions[3] = {&red, &green, &blue};
+
+	// The same mirrors as frame()
+	const bool fixed = fixed_point && aa_samples == 1 && my_format != RGB16 && my_format != RGB_FLOAT32;
+	const bool mirrors = aa_samples == 1 && my_format != RGB_FLOAT32 && !fixed;
+
+	Parity x_mirror[3], y_mirror[3];
+	bool mirror_rows = false;
+	for(int c = 0; c < 3; c++){
+		const ProgramInfo& info = expressions[c]->compiled().info();
+		x_mirror[c] = (mirrors && my_viewport.x_min == -my_viewport.x_max) ? info.x_parity : PARITY_NONE;
+		y_mirror[c] = (mirrors && my_viewport.y_min == -my_viewport.y_max) ? info.y_parity : PARITY_NONE;
+		if(y_mirror[c] != PARITY_NONE && my_height > 1)
+			mirror_rows = true;
+	}
+
+	double nanoseconds = cost_model.pixel;
+	for(int c = 0; c < 3; c++){
+		const double columns = (x_mirror[c] != PARITY_NONE) ? double((my_width + 1)/2)/my_width : 1.0;
+		const double rows = (mirror_rows && y_mirror[c] != PARITY_NONE) ? double((my_height + 1)/2)/my_height : 1.0;
+		nanoseconds += columns*rows*program_nanoseconds(cost_model, expressions[c]->compiled());
+	}
+
+	RenderEstimate estimate = {nanoseconds, nanoseconds*1e-9*my_width*my_height};
+
+	return estimate;
+}
+
+
+
+
+/******************************************************************************************************************************
+* Generate the random colour expressions, screened on the probe grid if enabled
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+void Martist::new_expressions(){
+
+	auto generate = [this](ColorExpression& red, ColorExpression& green, ColorExpression& blue){
+		red.new_exp(rdepth);
+		green.new_exp(gdepth);
+		blue.new_exp(bdepth);
+	};
+
+	if(screen_candidates <= 1)
+		generate(red_exp, green_exp, blue_exp);
+	else
+		screen(generate, screen_candidates, screen_thresholds, my_viewport, my_width*my_height, red_exp, green_exp, blue_exp,
+			screen_stats);
+}
+
+
+/******************************************************************************************************************************
+* Generate a new random image 
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+void Martist::paint(){
+
+	new_expressions();
+
+	compute_buffer();
+}
+
+
+/******************************************************************************************************************************
+* Draw the given colour expressions in the buffer
+*
+* ARGUMENTS :
+*	- red, green and blue are the expressions of the colour components
+*******************************************************************************************************************************/
+void Martist::draw(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue){
+
+	red_exp = red;
+	green_exp = green;
+	blue_exp = blue;
+
+	rdepth = red_exp.calculate_depth();
+	gdepth = green_exp.calculate_depth();
+	bdepth = blue_exp.calculate_depth();
+
+	compute_buffer();
+}
+
+
+/******************************************************************************************************************************
+* Generate a new random image in the background
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+RenderHandle Martist::paintAsync(){
+
+	new_expressions();
+
+	return start_render();
+}
+
+
+/******************************************************************************************************************************
+* Draw the given colour expressions in the background
+*
+* ARGUMENTS :
+*	- red, green and blue are the expressions of the colour components
+*******************************************************************************************************************************/
+RenderHandle Martist::drawAsync(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue){
+
+	red_exp = red;
+	green_exp = green;
+	blue_exp = blue;
+
+	rdepth = red_exp.calculate_depth();
+	gdepth = green_exp.calculate_depth();
+	bdepth = blue_exp.calculate_depth();
+
+	return start_render();
+}
+
+
+/******************************************************************************************************************************
+* Set whether starting a render cancels the one in flight (the default), or waits for it to finish first
+*
+* ARGUMENTS :
+*	- cancel is true to cancel the render in flight
+*******************************************************************************************************************************/
+void Martist::autoCancel(bool cancel){
+	auto_cancel = cancel;
+}
+
+
+/******************************************************************************************************************************
+* Get whether starting a render cancels the one in flight
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+bool Martist::autoCancel() const{
+	return auto_cancel;
+}
+
+
+/******************************************************************************************************************************
+* Cancel the render in flight and wait for it to stop
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+void Martist::cancelRender(){
+
+	if(!in_flight.state)
+		return;
+
+	in_flight.cancel();
+	in_flight.state->result.wait();
+	in_flight = RenderHandle();
+}
+
+
+
+/******************************************************************************************************************************
+* Copy of everything needed to compute the buffer, so that a render goes on while the settings of the Martist change
+*******************************************************************************************************************************/
+struct Martist::Frame
+{
+	unsigned char* my_buffer;
+	size_t my_width;
+	size_t my_height;
+	Viewport my_viewport;
+	PixelFormat my_format;
+	int aa_samples;
+	double aa_threshold;
+	size_t tile_rows;
+	size_t batch;
+	size_t threads;
+	bool streaming;
+	int surrogate_degree;
+	int surrogate_tolerance;
+	size_t task_nodes;
+	bool fixed_point; //The expressions are evaluated in fixed point (8-bit layouts without supersampling only)
+	bool flush_denormals; //The threads of the render flush the subnormal values to 0
+	const Kernels* kernel; //Kernels of the render : the ones of the profile, or of the MARTIST_KERNELS environment variable
+	Parity x_mirror[3]; //Symmetry in x of each component, to evaluate half of its rows (PARITY_NONE to evaluate them whole)
+	Parity y_mirror[3]; //Symmetry in y of each component, to copy its lower rows from the upper ones
+	bool mirror_rows; //The tiles cover the upper rows only, each of them computing its mirror row too
+	ColorExpression red_exp;
+	ColorExpression green_exp;
+	ColorExpression blue_exp;
+
+	size_t rows() const; //Number of rows covered by the tiles
+	size_t tiles() const; //Number of tiles of the buffer
+	size_t compute(const std::atomic<bool>* cancel, std::atomic<size_t>* done, size_t* approximated = nullptr) const; //Compute all the tiles in parallel
+	size_t compute_rows(size_t first, size_t last, const ChebyshevSurrogate* const surrogates[3], size_t& approximated) const; //Compute the rows [first, last) of the buffer
+	void compute_tasks(ThreadPool& pool) const; //Compute the whole buffer at once, the expressions being evaluated as graphs of tasks
+	void compute_fixed_rows(size_t first, size_t last, const FixedProgram programs[3]) const; //Compute the rows [first, last) in fixed point
+};
+
+
+
+/******************************************************************************************************************************
+* Returns the frame to compute with the current settings
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+std::shared_ptr<const Martist::Frame> Martist::frame() const{
+
+	std::shared_ptr<Frame> f = std::make_shared<Frame>();
+
+	f->my_buffer = my_buffer;
+	f->my_width = my_width;
+	f->my_height = my_height;
+	f->my_viewport = my_viewport;
+	f->my_format = my_format;
+	f->aa_samples = aa_samples;
+	f->aa_threshold = aa_threshold;
+	f->tile_rows = tune_profile.tile_rows;
+	f->batch = tune_profile.batch;
+	f->threads = tune_profile.threads;
+	f->streaming = stream_stores && my_width*my_height*bytes_per_pixel(my_format) >= STREAMING_BYTES;
+	f->surrogate_degree = surrogate_degree;
+	f->surrogate_tolerance = surrogate_tolerance;
+	f->task_nodes = task_nodes;
+	f->flush_denormals = flush_denormals;
+	f->kernel = &kernels(profile_kernel_isa(tune_profile));
+	f->fixed_point = fixed_point && aa_samples == 1 && my_format != RGB16 && my_format != RGB_FLOAT32;
+	f->red_exp = red_exp;
+	f->green_exp = green_exp;
+	f->blue_exp = blue_exp;
+
+	// The grid is symmetric about 0 when the viewport is centred. The supersamples would be summed in another order, and the
+	// floats would keep the sign of the zeros, so both evaluate every pixel (as the fixed point, which has its own path).
+	const bool mirrors = aa_samples == 1 && my_format != RGB_FLOAT32 && !f->fixed_point;
+	const ColorExpression* expressions[3] = {&f->red_exp, &f->green_exp, &f->blue_exp};
+
+	f->mirror_rows = false;
+	for(int c = 0; c < 3; c++){
+		const ProgramInfo& info = expressions[c]->compiled().info();
+		f->x_mirror[c] = (mirrors && my_viewport.x_min == -my_viewport.x_max) ? info.x_parity : PARITY_NONE;
+		f->y_mirror[c] = (mirrors && my_viewport.y_min == -my_viewport.y_max) ? info.y_parity : PARITY_NONE;
+		if(f->y_mirror[c] != PARITY_NONE && my_height > 1)
+			f->mirror_rows = true;
+	}
+
+	return f;
+}
+
+
+/******************************************************************************************************************************
+* Compute the buffer in the background. The render in flight is cancelled first, or waited for if autoCancel is off, so that
+* two renders never write the buffer at the same time.
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+RenderHandle Martist::start_render(){
+
+	RenderHandle previous = in_flight;
+	if(auto_cancel)
+		cancelRender();
+
+	std::shared_ptr<const Frame> f = frame();
+
+	RenderHandle handle;
+	handle.state = std::make_shared<RenderHandle::State>();
+	handle.state->done = 0;
+	handle.state->tiles = f->tiles();
+	handle.state->cancelled = false;
+
+	std::shared_ptr<RenderHandle::State> state = handle.state;
+
+	handle.state->result = std::async(std::launch::async, [f, state, previous]{
+
+		if(previous.state)
+			previous.state->result.wait();
+
+		f->compute(&state->cancelled, &state->done);
+
+		return !state->cancelled;
+
+	}).share();
+
+	in_flight = handle;
+
+	return handle;
+}
+
+
+/******************************************************************************************************************************
+* Compute the buffer with the different color expressions
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+void Martist::compute_buffer(){
+
+	//The render in flight would write the same buffer
+	cancelRender();
+
+	aa_pixels = frame()->compute(nullptr, nullptr, &approximated);
+}
+
+
+/******************************************************************************************************************************
+* Number of rows covered by the tiles : the upper half (middle row included) if the rows are mirrored, all of them otherwise
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+size_t Martist::Frame::rows() const{
+	return mirror_rows ? (my_height + 1)/2 : my_height;
+}
+
+
+/******************************************************************************************************************************
+* Number of tiles of the buffer : bands of tile_rows rows
+*
+* ARGUMENT : /
+*******************************************************************************************************************************/
+size_t Martist::Frame::tiles() const{
+	return (rows() + tile_rows - 1) / tile_rows;
+}
+
+
+/******************************************************************************************************************************
+* Compute all the tiles in parallel on the thread pool of the library with the chosen number of threads. The cancellation is
+* checked before each tile. The surrogates of the components, if enabled, are fitted first (see surrogates()). All the
+* threads flush the subnormal values to 0 if enabled (see flushDenormals()).
+*
+* ARGUMENTS :
+*	- cancel is the cancellation flag (nullptr if the computation can't be cancelled)
+*	- done is incremented after each tile (nullptr if the progress is not followed)
+*	- approximated receives the number of components taken from the surrogates (nullptr if they are not counted)
+*
+* RETURN : the number of supersampled pixels
+*******************************************************************************************************************************/
+size_t Martist::Frame::compute(const std::atomic<bool>* cancel, std::atomic<size_t>* done, size_t* approximated) const{
+
+	// The threads of the pool take the floating-point control of this one for the tasks of the render
+	DenormalFlush flush(flush_denormals);
+
+	ChebyshevSurrogate fits[3];
+	const ChebyshevSurrogate* surrogates[3] = {nullptr, nullptr, nullptr};
+
+	if(surrogate_degree > 0 && aa_samples == 1 && my_format != RGB16 && my_format != RGB_FLOAT32 && !fixed_point){
+
+		const ColorExpression* expressions[3] = {&red_exp, &green_exp, &blue_exp};
+
+		for(int c = 0; c < 3; c++){
+			if(fit_surrogate(expressions[c]->compiled(), my_viewport, surrogate_degree, surrogate_tolerance, my_width*my_height, fits[c],
+				*kernel))
+				surrogates[c] = &fits[c];
+		}
+	}
+
+	ThreadPool& pool = ThreadPool::sized(threads);
+
+	if(fixed_point){
+
+		const double x_bound = std::max(std::abs(my_viewport.x_min), std::abs(my_viewport.x_max));
+		const double y_bound = std::max(std::abs(my_viewport.y_min), std::abs(my_viewport.y_max));
+		const FixedProgram programs[3] = {FixedProgram(red_exp.compiled(), x_bound, y_bound),
+			FixedProgram(green_exp.compiled(), x_bound, y_bound), FixedProgram(blue_exp.compiled(), x_bound, y_bound)};
+
+		pool.run(tiles(), [&](size_t tile){
+
+			if(cancel != nullptr && *cancel)
+				return;
+
+			compute_fixed_rows(tile*tile_rows, std::min(rows(), (tile+1)*tile_rows), programs);
+
+			if(done != nullptr)
+				(*done)++;
+		});
+
+		if(approximated != nullptr)
+			*approximated = 0;
+
+		return 0;
+	}
+
+	// An image with fewer tiles than threads leaves them idle : a large expression is evaluated as a graph of tasks instead
+	if(task_nodes > 0 && aa_samples == 1 && !surrogates[0] && !surrogates[1] && !surrogates[2] && tiles() < pool.size()){
+
+		const size_t nodes = std::max(red_exp.compiled().info().nodes,
+			std::max(green_exp.compiled().info().nodes, blue_exp.compiled().info().nodes));
+
+		if(nodes >= 2*task_nodes){
+
+			if(cancel == nullptr || !*cancel)
+				compute_tasks(pool);
+
+			if(done != nullptr)
+				*done += tiles();
+			if(approximated != nullptr)
+				*approximated = 0;
+
+			return 0;
+		}
+	}
+
+	std::atomic<size_t> refined(0);
+	std::atomic<size_t> approximations(0);
+
+	pool.run(tiles(), [&](size_t tile){
+
+		if(cancel != nullptr && *cancel)
+			return;
+
+		size_t tile_approximations = 0;
+		refined += compute_rows(tile*tile_rows, std::min(rows(), (tile+1)*tile_rows), surrogates, tile_approximations);
+		approximations += tile_approximations;
+
+		if(done != nullptr)
+			(*done)++;
+	});
+
+	if(approximated != nullptr)
+		*approximated = approximations;
+
+	return refined;
+}
+
+
+/******************************************************************************************************************************
+* Compute the rows [first, last) of the buffer, and their mirror rows if the rows are mirrored. The pixels of a row are
+* evaluated by batches, and each batch is written straight in the layout of the buffer. With the adaptive supersampling, the
+* batch is evaluated with the partial derivatives first, then the pixels varying too much are evaluated again with several
+* samples (see antialiasing()). The components with a surrogate are computed by it, except the pixels whose byte it can't
+* guarantee, evaluated exactly (see surrogates()).
+*
+* The other components are mirrored when their expression is even or odd (see ProgramInfo) : the grid being symmetric about
+* 0, the right half of a row is then the copy or the negation of the left half, and a mirror row the copy or the negation of
+* its row, bit for bit but for the sign of zeros. A component even or odd in x and in y is evaluated on a quarter of the grid.
+* The values are negated before the quantization, so the bytes are the ones of the full evaluation.
+*
+* ARGUMENTS :
+*	- first and last are the rows to compute
+*	- surrogates are the surrogates of the red, green and blue components (nullptr for the ones evaluated exactly)
+*	- approximated is increased by the number of components taken from the surrogates
+*
+* RETURN : the number of supersampled pixels
+*******************************************************************************************************************************/
+size_t Martist::Frame::compute_rows(size_t first, size_t last, const ChebyshevSurrogate* const surrogates[3],
+	size_t& approximated) const{
+
+	// Distance between two samples of the grid, i.e. the footprint of a pixel
+	const double step_x = (my_viewport.x_max - my_viewport.x_min) / (my_width > 1 ? my_width - 1 : 1);
+	const double step_y = (my_viewport.y_max - my_viewport.y_min) / (my_height > 1 ? my_height - 1 : 1);
+
+	const Program* programs[3] = {&red_exp.compiled(), &green_exp.compiled(), &blue_exp.compiled()};
+	const int samples = aa_samples;
+	const int count = samples*samples;
+	size_t refined = 0;
+
+	vector<double> t(my_width), x(my_width);
+	for(size_t i = 0; i < my_width; i++){
+		t[i] = grid_coordinate(i, my_width);
+		x[i] = viewport_x(my_viewport, t[i]);
+	}
+
+	vector<double> y(batch), dx(batch), dy(batch);
+	vector<double> values[3] = {vector<double>(batch), vector<double>(batch), vector<double>(batch)};
+	double sub_x[MAX_SAMPLES*MAX_SAMPLES], sub_y[MAX_SAMPLES*MAX_SAMPLES], sub_values[MAX_SAMPLES*MAX_SAMPLES];
+	vector<char> refine(batch);
+
+	// The components with a surrogate or mirrored are computed a whole row at a time, the others by batches
+	Parity x_parity[3], y_parity[3];
+	bool whole_rows[3], any_whole_row = false;
+	for(int c = 0; c < 3; c++){
+		x_parity[c] = (surrogates[c] == nullptr) ? x_mirror[c] : PARITY_NONE;
+		y_parity[c] = (surrogates[c] == nullptr && mirror_rows) ? y_mirror[c] : PARITY_NONE;
+		whole_rows[c] = surrogates[c] != nullptr || x_parity[c] != PARITY_NONE || y_parity[c] != PARITY_NONE;
+		any_whole_row = any_whole_row || whole_rows[c];
+	}
+
+	// Values of a row of these components, and the pixels of the row a surrogate can't guarantee
+	vector<double> row_coefficients[3], row_values[3];
+	for(int c = 0; c < 3; c++){
+		if(surrogates[c] != nullptr)
+			row_coefficients[c].resize(surrogates[c]->degree() + 1);
+		if(whole_rows[c])
+			row_values[c].resize(my_width);
+	}
+	vector<size_t> uncertain(surrogates[0] || surrogates[1] || surrogates[2] ? my_width : 0);
+	vector<double> exact_x(uncertain.size()), exact_values(uncertain.size());
+	vector<double> row_y(any_whole_row ? my_width : 0);
+
+	// With the streaming stores, each row is written in a buffer of one row, then streamed to the image at once
+	vector<unsigned char> row(streaming ? my_width*bytes_per_pixel(my_format) : 0);
+
+	// Compute the row j, the mirror of the row computed just before if mirrored
+	auto compute_row = [&](size_t j, bool mirrored){
+
+		const double ty = grid_coordinate(j, my_height);
+		std::fill(y.begin(), y.end(), viewport_y(my_viewport, ty));
+		std::fill(row_y.begin(), row_y.end(), viewport_y(my_viewport, ty));
+
+		for(int c = 0; c < 3; c++){
+
+			if(!whole_rows[c])
+				continue;
+
+			double* v = row_values[c].data();
+
+			if(mirrored && y_parity[c] != PARITY_NONE){
+				if(y_parity[c] == PARITY_ODD)
+					for(size_t i = 0; i < my_width; i++)
+						v[i] = -v[i];
+				continue;
+			}
+
+			if(surrogates[c] == nullptr){
+
+				const size_t half = (x_parity[c] != PARITY_NONE) ? (my_width + 1)/2 : my_width;
+				programs[c]->evaluate(x.data(), row_y.data(), half, v, *kernel);
+
+				for(size_t i = half; i < my_width; i++)
+					v[i] = (x_parity[c] == PARITY_ODD) ? -v[my_width - 1 - i] : v[my_width - 1 - i];
+				continue;
+			}
+
+			// The pixels the surrogate can't guarantee are gathered over the whole row, to be evaluated exactly at once
+			surrogates[c]->row(ty, row_coefficients[c].data());
+			surrogates[c]->evaluate_row(row_coefficients[c].data(), t.data(), my_width, v, *kernel);
+
+			size_t m = 0;
+			for(size_t i = 0; i < my_width; i++){
+				if(!surrogate_byte_certain(v[i], surrogates[c]->error(), surrogate_tolerance)){
+					uncertain[m] = i;
+					exact_x[m++] = x[i];
+				}
+			}
+			approximated += my_width - m;
+
+			programs[c]->evaluate(exact_x.data(), row_y.data(), m, exact_values.data(), *kernel);
+			for(size_t k = 0; k < m; k++)
+				v[uncertain[k]] = exact_values[k];
+		}
+
+		for(size_t i = 0; i < my_width; i += batch){
+
+			size_t n = std::min(batch, my_width - i);
+
+			if(samples == 1){
+				for(int c = 0; c < 3; c++){
+					if(whole_rows[c])
+						std::copy(&row_values[c][i], &row_values[c][i] + n, values[c].begin());
+					else
+						programs[c]->evaluate(&x[i], y.data(), n, values[c].data(), *kernel);
+				}
+			}
+			else{
+				std::fill(refine.begin(), refine.begin() + n, false);
+
+				// Variation of each component over the footprint, in quantization steps
+				for(int c = 0; c < 3; c++){
+					programs[c]->evaluate_gradient(&x[i], y.data(), n, values[c].data(), dx.data(), dy.data(), *kernel);
+					for(size_t k = 0; k < n; k++){
+						if((std::abs(dx[k])*step_x + std::abs(dy[k])*step_y) * (255/2) > aa_threshold)
+							refine[k] = true;
+					}
+				}
+
+				for(size_t k = 0; k < n; k++){
+
+					if(!refine[k])
+						continue;
+					refined++;
+
+					for(int a = 0; a < samples; a++){
+						for(int b = 0; b < samples; b++){
+							sub_x[a*samples + b] = x[i+k] + step_x*((b + 0.5)/samples - 0.5);
+							sub_y[a*samples + b] = y[k] + step_y*((a + 0.5)/samples - 0.5);
+						}
+					}
+
+					for(int c = 0; c < 3; c++){
+						programs[c]->evaluate(sub_x, sub_y, count, sub_values, *kernel);
+						double sum = 0;
+						for(int s = 0; s < count; s++)
+							sum += sub_values[s];
+						values[c][k] = sum / count;
+					}
+				}
+			}
+
+			if(streaming)
+				store_pixels(my_format, values[0].data(), values[1].data(), values[2].data(), n, row.data(), my_width, 1, i, 0, *kernel);
+			else
+				store_pixels(my_format, values[0].data(), values[1].data(), values[2].data(), n, my_buffer, my_width, my_height, i, j, *kernel);
+		}
+
+		if(streaming)
+			stream_row(my_format, row.data(), my_buffer, my_width, my_height, j);
+	};
+
+	for(size_t j = first; j < last; j++){
+
+		compute_row(j, false);
+
+		if(mirror_rows && my_height - 1 - j != j)
+			compute_row(my_height - 1 - j, true);
+	}
+
+	if(streaming)
+		stream_fence();
+
+	return refined;
+}
+
+/******************************************************************************************************************************
+* Compute the rows [first, last) of the buffer in fixed point : each component of a row is evaluated and quantized at once
+* (see FixedProgram), then the row is written in the layout of the buffer.
+*
+* ARGUMENTS :
+*	- first and last are the rows to compute
+*	- programs are the red, green and blue expressions compiled for the viewport
+*******************************************************************************************************************************/
+void Martist::Frame::compute_fixed_rows(size_t first, size_t last, const FixedProgram programs[3]) const{
+
+	vector<double> x(my_width), y(my_width);
+	for(size_t i = 0; i < my_width; i++)
+		x[i] = viewport_x(my_viewport, grid_coordinate(i, my_width));
+
+	vector<unsigned char> bytes[3] = {vector<unsigned char>(my_width), vector<unsigned char>(my_width), vector<unsigned char>(my_width)};
+	vector<unsigned char> row(streaming ? my_width*bytes_per_pixel(my_format) : 0);
+
+	for(size_t j = first; j < last; j++){
+
+		std::fill(y.begin(), y.end(), viewport_y(my_viewport, grid_coordinate(j, my_height)));
+
+		for(int c = 0; c < 3; c++)
+			programs[c].evaluate(x.data(), y.data(), my_width, bytes[c].data(), *kernel);
+
+		if(streaming){
+			store_bytes(my_format, bytes[0].data(), bytes[1].data(), bytes[2].data(), my_width, row.data(), my_width, 1, 0, 0);
+			stream_row(my_format, row.data(), my_buffer, my_width, my_height, j);
+		}
+		else
+			store_bytes(my_format, bytes[0].data(), bytes[1].data(), bytes[2].data(), my_width, my_buffer, my_width, my_height, 0, j);
+	}
+
+	if(streaming)
+		stream_fence();
+}
+
+
+/******************************************************************************************************************************
+* Compute the whole buffer at once : each component is evaluated over all the pixels as a graph of tasks (see
+* Program::evaluate_tasks), then the rows are written in the layout of the buffer.
+*
+* ARGUMENTS :
+*	- pool is the thread pool of the render
+*******************************************************************************************************************************/
+void Martist::Frame::compute_tasks(ThreadPool& pool) const{
+
+	const size_t n = my_width*my_height;
+
+	vector<double> x(n), y(n);
+	viewport_grid(my_viewport, my_width, my_height, x.data(), y.data());
+
+	const Program* programs[3] = {&red_exp.compiled(), &green_exp.compiled(), &blue_exp.compiled()};
+	vector<double> values[3] = {vector<double>(n), vector<double>(n), vector<double>(n)};
+
+	for(int c = 0; c < 3; c++)
+		programs[c]->evaluate_tasks(x.data(), y.data(), n, values[c].data(), pool, task_nodes, *kernel);
+
+	for(size_t j = 0; j < my_height; j++){
+		const size_t row = j*my_width;
+		store_pixels(my_format, &values[0][row], &values[1][row], &values[2][row], my_width, my_buffer, my_width, my_height, 0, j, *kernel);
+	}
+}
+
+/***************************************************************************************************************
+* Returns the position in [-1,1] of the i-th of n samples. The grid is exactly symmetric about 0 : the sample n-1-i
+* is the exact negation of the sample i.
+* 
+* ARGUMENTS : 
+*	- i is the index of the sample
+*	- n is the number of samples
+****************************************************************************************************************/
+double grid_coordinate(size_t i, size_t n){
+
+	if(n < 2)
+		return 0.0;
+
+	return (2.0*i - (double)(n-1)) / (double)(n-1);
+}
+
+/***************************************************************************************************************
+* Returns the abscissa of the viewport at the position t in [-1,1] : x_min for -1, x_max for 1
+* 
+* ARGUMENTS : 
+*	- viewport is the part of the domain drawn
+*	- t is the position (see grid_coordinate)
+****************************************************************************************************************/
+double viewport_x(const Viewport& viewport, double t){
+	return (viewport.x_min + viewport.x_max)/2 + (viewport.x_max - viewport.x_min)/2*t;
+}
+
+/***************************************************************************************************************
+* Returns the ordinate of the viewport at the position t in [-1,1] : y_min for -1, y_max for 1
+* 
+* ARGUMENTS : 
+*	- viewport is the part of the domain drawn
+*	- t is the position (see grid_coordinate)
+****************************************************************************************************************/
+double viewport_y(const Viewport& viewport, double t){
+	return (viewport.y_min + viewport.y_max)/2 + (viewport.y_max - viewport.y_min)/2*t;
+}
+
+/***************************************************************************************************************
+* Computes the coordinates of the pixels of a buffer showing the viewport, row after row : the pixel (i,j) is the
+* point (viewport_x(grid_coordinate(i, width)), viewport_y(grid_coordinate(j, height))), as in every render
+* 
+* ARGUMENTS : 
+*	- viewport is the part of the domain drawn
+*	- width and height are the dimensions of the buffer (in pixels)
+*	- x and y receive the width*height coordinates
+****************************************************************************************************************/
+void viewport_grid(const Viewport& viewport, size_t width, size_t height, double* x, double* y){
+
+	for(size_t i = 0; i < width; i++)
+		x[i] = viewport_x(viewport, grid_coordinate(i, width));
+
+	for(size_t j = 0; j < height; j++){
+		std::copy(x, x + width, x + j*width);
+		std::fill(y + j*width, y + (j+1)*width, viewport_y(viewport, grid_coordinate(j, height)));
+	}
+}
+
+
+/********************************************************************************************************************************
+* Constructor of a handle without render
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+RenderHandle::RenderHandle(){}
+
+
+/********************************************************************************************************************************
+* Wait for the end of the render
+*
+* ARGUMENT : /
+*
+* RETURN : true if the render finished, false if it was cancelled (the errors of the render are rethrown)
+**********************************************************************************************************************************/
+bool RenderHandle::wait() const{
+
+	if(!state)
+		return false;
+
+	return state->result.get();
+}
+
+
+/********************************************************************************************************************************
+* The render is over (finished or cancelled)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+bool RenderHandle::ready() const{
+	return !state || state->result.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+
+/********************************************************************************************************************************
+* Future of the result of wait()
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+std::shared_future<bool> RenderHandle::future() const{
+
+	if(!state)
+		throw std::domain_error("ERROR : No render.");
+
+	return state->result;
+}
+
+
+/********************************************************************************************************************************
+* Number of tiles already computed (read without any lock)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t RenderHandle::progress() const{
+	return state ? state->done.load() : 0;
+}
+
+
+/********************************************************************************************************************************
+* Total number of tiles
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t RenderHandle::tiles() const{
+	return state ? state->tiles : 0;
+}
+
+
+/********************************************************************************************************************************
+* Ask the render to stop : the tiles being computed are finished, the others are skipped
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+void RenderHandle::cancel(){
+	if(state)
+		state->cancelled = true;
+}
+
+
+
+
+/********************************************************************************************************************************
+* Overloading output operator
+*
+* ARGUMENTS :
+*	- out is the output stream
+*	- m is an object of the class Martist
+**********************************************************************************************************************************/
+ostream& operator<<(ostream &out, const Martist& m){
+    
+    out << "red = ";
+    m.red_exp.write_infix(out);
+    out << std::endl;
+
+    out << "green = ";
+    m.green_exp.write_infix(out);
+    out << std::endl;
+
+    out << "blue = ";
+    m.blue_exp.write_infix(out);
+    out << std::endl;
+ 
+    return out;
+}
+ 
+
+
+/********************************************************************************************************************************
+* Overloading input operator
+*
+* ARGUMENTS :
+*	- in is the input stream
+*	- m is an object of the class Martist
+**********************************************************************************************************************************/
+istream& operator>>(istream& in, Martist& m){
+
+	const char* names[3] = {"red", "green", "blue"};
+	ColorExpression* exps[3] = {&m.red_exp, &m.green_exp, &m.blue_exp};
+	string line;
+
+	if(in){
+
+		// The lines to read are RED, GREEN and BLUE : user has to write "red= exp", "green= exp" and "blue= exp"
+		for(int i = 0; i < 3; i++){
+
+			//Check the whitespaces before the name of the colour
+			while(isspace(in.peek())){
+				in.get();
+				if(in.eof() || in.peek() == '\n')
+					throw std::domain_error("ERROR : bad argument entered.");
+				continue;
+			}
+
+			//Get the whole line and make the expression written after "name="
+			std::getline(in, line);
+			read_channel(line.data(), line.data() + line.size(), names[i], *exps[i]);
 		}
 
 		//Calculate the depths of the new expressions
@@ -2,9 +2,63 @@
 #define GUARD_martist_h
 
 #include "colorExpression.hpp"
+#include "pixelFormat.hpp"
+#include "probe.hpp"
+#include "tuner.hpp"
+#include "costModel.hpp"
 
 #include <string>
 #include <iostream>
+#include <memory>
+#include <future>
+
+
+struct Viewport // Part of the expression domain drawn in the buffer
+{
+	double x_min;
+	double x_max;
+	double y_min;
+	double y_max;
+};
+
+
+double grid_coordinate(size_t i, size_t n); // Position in [-1,1] of the i-th of n samples
+
+double viewport_x(const Viewport& viewport, double t); // Abscissa of the viewport at the position t in [-1,1]
+
+double viewport_y(const Viewport& viewport, double t); // Ordinate of the viewport at the position t in [-1,1]
+
+void viewport_grid(const Viewport& viewport, size_t width, size_t height, double* x, double* y); // Coordinates of the width*height pixels of the viewport, row after row
+
+
+class RenderHandle // Render started by Martist::paintAsync or Martist::drawAsync
+{
+
+public:
+
+	RenderHandle(); // Constructor of a handle without render
+
+	bool wait() const; // Wait for the end of the render, returns false if it was cancelled (rethrows its errors)
+
+	bool ready() const; // The render is over (finished or cancelled)
+
+	std::shared_future<bool> future() const; // Future of the result of wait()
+
+	size_t progress() const; // Number of tiles already computed
+
+	size_t tiles() const; // Total number of tiles
+
+	void cancel(); // Ask the render to stop at the next tile boundary
+
+
+private:
+
+	struct State;
+	std::shared_ptr<State> state;
+
+	friend class Martist;
+
+};
 
 
 class Martist
@@ -14,6 +68,8 @@ public:
 
 	explicit Martist(unsigned char* buffer, size_t width, size_t height, int rdepth, int gdepth, int bdepth); // Constructor
 
+	~Martist(); // Destructor, cancels the render in flight
+
 	void redDepth(int depth); // Set the depth of the red expression 
 
 	int redDepth() const; // Get the depth of the red expression 
@@ -30,8 +86,84 @@ public:
 
 	void changeBuffer(unsigned char* buffer, size_t width, size_t height); // Change the image buffer
 
+	void viewport(const Viewport& viewport); // Set the part of the domain drawn in the buffer
+
+	const Viewport& viewport() const; // Get the part of the domain drawn in the buffer
+
+	void format(PixelFormat format); // Set the layout of the buffer
+
+	PixelFormat format() const; // Get the layout of the buffer
+
+	void antialiasing(int samples, double threshold); // Set the adaptive supersampling (samples per axis, 1 to disable it)
+
+	int antialiasingSamples() const; // Get the number of samples per axis of the supersampled pixels
+
+	double antialiasingThreshold() const; // Get the variation above which a pixel is supersampled
+
+	size_t antialiasedPixels() const; // Get the number of pixels supersampled by the last computation of the buffer
+
+	void screening(int candidates, const ProbeThresholds& thresholds); // Set the screening of the random images (candidates probed per image, 1 to disable it)
+
+	int screeningCandidates() const; // Get the maximum number of candidates probed per random image
+
+	const ProbeThresholds& screeningThresholds() const; // Get the scores a candidate must reach to be rendered
+
+	const ScreeningStats& screeningStats() const; // Get the counters of the screening since the construction
+
+	void tuning(const TuningProfile& profile); // Set the rendering strategy : kernels, rows of a tile, pixels evaluated at once and threads
+
+	const TuningProfile& tuning() const; // Get the rendering strategy (the profile of the machine by default)
+
+	TuningProfile retune(); // Measure the rendering strategies on this machine, use and save the fastest one
+
+	void streamingStores(bool stream); // Set whether the pixels of buffers larger than the caches bypass them (non-temporal stores)
+
+	bool streamingStores() const; // Get whether the pixels of large buffers bypass the caches
+
+	void surrogates(int degree, int tolerance); // Set the Chebyshev surrogates of the smooth expressions (maximum degree, 0 to disable them, and bytes of tolerance)
+
+	int surrogateDegree() const; // Get the maximum degree of the surrogates (0 if they are disabled)
+
+	int surrogateTolerance() const; // Get the number of bytes a component computed by a surrogate may differ by
+
+	size_t approximatedValues() const; // Get the number of components taken from the surrogates by the last computation of the buffer
+
+	void taskParallel(size_t nodes); // Set the smallest sub-expression evaluated as a parallel task when the image is too small to share by tiles (0 to disable it)
+
+	size_t taskParallelNodes() const; // Get the smallest sub-expression evaluated as a parallel task (0 if it is disabled)
+
+	void fixedPoint(bool fixed); // Set whether the 8-bit renders evaluate the expressions in 16-bit fixed point, faster but approximate
+
+	bool fixedPoint() const; // Get whether the 8-bit renders evaluate the expressions in fixed point
+
+	void flushDenormals(bool flush); // Set whether the renders flush the subnormal values to 0 (flush-to-zero and denormals-are-zero)
+
+	bool flushDenormals() const; // Get whether the renders flush the subnormal values to 0
+
+	bool subnormalProne() const; // Get whether the expressions may fall below 2^-1022 on the pixels of the buffer
+
+	void costModel(const CostModel& model); // Set the costs of the opcodes used by estimate (the cost model of the machine by default)
+
+	const CostModel& costModel() const; // Get the costs of the opcodes used by estimate
+
+	CostModel recalibrate(); // Calibrate the cost model on this machine, use and save it
+
+	RenderEstimate estimate(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue) const; // Predict the time of a draw of the expressions, without rendering them
+
 	void paint(); // Generate a new random image 
 
+	void draw(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue); // Draw the given colour expressions in the buffer
+
+	RenderHandle paintAsync(); // Generate a new random image in the background
+
+	RenderHandle drawAsync(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue); // Draw the given colour expressions in the background
+
+	void autoCancel(bool cancel); // Set whether starting a render cancels the one in flight (otherwise it waits for it)
+
+	bool autoCancel() const; // Get whether starting a render cancels the one in flight
+
+	void cancelRender(); // Cancel the render in flight and wait for it to stop
+
 	friend std::ostream& operator<< (std::ostream& out, const Martist& m); // Overloading output operator
 
 	friend std::istream& operator>> (std::istream& in, Martist& m); // Overloading input operator
@@ -44,6 +176,30 @@ private:
 	size_t my_width;
 	size_t my_height;
 
+	Viewport my_viewport;
+	PixelFormat my_format;
+
+	int aa_samples;
+	double aa_threshold;
+	size_t aa_pixels;
+
+	int screen_candidates;
+	ProbeThresholds screen_thresholds;
+	ScreeningStats screen_stats;
+
+	TuningProfile tune_profile;
+	bool stream_stores;
+
+	int surrogate_degree;
+	int surrogate_tolerance;
+	size_t approximated;
+
+	size_t task_nodes;
+	bool fixed_point;
+	bool flush_denormals;
+
+	CostModel cost_model;
+
 	int rdepth;
 	int gdepth;
 	int bdepth;
@@ -52,8 +208,18 @@ private:
 	ColorExpression green_exp;
 	ColorExpression blue_exp;
 
+	bool auto_cancel;
+	RenderHandle in_flight;
+
+	struct Frame; // Copy of everything needed to compute the buffer
+
+	void new_expressions(); //Generate the random colour expressions, screened if enabled
+	std::shared_ptr<const Frame> frame() const; //Returns the frame to compute with the current settings
+	RenderHandle start_render(); //Compute the buffer in the background
 	void compute_buffer(); //Compute the buffer with the different color expressions
-	unsigned char simple_scaling(double value); //Returns an unsigned char [0,255] corresponding to the scaling of the given double value
+
+	Martist(const Martist&) = delete;
+	Martist& operator=(const Martist&) = delete;
 	
 };
 
@@ -7,6 +7,8 @@
 #include <ios> // streamoff
 #include <cctype> //isspace
 #include <vector>
+#include <algorithm> //std::find, std::min
+#include <cstddef> //ptrdiff_t
 
 using std::string;
 using std::vector;
@@ -15,8 +17,27 @@ using std::vector;
 
 /*********************************LEXER_CONSTRUCTOR**************************************
 *
+* The current line of the stream is read at once, so that the tokens are then analyzed
+* directly in memory instead of one get()/peek()/unget() call per character.
+*
+*****************************************************************************************/
+Lexer::Lexer(std::istream& in): counter(0){
+
+	std::getline(in, line);
+
+	input = line.data();
+	input_end = input + line.size();
+}
+
+
+/*********************************LEXER_CONSTRUCTOR**************************************
+*
+* ARGUMENTS :
+*	- first and last delimit the characters to analyze. The range is not copied and
+*	  must outlive the lexer. A '\n' ends the input, as for a stream.
+*
 *****************************************************************************************/
-Lexer::Lexer(std::istream& in): input(in), counter(0){}
+Lexer::Lexer(const char* first, const char* last): input(first), input_end(std::find(first, last, '\n')), counter(0){}
 
 
 /*******************************************next**************************************************
@@ -28,29 +49,21 @@ Lexer::Lexer(std::istream& in): input(in), counter(0){}
 ***************************************************************************************************/
 Lexer::token Lexer::next(){
 
-	Lexer::token tok;
-	char first;
-	
-	first = input.get();
-	counter++;
-	//Get the first character and check if input is not empty
-	if(input.eof() || input.peek() == '\n'){
-		throw std::domain_error("EOI");
-	}
-	
+	const char* pos = input;
 
-	//Check if the first character is a whitespace -> get the next one if it is
-	while(isspace(first)){
-		first = input.get();
-		counter++;
-		if(input.eof() || input.peek() == '\n'){
-			throw std::domain_error("EOI");
-		}
-		
+	//Skip the whitespaces and check if input is not empty
+	while(pos != input_end && isspace((unsigned char)*pos)){
+		pos++;
+	}
+	if(pos == input_end){
+		throw std::domain_error("EOI");
 	}
 
 	//Analyze of the input
-	tok = analyze(first, true);
+	Lexer::token tok = analyze(pos);
+
+	counter += pos - input;
+	input = pos;
 
 	return tok;
 }
@@ -65,36 +78,18 @@ Lexer::token Lexer::next(){
 ***************************************************************************************************/
 Lexer::token Lexer::peek(){
 
-	Lexer::token tok;
-	char first;
-	int nb_whites = 0;
+	const char* pos = input;
 
-	first = input.get();
-	//Get the first character and check if input is not empty
-	if(input.eof() || input.peek() == '\n'){
-		throw std::domain_error("EOI");
+	//Skip the whitespaces and check if input is not empty
+	while(pos != input_end && isspace((unsigned char)*pos)){
+		pos++;
 	}
-	
-
-	//Check if the first character is a whitespace -> get the next one if it is
-	while(isspace(first)){
-		first = input.get();
-		nb_whites++;
-		if(input.eof() || input.peek() == '\n'){
-			throw std::domain_error("EOI");
-		}
-		
+	if(pos == input_end){
+		throw std::domain_error("EOI");
 	}
 
-	//Analyze of the input
-	tok = analyze(first, false);
-
-	// Put back the first char of the token and the previous whitespaces
-	for(int i=0; i<nb_whites+1; i++){
-		input.unget();
-	}
-	
-	return tok;
+	//Analyze of the input, without moving the current position
+	return analyze(pos);
 }
 
 
@@ -122,22 +117,20 @@ void Lexer::reset(){
 }
 
 
-/*******************************************peek**************************************************
+/*******************************************analyze**************************************************
 *
 * ARGUMENTS :
-*	- first : a string corresponding to the last character extracted from the input stream
-*	- extract_char : a boolean varibale that takes the value "true" if we have to delete the
-*	  extracted_char (next) and "false" if not (peek).
+*	- pos : the position of the first character of the token. It is moved after the token.
 *
-* RETURN : the next token of the input stream
+* RETURN : the token starting at pos
 *
 ***************************************************************************************************/
-Lexer::token Lexer::analyze(const char& first, bool extract_char){
+Lexer::token Lexer::analyze(const char*& pos) const{
 
 	Lexer::token tok;
-	char second, third;
-	string error;
-	error += first;
+	const char first = *pos;
+	//Characters left in the input, the first one included
+	const std::ptrdiff_t left = input_end - pos;
 
 	switch(first){
 
@@ -157,63 +150,35 @@ Lexer::token Lexer::analyze(const char& first, bool extract_char){
 
 		//Check the "two characters" token (pi)
 		case 'p' :
-			if(input.peek() == input.eof() || input.peek() == '\n'){
-				throw std::domain_error("EOI");
-			}else{
-				second = input.get();
-		
-				if(second == 'i'){
-					tok = PI;
-				}else{
-					error += second;
-					throw std::domain_error("BAD TOKEN : " + error);
-				}
-				if(!extract_char){
-					input.unget();
-				}else{
-					counter++;
-				}
+			if(left < 2 || pos[1] != 'i'){
+				throw std::domain_error("BAD TOKEN : " + string(pos, pos + std::min<std::ptrdiff_t>(left, 2)));
 			}
-			break;
+			pos += 2;
+			return PI;
 
 		//Check the "three characters" tokens (sin, cos, avg)	
 		case 's' :
 		case 'c' :
 		case 'a' :
-			if(input.peek() == input.eof() || input.peek() == '\n'){
-				throw std::domain_error("EOI");
+			if(left >= 3 && first == 's' && pos[1] == 'i' && pos[2] == 'n'){
+				tok = SIN;
+			}else if(left >= 3 && first == 'c' && pos[1] == 'o' && pos[2] == 's'){
+				tok = COS;
+			}else if(left >= 3 && first == 'a' && pos[1] == 'v' && pos[2] == 'g'){
+				tok = AVG;
 			}else{
-				second = input.get();
-				error += second;
-				if(input.peek() == input.eof() || input.peek() == '\n'){
-					throw std::domain_error("EOI");
-				}else{
-					third = input.get();
-					error += third;
-					if(first == 's' && second == 'i' && third == 'n'){
-						tok = SIN;
-					}else if(first == 'c' && second == 'o' && third == 's'){
-						tok = COS;
-					}else if(first == 'a' && second == 'v' && third == 'g'){
-						tok = AVG;
-					}else{
-						throw std::domain_error("BAD TOKEN : " + error);
-					}
-					if(!extract_char){
-						input.unget();
-						input.unget();
-					}else{
-						counter+=2;
-					}
-				}
+				throw std::domain_error("BAD TOKEN : " + string(pos, pos + std::min<std::ptrdiff_t>(left, 3)));
 			}
-			break;
+			pos += 3;
+			return tok;
 
 		// In all other cases, we throw a "bad token" domain_error
 		default :
-			throw std::domain_error("BAD TOKEN : " + error);
+			throw std::domain_error("BAD TOKEN : " + string(1, first));
 	}
 
+	pos++;
+
 	return tok;
 }
 
@@ -225,6 +190,15 @@ Lexer::token Lexer::analyze(const char& first, bool extract_char){
 Parser::Parser(std::istream& in): lexer(in), nb_par(0){}
 
 
+/*********************************PARSER_CONSTRUCTOR**************************************
+*
+* ARGUMENTS :
+*	- first and last delimit the expression to parse (see the Lexer constructor)
+*
+*****************************************************************************************/
+Parser::Parser(const char* first, const char* last): lexer(first, last), nb_par(0){}
+
+
 
 /*******************************************parse**************************************************************
 *
@@ -236,6 +210,31 @@ Parser::Parser(std::istream& in): lexer(in), nb_par(0){}
 ****************************************************************************************************************/
 bool Parser::parse(Exp& exp){
 
+	vector<Lexer::token> rpn;
+
+	if(!parse(rpn)){
+		return false;
+	}
+
+	exp.reserve(exp.size() + rpn.size());
+	for(vector<Lexer::token>::size_type i = 0; i != rpn.size(); i++){
+		exp.push_back(token_to_string(rpn[i]));
+	}
+
+	return true;
+}
+
+
+/*******************************************parse**************************************************************
+*
+* ARGUMENTS :
+*	- rpn : a vector of tokens containing the parsed expression in reverse polish notation (no string is built)
+*
+* RETURN : returns true if it success-fully parsed a complete expression (false if the expression is incomplete)
+*
+****************************************************************************************************************/
+bool Parser::parse(vector<Lexer::token>& rpn){
+
 	bool success = false;
 
 	try{
@@ -258,7 +257,7 @@ bool Parser::parse(Exp& exp){
 	}
 
 	if(success){
-		infix_to_rpn(exp);
+		infix_to_rpn(rpn);
 	}
 
 	return success;
@@ -268,6 +267,10 @@ bool Parser::parse(Exp& exp){
 
 /*******************************************check_syntax******************************************************
 *
+* The operators whose operands are being checked are kept on an explicit stack, with what is expected after the
+* current operand, so that the depth of the expression is not limited by the call stack. An incomplete operand
+* makes the whole check return false, as when each level returned false to the one above.
+*
 * ARGUMENTS : /
 *
 * RETURN : returns true if it the syntax of the tokens is correct (false neither)
@@ -275,268 +278,159 @@ bool Parser::parse(Exp& exp){
 ****************************************************************************************************************/
 bool Parser::check_syntax(){
 
-	bool success = false;
-	int token_size = 0;
+	vector<step> pending;
 
-	Lexer::token tok = lexer.next();
+	while(true){
 
-	//Check x and y
-	if(tok == Lexer::X || tok == Lexer::Y){
-		token_vec.push_back(tok);
-		success = true;
+		Lexer::token tok = lexer.next();
 
-		//Check next token
-		if(!check_after_token()){
-			token_size = check_size_token();
-			lexer.next();
-			throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
+		//Check x and y
+		if(tok == Lexer::X || tok == Lexer::Y){
+			token_vec.push_back(tok);
+
+			//Check next token
+			if(!check_after_token()){
+				parse_error();
+			}
 		}
-	}
 
-	//Check product
-	else if(tok == Lexer::OPEN_PAR){
-		nb_par++;
-		token_vec.push_back(tok);
-		success = check_product();
-	}
-	
-	//Check sin and cos syntax
-	else if(tok == Lexer::SIN || tok == Lexer::COS){
-		token_vec.push_back(tok);
-		success = check_sin_cos();
-	}
+		//Check product : "(exp1*exp2)"
+		else if(tok == Lexer::OPEN_PAR){
+			nb_par++;
+			token_vec.push_back(tok);
 
-	//Check avg syntax
-	else if(tok == Lexer::AVG){
-		token_vec.push_back(tok);
-		success = check_avg();
-	}
+			if(!check_operand(Lexer::TIMES)){
+				return false;
+			}
+			pending.push_back(PRODUCT_TIMES);
+			continue;
+		}
 
-	//Invalid token
-	else{
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()));
-	}
+		//Check sin and cos syntax : "sin(pi*exp)" or "cos(pi*exp)"
+		else if(tok == Lexer::SIN || tok == Lexer::COS){
+			token_vec.push_back(tok);
 
-	return success;
-}
+			expect(Lexer::OPEN_PAR);
+			nb_par++;
+			expect(Lexer::PI);
+			expect(Lexer::TIMES);
 
+			if(!check_operand(Lexer::CLOSE_PAR)){
+				return false;
+			}
+			pending.push_back(CLOSE);
+			continue;
+		}
 
+		//Check avg syntax : "avg(exp1,exp2)"
+		else if(tok == Lexer::AVG){
+			token_vec.push_back(tok);
 
-/*******************************************check_product******************************************************
-*
-* ARGUMENTS : /
-*
-* RETURN : returns true if the syntax of the product expression is correct (false neither)
-*
-****************************************************************************************************************/
-bool Parser::check_product(){
+			expect(Lexer::OPEN_PAR);
+			nb_par++;
 
-	int token_size = 0;
+			if(!check_operand(Lexer::COMMA)){
+				return false;
+			}
+			pending.push_back(AVG_COMMA);
+			continue;
+		}
 
-	//If no exp1
-	if(lexer.peek() == Lexer::TIMES){
-		return false;
-	} 
-	//If exp1 invalid
-	if(lexer.peek() == Lexer::CLOSE_PAR || lexer.peek() == Lexer::COMMA || lexer.peek() == Lexer::PI){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	//If exp1 exists, check its syntax
-	if(!check_syntax()){
-		return false;
-	}
-	
-	if(lexer.peek() != Lexer::TIMES){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}else{
-		//Add * to the token vec
-		token_vec.push_back(lexer.next());
-	}
-	
-	//If no exp2
-	if(lexer.peek() == Lexer::CLOSE_PAR){
-		return false;
-	}
-	// If exp2 invalid
-	if(lexer.peek() == Lexer::TIMES || lexer.peek() == Lexer::COMMA || lexer.peek() == Lexer::PI){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	//If exp2 exists, check its syntax
-	if(!check_syntax()){
-		return false;
-	}
-	
-	//Check is it ends by a close par
-	if(lexer.peek() != Lexer::CLOSE_PAR){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}else{
-		nb_par--;
-		token_vec.push_back(lexer.next());
-	}
+		//Invalid token
+		else{
+			throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()));
+		}
 
-	//Check the next token after close_par
-	if(!check_after_token()){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
+		//The operand is complete : go on with the operators waiting for it
+		while(true){
 
-	return true;
+			if(pending.empty()){
+				return true;
+			}
+
+			step s = pending.back();
+			pending.pop_back();
+
+			if(s == PRODUCT_TIMES || s == AVG_COMMA){
+				//Separator, then the second operand
+				expect(s == PRODUCT_TIMES ? Lexer::TIMES : Lexer::COMMA);
+
+				if(!check_operand(Lexer::CLOSE_PAR)){
+					return false;
+				}
+				pending.push_back(CLOSE);
+				break;
+			}
+
+			//Check it ends by a close par
+			if(lexer.peek() != Lexer::CLOSE_PAR){
+				parse_error();
+			}
+			nb_par--;
+			token_vec.push_back(lexer.next());
+
+			//Check the next token after close_par
+			if(!check_after_token()){
+				parse_error();
+			}
+		}
+	}
 }
 
 
-/*******************************************check_sin_cos*******************************************************
+
+/*******************************************check_operand******************************************************
 *
-* ARGUMENTS : /
+* ARGUMENTS :
+*	- end : the token expected after the operand (an operand starting with it is missing)
 *
-* RETURN : returns true if the syntax of the sin/cos expression is correct (false neither)
+* RETURN : returns true if an operand starts at the next token, false if it is missing (throws if it is invalid)
 *
 ****************************************************************************************************************/
-bool Parser::check_sin_cos(){
-
-	int token_size = 0;
-
-	//Check if it's of type "sin(pi*exp)" or "cos(pi*exp)"
-	if(lexer.peek() != Lexer::OPEN_PAR){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	nb_par++;
-	token_vec.push_back(lexer.next());
-
-	if(lexer.peek() != Lexer::PI){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	token_vec.push_back(lexer.next());
+bool Parser::check_operand(Lexer::token end){
 
-	if(lexer.peek() != Lexer::TIMES){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	token_vec.push_back(lexer.next());
+	Lexer::token tok = lexer.peek();
 
-	//Check if exp exists
-	if(lexer.peek() == Lexer::CLOSE_PAR){
+	if(tok == end){
 		return false;
 	}
-	//Check if it is valid
-	if(lexer.peek() == Lexer::TIMES || lexer.peek() == Lexer::COMMA || lexer.peek() == Lexer::PI){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	//If it's valid, check it's syntax
-	if(!check_syntax()){
-		return false;
-	}
-	
-	if(lexer.peek() != Lexer::CLOSE_PAR){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}else{
-		nb_par--;
-		token_vec.push_back(lexer.next());
-	}
-
-	//Check the next token after close_par
-	if(!check_after_token()){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
+	if(tok == Lexer::TIMES || tok == Lexer::COMMA || tok == Lexer::CLOSE_PAR || tok == Lexer::PI){
+		parse_error();
 	}
 
 	return true;
 }
 
 
-/*******************************************check_avg************************************************************
+/*******************************************expect*************************************************************
 *
-* ARGUMENTS : /
+* ARGUMENTS :
+*	- tok : the token that must come next, which is added to the token vec
 *
-* RETURN : returns true if the syntax of the average expression is correct (false neither)
+* RETURN : /
 *
 ****************************************************************************************************************/
-bool Parser::check_avg(){
-
-	int token_size = 0;
+void Parser::expect(Lexer::token tok){
 
-	if(lexer.peek() != Lexer::OPEN_PAR){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
+	if(lexer.peek() != tok){
+		parse_error();
 	}
-	nb_par++;
 	token_vec.push_back(lexer.next());
+}
 
-	//Check if exp1 exists
-	if(lexer.peek() == Lexer::COMMA){
-		return false;
-	}
-	//Check if exp1 is valid
-	if(lexer.peek() == Lexer::TIMES || lexer.peek() == Lexer::CLOSE_PAR || lexer.peek() == Lexer::PI){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	//If exp1 is valid, check it's syntax
-	if(!check_syntax()){
-		return false;
-	}
-	
-	if(lexer.peek() != Lexer::COMMA){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}else{
-		//Add , to the token vec
-		token_vec.push_back(lexer.next());
-	}
-
-	//Check if exp2 exists
-	if(lexer.peek() == Lexer::CLOSE_PAR){
-		return false;
-	}
-	//Check if exp2 is valid
-	if(lexer.peek() == Lexer::TIMES || lexer.peek() == Lexer::COMMA || lexer.peek() == Lexer::PI){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
-	//If exp2 is valid, check it's syntax
-	if(!check_syntax()){
-		return false;
-	}
-	
-	if(lexer.peek() != Lexer::CLOSE_PAR){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}else{
-		nb_par--;
-		token_vec.push_back(lexer.next());
-	}
 
-	//Check the next token after close_par
-	if(!check_after_token()){
-		token_size = check_size_token();
-		lexer.next();
-		throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
-	}
+/*******************************************parse_error********************************************************
+*
+* ARGUMENTS : /
+*
+* RETURN : / (throws a parse error at the position of the next token)
+*
+****************************************************************************************************************/
+void Parser::parse_error(){
 
-	return true;
+	int token_size = check_size_token();
+	lexer.next();
+	throw std::domain_error("PARSE ERROR at : "+ std::to_string(lexer.count()+1 - token_size));
 }
 
 
@@ -581,30 +475,30 @@ int Parser::check_size_token(){
 /*******************************************infix_to_rpn*********************************************************
 *
 * ARGUMENTS : 
-*	- exp : a vector of string containing the reverse polish notation of the given sequence
+*	- rpn : a vector of tokens receiving the reverse polish notation of the given sequence
 *
 * RETURN : /
 *
 ****************************************************************************************************************/
-void Parser::infix_to_rpn(Exp& exp){
+void Parser::infix_to_rpn(vector<Lexer::token>& rpn){
 
 	Lexer::token tok;
-	Exp operator_stack;
+	vector<Lexer::token> operator_stack;
 
 	//While tokens are read from the lexer
 	for(vector<Lexer::token>::size_type i=0; i != token_vec.size(); i++){
 
 		tok = token_vec[i];
 
-		//If token is a number "x,y,pi", then push it onto exp
+		//If token is a number "x,y,pi", then push it onto rpn
 		if(tok == Lexer::X || tok == Lexer::Y || tok == Lexer::PI){
-			exp.push_back(token_to_string(tok));
+			rpn.push_back(tok);
 		}
 
 		//If AVG is met
 		else if(tok == Lexer::AVG){
 			//Push the read operator onto the operator stack
-			operator_stack.push_back(token_to_string(tok));
+			operator_stack.push_back(tok);
 		}
 
 		//If it's a comma
@@ -612,8 +506,8 @@ void Parser::infix_to_rpn(Exp& exp){
 			//While there is an operator at the top of the operator_stack with greater or equal precedence
 			while(greater_precedence(tok, operator_stack.back())){
 			
-				//Pop operators from the operator stack and push them onto exp
-				exp.push_back(operator_stack.back());
+				//Pop operators from the operator stack and push them onto rpn
+				rpn.push_back(operator_stack.back());
 				operator_stack.pop_back();
 
 				if(operator_stack.empty()){
@@ -629,8 +523,8 @@ void Parser::infix_to_rpn(Exp& exp){
 				//While there is an operator at the top of the operator_stack with greater or equal precedence
 				while(greater_precedence(tok, operator_stack.back())){
 				
-					//Pop operators from the operator stack and push them onto exp
-					exp.push_back(operator_stack.back());
+					//Pop operators from the operator stack and push them onto rpn
+					rpn.push_back(operator_stack.back());
 					operator_stack.pop_back();
 
 					if(operator_stack.empty()){
@@ -639,33 +533,40 @@ void Parser::infix_to_rpn(Exp& exp){
 				}
 			}
 			//Push the read operator onto the operator stack
-			operator_stack.push_back(token_to_string(tok));
+			operator_stack.push_back(tok);
 		}
 
 		//If it's a left bracket "(", then push it onto the operator stack
 		else if(tok == Lexer::OPEN_PAR){
-			operator_stack.push_back(token_to_string(tok));
+			operator_stack.push_back(tok);
 		}
 
 		//If it's a right bracket ")", then :
 		else if(tok == Lexer::CLOSE_PAR){
 
 			//While there is no left bracket at the top of the operator stack:
-			while(operator_stack.back() != "("){
+			while(operator_stack.back() != Lexer::OPEN_PAR){
 
-				//Pop operators from the operator stack and push them onto exp
-				exp.push_back(operator_stack.back());
+				//Pop operators from the operator stack and push them onto rpn
+				rpn.push_back(operator_stack.back());
 				operator_stack.pop_back();
 
 			}
 			//Pop the left bracket from the operator stack and delete it
 			operator_stack.pop_back();
+
+			//If the brackets were the ones of sin, cos or avg, its operands are complete : push it onto rpn
+			if(!operator_stack.empty() && (operator_stack.back() == Lexer::SIN || operator_stack.back() == Lexer::COS
+				|| operator_stack.back() == Lexer::AVG)){
+				rpn.push_back(operator_stack.back());
+				operator_stack.pop_back();
+			}
 		}
 	}
 
-	//While there are operators on the operator stack, pop them onto exp
+	//While there are operators on the operator stack, pop them onto rpn
 	while(!operator_stack.empty()){
-		exp.push_back(operator_stack.back());
+		rpn.push_back(operator_stack.back());
 		operator_stack.pop_back();
 	}
 }
@@ -707,25 +608,25 @@ string Parser::token_to_string(const Lexer::token& tok){
 /*******************************************greater_precedence***************************************************
 *
 * ARGUMENTS : 
-*	- tok : the read token to be compared with the top of the operator stack (str)
-*	- str : the string expression at the top of the operator stack
+*	- tok : the read token to be compared with the top of the operator stack (top)
+*	- top : the token at the top of the operator stack
 *
-* RETURN : returns true if the string is of greater or equal precedence than the token (false neither)
+* RETURN : returns true if the top of the stack is of greater or equal precedence than the token (false neither)
 *
 ****************************************************************************************************************/
-bool Parser::greater_precedence(const Lexer::token& tok, const string& str){
+bool Parser::greater_precedence(const Lexer::token& tok, const Lexer::token& top){
 
 	if(tok == Lexer::COMMA){
-		if(str == "avg" || str == "sin" || str == "cos"){
+		if(top == Lexer::AVG || top == Lexer::SIN || top == Lexer::COS){
 			return true;
 		}
 	}
 	else if(tok == Lexer::TIMES){
-		if(str == "*" || str == "sin" || str == "cos"){
+		if(top == Lexer::TIMES || top == Lexer::SIN || top == Lexer::COS){
 			return true;
 		}
 	}else if(tok == Lexer::SIN || tok == Lexer::COS){
-		if(str == "sin" || str == "cos"){
+		if(top == Lexer::SIN || top == Lexer::COS){
 			return true;
 		}
 	}
@@ -16,7 +16,8 @@ public:
 
 	enum token {X, Y, SIN, COS, PI, OPEN_PAR, CLOSE_PAR, TIMES, AVG, COMMA};
 
-	explicit Lexer(std::istream& in); //Constructor
+	explicit Lexer(std::istream& in); //Constructor (reads the current line of the stream)
+	Lexer(const char* first, const char* last); //Constructor working directly on a character range (up to the first '\n')
 
 	token next(); //returns the next token, removing it from the input
 	token peek(); //returns the next token, but without removing it from the input
@@ -25,10 +26,15 @@ public:
 
 private:
 	
-	std::istream& input;
+	std::string line; //storage for the line read from an istream
+	const char* input; //next character to read
+	const char* input_end; //end of the character range
 	std::streamoff counter;
 
-	token analyze(const char& c, bool extract_char); //analyze an extracted char from the input
+	token analyze(const char*& pos) const; //analyze the token starting at pos and move pos after it
+
+	Lexer(const Lexer&) = delete;
+	Lexer& operator=(const Lexer&) = delete;
 
 };
 
@@ -45,7 +51,9 @@ class Parser
 public:
 
 	explicit Parser(std::istream& in); //Constructor
+	Parser(const char* first, const char* last); //Constructor parsing a character range without any stream
 	bool parse(Exp& exp); //returns true if it success-fully parsed a complete expression, and false if the expression is incomplete
+	bool parse(std::vector<Lexer::token>& rpn); //same, giving the reverse polish notation as tokens instead of strings
 
 private :
 	
@@ -53,18 +61,20 @@ private :
 	std::vector<Lexer::token> token_vec; //vector containing the tokens read from the lexer
 	size_t nb_par; //variable used to check if there are as many close par as open par
 
-	bool check_syntax(); //check the syntax of an expression
-	bool check_sin_cos(); //check the syntax of the sin/cos expression
-	bool check_product(); //check the syntax of the product expression
-	bool check_avg(); //check the syntax of the average expression
+	enum step {PRODUCT_TIMES, AVG_COMMA, CLOSE}; //what is expected after the operand being checked
+
+	bool check_syntax(); //check the syntax of an expression, with an explicit stack instead of recursive calls
+	bool check_operand(Lexer::token end); //check that an operand starts at the next token
+	void expect(Lexer::token tok); //check the next token and add it to the token vec
+	void parse_error(); //throw a parse error at the position of the next token
 
 	bool check_after_token(); //check if there is a valid token after one
 	int check_size_token(); //check size of the next token
 	
-	void infix_to_rpn(Exp& exp); //convert the infix sequence of tokens in a RPN keystrokes' sequence
+	void infix_to_rpn(std::vector<Lexer::token>& rpn); //convert the infix sequence of tokens in a RPN keystrokes' sequence
 
 	std::string token_to_string(const Lexer::token& tok); //convert a token to a string
-	bool greater_precedence(const Lexer::token& tok, const std::string& str); //check the precedence between tokens
+	bool greater_precedence(const Lexer::token& tok, const Lexer::token& top); //check the precedence between tokens
 
 };
 
@@ -0,0 +1,433 @@
+#include "pipeline.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "image.hpp"
+#include "png.hpp"
+#include "boundedQueue.hpp"
+#include "kernels.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <random> //std::mt19937, std::seed_seq
+#include <iostream>
+#include <iomanip> //std::setprecision
+#include <cstdio> //snprintf
+#include <stdexcept> //domain_error
+
+
+using std::vector;
+using std::unique_ptr;
+
+typedef vector<unsigned char> Bytes;
+
+
+
+/********************************************************************************************************************************
+* Items going through the pipeline. An item a stage failed on still goes through the next ones, so every stage handles count
+* items and no stage waits forever on its queue.
+**********************************************************************************************************************************/
+struct GeneratedImage
+{
+	size_t index;
+	bool failed; // The expressions couldn't be generated
+	ColorExpression exps[3];
+};
+
+struct RenderedImage
+{
+	size_t index;
+	Bytes* pixels; // Taken from the pixel pool (nullptr if the image failed)
+};
+
+struct EncodedImage
+{
+	size_t index;
+	Bytes* bytes; // Taken from the byte pool (nullptr if the image failed)
+};
+
+
+
+/********************************************************************************************************************************
+* Queue between two stages, with its occupancy metrics
+**********************************************************************************************************************************/
+template <class T>
+struct StageQueue
+{
+	BoundedQueue<T> queue;
+	std::atomic<size_t> samples;
+	std::atomic<size_t> occupancy; // Sum of the sampled sizes
+	std::atomic<size_t> max;
+
+	explicit StageQueue(size_t capacity) : queue(capacity), samples(0), occupancy(0), max(0){}
+
+	void push(T value){ // Push a value, waiting while the queue is full
+		while(!queue.try_push(std::move(value)))
+			std::this_thread::yield();
+	}
+
+	T pop(){ // Pop a value, waiting while the queue is empty
+
+		size_t size = queue.size();
+		samples++;
+		occupancy += size;
+		size_t seen = max;
+		while(size > seen && !max.compare_exchange_weak(seen, size)){}
+
+		T value;
+		while(!queue.try_pop(value))
+			std::this_thread::yield();
+		return value;
+	}
+
+	void report(StageStats& stats) const{
+		stats.queue_average = samples ? (double)occupancy / samples : 0.0;
+		stats.queue_max = max;
+		stats.queue_capacity = queue.capacity();
+	}
+};
+
+
+
+/********************************************************************************************************************************
+* Default settings : 100 PPM images of 256x256, depths in [4,10], one thread per stage and one more renderer per core
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+GalleryOptions default_gallery_options(){
+
+	GalleryOptions options;
+
+	options.count = 100;
+	options.width = 256;
+	options.height = 256;
+	options.min_depth = 4;
+	options.max_depth = 10;
+	options.max_nodes = UNLIMITED_NODES;
+	options.cost = 0.0;
+	options.cost_tolerance = 0.05;
+	options.seed = 0;
+	options.prefix = "gallery";
+	options.png = false;
+	options.png_mode = PNG_DEFAULT;
+	options.candidates = 1;
+	options.thresholds = default_probe_thresholds();
+	options.surrogate_degree = 0;
+	options.surrogate_tolerance = 0;
+	options.threads[0] = 1;
+	options.threads[1] = std::max(1u, std::thread::hardware_concurrency());
+	options.threads[2] = 1;
+	options.threads[3] = 1;
+	options.queue_capacity = 16;
+	options.buffers = 8;
+
+	return options;
+}
+
+
+/********************************************************************************************************************************
+* Run a stage : each of its threads takes the next item until the stage has handled count items
+*
+* ARGUMENTS :
+*	- threads is the number of threads of the stage
+*	- count is the number of items to handle
+*	- step handles one item, catching its errors (an exception leaving a thread would end the process)
+**********************************************************************************************************************************/
+template <class Step>
+static void run_stage(vector<std::thread>& workers, size_t threads, size_t count, Step step){
+
+	std::shared_ptr<std::atomic<size_t> > claimed = std::make_shared<std::atomic<size_t> >(0);
+
+	for(size_t t = 0; t < threads; t++){
+		workers.push_back(std::thread([=]{
+			while((*claimed)++ < count)
+				step();
+		}));
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Nanoseconds elapsed since start, time spent waiting on the queues being left out by the stages
+*
+* ARGUMENT :
+*	- start is the beginning of the measure
+*
+* RETURN : the elapsed time
+**********************************************************************************************************************************/
+static long long elapsed(std::chrono::steady_clock::time_point start){
+
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+
+
+/********************************************************************************************************************************
+* Generate, render, encode and write random images. The four stages run at the same time on their own threads, connected
+* by bounded lock-free queues : while some images are rendered, the previous ones are encoded and written. The pixel and
+* byte buffers are taken from pools and given back once encoded or written, so the memory used doesn't depend on count.
+*
+* ARGUMENTS :
+*	- options are the settings of the generation
+*
+* RETURN : the throughput and the metrics of each stage
+**********************************************************************************************************************************/
+GalleryStats generate_gallery(const GalleryOptions& options){
+
+	if(options.width == 0 || options.height == 0)
+		throw std::domain_error("ERROR : Width or height can't be negative.");
+	if(options.min_depth < 0 || options.max_depth < options.min_depth)
+		throw std::domain_error("ERROR : Depth of expressions can't be negative.");
+	if(options.max_nodes < minimum_nodes(options.max_depth))
+		throw std::domain_error("ERROR : Node budget too small for the maximum depth.");
+	if(options.cost != 0.0 && (!(options.cost >= 1.0) || !(options.cost_tolerance >= 0.0)))
+		throw std::domain_error("ERROR : Cost must be at least 1 and its tolerance can't be negative.");
+	for(int s = 0; s < 4; s++){
+		if(options.threads[s] == 0)
+			throw std::domain_error("ERROR : Every stage needs a thread.");
+	}
+	if(options.candidates < 1)
+		throw std::domain_error("ERROR : Number of candidates must be at least 1.");
+	if(options.surrogate_degree < 0 || options.surrogate_degree > 64 || options.surrogate_tolerance < 0 || options.surrogate_tolerance > 255)
+		throw std::domain_error("ERROR : Degree of the surrogates must be in [0,64] and their tolerance in [0,255].");
+
+	const size_t count = options.count;
+	const size_t buffers = std::max<size_t>(1, options.buffers);
+
+	StageQueue<unique_ptr<GeneratedImage> > generated(options.queue_capacity);
+	StageQueue<RenderedImage> rendered(options.queue_capacity);
+	StageQueue<EncodedImage> encoded(options.queue_capacity);
+
+	//Buffer pools : a buffer goes back to its pool once it has been used by the next stage
+	vector<Bytes> pixel_storage(buffers, Bytes(3*options.width*options.height));
+	vector<Bytes> byte_storage(buffers);
+	BoundedQueue<Bytes*> pixel_pool(buffers);
+	BoundedQueue<Bytes*> byte_pool(buffers);
+	for(size_t i = 0; i < buffers; i++){
+		pixel_pool.try_push(&pixel_storage[i]);
+		byte_pool.try_push(&byte_storage[i]);
+	}
+
+	std::atomic<size_t> next(0);
+	std::atomic<size_t> errors(0);
+	std::atomic<long long> busy[4];
+	std::atomic<size_t> failed[4];
+	std::mutex screening_mutex;
+	ScreeningStats screening = ScreeningStats();
+	for(int s = 0; s < 4; s++){
+		busy[s] = 0;
+		failed[s] = 0;
+	}
+
+	// An image failed in a stage : counted once, the first error being printed
+	auto fail = [&](int stage, const std::exception& e){
+		failed[stage]++;
+		if(errors++ == 0)
+			std::cerr << e.what() << std::endl;
+	};
+
+	vector<std::thread> workers;
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	// Generation
+	run_stage(workers, options.threads[0], count, [&]{
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		unique_ptr<GeneratedImage> image(new GeneratedImage);
+		image->index = next++;
+		image->failed = false;
+
+		std::seed_seq seq{options.seed, (unsigned int)image->index};
+		std::mt19937 generator(seq);
+		RandomSource random = [&generator]{ return (int)(generator() >> 1); };
+
+		auto generate = [&](ColorExpression& red, ColorExpression& green, ColorExpression& blue){
+			ColorExpression* exps[3] = {&red, &green, &blue};
+			for(int c = 0; c < 3; c++){
+				if(options.cost > 0.0)
+					exps[c]->new_exp_within_cost(options.cost, options.cost_tolerance, random);
+				else
+					exps[c]->new_exp(options.min_depth + (int)(generator() % (options.max_depth - options.min_depth + 1)),
+						options.max_nodes, random);
+			}
+		};
+
+		try{
+			if(options.candidates <= 1)
+				generate(image->exps[0], image->exps[1], image->exps[2]);
+			else{
+				ScreeningStats counters = ScreeningStats();
+				screen(generate, options.candidates, options.thresholds, Viewport{-1.0, 1.0, -1.0, 1.0}, options.width*options.height,
+					image->exps[0], image->exps[1], image->exps[2], counters);
+
+				std::lock_guard<std::mutex> lock(screening_mutex);
+				screening.candidates += counters.candidates;
+				screening.rejected += counters.rejected;
+				screening.probe_pixels += counters.probe_pixels;
+				screening.saved_pixels += counters.saved_pixels;
+			}
+		}catch(std::exception& e){
+			image->failed = true;
+			fail(0, e);
+		}
+
+		busy[0] += elapsed(start);
+		generated.push(std::move(image));
+	});
+
+	// Rendering
+	run_stage(workers, options.threads[1], count, [&]{
+
+		unique_ptr<GeneratedImage> image = generated.pop();
+		if(image->failed){
+			rendered.push(RenderedImage{image->index, nullptr});
+			return;
+		}
+
+		Bytes* pixels;
+		while(!pixel_pool.try_pop(pixels))
+			std::this_thread::yield();
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		try{
+			Martist martist(pixels->data(), options.width, options.height, 0, 0, 0);
+			martist.surrogates(options.surrogate_degree, options.surrogate_tolerance);
+			martist.draw(image->exps[0], image->exps[1], image->exps[2]);
+		}catch(std::exception& e){
+			pixel_pool.try_push(std::move(pixels));
+			pixels = nullptr;
+			fail(1, e);
+		}
+
+		busy[1] += elapsed(start);
+		rendered.push(RenderedImage{image->index, pixels});
+	});
+
+	// Encoding
+	run_stage(workers, options.threads[2], count, [&]{
+
+		RenderedImage image = rendered.pop();
+		if(image.pixels == nullptr){
+			encoded.push(EncodedImage{image.index, nullptr});
+			return;
+		}
+
+		Bytes* bytes;
+		while(!byte_pool.try_pop(bytes))
+			std::this_thread::yield();
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		try{
+			if(options.png)
+				encode_png(image.pixels->data(), options.width, options.height, RGB8, *bytes, options.png_mode);
+			else
+				encode_ppm(image.pixels->data(), options.width, options.height, *bytes);
+		}catch(std::exception& e){
+			byte_pool.try_push(std::move(bytes));
+			bytes = nullptr;
+			fail(2, e);
+		}
+
+		Bytes* pixels = image.pixels;
+		pixel_pool.try_push(std::move(pixels));
+		busy[2] += elapsed(start);
+		encoded.push(EncodedImage{image.index, bytes});
+	});
+
+	// Writing
+	run_stage(workers, options.threads[3], count, [&]{
+
+		EncodedImage image = encoded.pop();
+		if(image.bytes == nullptr)
+			return;
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		char number[32];
+		std::snprintf(number, sizeof(number), "%06zu", image.index + 1);
+
+		try{
+			write_file(options.prefix + number + (options.png ? ".png" : ".ppm"), *image.bytes);
+		}catch(std::exception& e){
+			fail(3, e);
+		}
+
+		Bytes* bytes = image.bytes;
+		byte_pool.try_push(std::move(bytes));
+		busy[3] += elapsed(start);
+	});
+
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+
+	GalleryStats stats;
+	const char* names[4] = {"generate", "render", "encode", "write"};
+
+	stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	stats.errors = errors;
+	stats.images = count - stats.errors;
+	stats.images_per_second = stats.seconds > 0 ? stats.images / stats.seconds : 0.0;
+
+	for(int s = 0; s < 4; s++){
+		stats.stages[s].name = names[s];
+		stats.stages[s].threads = options.threads[s];
+		stats.stages[s].busy = busy[s] * 1e-9;
+		stats.stages[s].queue_average = 0.0;
+		stats.stages[s].queue_max = 0;
+		stats.stages[s].queue_capacity = 0;
+		stats.stages[s].failed = failed[s];
+	}
+	generated.report(stats.stages[1]);
+	rendered.report(stats.stages[2]);
+	encoded.report(stats.stages[3]);
+
+	stats.screening = screening;
+	stats.saved_seconds = (count > 0) ? stats.stages[1].busy * screening.saved_pixels / (count*options.width*options.height) : 0.0;
+
+	return stats;
+}
+
+
+
+/********************************************************************************************************************************
+* Print the metrics of a gallery generation
+*
+* ARGUMENTS :
+*	- out is the output stream
+*	- stats are the metrics to print
+**********************************************************************************************************************************/
+std::ostream& operator<<(std::ostream& out, const GalleryStats& stats){
+
+	out << stats.images << " image(s) in " << std::fixed << std::setprecision(3) << stats.seconds << " s : "
+		<< std::setprecision(1) << stats.images_per_second << " images/s (" << kernel_isa_name(profile_kernel_isa(machine_tuning_profile())) << " kernels)";
+	if(stats.errors > 0)
+		out << ", " << stats.errors << " failed";
+	out << std::endl;
+
+	for(int s = 0; s < 4; s++){
+		const StageStats& stage = stats.stages[s];
+		out << "  " << std::setw(8) << std::left << stage.name << std::right << " : " << stage.threads << " thread(s), busy "
+			<< std::setprecision(3) << stage.busy << " s";
+		if(stage.failed > 0)
+			out << ", " << stage.failed << " failed";
+		if(stage.queue_capacity > 0)
+			out << ", input queue " << std::setprecision(1) << stage.queue_average << " / " << stage.queue_capacity
+				<< " on average (max " << stage.queue_max << ")";
+		out << std::endl;
+	}
+
+	const ScreeningStats& screening = stats.screening;
+	if(screening.candidates > 0){
+		out << "  screening : " << screening.rejected << " of " << screening.candidates << " candidate(s) rejected ("
+			<< std::setprecision(1) << 100.0*screening.rejected/screening.candidates << " %), " << screening.saved_pixels
+			<< " pixels of full renders saved for " << screening.probe_pixels << " probed, about " << std::setprecision(3)
+			<< stats.saved_seconds << " s of rendering" << std::endl;
+	}
+
+	out.unsetf(std::ios::floatfield);
+	return out;
+}
@@ -0,0 +1,67 @@
+#ifndef GUARD_pipeline_h
+#define GUARD_pipeline_h
+
+#include "png.hpp"
+#include "probe.hpp"
+
+#include <string>
+#include <iostream>
+#include <cstddef>
+
+
+struct GalleryOptions // Settings of a gallery generation
+{
+	size_t count; // Number of images
+	size_t width;
+	size_t height;
+	int min_depth; // Depth of each colour expression, drawn in [min_depth, max_depth]
+	int max_depth;
+	size_t max_nodes; // Node budget of each colour expression (UNLIMITED_NODES by default)
+	double cost; // Cost of each colour expression (see expression_cost), drawn instead of the depth when positive (0 by default)
+	double cost_tolerance; // Largest relative difference between the cost of an expression and the cost wanted
+	unsigned int seed; // Image i only depends on the seed and i, whatever the number of threads
+	std::string prefix; // Images are written to <prefix><number>.ppm, or .png
+	bool png; // Encode as PNG rather than PPM
+	PngMode png_mode;
+	int candidates; // Candidates probed per image before the full size render (1 disables the screening)
+	ProbeThresholds thresholds; // Scores a candidate must reach
+	int surrogate_degree; // Maximum degree of the Chebyshev surrogates of the colour expressions (0 disables them)
+	int surrogate_tolerance; // Bytes a component computed by a surrogate may differ by
+	size_t threads[4]; // Threads of the generation, rendering, encoding and writing stages
+	size_t queue_capacity; // Capacity of the queues between the stages
+	size_t buffers; // Number of image buffers shared by the rendering and encoding stages
+};
+
+GalleryOptions default_gallery_options(); // Default settings : 100 PPM images of 256x256, depths in [4,10]
+
+
+
+struct StageStats // Metrics of a stage of the pipeline
+{
+	const char* name;
+	size_t threads;
+	double busy; // Seconds spent working, all threads together
+	double queue_average; // Average number of items waiting in the input queue of the stage, sampled at each pop
+	size_t queue_max;
+	size_t queue_capacity;
+	size_t failed; // Items the stage failed on, passed on to the next stages as failed
+};
+
+struct GalleryStats // Metrics of a gallery generation
+{
+	size_t images; // Number of images written
+	size_t errors; // Images not written, whatever the stage that failed
+	double seconds;
+	double images_per_second;
+	StageStats stages[4];
+	ScreeningStats screening;
+	double saved_seconds; // Render time avoided by the screening, estimated from the pixels saved and the rendering speed
+};
+
+std::ostream& operator<<(std::ostream& out, const GalleryStats& stats); // Print the metrics of a gallery generation
+
+
+
+GalleryStats generate_gallery(const GalleryOptions& options); // Generate, render, encode and write random images, the four stages overlapping
+
+#endif
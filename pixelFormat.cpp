@@ -0,0 +1,267 @@
+#include "pixelFormat.hpp"
+#include "kernels.hpp"
+
+#include <cstddef>
+#include <cstring> //memcpy
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+static const size_t STAGING = 64; // Pixels quantized at once before being interleaved
+
+
+
+/********************************************************************************************************************************
+* Size of a pixel in the buffer (all the planes included). The buffer of an image holds width*height*bytes_per_pixel bytes.
+*
+* ARGUMENTS :
+*	- format is the layout of the buffer
+**********************************************************************************************************************************/
+size_t bytes_per_pixel(PixelFormat format){
+
+	switch(format){
+		case RGBA8 :
+		case BGRA8 :
+			return 4;
+		case RGB16 :
+			return 6;
+		case RGB_FLOAT32 :
+			return 12;
+		default :
+			return 3;
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Scale n values in [-1,1] to bytes : 0 gives 0 (black), any other value gives 255/2*(value+1)
+* truncated, in the vector kernels of the processor.
+*
+* ARGUMENTS :
+*	- values are the values to scale
+*	- n is the number of values
+*	- out receives the n bytes
+*	- kernel are the kernels of the quantization (the active ones by default)
+**********************************************************************************************************************************/
+void quantize(const double* values, size_t n, unsigned char* out, const Kernels& kernel){
+	kernel.quantize(values, n, out);
+}
+
+
+
+/********************************************************************************************************************************
+* Scale a value in [-1,1] to 16 bits, as quantize does to 8 bits (0 stays 0)
+*
+* ARGUMENTS :
+*	- value is the value to scale
+**********************************************************************************************************************************/
+static inline uint16_t quantize16(double value){
+	return (value == 0.0) ? 0 : (uint16_t)(65535/2.0 * (value + 1));
+}
+
+
+
+/********************************************************************************************************************************
+* Interleave n bytes of each component in an 8-bit interleaved layout (RGB8, RGBA8 or BGRA8), the alpha being opaque
+*
+* ARGUMENTS :
+*	- format is the layout of the buffer
+*	- red, green and blue are the bytes of the n pixels
+*	- n is the number of pixels
+*	- out receives the n pixels
+**********************************************************************************************************************************/
+static void interleave(PixelFormat format, const unsigned char* red, const unsigned char* green, const unsigned char* blue,
+	size_t n, unsigned char* out){
+
+	const size_t size = bytes_per_pixel(format);
+	const size_t r = (format == BGRA8) ? 2 : 0;
+	const size_t b = (format == BGRA8) ? 0 : 2;
+
+	for(size_t i = 0; i < n; i++, out += size){
+		out[r] = red[i];
+		out[1] = green[i];
+		out[b] = blue[i];
+		if(size == 4)
+			out[3] = 255;
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Write n consecutive pixels of an interleaved layout (all but PLANAR_RGB8) : the 8-bit layouts quantize the values by batches
+* before interleaving them.
+*
+* ARGUMENTS :
+*	- format is the layout of the buffer
+*	- red, green and blue are the values of the n pixels
+*	- n is the number of pixels
+*	- out receives the n pixels
+*	- kernel are the kernels of the quantization
+**********************************************************************************************************************************/
+static void write_pixels(PixelFormat format, const double* red, const double* green, const double* blue, size_t n,
+	unsigned char* out, const Kernels& kernel){
+
+	if(format == RGB16){
+		uint16_t* words = reinterpret_cast<uint16_t*>(out);
+		for(size_t i = 0; i < n; i++){
+			words[3*i] = quantize16(red[i]);
+			words[3*i+1] = quantize16(green[i]);
+			words[3*i+2] = quantize16(blue[i]);
+		}
+		return;
+	}
+
+	if(format == RGB_FLOAT32){
+		float* floats = reinterpret_cast<float*>(out);
+		for(size_t i = 0; i < n; i++){
+			floats[3*i] = (float)red[i];
+			floats[3*i+1] = (float)green[i];
+			floats[3*i+2] = (float)blue[i];
+		}
+		return;
+	}
+
+	// Interleaved bytes : quantize a batch of each component, then interleave it
+	unsigned char bytes[3][STAGING];
+
+	for(size_t first = 0; first < n; first += STAGING){
+
+		size_t count = (n - first < STAGING) ? n - first : STAGING;
+
+		kernel.quantize(red + first, count, bytes[0]);
+		kernel.quantize(green + first, count, bytes[1]);
+		kernel.quantize(blue + first, count, bytes[2]);
+
+		interleave(format, bytes[0], bytes[1], bytes[2], count, out + bytes_per_pixel(format)*first);
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Copy bytes with non-temporal stores, which go straight to the memory instead of first reading the destination in the caches
+* and evicting other data from them. The bytes before the first 16-byte boundary and after the last one are copied normally.
+*
+* ARGUMENTS :
+*	- out is the destination
+*	- in are the bytes to copy
+*	- size is the number of bytes
+**********************************************************************************************************************************/
+static void stream_copy(unsigned char* out, const unsigned char* in, size_t size){
+
+#ifdef __SSE2__
+	size_t head = (16 - (uintptr_t)out % 16) % 16;
+	if(head > size)
+		head = size;
+	std::memcpy(out, in, head);
+
+	size_t i = head;
+	for(; i + 16 <= size; i += 16)
+		_mm_stream_si128(reinterpret_cast<__m128i*>(out + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+
+	std::memcpy(out + i, in + i, size - i);
+#else
+	std::memcpy(out, in, size);
+#endif
+}
+
+
+
+/********************************************************************************************************************************
+* Make the streaming stores of the calling thread visible before its next stores (at the end of a tile)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+void stream_fence(){
+#ifdef __SSE2__
+	_mm_sfence();
+#endif
+}
+
+
+
+/********************************************************************************************************************************
+* Write n consecutive pixels of a row directly in the layout of the buffer. The 8-bit layouts quantize the values by batches,
+* the planar one straight into its planes.
+*
+* ARGUMENTS :
+*	- format is the layout of the buffer
+*	- red, green and blue are the values of the n pixels
+*	- n is the number of pixels
+*	- buffer, width and height describe the image
+*	- x and y are the position of the first pixel
+*	- kernel are the kernels of the quantization (the active ones by default)
+**********************************************************************************************************************************/
+void store_pixels(PixelFormat format, const double* red, const double* green, const double* blue, size_t n,
+	unsigned char* buffer, size_t width, size_t height, size_t x, size_t y, const Kernels& kernel){
+
+	size_t pixel = y*width + x;
+
+	if(format == PLANAR_RGB8){
+		size_t plane = width*height;
+		kernel.quantize(red, n, buffer + pixel);
+		kernel.quantize(green, n, buffer + plane + pixel);
+		kernel.quantize(blue, n, buffer + 2*plane + pixel);
+		return;
+	}
+
+	write_pixels(format, red, green, blue, n, buffer + bytes_per_pixel(format)*pixel, kernel);
+}
+
+
+
+/********************************************************************************************************************************
+* Write n consecutive pixels of a row of an 8-bit layout from their bytes, already quantized
+*
+* ARGUMENTS :
+*	- format is the layout of the buffer (RGB8, RGBA8, BGRA8 or PLANAR_RGB8)
+*	- red, green and blue are the bytes of the n pixels
+*	- n is the number of pixels
+*	- buffer, width and height describe the image
+*	- x and y are the position of the first pixel
+**********************************************************************************************************************************/
+void store_bytes(PixelFormat format, const unsigned char* red, const unsigned char* green, const unsigned char* blue, size_t n,
+	unsigned char* buffer, size_t width, size_t height, size_t x, size_t y){
+
+	size_t pixel = y*width + x;
+
+	if(format == PLANAR_RGB8){
+		size_t plane = width*height;
+		std::memcpy(buffer + pixel, red, n);
+		std::memcpy(buffer + plane + pixel, green, n);
+		std::memcpy(buffer + 2*plane + pixel, blue, n);
+		return;
+	}
+
+	interleave(format, red, green, blue, n, buffer + bytes_per_pixel(format)*pixel);
+}
+
+
+
+/********************************************************************************************************************************
+* Copy a row of pixels to the buffer with non-temporal stores, for buffers too large to stay in the caches and which the render
+* won't read back : the row is first written with store_pixels in a buffer of one row (width x 1), then streamed at once, so
+* that only its first and last cache lines are partial. Call stream_fence() before signalling that the rows are written.
+*
+* ARGUMENTS :
+*	- format is the layout of the buffer
+*	- row is the buffer of one row, in the same layout
+*	- buffer, width and height describe the image
+*	- y is the row to write
+**********************************************************************************************************************************/
+void stream_row(PixelFormat format, const unsigned char* row, unsigned char* buffer, size_t width, size_t height, size_t y){
+
+	if(format == PLANAR_RGB8){
+		for(size_t c = 0; c < 3; c++)
+			stream_copy(buffer + c*width*height + y*width, row + c*width, width);
+		return;
+	}
+
+	const size_t size = bytes_per_pixel(format)*width;
+	stream_copy(buffer + y*size, row, size);
+}
@@ -0,0 +1,36 @@
+#ifndef GUARD_pixelFormat_h
+#define GUARD_pixelFormat_h
+
+#include "kernels.hpp"
+
+#include <cstddef>
+
+
+enum PixelFormat // Layout of the image buffer
+{
+	RGB8, // Interleaved red, green, blue bytes (the default)
+	RGBA8, // Interleaved red, green, blue and an opaque alpha byte
+	BGRA8, // Interleaved blue, green, red and an opaque alpha byte
+	PLANAR_RGB8, // A plane of red bytes, then the green plane and the blue plane (the layout of CImg)
+	RGB16, // Interleaved red, green, blue 16-bit values, in the native byte order
+	RGB_FLOAT32 // Interleaved red, green, blue floats, the raw values of the expressions in [-1,1]
+};
+
+
+size_t bytes_per_pixel(PixelFormat format); // Size of a pixel in the buffer (all the planes included)
+
+void quantize(const double* values, size_t n, unsigned char* out, const Kernels& kernel = kernels()); // Scale n values in [-1,1] to bytes, 255/2*(value+1) truncated and 0 staying black
+
+void store_pixels(PixelFormat format, const double* red, const double* green, const double* blue, size_t n,
+	unsigned char* buffer, size_t width, size_t height, size_t x, size_t y,
+	const Kernels& kernel = kernels()); // Write n consecutive pixels of a row, starting at (x,y)
+
+void store_bytes(PixelFormat format, const unsigned char* red, const unsigned char* green, const unsigned char* blue, size_t n,
+	unsigned char* buffer, size_t width, size_t height, size_t x, size_t y); // Write n consecutive pixels of a row of an 8-bit layout from their bytes
+
+void stream_row(PixelFormat format, const unsigned char* row, unsigned char* buffer, size_t width, size_t height,
+	size_t y); // Copy a row written in a buffer of one row to the row y, with non-temporal stores
+
+void stream_fence(); // Make the streaming stores of the calling thread visible before its next stores
+
+#endif
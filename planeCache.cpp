@@ -0,0 +1,329 @@
+#include "planeCache.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "program.hpp"
+#include "pixelFormat.hpp"
+#include "threadPool.hpp"
+#include "kernels.hpp"
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <algorithm> //std::sort, std::copy, std::fill, std::equal, std::min, std::max
+#include <functional> //std::greater
+#include <stdexcept> //domain_error
+#include <math.h> //M_PI
+
+
+using std::vector;
+
+
+static const size_t MIN_PLANE_NODES = 4; // Smallest sub-expression whose plane is kept : reading a plane costs about one opcode
+static const uint64_t HASH_SEED = 14695981039346656037ULL; // FNV offset basis
+
+
+
+/********************************************************************************************************************************
+* Constructor
+*
+* ARGUMENTS :
+*	- buffer is an interleaved RGB8 buffer of width*height pixels
+*	- width and height are the dimensions of the buffer (in pixels)
+*	- budget is the memory of the planes kept, in bytes, shared equally by the three channels (a plane takes 8 bytes a pixel)
+*	- viewport is the part of the domain drawn in the buffer, as in a Martist
+**********************************************************************************************************************************/
+PlaneCache::PlaneCache(unsigned char* buffer, size_t width, size_t height, size_t budget, const Viewport& viewport) :
+	buffer(buffer),
+	width(width),
+	height(height),
+	budget(budget),
+	x(width*height),
+	y(width*height),
+	channels(),
+	counters()
+{
+	if(buffer == nullptr)
+		throw std::domain_error("ERROR : Buffer is empty.");
+
+	if((int)width <= 0 || (int)height <= 0)
+		throw std::domain_error("ERROR : Width or height can't be negative.");
+
+	if(!(viewport.x_min < viewport.x_max) || !(viewport.y_min < viewport.y_max))
+		throw std::domain_error("ERROR : Viewport is empty.");
+
+	viewport_grid(viewport, width, height, x.data(), y.data());
+
+	for(int c = 0; c < 3; c++)
+		channels[c].drawn = false;
+}
+
+
+
+/********************************************************************************************************************************
+* Draw the colour expressions in the buffer. A channel whose expression didn't change isn't evaluated again, the others reuse
+* the planes of the sub-expressions they share with the previous expression.
+*
+* ARGUMENTS :
+*	- red, green and blue are the colour expressions
+**********************************************************************************************************************************/
+void PlaneCache::draw(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue){
+
+	const ColorExpression* exps[3] = {&red, &green, &blue};
+	PlaneStats total = {0, 0, 0, 0, 0, 0};
+
+	for(int c = 0; c < 3; c++){
+
+		total.nodes += exps[c]->compiled().info().nodes;
+		if(channels[c].drawn && exps[c]->compiled().code() == channels[c].exp.compiled().code())
+			continue;
+
+		channels[c].exp = *exps[c];
+		render(c);
+		total.evaluated += counters.evaluated;
+		total.reused += counters.reused;
+		total.computed += counters.computed;
+	}
+
+	counters.nodes = total.nodes;
+	counters.evaluated = total.evaluated;
+	counters.reused = total.reused;
+	counters.computed = total.computed;
+}
+
+
+
+/********************************************************************************************************************************
+* Replace a sub-expression of a channel and draw the channel again : the planes of the sub-expressions left untouched are read,
+* so only the opcodes of the new sub-expression and of its ancestors are evaluated (those of the sub-expressions too small to
+* have a plane too)
+*
+* ARGUMENTS :
+*	- channel is the channel edited (0 for red, 1 for green, 2 for blue)
+*	- node is the last opcode of the sub-expression to replace, in reverse polish notation (see Program::subtree_starts)
+*	- subtree is the expression put in its place
+**********************************************************************************************************************************/
+void PlaneCache::edit(int channel, size_t node, const ColorExpression& subtree){
+
+	if(channel < 0 || channel > 2)
+		throw std::domain_error("ERROR : Channel must be in [0,2].");
+
+	channels[channel].exp.replace_subtree(node, subtree);
+	render(channel);
+	counters.nodes = channels[channel].exp.compiled().info().nodes;
+}
+
+
+
+/********************************************************************************************************************************
+* Expression of a channel
+*
+* ARGUMENT :
+*	- channel is the channel (0 for red, 1 for green, 2 for blue)
+**********************************************************************************************************************************/
+const ColorExpression& PlaneCache::expression(int channel) const{
+
+	if(channel < 0 || channel > 2)
+		throw std::domain_error("ERROR : Channel must be in [0,2].");
+
+	return channels[channel].exp;
+}
+
+
+
+/********************************************************************************************************************************
+* Work of the last draw or edit
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const PlaneStats& PlaneCache::stats() const{
+	return counters;
+}
+
+
+
+/********************************************************************************************************************************
+* Evaluate a channel over the buffer.
+*
+* Every sub-expression is found by a hash of its opcodes, so a sub-expression an edit left untouched keeps its plane wherever
+* it moved. A plane is only read if the opcodes kept with it are the ones of the sub-expression : two sub-expressions of the
+* same hash never share a plane. The sub-expressions whose plane is kept are the operands of avg and * : after an edit, the ancestors of the
+* new sub-expression are evaluated again and need the values of their other operand. The largest ones are kept within the
+* budget of the channel, never smaller than MIN_PLANE_NODES opcodes. The opcodes are then run as in Program::evaluate, by
+* blocks of pixels on the thread pool of the library, but a sub-expression with a plane is read from it instead, and the
+* planes of the selected sub-expressions evaluated are written on the way. The values, hence the bytes, are exactly the ones
+* of a Martist (which flushes the subnormal values to 0 by default).
+*
+* ARGUMENT :
+*	- channel is the channel (0 for red, 1 for green, 2 for blue)
+**********************************************************************************************************************************/
+void PlaneCache::render(int channel){
+
+	Channel& state = channels[channel];
+	const Program& program = state.exp.compiled();
+	const vector<Opcode>& ops = program.code();
+	const vector<size_t> start = program.subtree_starts();
+	const size_t n = width*height;
+	const size_t count = ops.size();
+
+	// Hash of each sub-expression, from the ones of its operands
+	vector<uint64_t> hashes(count);
+	for(size_t i = 0; i < count; i++){
+		if(ops[i] <= OP_PI)
+			hashes[i] = hash_combine(HASH_SEED, ops[i]);
+		else if(ops[i] <= OP_COS)
+			hashes[i] = hash_combine(hashes[i-1], ops[i]);
+		else
+			hashes[i] = hash_combine(hash_combine(hashes[start[i-1]-1], hashes[i-1]), ops[i]);
+	}
+
+	// The operands of avg and * are the siblings an edit below them needs, the larger ones being kept within the budget
+	vector<char> operand(count, 0);
+	for(size_t i = 0; i < count; i++){
+		if(ops[i] >= OP_AVG){
+			operand[i-1] = 1;
+			operand[start[i-1]-1] = 1;
+		}
+	}
+
+	const size_t max_planes = budget/3/(n*sizeof(double));
+	vector<size_t> sizes;
+	for(size_t i = 0; i < count; i++)
+		if(operand[i] && i - start[i] + 1 >= MIN_PLANE_NODES)
+			sizes.push_back(i - start[i] + 1);
+
+	size_t threshold = MIN_PLANE_NODES;
+	if(sizes.size() > max_planes){
+		std::sort(sizes.begin(), sizes.end(), std::greater<size_t>());
+		threshold = sizes[max_planes] + 1;
+	}
+
+	vector<char> selected(count, 0);
+	for(size_t i = 0; i < count; i++)
+		selected[i] = operand[i] && (i - start[i] + 1 >= threshold);
+
+	// Plane of the sub-expression ending at opcode i in a set of planes, if its opcodes are the same
+	auto find = [&](Planes& in, size_t i) -> Plane*{
+		Planes::iterator it = in.find(hashes[i]);
+		if(it == in.end() || it->second.code.size() != i - start[i] + 1
+			|| !std::equal(it->second.code.begin(), it->second.code.end(), ops.begin() + start[i]))
+			return nullptr;
+		return &it->second;
+	};
+
+	// The outermost sub-expression with a plane starting at each opcode is read instead of evaluated
+	vector<size_t> skip(count, count);
+	for(size_t i = 0; i < count; i++)
+		if(selected[i] && find(state.planes, i) && (skip[start[i]] == count || skip[start[i]] < i))
+			skip[start[i]] = i;
+
+	// The selected sub-expressions evaluated write their plane
+	Planes planes;
+	vector<double*> writes(count, nullptr);
+	vector<const double*> reads(count, nullptr); // Plane read at the first opcode of a sub-expression
+	vector<size_t> jumps(count, count); // Last opcode of that sub-expression
+	size_t evaluated = 0;
+
+	for(size_t i = 0; i < count; i++){
+		const Plane* kept = selected[i] ? find(state.planes, i) : nullptr;
+		if(kept)
+			planes[hashes[i]] = *kept;
+	}
+
+	for(size_t i = 0; i < count;){
+		if(skip[i] < count){
+			jumps[i] = skip[i];
+			reads[i] = find(planes, skip[i])->values->data();
+			i = skip[i] + 1;
+			continue;
+		}
+		// A sub-expression whose hash is the one of another plane of the channel gets no plane
+		if(selected[i] && !planes.count(hashes[i])){
+			Plane& plane = planes[hashes[i]];
+			plane.code.assign(ops.begin() + start[i], ops.begin() + i + 1);
+			plane.values = std::make_shared<vector<double> >(n);
+			writes[i] = plane.values->data();
+		}
+		evaluated++;
+		i++;
+	}
+
+	size_t reused = 0, computed = 0;
+	for(size_t i = 0; i < count; i++){
+		reused += (jumps[i] < count);
+		computed += (writes[i] != nullptr);
+	}
+
+	// Evaluation by blocks, the stack rows of a block staying in the cache, with the subnormals flushed as in a Martist
+	DenormalFlush flush;
+	const size_t block = program.evaluation_block();
+	const size_t blocks = (n + block - 1)/block;
+	const Kernels& kernel = kernels();
+
+	ThreadPool::global().run(blocks, [&](size_t b){
+
+		const size_t first = b*block;
+		const size_t m = std::min(block, n - first);
+		const double* bx = x.data() + first;
+		const double* by = y.data() + first;
+
+		static thread_local vector<double> scratch;
+		static thread_local vector<unsigned char> bytes;
+		if(scratch.size() < program.stack_height()*block)
+			scratch.resize(program.stack_height()*block);
+		if(bytes.size() < block)
+			bytes.resize(block);
+
+		double* top = scratch.data() - m;
+
+		for(size_t i = 0; i < count;){
+
+			if(jumps[i] < count){
+				const double* plane = reads[i] + first;
+				top += m;
+				std::copy(plane, plane + m, top);
+				i = jumps[i] + 1;
+				continue;
+			}
+
+			switch(ops[i]){
+				case OP_ZERO : top += m; std::fill(top, top + m, 0.0);
+					break;
+				case OP_X : top += m; std::copy(bx, bx + m, top);
+					break;
+				case OP_Y : top += m; std::copy(by, by + m, top);
+					break;
+				case OP_PI : top += m; std::fill(top, top + m, M_PI);
+					break;
+				case OP_SIN : kernel.sin(top, m);
+					break;
+				case OP_COS : kernel.cos(top, m);
+					break;
+				case OP_AVG : kernel.average(top - m, top, m); top -= m;
+					break;
+				case OP_TIMES : kernel.times(top - m, top, m); top -= m;
+					break;
+			}
+
+			if(writes[i])
+				std::copy(top, top + m, writes[i] + first);
+			i++;
+		}
+
+		kernel.quantize(top, m, bytes.data());
+		unsigned char* out = buffer + 3*first + channel;
+		for(size_t k = 0; k < m; k++)
+			out[3*k] = bytes[k];
+	});
+
+	state.planes.swap(planes);
+	state.drawn = true;
+
+	counters.nodes = count;
+	counters.evaluated = evaluated;
+	counters.reused = reused;
+	counters.computed = computed;
+	counters.planes = 0;
+	for(int c = 0; c < 3; c++)
+		counters.planes += channels[c].planes.size();
+	counters.bytes = counters.planes*n*sizeof(double);
+}
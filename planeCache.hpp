@@ -0,0 +1,76 @@
+#ifndef GUARD_planeCache_h
+#define GUARD_planeCache_h
+
+#include "martist.hpp"
+#include "colorExpression.hpp"
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstddef>
+#include <stdint.h>
+
+
+struct PlaneStats // Work of the last render of a PlaneCache
+{
+	size_t nodes; // Opcodes of the expressions rendered
+	size_t evaluated; // Opcodes applied at every pixel (the others were read from planes)
+	size_t reused; // Planes read instead of evaluating their sub-expression
+	size_t computed; // Planes written
+	size_t planes; // Planes kept, all channels together
+	size_t bytes; // Memory of the planes kept
+};
+
+
+
+class PlaneCache // Renders colour expressions keeping the value planes of their larger sub-expressions, to render edits incrementally
+{
+
+public:
+
+	PlaneCache(unsigned char* buffer, size_t width, size_t height, size_t budget,
+		const Viewport& viewport = {-1.0, 1.0, -1.0, 1.0}); // Constructor (RGB8 buffer, budget of the planes in bytes)
+
+	void draw(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue); // Draw the expressions, the unchanged channels being kept
+
+	void edit(int channel, size_t node, const ColorExpression& subtree); // Replace the sub-expression ending at opcode node of a channel (0 to 2) and draw it again
+
+	const ColorExpression& expression(int channel) const; // Expression of a channel (0 for red, 1 for green, 2 for blue)
+
+	const PlaneStats& stats() const; // Work of the last draw or edit
+
+
+private:
+
+	struct Plane // Values of a sub-expression, one per pixel
+	{
+		std::vector<Opcode> code; // Opcodes of the sub-expression, compared before the plane is read (the hash only finds it)
+		std::shared_ptr<std::vector<double> > values;
+	};
+
+	typedef std::unordered_map<uint64_t, Plane> Planes; // Planes by hash of the opcodes of their sub-expression
+
+	struct Channel
+	{
+		ColorExpression exp;
+		bool drawn; // The buffer holds the channel of exp
+		Planes planes; // Planes of the selected sub-expressions
+	};
+
+	unsigned char* buffer;
+	size_t width;
+	size_t height;
+	size_t budget;
+	std::vector<double> x; // Coordinates of the pixels, as in a Martist
+	std::vector<double> y;
+	Channel channels[3];
+	PlaneStats counters;
+
+	void render(int channel); // Evaluate a channel, reading the planes kept and writing the missing ones
+
+	PlaneCache(const PlaneCache&) = delete;
+	PlaneCache& operator=(const PlaneCache&) = delete;
+
+};
+
+#endif
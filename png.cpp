@@ -0,0 +1,950 @@
+#include "png.hpp"
+#include "image.hpp"
+#include "threadPool.hpp"
+
+#include <string>
+#include <vector>
+#include <algorithm> //std::sort, std::min
+#include <cstring> //memcpy
+#include <cstdlib> //abs
+#include <cerrno>
+#include <stdint.h>
+#include <stdexcept> //domain_error
+#include <unistd.h> //write
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using std::string;
+using std::vector;
+
+typedef vector<unsigned char> Bytes;
+
+
+static const size_t BAND_BYTES = 256*1024; // Filtered bytes compressed by a task, which fixes the output whatever the threads
+static const size_t WINDOW = 32768;
+static const size_t MIN_MATCH = 3;
+static const size_t MAX_MATCH = 258;
+static const size_t HASH_BITS = 15;
+static const int MAX_CHAIN = 32; // Candidates tried by PNG_DEFAULT at each position
+static const size_t LAZY_LENGTH = 32; // PNG_DEFAULT looks one position ahead for matches shorter than this
+static const size_t BLOCK_TOKENS = 32768; // Tokens per dynamic block, so the codes follow the statistics of the band
+
+
+
+/********************************************************************************************************************************
+* Tables of the deflate format and of the CRC-32, built once
+**********************************************************************************************************************************/
+static const uint16_t LENGTH_BASE[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const unsigned char LENGTH_EXTRA[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t DISTANCE_BASE[30] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,
+	6145,8193,12289,16385,24577};
+static const unsigned char DISTANCE_EXTRA[30] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+static const unsigned char CODE_LENGTH_ORDER[19] = {16,17,18,0,8,7,9,6,10,5,11,4,12,3,13,2,14,1,15};
+
+struct Tables
+{
+	unsigned char length_code[MAX_MATCH+1]; // Index in LENGTH_BASE of each match length
+	unsigned char distance_code[WINDOW+1]; // Index in DISTANCE_BASE of each distance
+	uint32_t crc[256];
+
+	Tables(){
+		for(int code = 0; code < 29; code++){
+			for(size_t length = LENGTH_BASE[code]; length < LENGTH_BASE[code] + (1u << LENGTH_EXTRA[code]) && length <= MAX_MATCH; length++)
+				length_code[length] = code;
+		}
+		length_code[MAX_MATCH] = 28;
+
+		for(int code = 0; code < 30; code++){
+			for(size_t distance = DISTANCE_BASE[code]; distance < DISTANCE_BASE[code] + (1u << DISTANCE_EXTRA[code]); distance++)
+				distance_code[distance] = code;
+		}
+
+		for(uint32_t n = 0; n < 256; n++){
+			uint32_t c = n;
+			for(int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			crc[n] = c;
+		}
+	}
+};
+
+static const Tables& tables(){
+
+	static const Tables instance;
+	return instance;
+}
+
+
+
+/********************************************************************************************************************************
+* Checksums of the PNG chunks (CRC-32) and of the zlib stream (Adler-32)
+**********************************************************************************************************************************/
+static uint32_t crc32(uint32_t crc, const unsigned char* data, size_t n){
+
+	const uint32_t* table = tables().crc;
+
+	crc = ~crc;
+	for(size_t i = 0; i < n; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+static const uint32_t ADLER_BASE = 65521;
+
+static uint32_t adler32(const unsigned char* data, size_t n){
+
+	uint32_t a = 1, b = 0;
+
+	while(n > 0){
+		size_t block = std::min<size_t>(n, 5552); // Largest block whose sums can't overflow
+		for(size_t i = 0; i < block; i++){
+			a += data[i];
+			b += a;
+		}
+		a %= ADLER_BASE;
+		b %= ADLER_BASE;
+		data += block;
+		n -= block;
+	}
+
+	return (b << 16) | a;
+}
+
+// Adler-32 of the concatenation of two blocks, from their own checksums and the size of the second one
+static uint32_t adler32_combine(uint32_t first, uint32_t second, size_t second_size){
+
+	uint32_t remainder = second_size % ADLER_BASE;
+	uint32_t a = first & 0xFFFF;
+	uint32_t b = (uint32_t)(((uint64_t)remainder * a) % ADLER_BASE);
+
+	a += (second & 0xFFFF) + ADLER_BASE - 1;
+	b += (first >> 16) + (second >> 16) + ADLER_BASE - remainder;
+	if(a >= ADLER_BASE) a -= ADLER_BASE;
+	if(a >= ADLER_BASE) a -= ADLER_BASE;
+	if(b >= 2*ADLER_BASE) b -= 2*ADLER_BASE;
+	if(b >= ADLER_BASE) b -= ADLER_BASE;
+
+	return (b << 16) | a;
+}
+
+static void put32(Bytes& out, uint32_t value){ // Big-endian, as everything in PNG
+
+	out.push_back(value >> 24);
+	out.push_back(value >> 16);
+	out.push_back(value >> 8);
+	out.push_back(value);
+}
+
+
+
+/********************************************************************************************************************************
+* Rows of the image in the PNG layout : RGB or RGBA bytes, or big-endian 16-bit RGB values
+**********************************************************************************************************************************/
+struct Layout
+{
+	unsigned char bit_depth;
+	unsigned char color_type; // 2 for RGB, 6 for RGBA
+	size_t bpp; // Bytes per pixel, the distance used by the filters
+	size_t stride; // Bytes per row, the filter type excluded
+};
+
+static Layout png_layout(PixelFormat format, size_t width){
+
+	Layout layout;
+
+	switch(format){
+		case RGB8: case PLANAR_RGB8: layout.bit_depth = 8; layout.color_type = 2; layout.bpp = 3; break;
+		case RGBA8: case BGRA8: layout.bit_depth = 8; layout.color_type = 6; layout.bpp = 4; break;
+		case RGB16: layout.bit_depth = 16; layout.color_type = 2; layout.bpp = 6; break;
+		default: throw std::domain_error("ERROR : This pixel format can't be written as PNG.");
+	}
+
+	layout.stride = layout.bpp*width;
+	return layout;
+}
+
+static void png_row(PixelFormat format, const unsigned char* pixels, size_t width, size_t height, size_t y, unsigned char* row){
+
+	switch(format){
+
+		case RGB8: case RGBA8:
+			std::memcpy(row, pixels + y*width*bytes_per_pixel(format), width*bytes_per_pixel(format));
+			break;
+
+		case BGRA8:
+			for(const unsigned char* in = pixels + 4*y*width, *end = in + 4*width; in != end; in += 4, row += 4){
+				row[0] = in[2]; row[1] = in[1]; row[2] = in[0]; row[3] = in[3];
+			}
+			break;
+
+		case PLANAR_RGB8:
+			for(size_t x = 0, plane = width*height, pixel = y*width; x < width; x++, pixel++){
+				row[3*x] = pixels[pixel];
+				row[3*x+1] = pixels[plane + pixel];
+				row[3*x+2] = pixels[2*plane + pixel];
+			}
+			break;
+
+		default: //RGB16
+			const uint16_t* in = reinterpret_cast<const uint16_t*>(pixels) + 3*y*width;
+			for(size_t i = 0; i < 3*width; i++){
+				row[2*i] = in[i] >> 8;
+				row[2*i+1] = in[i] & 0xFF;
+			}
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Filter a row with the five PNG filters and keep the one whose bytes, read as signed, have the smallest absolute sum (the
+* heuristic advised by the PNG specification). With SSE2, sixteen bytes of every filter are computed at once.
+*
+* ARGUMENTS :
+*	- row and above are the row and the previous one (zeros for the first row of the image)
+*	- stride and bpp are the bytes per row and per pixel
+*	- candidates holds 5*stride bytes of scratch
+*	- out receives the filter type followed by the filtered row
+**********************************************************************************************************************************/
+static inline unsigned char paeth(int a, int b, int c){
+
+	int pa = std::abs(b - c), pb = std::abs(a - c), pc = std::abs(a + b - 2*c);
+	return (pa <= pb && pa <= pc) ? a : (pb <= pc) ? b : c;
+}
+
+static inline unsigned int magnitude(unsigned char byte){
+
+	return byte < 128 ? byte : 256 - byte;
+}
+
+#ifdef __SSE2__
+static inline __m128i abs16(__m128i x){
+
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+
+static inline __m128i select(__m128i mask, __m128i yes, __m128i no){
+
+	return _mm_or_si128(_mm_and_si128(mask, yes), _mm_andnot_si128(mask, no));
+}
+
+static inline __m128i paeth16(__m128i a, __m128i b, __m128i c){ // Eight 16-bit lanes
+
+	__m128i pa = abs16(_mm_sub_epi16(b, c));
+	__m128i pb = abs16(_mm_sub_epi16(a, c));
+	__m128i pc = abs16(_mm_sub_epi16(_mm_add_epi16(a, b), _mm_add_epi16(c, c)));
+
+	__m128i not_a = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+	__m128i not_b = _mm_cmpgt_epi16(pb, pc);
+	return select(not_a, select(not_b, c, b), a);
+}
+
+static inline __m128i magnitude_sum(__m128i bytes){ // Two partial sums of the magnitudes of sixteen signed bytes
+
+	__m128i zero = _mm_setzero_si128();
+	return _mm_sad_epu8(_mm_min_epu8(bytes, _mm_sub_epi8(zero, bytes)), zero);
+}
+#endif
+
+static void filter_row(const unsigned char* row, const unsigned char* above, size_t stride, size_t bpp, unsigned char* candidates,
+	unsigned char* out){
+
+	unsigned char* sub = candidates;
+	unsigned char* up = candidates + stride;
+	unsigned char* average = candidates + 2*stride;
+	unsigned char* predicted = candidates + 3*stride;
+	uint64_t sums[5] = {0, 0, 0, 0, 0};
+	size_t i = 0;
+
+	// The first pixel has no left neighbour
+	for(; i < bpp && i < stride; i++){
+		sub[i] = row[i];
+		up[i] = row[i] - above[i];
+		average[i] = row[i] - (above[i] >> 1);
+		predicted[i] = row[i] - above[i];
+	}
+
+#ifdef __SSE2__
+	__m128i zero = _mm_setzero_si128();
+	__m128i total[5] = {zero, zero, zero, zero, zero};
+
+	for(; i + 16 <= stride; i += 16){
+
+		__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i));
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + i - bpp));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + i));
+		__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + i - bpp));
+
+		__m128i f_sub = _mm_sub_epi8(x, a);
+		__m128i f_up = _mm_sub_epi8(x, b);
+		__m128i floor_average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+		__m128i f_average = _mm_sub_epi8(x, floor_average);
+		__m128i low = paeth16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+		__m128i high = paeth16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+		__m128i f_paeth = _mm_sub_epi8(x, _mm_packus_epi16(low, high));
+
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(sub + i), f_sub);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(up + i), f_up);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(average + i), f_average);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(predicted + i), f_paeth);
+
+		total[0] = _mm_add_epi64(total[0], magnitude_sum(x));
+		total[1] = _mm_add_epi64(total[1], magnitude_sum(f_sub));
+		total[2] = _mm_add_epi64(total[2], magnitude_sum(f_up));
+		total[3] = _mm_add_epi64(total[3], magnitude_sum(f_average));
+		total[4] = _mm_add_epi64(total[4], magnitude_sum(f_paeth));
+	}
+
+	for(int f = 0; f < 5; f++){
+		uint64_t halves[2];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(halves), total[f]);
+		sums[f] = halves[0] + halves[1];
+	}
+#endif
+
+	for(; i < stride; i++){
+		sub[i] = row[i] - row[i-bpp];
+		up[i] = row[i] - above[i];
+		average[i] = row[i] - ((row[i-bpp] + above[i]) >> 1);
+		predicted[i] = row[i] - paeth(row[i-bpp], above[i], above[i-bpp]);
+	}
+
+	// Sums of the bytes not covered by SSE2
+#ifdef __SSE2__
+	size_t first = std::min(bpp, stride), last = first + (stride - first)/16*16;
+#else
+	size_t first = 0, last = 0;
+#endif
+	for(size_t j = 0; j < stride; j++){
+		if(j == first)
+			j = last;
+		if(j >= stride)
+			break;
+		sums[0] += magnitude(row[j]);
+		sums[1] += magnitude(sub[j]);
+		sums[2] += magnitude(up[j]);
+		sums[3] += magnitude(average[j]);
+		sums[4] += magnitude(predicted[j]);
+	}
+
+	int best = 0;
+	for(int f = 1; f < 5; f++){
+		if(sums[f] < sums[best])
+			best = f;
+	}
+
+	out[0] = best;
+	std::memcpy(out + 1, best == 0 ? row : candidates + (best-1)*stride, stride);
+}
+
+
+
+/********************************************************************************************************************************
+* Bits of a deflate stream, least significant first
+**********************************************************************************************************************************/
+class BitWriter
+{
+	public:
+		explicit BitWriter(Bytes& output) : out(output), bits(0), count(0){}
+
+		void put(uint32_t value, int n){ // Append the n low bits of value (n <= 32)
+			bits |= (uint64_t)value << count;
+			count += n;
+			if(count >= 32){
+				for(int k = 0; k < 4; k++, bits >>= 8)
+					out.push_back(bits & 0xFF);
+				count -= 32;
+			}
+		}
+
+		void align(){ // Pad with zeros up to the next byte
+			while(count > 0){
+				out.push_back(bits & 0xFF);
+				bits >>= 8;
+				count = count > 8 ? count - 8 : 0;
+			}
+			bits = 0;
+		}
+
+	private:
+		Bytes& out;
+		uint64_t bits;
+		int count;
+};
+
+
+
+/********************************************************************************************************************************
+* Huffman codes : lengths limited to a maximum (the frequencies are halved until the tree fits) and canonical codes, stored
+* bit-reversed since deflate sends them most significant bit first
+**********************************************************************************************************************************/
+static void huffman_lengths(const uint32_t* frequencies, int n, int limit, unsigned char* lengths){
+
+	vector<uint32_t> weights(frequencies, frequencies + n);
+	std::fill(lengths, lengths + n, 0);
+
+	for(;;){
+
+		vector<std::pair<uint32_t, int> > leaves;
+		for(int s = 0; s < n; s++){
+			if(weights[s] > 0)
+				leaves.push_back(std::make_pair(weights[s], s));
+		}
+
+		size_t m = leaves.size();
+		if(m == 0)
+			return;
+		if(m == 1){
+			lengths[leaves[0].second] = 1;
+			return;
+		}
+
+		std::sort(leaves.begin(), leaves.end());
+
+		// Two-queue construction : the leaves sorted by weight, then the internal nodes, created in increasing weight
+		vector<uint64_t> weight(2*m-1);
+		vector<size_t> parent(2*m-1);
+		for(size_t k = 0; k < m; k++)
+			weight[k] = leaves[k].first;
+
+		size_t leaf = 0, node = m;
+		for(size_t k = m; k < 2*m-1; k++){
+			weight[k] = 0;
+			for(int pick = 0; pick < 2; pick++){
+				size_t child = (leaf < m && (node >= k || weight[leaf] <= weight[node])) ? leaf++ : node++;
+				parent[child] = k;
+				weight[k] += weight[child];
+			}
+		}
+
+		vector<int> depth(2*m-1);
+		depth[2*m-2] = 0;
+		int longest = 0;
+		for(size_t k = 2*m-2; k-- > 0;){
+			depth[k] = depth[parent[k]] + 1;
+			longest = std::max(longest, depth[k]);
+		}
+
+		if(longest <= limit){
+			for(size_t k = 0; k < m; k++)
+				lengths[leaves[k].second] = depth[k];
+			return;
+		}
+
+		for(int s = 0; s < n; s++){
+			if(weights[s] > 0)
+				weights[s] = (weights[s] >> 1) | 1;
+		}
+	}
+}
+
+static void canonical_codes(const unsigned char* lengths, int n, uint16_t* codes){
+
+	int count[16] = {0};
+	for(int s = 0; s < n; s++)
+		count[lengths[s]]++;
+	count[0] = 0;
+
+	int next[16];
+	int code = 0;
+	for(int bits = 1; bits < 16; bits++){
+		code = (code + count[bits-1]) << 1;
+		next[bits] = code;
+	}
+
+	for(int s = 0; s < n; s++){
+		int length = lengths[s];
+		codes[s] = 0;
+		if(length == 0)
+			continue;
+		int value = next[length]++, reversed = 0;
+		for(int k = 0; k < length; k++)
+			reversed |= ((value >> k) & 1) << (length - 1 - k);
+		codes[s] = reversed;
+	}
+}
+
+// Make sure at least two symbols have a code, so the code is complete as inflaters require
+static void two_symbols(uint32_t* frequencies, int n){
+
+	int used = 0;
+	for(int s = 0; s < n; s++)
+		used += frequencies[s] > 0;
+	for(int s = 0; used < 2 && s < n; s++){
+		if(frequencies[s] == 0){
+			frequencies[s] = 1;
+			used++;
+		}
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* LZ77 matching : the tokens are literals (distance 0) or matches, (distance << 16) | length
+**********************************************************************************************************************************/
+static inline uint32_t hash3(const unsigned char* p){
+
+	return ((p[0] << 16 | p[1] << 8 | p[2]) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static inline size_t match_length(const unsigned char* a, const unsigned char* b, size_t limit){
+
+	size_t n = 0;
+	while(n + 8 <= limit){
+		uint64_t x, y;
+		std::memcpy(&x, a + n, 8);
+		std::memcpy(&y, b + n, 8);
+		if(x != y)
+			return n + (__builtin_ctzll(x ^ y) >> 3);
+		n += 8;
+	}
+	while(n < limit && a[n] == b[n])
+		n++;
+	return n;
+}
+
+static void match(const unsigned char* data, size_t n, PngMode mode, vector<uint32_t>& tokens){
+
+	vector<int32_t> head(1u << HASH_BITS, -1);
+	vector<int32_t> previous(mode == PNG_DEFAULT ? WINDOW : 0);
+	tokens.clear();
+
+	// Longest match at i among the positions of the hash chain
+	auto search = [&](size_t i, size_t& distance){
+		size_t limit = std::min(MAX_MATCH, n - i), best = 0;
+		int32_t candidate = head[hash3(data + i)];
+		for(int chain = 0; candidate >= 0 && i - candidate <= WINDOW && chain < MAX_CHAIN; chain++){
+			size_t length = match_length(data + candidate, data + i, limit);
+			if(length > best){
+				best = length;
+				distance = i - candidate;
+				if(length == limit)
+					break;
+			}
+			int32_t next = previous[candidate & (WINDOW-1)];
+			if(next >= candidate)
+				break;
+			candidate = next;
+		}
+		return best;
+	};
+	auto insert = [&](size_t i){
+		uint32_t h = hash3(data + i);
+		previous[i & (WINDOW-1)] = head[h];
+		head[h] = i;
+	};
+
+	size_t i = 0;
+
+	if(mode == PNG_FAST){
+		while(i + MIN_MATCH <= n){
+			uint32_t h = hash3(data + i);
+			int32_t candidate = head[h];
+			head[h] = i;
+			size_t length = (candidate >= 0 && i - candidate <= WINDOW) ?
+				match_length(data + candidate, data + i, std::min(MAX_MATCH, n - i)) : 0;
+			if(length >= MIN_MATCH){
+				tokens.push_back((uint32_t)(i - candidate) << 16 | length);
+				i += length;
+			}
+			else
+				tokens.push_back(data[i++]);
+		}
+	}
+	else{
+		size_t ahead_distance = 0, ahead_length = 0;
+		bool ahead = false;
+
+		while(i + MIN_MATCH <= n){
+			size_t distance = 0;
+			size_t length = ahead ? ahead_length : search(i, distance);
+			if(ahead)
+				distance = ahead_distance;
+			ahead = false;
+			insert(i);
+
+			if(length < MIN_MATCH){
+				tokens.push_back(data[i++]);
+				continue;
+			}
+
+			// Lazy matching : a longer match at the next position is worth a literal
+			if(length < LAZY_LENGTH && i + 1 + MIN_MATCH <= n){
+				ahead_length = search(i + 1, ahead_distance);
+				if(ahead_length > length){
+					ahead = true;
+					tokens.push_back(data[i++]);
+					continue;
+				}
+			}
+
+			tokens.push_back((uint32_t)distance << 16 | length);
+			for(size_t k = 1; k < length && i + k + MIN_MATCH <= n; k++)
+				insert(i + k);
+			i += length;
+		}
+	}
+
+	while(i < n)
+		tokens.push_back(data[i++]);
+}
+
+
+
+/********************************************************************************************************************************
+* Deflate blocks
+**********************************************************************************************************************************/
+struct Code
+{
+	unsigned char literal_lengths[288];
+	uint16_t literal_codes[288];
+	unsigned char distance_lengths[30];
+	uint16_t distance_codes[30];
+};
+
+static void write_tokens(BitWriter& bits, const uint32_t* tokens, size_t n, const Code& code){
+
+	const Tables& table = tables();
+
+	for(size_t t = 0; t < n; t++){
+		uint32_t distance = tokens[t] >> 16, length = tokens[t] & 0xFFFF;
+		if(distance == 0){
+			bits.put(code.literal_codes[length], code.literal_lengths[length]);
+			continue;
+		}
+		int l = table.length_code[length], d = table.distance_code[distance];
+		bits.put(code.literal_codes[257 + l], code.literal_lengths[257 + l]);
+		bits.put(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+		bits.put(code.distance_codes[d], code.distance_lengths[d]);
+		bits.put(distance - DISTANCE_BASE[d], DISTANCE_EXTRA[d]);
+	}
+	bits.put(code.literal_codes[256], code.literal_lengths[256]);
+}
+
+static void write_fixed_block(BitWriter& bits, const uint32_t* tokens, size_t n, bool last){
+
+	static const Code code = []{
+		Code fixed;
+		for(int s = 0; s < 288; s++)
+			fixed.literal_lengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+		std::fill(fixed.distance_lengths, fixed.distance_lengths + 30, 5);
+		canonical_codes(fixed.literal_lengths, 288, fixed.literal_codes);
+		canonical_codes(fixed.distance_lengths, 30, fixed.distance_codes);
+		return fixed;
+	}();
+
+	bits.put(last, 1);
+	bits.put(1, 2);
+	write_tokens(bits, tokens, n, code);
+}
+
+static void write_dynamic_block(BitWriter& bits, const uint32_t* tokens, size_t n, bool last){
+
+	const Tables& table = tables();
+	uint32_t literal_frequencies[286] = {0}, distance_frequencies[30] = {0};
+
+	for(size_t t = 0; t < n; t++){
+		uint32_t distance = tokens[t] >> 16, length = tokens[t] & 0xFFFF;
+		if(distance == 0)
+			literal_frequencies[length]++;
+		else{
+			literal_frequencies[257 + table.length_code[length]]++;
+			distance_frequencies[table.distance_code[distance]]++;
+		}
+	}
+	literal_frequencies[256] = 1;
+	two_symbols(literal_frequencies, 286);
+	two_symbols(distance_frequencies, 30);
+
+	Code code;
+	std::fill(code.literal_lengths, code.literal_lengths + 288, 0);
+	huffman_lengths(literal_frequencies, 286, 15, code.literal_lengths);
+	huffman_lengths(distance_frequencies, 30, 15, code.distance_lengths);
+	canonical_codes(code.literal_lengths, 288, code.literal_codes);
+	canonical_codes(code.distance_lengths, 30, code.distance_codes);
+
+	int literals = 286, distances = 30;
+	while(literals > 257 && code.literal_lengths[literals-1] == 0)
+		literals--;
+	while(distances > 1 && code.distance_lengths[distances-1] == 0)
+		distances--;
+
+	// Run-length encoding of the code lengths : symbols 0-15, 16 (repeat the previous 3-6 times), 17 and 18 (3-10 and 11-138 zeros)
+	unsigned char lengths[286 + 30];
+	std::memcpy(lengths, code.literal_lengths, literals);
+	std::memcpy(lengths + literals, code.distance_lengths, distances);
+	int total = literals + distances;
+
+	vector<std::pair<unsigned char, unsigned char> > runs; // Symbol and its extra bits
+	for(int i = 0; i < total;){
+		int value = lengths[i], run = 1;
+		while(i + run < total && lengths[i + run] == value)
+			run++;
+		i += run;
+
+		if(value == 0){
+			for(; run >= 11; run -= std::min(run, 138))
+				runs.push_back(std::make_pair(18, std::min(run, 138) - 11));
+			if(run >= 3){
+				runs.push_back(std::make_pair(17, run - 3));
+				run = 0;
+			}
+		}
+		else{
+			runs.push_back(std::make_pair(value, 0));
+			run--;
+			for(; run >= 3; run -= std::min(run, 6))
+				runs.push_back(std::make_pair(16, std::min(run, 6) - 3));
+		}
+		for(; run > 0; run--)
+			runs.push_back(std::make_pair(value, 0));
+	}
+
+	uint32_t length_frequencies[19] = {0};
+	for(size_t r = 0; r < runs.size(); r++)
+		length_frequencies[runs[r].first]++;
+	two_symbols(length_frequencies, 19);
+
+	unsigned char length_lengths[19];
+	uint16_t length_codes[19];
+	huffman_lengths(length_frequencies, 19, 7, length_lengths);
+	canonical_codes(length_lengths, 19, length_codes);
+
+	int order = 19;
+	while(order > 4 && length_lengths[CODE_LENGTH_ORDER[order-1]] == 0)
+		order--;
+
+	bits.put(last, 1);
+	bits.put(2, 2);
+	bits.put(literals - 257, 5);
+	bits.put(distances - 1, 5);
+	bits.put(order - 4, 4);
+	for(int k = 0; k < order; k++)
+		bits.put(length_lengths[CODE_LENGTH_ORDER[k]], 3);
+
+	static const int EXTRA_BITS[19] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,2,3,7};
+	for(size_t r = 0; r < runs.size(); r++){
+		bits.put(length_codes[runs[r].first], length_lengths[runs[r].first]);
+		bits.put(runs[r].second, EXTRA_BITS[runs[r].first]);
+	}
+
+	write_tokens(bits, tokens, n, code);
+}
+
+static void write_stored_blocks(BitWriter& bits, Bytes& out, const unsigned char* data, size_t n, bool last){
+
+	do{
+		size_t size = std::min<size_t>(n, 65535);
+		bits.put(last && size == n, 1);
+		bits.put(0, 2);
+		bits.align();
+		out.push_back(size & 0xFF);
+		out.push_back(size >> 8);
+		out.push_back(~size & 0xFF);
+		out.push_back((~size >> 8) & 0xFF);
+		out.insert(out.end(), data, data + size);
+		data += size;
+		n -= size;
+	}while(n > 0);
+}
+
+
+
+/********************************************************************************************************************************
+* Compress a band of rows into a complete IDAT chunk. The bands are independent deflate blocks : every band but the last ends
+* with an empty stored block, which aligns the stream on a byte, so the chunks put one after the other form a valid stream.
+*
+* ARGUMENTS :
+*	- first and last are the rows of the band
+*	- chunk receives the IDAT chunk
+*	- adler receives the Adler-32 of the filtered rows
+**********************************************************************************************************************************/
+struct Image
+{
+	const unsigned char* pixels;
+	size_t width, height;
+	PixelFormat format;
+	Layout layout;
+	PngMode mode;
+};
+
+static void compress_band(const Image& image, size_t first, size_t last, Bytes& chunk, uint32_t& adler){
+
+	const size_t stride = image.layout.stride;
+	const bool last_band = (last == image.height);
+
+	// Filtered rows, each one preceded by its filter type
+	Bytes filtered((last - first)*(stride + 1));
+	Bytes above(stride, 0), row(stride), candidates(image.mode == PNG_STORED ? 0 : 4*stride);
+
+	if(first > 0)
+		png_row(image.format, image.pixels, image.width, image.height, first - 1, above.data());
+
+	for(size_t y = first; y < last; y++){
+		unsigned char* out = filtered.data() + (y - first)*(stride + 1);
+		png_row(image.format, image.pixels, image.width, image.height, y, row.data());
+		if(image.mode == PNG_STORED){
+			out[0] = 0;
+			std::memcpy(out + 1, row.data(), stride);
+		}
+		else
+			filter_row(row.data(), above.data(), stride, image.layout.bpp, candidates.data(), out);
+		row.swap(above);
+	}
+
+	adler = adler32(filtered.data(), filtered.size());
+
+	chunk.clear();
+	chunk.reserve(filtered.size()/2 + 64);
+	chunk.resize(4);
+	chunk.insert(chunk.end(), {'I', 'D', 'A', 'T'});
+	if(first == 0){ // zlib header : deflate with a 32K window, and the compression level
+		chunk.push_back(0x78);
+		chunk.push_back(image.mode == PNG_STORED ? 0x01 : image.mode == PNG_FAST ? 0x5E : 0x9C);
+	}
+
+	BitWriter bits(chunk);
+
+	if(image.mode == PNG_STORED)
+		write_stored_blocks(bits, chunk, filtered.data(), filtered.size(), last_band);
+	else{
+		vector<uint32_t> tokens;
+		match(filtered.data(), filtered.size(), image.mode, tokens);
+
+		if(image.mode == PNG_FAST)
+			write_fixed_block(bits, tokens.data(), tokens.size(), last_band);
+		else{
+			for(size_t t = 0; t < tokens.size(); t += BLOCK_TOKENS){
+				size_t n = std::min(BLOCK_TOKENS, tokens.size() - t);
+				write_dynamic_block(bits, tokens.data() + t, n, last_band && t + n == tokens.size());
+			}
+		}
+
+		if(!last_band){ // Empty stored block, as a zlib full flush
+			bits.put(0, 3);
+			bits.align();
+			chunk.insert(chunk.end(), {0x00, 0x00, 0xFF, 0xFF});
+		}
+		bits.align();
+	}
+
+	uint32_t size = chunk.size() - 8;
+	chunk[0] = size >> 24;
+	chunk[1] = size >> 16;
+	chunk[2] = size >> 8;
+	chunk[3] = size;
+	put32(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+}
+
+
+
+/********************************************************************************************************************************
+* Encode a Martist buffer as a PNG image in memory. The rows are cut in bands of about 256 KB that are filtered and compressed
+* in parallel on the global thread pool; the bands don't depend on the number of threads, neither does the output.
+*
+* ARGUMENTS :
+*	- pixels, width and height describe the image
+*	- format is the layout of the buffer (RGB_FLOAT32 can't be written)
+*	- out receives the PNG file
+*	- mode is the compression
+**********************************************************************************************************************************/
+void encode_png(const unsigned char* pixels, size_t width, size_t height, PixelFormat format, Bytes& out, PngMode mode){
+
+	if(width == 0 || height == 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF)
+		throw std::domain_error("ERROR : Bad size for a PNG image.");
+
+	Image image = {pixels, width, height, format, png_layout(format, width), mode};
+
+	size_t band_rows = std::max<size_t>(1, BAND_BYTES/(image.layout.stride + 1));
+	size_t bands = (height + band_rows - 1)/band_rows;
+
+	vector<Bytes> chunks(bands);
+	vector<uint32_t> checksums(bands);
+
+	ThreadPool::global().run(bands, [&](size_t b){
+		size_t first = b*band_rows;
+		compress_band(image, first, std::min(height, first + band_rows), chunks[b], checksums[b]);
+	});
+
+	static const unsigned char SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+	size_t total = 8 + 25 + 16 + 12;
+	for(size_t b = 0; b < bands; b++)
+		total += chunks[b].size();
+
+	out.clear();
+	out.reserve(total);
+	out.insert(out.end(), SIGNATURE, SIGNATURE + 8);
+
+	Bytes header;
+	put32(header, 13);
+	header.insert(header.end(), {'I', 'H', 'D', 'R'});
+	put32(header, width);
+	put32(header, height);
+	header.insert(header.end(), {image.layout.bit_depth, image.layout.color_type, 0, 0, 0});
+	put32(header, crc32(0, header.data() + 4, header.size() - 4));
+	out.insert(out.end(), header.begin(), header.end());
+
+	uint32_t adler = checksums[0];
+	for(size_t b = 0; b < bands; b++){
+		out.insert(out.end(), chunks[b].begin(), chunks[b].end());
+		if(b > 0){
+			size_t rows = std::min(height, (b+1)*band_rows) - b*band_rows;
+			adler = adler32_combine(adler, checksums[b], rows*(image.layout.stride + 1));
+		}
+	}
+
+	// The Adler-32 of the zlib stream, in a last IDAT chunk since it needs every band
+	Bytes trailer;
+	put32(trailer, 4);
+	trailer.insert(trailer.end(), {'I', 'D', 'A', 'T'});
+	put32(trailer, adler);
+	put32(trailer, crc32(0, trailer.data() + 4, trailer.size() - 4));
+	out.insert(out.end(), trailer.begin(), trailer.end());
+
+	static const unsigned char END[12] = {0, 0, 0, 0, 'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82};
+	out.insert(out.end(), END, END + 12);
+}
+
+
+
+/********************************************************************************************************************************
+* Encode a Martist buffer as a PNG image and write it to a file descriptor (a file, a pipe or a socket)
+*
+* ARGUMENTS :
+*	- fd is the open file descriptor
+*	- pixels, width, height, format and mode are as in encode_png
+**********************************************************************************************************************************/
+void write_png(int fd, const unsigned char* pixels, size_t width, size_t height, PixelFormat format, PngMode mode){
+
+	Bytes png;
+	encode_png(pixels, width, height, format, png, mode);
+
+	for(size_t written = 0; written < png.size();){
+		ssize_t n = ::write(fd, png.data() + written, png.size() - written);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			throw std::domain_error("ERROR : Can't write the PNG image.");
+		written += n;
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Encode a Martist buffer as a PNG image and write it to a file
+*
+* ARGUMENTS :
+*	- path is the name of the file
+*	- pixels, width, height, format and mode are as in encode_png
+**********************************************************************************************************************************/
+void write_png(const string& path, const unsigned char* pixels, size_t width, size_t height, PixelFormat format, PngMode mode){
+
+	Bytes png;
+	encode_png(pixels, width, height, format, png, mode);
+	write_file(path, png);
+}
@@ -0,0 +1,28 @@
+#ifndef GUARD_png_h
+#define GUARD_png_h
+
+#include "pixelFormat.hpp"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+
+enum PngMode // Compression of the PNG encoder
+{
+	PNG_STORED, // No compression nor filtering : the fastest, for throughput-first jobs
+	PNG_FAST, // Adaptive filters, single-probe matching and the fixed Huffman codes
+	PNG_DEFAULT // Adaptive filters, hash chains with lazy matching and dynamic Huffman codes
+};
+
+
+void encode_png(const unsigned char* pixels, size_t width, size_t height, PixelFormat format, std::vector<unsigned char>& out,
+	PngMode mode = PNG_DEFAULT); // Encode a Martist buffer as a PNG image in memory
+
+void write_png(int fd, const unsigned char* pixels, size_t width, size_t height, PixelFormat format,
+	PngMode mode = PNG_DEFAULT); // Encode a Martist buffer as a PNG image and write it to a file descriptor
+
+void write_png(const std::string& path, const unsigned char* pixels, size_t width, size_t height, PixelFormat format,
+	PngMode mode = PNG_DEFAULT); // Encode a Martist buffer as a PNG image and write it to a file
+
+#endif
@@ -0,0 +1,145 @@
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "costModel.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath> //std::abs
+#include <cstdlib> //strtoul, atoi, atof
+#include <stdexcept> //domain_error
+#include <algorithm> //std::max, std::min
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+static const int DRAWS = 3; // Draws of each scene, the fastest one is kept
+
+
+
+/********************************************************************************************************************************
+* Check of the render time estimates (Martist::estimate) against real draws. Random scenes, of the given depths or of the given
+* cost (see ColorExpression::new_exp_within_cost), are drawn on the viewport [-1,1] x [-1,1], so the mirrored components are
+* estimated too. With --calibrate, the cost model of the machine is calibrated and saved first (see calibrate_cost_model).
+*
+*	predict [count] [width] [height] [--calibrate] [--depth MIN MAX] [--cost C] [--seed S] [--tolerance T]
+*
+* For each scene, it prints its opcodes, the time estimated and the time measured (the fastest of three draws). It fails when
+* the average relative error of the estimates is above the tolerance (0.25 by default).
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	int positional = 1;
+	while(positional < argc && positional < 4 && argv[positional][0] != '-')
+		positional++;
+
+	const size_t count = (positional > 1) ? std::strtoul(argv[1], nullptr, 10) : 20;
+	const size_t width = (positional > 2) ? std::strtoul(argv[2], nullptr, 10) : 512;
+	const size_t height = (positional > 3) ? std::strtoul(argv[3], nullptr, 10) : 512;
+	int min_depth = 4, max_depth = 12;
+	double cost = 0.0, tolerance = 0.25;
+	unsigned int seed = 1;
+	bool calibrate = false;
+
+	for(int i = positional; i < argc; i++){
+
+		string option = argv[i];
+		int left = argc - i - 1;
+
+		if(option == "--calibrate")
+			calibrate = true;
+		else if(option == "--depth" && left >= 2){
+			min_depth = std::atoi(argv[++i]);
+			max_depth = std::atoi(argv[++i]);
+		}
+		else if(option == "--cost" && left >= 1)
+			cost = std::atof(argv[++i]);
+		else if(option == "--seed" && left >= 1)
+			seed = std::strtoul(argv[++i], nullptr, 10);
+		else if(option == "--tolerance" && left >= 1)
+			tolerance = std::atof(argv[++i]);
+		else{
+			cerr << "Usage : " << argv[0] << " [count] [width] [height] [--calibrate] [--depth MIN MAX] [--cost C] [--seed S]"
+				<< " [--tolerance T]" << endl;
+			return 2;
+		}
+	}
+
+	if(count == 0 || width == 0 || height == 0 || min_depth < 1 || max_depth < min_depth){
+		cerr << "ERROR : invalid arguments." << endl;
+		return 2;
+	}
+
+	try{
+		if(calibrate){
+			vector<CostSample> samples;
+			CostModel model = calibrate_cost_model(width, height, &samples);
+			save_machine_cost_model(model);
+
+			cout << "calibration scene   measured ns/pixel  predicted ns/pixel" << endl;
+			for(size_t s = 0; s < samples.size(); s++)
+				cout << std::left << std::setw(18) << samples[s].name << std::right << std::fixed << std::setprecision(2)
+					<< std::setw(19) << samples[s].measured << std::setw(20) << samples[s].predicted << endl;
+			cout << "\nCost model written to " << cost_model_path() << " :\n" << model << endl;
+		}
+
+		vector<unsigned char> buffer(3*width*height);
+		Martist martist(buffer.data(), width, height, 1, 1, 1);
+
+		std::mt19937 generator(seed);
+		RandomSource random = [&generator]{ return (int)(generator() >> 1); };
+
+		double total_error = 0.0, max_error = 0.0;
+
+		cout << "scene  opcodes  sin/cos  estimated ms  measured ms   error" << endl;
+
+		for(size_t n = 0; n < count; n++){
+
+			ColorExpression exps[3];
+			size_t nodes = 0, trig = 0;
+			for(int c = 0; c < 3; c++){
+				if(cost > 0.0)
+					exps[c].new_exp_within_cost(cost, 0.05, random);
+				else
+					exps[c].new_exp(min_depth + (int)(generator() % (max_depth - min_depth + 1)), random);
+				nodes += exps[c].compiled().info().nodes;
+				trig += exps[c].compiled().info().counts[OP_SIN] + exps[c].compiled().info().counts[OP_COS];
+			}
+
+			const RenderEstimate estimate = martist.estimate(exps[0], exps[1], exps[2]);
+
+			double measured = 0.0;
+			for(int d = 0; d < DRAWS; d++){
+				Clock::time_point start = Clock::now();
+				martist.draw(exps[0], exps[1], exps[2]);
+				const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+				measured = (d == 0) ? seconds : std::min(measured, seconds);
+			}
+
+			const double error = (estimate.seconds - measured)/measured;
+			total_error += std::abs(error);
+			max_error = std::max(max_error, std::abs(error));
+
+			cout << std::setw(5) << n << std::setw(9) << nodes << std::setw(9) << trig << std::fixed << std::setprecision(3)
+				<< std::setw(14) << 1000*estimate.seconds << std::setw(13) << 1000*measured << std::setprecision(1)
+				<< std::setw(7) << 100*error << "%" << endl;
+		}
+
+		const double average = total_error/count;
+		cout << "\nAverage error " << std::setprecision(1) << 100*average << "%, largest " << 100*max_error << "%" << endl;
+
+		return (average <= tolerance) ? 0 : 1;
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 2;
+	}
+}
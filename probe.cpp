@@ -0,0 +1,192 @@
+#include "probe.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "pixelFormat.hpp"
+
+#include <vector>
+#include <algorithm> //std::min
+#include <cmath> //std::log2, std::sqrt
+#include <limits>
+
+
+using std::vector;
+
+
+static const size_t PROBE_SIZE = 32; // Samples per axis of the probe of a screened candidate
+
+
+
+/********************************************************************************************************************************
+* Thresholds rejecting the flat and almost single-colour images : a "0" channel, products tending to zero and averages that
+* cancel out give images whose luminance barely varies or whose colours hardly differ
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ProbeThresholds default_probe_thresholds(){
+
+	ProbeThresholds thresholds;
+
+	thresholds.contrast = 0.06;
+	thresholds.entropy = 4.0;
+	thresholds.colour_variance = 0.01;
+
+	return thresholds;
+}
+
+
+
+/********************************************************************************************************************************
+* Render the colour expressions on a size x size grid covering the viewport, quantized as the full size image would be, and
+* score the result : contrast and entropy of the luminance, variance of the colours. The probe costs size*size pixels whatever
+* the size of the image.
+*
+* ARGUMENTS :
+*	- red, green and blue are the colour expressions of the candidate
+*	- viewport is the part of the domain drawn by the full size render
+*	- size is the number of samples per axis of the probe
+*
+* RETURN : the scores of the candidate
+**********************************************************************************************************************************/
+ProbeScore probe_score(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue,
+	const Viewport& viewport, size_t size){
+
+	const size_t n = size*size;
+
+	vector<double> x(n), y(n), values(n);
+	viewport_grid(viewport, size, size, x.data(), y.data());
+
+	const Program* programs[3] = {&red.compiled(), &green.compiled(), &blue.compiled()};
+	vector<unsigned char> bytes[3];
+	double variance = 0.0;
+
+	for(int c = 0; c < 3; c++){
+
+		programs[c]->evaluate(x.data(), y.data(), n, values.data());
+		bytes[c].resize(n);
+		quantize(values.data(), n, bytes[c].data());
+
+		double sum = 0.0, squares = 0.0;
+		for(size_t k = 0; k < n; k++){
+			sum += bytes[c][k];
+			squares += (double)bytes[c][k]*bytes[c][k];
+		}
+		double mean = sum/n;
+		variance += (squares/n - mean*mean)/(255.0*255.0);
+	}
+
+	// Luminance (ITU-R BT.601)
+	size_t histogram[256] = {0};
+	double sum = 0.0, squares = 0.0;
+	for(size_t k = 0; k < n; k++){
+		double luminance = 0.299*bytes[0][k] + 0.587*bytes[1][k] + 0.114*bytes[2][k];
+		histogram[std::min(255, (int)(luminance + 0.5))]++;
+		sum += luminance;
+		squares += luminance*luminance;
+	}
+
+	double mean = sum/n;
+	double entropy = 0.0;
+	for(int v = 0; v < 256; v++){
+		if(histogram[v] > 0){
+			double p = (double)histogram[v]/n;
+			entropy -= p*std::log2(p);
+		}
+	}
+
+	ProbeScore score;
+	score.contrast = std::sqrt(std::max(0.0, squares/n - mean*mean))/255.0;
+	score.entropy = entropy;
+	score.colour_variance = std::max(0.0, variance/3);
+
+	return score;
+}
+
+
+
+/********************************************************************************************************************************
+* The candidate reaches all the thresholds
+*
+* ARGUMENTS :
+*	- score is the score of the candidate
+*	- thresholds are the minimal scores
+**********************************************************************************************************************************/
+bool probe_accepts(const ProbeScore& score, const ProbeThresholds& thresholds){
+
+	return score.contrast >= thresholds.contrast && score.entropy >= thresholds.entropy
+		&& score.colour_variance >= thresholds.colour_variance;
+}
+
+
+
+/********************************************************************************************************************************
+* Smallest ratio of a score to its threshold, to keep the best of candidates that are all rejected (at least 1 when the
+* candidate is accepted)
+*
+* ARGUMENTS :
+*	- score is the score of the candidate
+*	- thresholds are the minimal scores
+**********************************************************************************************************************************/
+double probe_margin(const ProbeScore& score, const ProbeThresholds& thresholds){
+
+	const double scores[3] = {score.contrast, score.entropy, score.colour_variance};
+	const double limits[3] = {thresholds.contrast, thresholds.entropy, thresholds.colour_variance};
+	double margin = std::numeric_limits<double>::infinity();
+
+	for(int k = 0; k < 3; k++){
+		if(limits[k] > 0)
+			margin = std::min(margin, scores[k]/limits[k]);
+	}
+
+	return margin;
+}
+
+
+
+/********************************************************************************************************************************
+* Generate candidates until one reaches the thresholds on the probe grid. If none of them does, the best one is kept, so
+* that an image is always produced.
+*
+* ARGUMENTS :
+*	- generate draws a new candidate
+*	- candidates is the maximum number of candidates to probe (at least 1)
+*	- thresholds are the scores a candidate must reach
+*	- viewport is the part of the domain drawn by the full size render
+*	- pixels is the size of the full size render, to count the pixels saved by each rejection
+*	- red, green and blue receive the chosen candidate
+*	- stats are the counters to update
+**********************************************************************************************************************************/
+void screen(const CandidateSource& generate, int candidates, const ProbeThresholds& thresholds, const Viewport& viewport,
+	size_t pixels, ColorExpression& red, ColorExpression& green, ColorExpression& blue, ScreeningStats& stats){
+
+	ColorExpression best[3];
+	double best_margin = -1.0;
+
+	for(int k = 0; k < candidates; k++){
+
+		generate(red, green, blue);
+
+		ProbeScore score = probe_score(red, green, blue, viewport, PROBE_SIZE);
+		stats.candidates++;
+		stats.probe_pixels += PROBE_SIZE*PROBE_SIZE;
+
+		if(probe_accepts(score, thresholds))
+			return;
+
+		stats.rejected++;
+		stats.saved_pixels += pixels;
+
+		double margin = probe_margin(score, thresholds);
+		if(margin > best_margin){
+			best_margin = margin;
+			best[0] = red;
+			best[1] = green;
+			best[2] = blue;
+		}
+	}
+
+	// No candidate passed : the best one is rendered all the same
+	red = best[0];
+	green = best[1];
+	blue = best[2];
+	stats.saved_pixels -= pixels;
+}
@@ -0,0 +1,54 @@
+#ifndef GUARD_probe_h
+#define GUARD_probe_h
+
+#include "colorExpression.hpp"
+
+#include <functional>
+#include <cstddef>
+
+
+struct Viewport;
+
+
+struct ProbeThresholds // Scores under which a candidate image is rejected
+{
+	double contrast; // Standard deviation of the luminance, in [0,1]
+	double entropy; // Entropy of the luminance histogram, in bits, in [0,8]
+	double colour_variance; // Mean of the variances of the three components, in [0,0.25]
+};
+
+ProbeThresholds default_probe_thresholds(); // Thresholds rejecting the flat and almost single-colour images
+
+
+
+struct ProbeScore // Scores of a candidate image on the probe grid
+{
+	double contrast;
+	double entropy;
+	double colour_variance;
+};
+
+ProbeScore probe_score(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue,
+	const Viewport& viewport, size_t size = 32); // Render the colour expressions on a size x size grid and score the result
+
+bool probe_accepts(const ProbeScore& score, const ProbeThresholds& thresholds); // The candidate reaches all the thresholds
+
+double probe_margin(const ProbeScore& score, const ProbeThresholds& thresholds); // Smallest ratio of a score to its threshold
+
+
+
+struct ScreeningStats // Counters of a screening
+{
+	size_t candidates; // Candidates probed
+	size_t rejected; // Candidates rejected and regenerated
+	size_t probe_pixels; // Pixels computed by the probes
+	size_t saved_pixels; // Pixels of the full size renders avoided by rejecting candidates
+};
+
+typedef std::function<void(ColorExpression& red, ColorExpression& green, ColorExpression& blue)> CandidateSource;
+
+void screen(const CandidateSource& generate, int candidates, const ProbeThresholds& thresholds, const Viewport& viewport,
+	size_t pixels, ColorExpression& red, ColorExpression& green, ColorExpression& blue,
+	ScreeningStats& stats); // Generate candidates until one reaches the thresholds, or keep the best one
+
+#endif
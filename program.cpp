@@ -0,0 +1,867 @@
+#include "program.hpp"
+#include "parser.hpp"
+#include "kernels.hpp"
+#include "threadPool.hpp"
+
+#include <math.h> //M_PI
+#include <cmath> //std::log2
+#include <string>
+#include <vector>
+#include <algorithm> //std::max, std::min, std::lexicographical_compare, std::fill, std::copy
+#include <stdexcept> //domain_error
+#include <utility> //std::move, std::swap, std::pair
+#include <iostream>
+
+
+using std::string;
+using std::vector;
+
+
+static const uint64_t FNV_OFFSET = 14695981039346656037ULL;
+static const uint64_t FNV_PRIME = 1099511628211ULL;
+
+static const int LOCAL_STACK = 64; // Stack height evaluated without any allocation
+static const size_t BLOCK_BYTES = 256*1024; // Stack rows of the batched evaluation kept within the L2 cache
+static const size_t MIN_BLOCK = 64; // Smallest number of points evaluated at once
+static const size_t TASKS_PER_THREAD = 8; // Tasks of the task-parallel evaluation per thread, to balance their sizes
+
+
+
+/********************************************************************************************************************************
+* Number of points evaluated at once so that all the rows of the stack fit in BLOCK_BYTES
+*
+* ARGUMENTS :
+*	- stack_height is the number of rows of the stack
+*	- values is the number of values per point in each row
+**********************************************************************************************************************************/
+static size_t block_points(int stack_height, size_t values){
+	size_t points = BLOCK_BYTES/(sizeof(double)*values*std::max(stack_height, 1));
+	return std::max(MIN_BLOCK, points - points%8);
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor of the expression "0"
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+Program::Program() : ops(1, OP_ZERO){
+	check();
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor from already compiled opcodes
+*
+* ARGUMENTS :
+*	- code is the sequence of opcodes
+**********************************************************************************************************************************/
+Program::Program(vector<Opcode>&& code) : ops(std::move(code)){
+	check();
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor copying compiled opcodes, for instance from a mapped program library
+*
+* ARGUMENTS :
+*	- code and size are the opcodes and their number
+**********************************************************************************************************************************/
+Program::Program(const Opcode* code, size_t size) : ops(code, code + size){
+	check();
+}
+
+
+
+/********************************************************************************************************************************
+* Compile an expression in reverse polish notation
+*
+* ARGUMENTS :
+*	- rpn is a complete expression, as made by the Parser or ColorExpression
+**********************************************************************************************************************************/
+Program::Program(const Exp& rpn){
+
+	ops.reserve(rpn.size());
+
+	for(Exp::size_type i = 0; i != rpn.size(); i++){
+
+		const string& tok = rpn[i];
+
+		if(tok == "x")
+			ops.push_back(OP_X);
+		else if(tok == "y")
+			ops.push_back(OP_Y);
+		else if(tok == "pi")
+			ops.push_back(OP_PI);
+		else if(tok == "0")
+			ops.push_back(OP_ZERO);
+		else if(tok == "sin")
+			ops.push_back(OP_SIN);
+		else if(tok == "cos")
+			ops.push_back(OP_COS);
+		else if(tok == "avg")
+			ops.push_back(OP_AVG);
+		else if(tok == "*")
+			ops.push_back(OP_TIMES);
+		else
+			throw std::domain_error("ERROR : unknown token " + tok + ".");
+	}
+
+	check();
+}
+
+
+
+/********************************************************************************************************************************
+* Parity of an operation along an axis from the parities of its operands. The kernels keep it bit for bit : sin and cos are
+* computed from the absolute value and the sign bit, and (-a-b)/2 and (-a)*b are the exact negations of (a+b)/2 and a*b. Only
+* the sign of a zero may differ, which no operation turns into another value.
+*
+* ARGUMENTS :
+*	- op is the operation (sin, cos, avg or *)
+*	- a is the parity of the first operand (of the only one for sin and cos)
+*	- b is the parity of the second operand
+*
+* RETURN : the parity of the result
+**********************************************************************************************************************************/
+static Parity operation_parity(Opcode op, Parity a, Parity b){
+
+	switch(op){
+		case OP_SIN : return a;
+		case OP_COS : return (a == PARITY_NONE) ? PARITY_NONE : PARITY_EVEN;
+		case OP_AVG : return Parity(a & b);
+		case OP_TIMES : {
+			const bool even = ((a & PARITY_EVEN) && (b & PARITY_EVEN)) || ((a & PARITY_ODD) && (b & PARITY_ODD));
+			const bool odd = ((a & PARITY_EVEN) && (b & PARITY_ODD)) || ((a & PARITY_ODD) && (b & PARITY_EVEN));
+			return Parity((even ? PARITY_EVEN : 0) | (odd ? PARITY_ODD : 0));
+		}
+		default : return PARITY_NONE;
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Check that the opcodes make one complete expression and compute their metadata, in one pass. The depth of each
+* sub-expression is kept on a stack mirroring the evaluation stack : x, y and pi have depth 1, sin and cos keep the depth of
+* their operand (pi*exp, which already counts its own level), avg and * add one level to their deepest operand. The parities
+* in x and in y are kept on the same stack (see operation_parity), and so is whether each sub-expression is pi or a product by
+* pi, which the operands of sin and cos must be to be written in infix notation.
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+void Program::check(){
+
+	vector<int> depths;
+	depths.reserve(64);
+	vector<Parity> x_parities, y_parities;
+	x_parities.reserve(64);
+	y_parities.reserve(64);
+	vector<size_t> factors;
+	factors.reserve(64);
+	enum Shape : unsigned char {SHAPE_OTHER, SHAPE_PI, SHAPE_PI_PRODUCT};
+	vector<Shape> shapes;
+	shapes.reserve(64);
+
+	information.nodes = ops.size();
+	information.infix = true;
+	information.stack_height = 0;
+	information.uses_x = false;
+	information.uses_y = false;
+	std::fill(information.counts, information.counts + OPCODES, 0);
+
+	for(size_t i = 0; i < ops.size(); i++){
+
+		if(ops[i] < OPCODES)
+			information.counts[ops[i]]++;
+
+		switch(ops[i]){
+			case OP_ZERO : depths.push_back(0); x_parities.push_back(PARITY_ZERO); y_parities.push_back(PARITY_ZERO); factors.push_back(0);
+				shapes.push_back(SHAPE_OTHER);
+				break;
+			case OP_X : information.uses_x = true; depths.push_back(1); x_parities.push_back(PARITY_ODD); y_parities.push_back(PARITY_EVEN);
+				factors.push_back(1); shapes.push_back(SHAPE_OTHER);
+				break;
+			case OP_Y : information.uses_y = true; depths.push_back(1); x_parities.push_back(PARITY_EVEN); y_parities.push_back(PARITY_ODD);
+				factors.push_back(1); shapes.push_back(SHAPE_OTHER);
+				break;
+			case OP_PI : depths.push_back(1); x_parities.push_back(PARITY_EVEN); y_parities.push_back(PARITY_EVEN); factors.push_back(0);
+				shapes.push_back(SHAPE_PI);
+				break;
+			case OP_SIN :
+			case OP_COS :
+				if(depths.empty())
+					throw std::domain_error("ERROR : missing operand at opcode " + std::to_string(i) + ".");
+				x_parities.back() = operation_parity(ops[i], x_parities.back(), PARITY_NONE);
+				y_parities.back() = operation_parity(ops[i], y_parities.back(), PARITY_NONE);
+				if(ops[i] == OP_COS)
+					factors.back() = 0;
+				if(shapes.back() != SHAPE_PI_PRODUCT)
+					information.infix = false;
+				shapes.back() = SHAPE_OTHER;
+				break;
+			case OP_AVG :
+			case OP_TIMES :
+				if(depths.size() < 2)
+					throw std::domain_error("ERROR : missing operand at opcode " + std::to_string(i) + ".");
+				depths[depths.size()-2] = 1 + std::max(depths[depths.size()-2], depths.back());
+				depths.pop_back();
+				x_parities[x_parities.size()-2] = operation_parity(ops[i], x_parities[x_parities.size()-2], x_parities.back());
+				x_parities.pop_back();
+				y_parities[y_parities.size()-2] = operation_parity(ops[i], y_parities[y_parities.size()-2], y_parities.back());
+				y_parities.pop_back();
+				// The product of small values multiplies their factors, the mean of two values is as small as the larger one
+				if(ops[i] == OP_TIMES)
+					factors[factors.size()-2] += factors.back();
+				else
+					factors[factors.size()-2] = std::min(factors[factors.size()-2], factors.back());
+				factors.pop_back();
+				shapes[shapes.size()-2] = (ops[i] == OP_TIMES && (shapes[shapes.size()-2] == SHAPE_PI || shapes.back() == SHAPE_PI))
+					? SHAPE_PI_PRODUCT : SHAPE_OTHER;
+				shapes.pop_back();
+				break;
+			default :
+				throw std::domain_error("ERROR : unknown opcode " + std::to_string((int)ops[i]) + ".");
+		}
+
+		information.stack_height = std::max(information.stack_height, (int)depths.size());
+	}
+
+	if(depths.size() != 1)
+		throw std::domain_error("ERROR : incomplete expression.");
+
+	information.depth = depths.back();
+	information.x_parity = x_parities.back();
+	information.y_parity = y_parities.back();
+	information.factors = factors.back();
+}
+
+
+
+/********************************************************************************************************************************
+* Returns the expression in reverse polish notation, one token per opcode
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+Exp Program::to_rpn() const{
+
+	static const char* tokens[] = {"0", "x", "y", "pi", "sin", "cos", "avg", "*"};
+
+	Exp rpn;
+	rpn.reserve(ops.size());
+
+	for(size_t i = 0; i < ops.size(); i++)
+		rpn.push_back(tokens[ops[i]]);
+
+	return rpn;
+}
+
+
+
+/********************************************************************************************************************************
+* Returns the value of the expression at the point (x,y)
+*
+* ARGUMENTS :
+*	- x and y are the coordinates of the point
+**********************************************************************************************************************************/
+double Program::evaluate(double x, double y) const{
+
+	double local[LOCAL_STACK];
+	vector<double> heap;
+	double* stack = local;
+
+	if(information.stack_height > LOCAL_STACK){
+		heap.resize(information.stack_height);
+		stack = heap.data();
+	}
+
+	// Index of the top of the stack
+	int top = -1;
+	stack[0] = 0.0;
+
+	for(size_t i = 0; i < ops.size(); i++){
+
+		switch(ops[i]){
+			case OP_ZERO : stack[++top] = 0.0;
+				break;
+			case OP_X : stack[++top] = x;
+				break;
+			case OP_Y : stack[++top] = y;
+				break;
+			case OP_PI : stack[++top] = M_PI;
+				break;
+			case OP_SIN : kernels().sin(stack + top, 1);
+				break;
+			case OP_COS : kernels().cos(stack + top, 1);
+				break;
+			case OP_AVG : top--; stack[top] = (stack[top] + stack[top+1])/2;
+				break;
+			case OP_TIMES : top--; stack[top] = stack[top] * stack[top+1];
+				break;
+		}
+	}
+
+	return stack[0];
+}
+
+
+
+/********************************************************************************************************************************
+* Evaluate the expression at n points at once : each opcode is applied to the n values of its operands before going to the
+* next one, so the loops over the points run in the vector kernels of the processor (see kernels.hpp) and the opcodes are
+* decoded once per batch instead of once per point. The operations are the same as in the scalar evaluation, so are the results.
+* The points are taken in blocks whose stack rows stay in the cache (see evaluation_block), large programs then stream through
+* their opcodes once per block instead of through rows that no longer fit in the cache.
+*
+* ARGUMENTS :
+*	- x and y are the coordinates of the n points
+*	- n is the number of points
+*	- result receives the n values
+*	- kernel are the kernels of the evaluation (the active ones by default)
+**********************************************************************************************************************************/
+void Program::evaluate(const double* x, const double* y, size_t n, double* result, const Kernels& kernel) const{
+
+	const size_t block = evaluation_block();
+	if(n > block){
+		for(size_t i = 0; i < n; i += block)
+			evaluate(x + i, y + i, std::min(block, n - i), result + i, kernel);
+		return;
+	}
+
+	// One row of n values per stack level, kept from one call to the next
+	static thread_local vector<double> scratch;
+	if(scratch.size() < information.stack_height*n)
+		scratch.resize(information.stack_height*n);
+
+	double* top = scratch.data() - n;
+
+	for(size_t i = 0; i < ops.size(); i++){
+
+		switch(ops[i]){
+			case OP_ZERO : top += n; std::fill(top, top + n, 0.0);
+				break;
+			case OP_X : top += n; std::copy(x, x + n, top);
+				break;
+			case OP_Y : top += n; std::copy(y, y + n, top);
+				break;
+			case OP_PI : top += n; std::fill(top, top + n, M_PI);
+				break;
+			case OP_SIN : kernel.sin(top, n);
+				break;
+			case OP_COS : kernel.cos(top, n);
+				break;
+			case OP_AVG : kernel.average(top - n, top, n); top -= n;
+				break;
+			case OP_TIMES : kernel.times(top - n, top, n); top -= n;
+				break;
+		}
+	}
+
+	std::copy(top, top + n, result);
+}
+
+
+
+/********************************************************************************************************************************
+* Evaluate the expression and its partial derivatives at n points at once, with forward-mode automatic differentiation :
+* every value on the stack carries its derivatives along x and y. The values are computed exactly as by evaluate(), in blocks
+* three times smaller.
+*
+* ARGUMENTS :
+*	- x and y are the coordinates of the n points
+*	- n is the number of points
+*	- value, dx and dy receive the n values and partial derivatives
+*	- kernel are the kernels of the evaluation (the active ones by default)
+**********************************************************************************************************************************/
+void Program::evaluate_gradient(const double* x, const double* y, size_t n, double* value, double* dx, double* dy,
+	const Kernels& kernel) const{
+
+	const size_t block = block_points(information.stack_height, 3);
+	if(n > block){
+		for(size_t i = 0; i < n; i += block)
+			evaluate_gradient(x + i, y + i, std::min(block, n - i), value + i, dx + i, dy + i, kernel);
+		return;
+	}
+
+	// Values, x derivatives and y derivatives of each stack level
+	static thread_local vector<double> scratch;
+	const size_t level = 3*n;
+	if(scratch.size() < information.stack_height*level)
+		scratch.resize(information.stack_height*level);
+
+	double* top = scratch.data() - level;
+
+	for(size_t i = 0; i < ops.size(); i++){
+
+		switch(ops[i]){
+			case OP_ZERO :
+			case OP_PI :
+				top += level;
+				std::fill(top, top + n, (ops[i] == OP_PI) ? M_PI : 0.0);
+				std::fill(top + n, top + level, 0.0);
+				break;
+			case OP_X :
+				top += level;
+				std::copy(x, x + n, top);
+				std::fill(top + n, top + 2*n, 1.0);
+				std::fill(top + 2*n, top + level, 0.0);
+				break;
+			case OP_Y :
+				top += level;
+				std::copy(y, y + n, top);
+				std::fill(top + n, top + 2*n, 0.0);
+				std::fill(top + 2*n, top + level, 1.0);
+				break;
+			case OP_SIN : kernel.sin_gradient(top, n);
+				break;
+			case OP_COS : kernel.cos_gradient(top, n);
+				break;
+			case OP_AVG : kernel.average(top - level, top, level); top -= level;
+				break;
+			case OP_TIMES : kernel.times_gradient(top - level, top, n); top -= level;
+				break;
+		}
+	}
+
+	std::copy(top, top + n, value);
+	std::copy(top + n, top + 2*n, dx);
+	std::copy(top + 2*n, top + level, dy);
+}
+
+
+
+/********************************************************************************************************************************
+* Evaluate the expression at n points as a graph of tasks, for the expressions too large for the few points to share the work.
+* Where both operands of avg or * have at least min_nodes opcodes, each of them is a task : it is evaluated over the n points
+* on its own, the tasks it contains being read from their values instead. The tasks are made larger than min_nodes when
+* needed so that there are about TASKS_PER_THREAD per thread of the pool, which bounds the memory of their values. The tasks
+* whose inner tasks are done run together, each of them split by blocks of points (see evaluation_block), on the given pool.
+* The values are exactly the ones of evaluate().
+*
+* ARGUMENTS :
+*	- x and y are the coordinates of the n points
+*	- n is the number of points
+*	- result receives the n values
+*	- pool is the thread pool running the tasks
+*	- min_nodes is the smallest number of opcodes of a task, the smaller sub-expressions being evaluated within their task
+*	- kernel are the kernels of the evaluation (the active ones by default)
+**********************************************************************************************************************************/
+void Program::evaluate_tasks(const double* x, const double* y, size_t n, double* result, ThreadPool& pool, size_t min_nodes,
+	const Kernels& kernel) const{
+
+	const size_t count = ops.size();
+	const size_t threshold = std::max(std::max(min_nodes, (size_t)1), count/(pool.size()*TASKS_PER_THREAD));
+
+	if(pool.size() < 2 || count < 2*threshold || n == 0){
+		evaluate(x, y, n, result, kernel);
+		return;
+	}
+
+	const vector<size_t> start = subtree_starts();
+
+	// The roots of the tasks : the whole expression, and both operands of avg and * when they are large enough
+	vector<size_t> roots;
+	for(size_t i = 0; i < count; i++){
+		if(ops[i] >= OP_AVG){
+			const size_t right = i - 1, left = start[i-1] - 1;
+			if(right - start[right] + 1 >= threshold && left - start[left] + 1 >= threshold){
+				roots.push_back(left);
+				roots.push_back(right);
+			}
+		}
+	}
+	roots.push_back(count - 1);
+	std::sort(roots.begin(), roots.end());
+
+	// Task containing each task (the last one is the whole expression), found from the last opcode backwards
+	const size_t tasks = roots.size();
+	vector<size_t> parent(tasks, tasks), open;
+	for(size_t t = tasks; t-- > 0;){
+		while(!open.empty() && start[roots[open.back()]] > roots[t])
+			open.pop_back();
+		if(!open.empty())
+			parent[t] = open.back();
+		open.push_back(t);
+	}
+
+	// Inner tasks of each task, in the order of their opcodes, and waves of tasks whose inner tasks are done
+	vector<vector<size_t> > inner(tasks);
+	vector<size_t> wave(tasks, 0);
+	size_t waves = 1;
+	for(size_t t = 0; t < tasks; t++){
+		if(parent[t] < tasks){
+			inner[parent[t]].push_back(t);
+			wave[parent[t]] = std::max(wave[parent[t]], wave[t] + 1);
+			waves = std::max(waves, wave[parent[t]] + 1);
+		}
+	}
+
+	vector<vector<double> > values(tasks - 1, vector<double>(n));
+	const size_t block = evaluation_block();
+	const size_t blocks = (n + block - 1)/block;
+
+	for(size_t w = 0; w < waves; w++){
+
+		vector<size_t> ready;
+		for(size_t t = 0; t < tasks; t++)
+			if(wave[t] == w)
+				ready.push_back(t);
+
+		pool.run(ready.size()*blocks, [&](size_t job){
+
+			const size_t t = ready[job/blocks];
+			const size_t first = (job%blocks)*block;
+			const size_t m = std::min(block, n - first);
+			const double* bx = x + first;
+			const double* by = y + first;
+
+			static thread_local vector<double> scratch;
+			if(scratch.size() < information.stack_height*block)
+				scratch.resize(information.stack_height*block);
+
+			double* top = scratch.data() - m;
+			size_t next = 0; // Next inner task to read
+
+			for(size_t i = start[roots[t]]; i <= roots[t];){
+
+				if(next < inner[t].size() && i == start[roots[inner[t][next]]]){
+					const double* v = values[inner[t][next]].data() + first;
+					top += m;
+					std::copy(v, v + m, top);
+					i = roots[inner[t][next++]] + 1;
+					continue;
+				}
+
+				switch(ops[i]){
+					case OP_ZERO : top += m; std::fill(top, top + m, 0.0);
+						break;
+					case OP_X : top += m; std::copy(bx, bx + m, top);
+						break;
+					case OP_Y : top += m; std::copy(by, by + m, top);
+						break;
+					case OP_PI : top += m; std::fill(top, top + m, M_PI);
+						break;
+					case OP_SIN : kernel.sin(top, m);
+						break;
+					case OP_COS : kernel.cos(top, m);
+						break;
+					case OP_AVG : kernel.average(top - m, top, m); top -= m;
+						break;
+					case OP_TIMES : kernel.times(top - m, top, m); top -= m;
+						break;
+				}
+				i++;
+			}
+
+			std::copy(top, top + m, (t + 1 < tasks ? values[t].data() : result) + first);
+		});
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Number of points the batched evaluation computes at once : its stack rows then take at most 256 KB
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t Program::evaluation_block() const{
+	return block_points(information.stack_height, 1);
+}
+
+
+
+/********************************************************************************************************************************
+* The opcodes, in reverse polish notation
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const vector<Opcode>& Program::code() const{
+	return ops;
+}
+
+
+
+/********************************************************************************************************************************
+* Maximum number of values on the stack during an evaluation
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+int Program::stack_height() const{
+	return information.stack_height;
+}
+
+
+
+/********************************************************************************************************************************
+* Depth, number of nodes, stack height and variables of the expression
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const ProgramInfo& Program::info() const{
+	return information;
+}
+
+
+
+/********************************************************************************************************************************
+* Write the expression in infix notation, without building any string. The first opcode of every sub-expression is found
+* in one pass (see subtree_starts), then the tree is walked with an explicit stack, so very deep expressions don't overflow the call stack.
+* The text is read back by the parser if info().infix is true : an operand of sin or cos which isn't a product by pi is written
+* between parentheses, which the grammar has no form for.
+*
+* ARGUMENTS :
+*	- out is the output stream
+**********************************************************************************************************************************/
+void Program::write_infix(std::ostream& out) const{
+
+	static const char* names[] = {"0", "x", "y", "pi", "sin", "cos", "avg", "*"};
+
+	const vector<size_t> start = subtree_starts();
+
+	//Nodes being written, with the number of operands already written
+	vector<std::pair<size_t, int> > nodes(1, std::make_pair(ops.size()-1, 0));
+
+	while(!nodes.empty()){
+
+		size_t node = nodes.back().first;
+		int stage = nodes.back().second++;
+		Opcode op = ops[node];
+
+		if(op <= OP_PI){
+			out << names[op];
+			nodes.pop_back();
+		}
+		else if(op <= OP_COS){
+			//sin(pi*exp), with pi written first whichever operand of the product it is (see ProgramInfo::infix for other operands)
+			if(stage == 0){
+				size_t operand = node-1;
+				if(ops[operand] == OP_TIMES){
+					const size_t right = operand-1, left = start[right]-1;
+					if(ops[left] == OP_PI || ops[right] == OP_PI){
+						out << names[op] << "(pi*";
+						nodes.push_back(std::make_pair(ops[left] == OP_PI ? right : left, 0));
+						continue;
+					}
+				}
+				out << names[op] << "(";
+				nodes.push_back(std::make_pair(operand, 0));
+			}else{
+				out << ")";
+				nodes.pop_back();
+			}
+		}
+		else{
+			//The right operand ends just before the operator, the left one just before the right one
+			if(stage == 0){
+				out << (op == OP_AVG ? "avg(" : "(");
+				nodes.push_back(std::make_pair(start[node-1]-1, 0));
+			}else if(stage == 1){
+				out << (op == OP_AVG ? "," : "*");
+				nodes.push_back(std::make_pair(node-1, 0));
+			}else{
+				out << ")";
+				nodes.pop_back();
+			}
+		}
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* First opcode of the sub-expression ending at each opcode, found in one pass : the opcodes of a sub-expression are the range
+* [start[i], i], its operator being the last one
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+vector<size_t> Program::subtree_starts() const{
+
+	vector<size_t> start(ops.size());
+	vector<size_t> stack;
+
+	for(size_t i = 0; i < ops.size(); i++){
+		if(ops[i] <= OP_PI){
+			stack.push_back(i);
+		}
+		else if(ops[i] >= OP_AVG){
+			stack.pop_back();
+		}
+		start[i] = stack.back();
+	}
+
+	return start;
+}
+
+
+
+/********************************************************************************************************************************
+* Same expression with one sub-expression replaced by another : a structural edit, the opcodes being spliced without parsing
+* the expression again
+*
+* ARGUMENTS :
+*	- node is the last opcode of the sub-expression to replace (its operator, see subtree_starts)
+*	- subtree is the expression put in its place
+**********************************************************************************************************************************/
+Program Program::replace(size_t node, const Program& subtree) const{
+
+	if(node >= ops.size())
+		throw std::domain_error("ERROR : no opcode " + std::to_string(node) + " in the expression.");
+
+	const size_t first = subtree_starts()[node];
+
+	vector<Opcode> code;
+	code.reserve(ops.size() - (node + 1 - first) + subtree.ops.size());
+	code.insert(code.end(), ops.begin(), ops.begin() + first);
+	code.insert(code.end(), subtree.ops.begin(), subtree.ops.end());
+	code.insert(code.end(), ops.begin() + node + 1, ops.end());
+
+	return Program(std::move(code));
+}
+
+
+
+/********************************************************************************************************************************
+* The values may fall below 2^-1022, where the operations on subnormal doubles are a hundred times slower (see DenormalFlush).
+* The smallest values are the ones near the axes, about |x|^factors (see ProgramInfo) : the expressions multiplying many small
+* factors are prone to subnormals, the ones whose factors are reset by cos or the constants are not.
+*
+* ARGUMENTS :
+*	- smallest is the smallest non-zero |x| and |y| of the points evaluated (half the step of the grid when it crosses 0)
+**********************************************************************************************************************************/
+bool Program::subnormal_prone(double smallest) const{
+
+	if(!(smallest > 0.0) || smallest >= 1.0)
+		return false;
+
+	return information.factors*-std::log2(smallest) > 1022;
+}
+
+
+
+/********************************************************************************************************************************
+* Same expression with the operands of avg and * in a fixed order. Both operators are commutative in floating point too, so the
+* canonical program renders exactly the same image.
+*
+* The operands are ordered by the hash of their canonical form, then by their size; only operands of the same hash and size
+* (nearly always the same sub-expression) are ordered by the opcodes of their canonical form. The hashes are computed from the
+* ones of the operands, and the canonical opcodes are written once at the end by walking the tree, so the time is linear in
+* the number of opcodes, even for the deep expressions the parser accepts.
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+Program Program::canonical() const{
+
+	const size_t count = ops.size();
+	const vector<size_t> start = subtree_starts();
+
+	//Hash of the canonical form of each sub-expression, and whether the operands of avg and * are exchanged
+	vector<uint64_t> hashes(count);
+	vector<char> swapped(count, 0);
+
+	//Append the canonical opcodes of the sub-expression ending at opcode node, walking its tree with an explicit stack
+	vector<std::pair<size_t, bool> > pending;
+	auto emit = [&](size_t node, vector<Opcode>& out){
+
+		pending.assign(1, std::make_pair(node, false));
+
+		while(!pending.empty()){
+
+			const size_t i = pending.back().first;
+			const bool operands_done = pending.back().second;
+			pending.pop_back();
+
+			if(ops[i] <= OP_PI || operands_done){
+				out.push_back(ops[i]);
+				continue;
+			}
+
+			pending.push_back(std::make_pair(i, true));
+			if(ops[i] <= OP_COS){
+				pending.push_back(std::make_pair(i - 1, false));
+				continue;
+			}
+
+			const size_t right = i - 1, left = start[i-1] - 1;
+			pending.push_back(std::make_pair(swapped[i] ? left : right, false));
+			pending.push_back(std::make_pair(swapped[i] ? right : left, false));
+		}
+	};
+
+	vector<Opcode> first, second;
+
+	for(size_t i = 0; i < count; i++){
+
+		if(ops[i] <= OP_PI){
+			hashes[i] = hash_combine(FNV_OFFSET, ops[i]);
+			continue;
+		}
+		if(ops[i] <= OP_COS){
+			hashes[i] = hash_combine(hashes[i-1], ops[i]);
+			continue;
+		}
+
+		const size_t right = i - 1, left = start[i-1] - 1;
+		const size_t left_size = left - start[left] + 1, right_size = right - start[right] + 1;
+
+		if(hashes[right] != hashes[left] || right_size != left_size)
+			swapped[i] = (hashes[right] < hashes[left]) || (hashes[right] == hashes[left] && right_size < left_size);
+		else{
+			first.clear();
+			second.clear();
+			emit(left, first);
+			emit(right, second);
+			swapped[i] = std::lexicographical_compare(second.begin(), second.end(), first.begin(), first.end());
+		}
+
+		hashes[i] = swapped[i] ? hash_combine(hash_combine(hashes[right], hashes[left]), ops[i])
+			: hash_combine(hash_combine(hashes[left], hashes[right]), ops[i]);
+	}
+
+	vector<Opcode> code;
+	code.reserve(count);
+	emit(count - 1, code);
+
+	return Program(std::move(code));
+}
+
+
+
+/********************************************************************************************************************************
+* Content hash of the opcodes (FNV-1a). Use canonical().hash() to get the same hash for equivalent expressions.
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+uint64_t Program::hash() const{
+
+	uint64_t h = FNV_OFFSET;
+
+	for(size_t i = 0; i < ops.size(); i++){
+		h ^= ops[i];
+		h *= FNV_PRIME;
+	}
+
+	return h;
+}
+
+
+
+/********************************************************************************************************************************
+* Mix a value into a hash (FNV-1a over its bytes)
+*
+* ARGUMENTS :
+*	- seed is the hash so far
+*	- value is the value to mix in
+**********************************************************************************************************************************/
+uint64_t hash_combine(uint64_t seed, uint64_t value){
+
+	for(int i = 0; i < 8; i++){
+		seed ^= (value >> (8*i)) & 0xff;
+		seed *= FNV_PRIME;
+	}
+
+	return seed;
+}
@@ -0,0 +1,103 @@
+#ifndef GUARD_program_h
+#define GUARD_program_h
+
+#include "parser.hpp"//to use typedef Exp
+#include "kernels.hpp"
+
+#include <vector>
+#include <iostream>
+#include <cstddef>
+#include <stdint.h>
+
+
+class ThreadPool;
+
+
+enum Opcode : unsigned char {OP_ZERO, OP_X, OP_Y, OP_PI, OP_SIN, OP_COS, OP_AVG, OP_TIMES};
+
+const int OPCODES = OP_TIMES + 1; // Number of opcodes
+
+
+enum Parity : unsigned char // Symmetry of an expression along an axis, the other coordinate being fixed
+{
+	PARITY_NONE = 0, // No symmetry known
+	PARITY_EVEN = 1, // f(-x) = f(x)
+	PARITY_ODD = 2, // f(-x) = -f(x)
+	PARITY_ZERO = 3 // Both : the expression is 0 (as "0" or "0*y")
+};
+
+
+struct ProgramInfo // Metadata of a program, computed in one pass over the opcodes
+{
+	int depth; // Depth of the expression, as defined by make_random_rpn_exp ("0" has depth 0)
+	size_t nodes; // Number of nodes of the expression tree (one per opcode)
+	int stack_height; // Maximum number of values on the stack during an evaluation
+	bool uses_x; // The expression depends on x
+	bool uses_y; // The expression depends on y
+	Parity x_parity; // Symmetry of the expression in x (exact : the evaluation of a mirrored point gives the same bits, or their negation)
+	Parity y_parity; // Symmetry of the expression in y
+	size_t counts[OPCODES]; // Number of opcodes of each type
+	size_t factors; // Most factors x and y multiplied together (sin keeps them, cos and the constants have none) : near the axes the value is about |x|^factors
+	bool infix; // Every operand of sin and cos is a product by pi, so that write_infix gives text the parser reads back
+};
+
+
+class Program // Compiled form of a colour expression : the RPN sequence as one opcode per token
+{
+
+public:
+
+	Program(); // Constructor of the expression "0"
+
+	explicit Program(const Exp& rpn); // Compile an expression in reverse polish notation
+
+	Program(const Opcode* code, size_t size); // Constructor copying compiled opcodes (checked)
+
+	Exp to_rpn() const; // Returns the expression in reverse polish notation
+
+	double evaluate(double x, double y) const; // Returns the value of the expression at the point (x,y)
+
+	void evaluate(const double* x, const double* y, size_t n, double* result, const Kernels& kernel = kernels()) const; // Evaluate the expression at n points at once
+
+	void evaluate_gradient(const double* x, const double* y, size_t n, double* value, double* dx, double* dy,
+		const Kernels& kernel = kernels()) const; // Evaluate the expression and its partial derivatives at n points
+
+	void evaluate_tasks(const double* x, const double* y, size_t n, double* result, ThreadPool& pool, size_t min_nodes,
+		const Kernels& kernel = kernels()) const; // Evaluate at n points, the large independent sub-expressions being parallel tasks
+
+	size_t evaluation_block() const; // Number of points the batched evaluation computes at once
+
+	const std::vector<Opcode>& code() const; // The opcodes, in reverse polish notation
+
+	int stack_height() const; // Maximum number of values on the stack during an evaluation
+
+	const ProgramInfo& info() const; // Depth, number of nodes, stack height and variables of the expression
+
+	void write_infix(std::ostream& out) const; // Write the expression in infix notation, without building any string
+
+	std::vector<size_t> subtree_starts() const; // First opcode of the sub-expression ending at each opcode
+
+	Program replace(size_t node, const Program& subtree) const; // Same expression with the sub-expression ending at opcode node replaced
+
+	bool subnormal_prone(double smallest) const; // The values may fall below 2^-1022 where |x| and |y| are as small as smallest
+
+	Program canonical() const; // Same expression with the operands of avg and * in a fixed order
+
+	uint64_t hash() const; // Content hash of the opcodes (FNV-1a)
+
+
+private:
+
+	std::vector<Opcode> ops;
+	ProgramInfo information;
+
+	explicit Program(std::vector<Opcode>&& code); // Constructor from already compiled opcodes
+
+	void check(); // Check the opcodes and compute their metadata
+
+};
+
+
+uint64_t hash_combine(uint64_t seed, uint64_t value); // Mix a value into a hash (FNV-1a over its bytes)
+
+#endif
@@ -0,0 +1,210 @@
+#include "programLibrary.hpp"
+#include "program.hpp"
+#include "colorExpression.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept> //domain_error
+#include <cstring> //memcmp, memcpy
+
+#include <fcntl.h> //open
+#include <unistd.h> //close
+#include <sys/mman.h> //mmap
+#include <sys/stat.h> //fstat
+
+
+using std::string;
+using std::vector;
+
+
+static const char LIBRARY_MAGIC[8] = {'M', 'A', 'R', 'T', 'P', 'R', 'G', '\0'};
+static const uint32_t LIBRARY_VERSION = 1;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+
+
+/********************************************************************************************************************************
+* Constructor, maps the library and checks its header and records (the opcodes themselves are checked when they are loaded)
+*
+* ARGUMENTS :
+*	- path is the path of the library
+**********************************************************************************************************************************/
+ProgramLibrary::ProgramLibrary(const string& path) : data(nullptr), length(0){
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::domain_error("ERROR : Can't open " + path + ".");
+
+	struct stat info;
+	if(fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(LibraryHeader)){
+		close(fd);
+		throw std::domain_error("ERROR : " + path + " is not a program library.");
+	}
+	length = info.st_size;
+
+	data = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED){
+		data = nullptr;
+		throw std::domain_error("ERROR : Can't map " + path + ".");
+	}
+
+	const char* bytes = static_cast<const char*>(data);
+	header = reinterpret_cast<const LibraryHeader*>(bytes);
+	records = reinterpret_cast<const ChannelRecord*>(bytes + sizeof(LibraryHeader));
+
+	string error;
+
+	if(std::memcmp(header->magic, LIBRARY_MAGIC, sizeof(LIBRARY_MAGIC)) != 0)
+		error = path + " is not a program library.";
+	else if(header->byte_order != BYTE_ORDER_MARK)
+		error = path + " was written with another byte order.";
+	else if(header->version != LIBRARY_VERSION)
+		error = path + " has an unsupported version (" + std::to_string(header->version) + ").";
+	else if(header->count > (length - sizeof(LibraryHeader)) / (3*sizeof(ChannelRecord))
+		|| header->code_size != length - sizeof(LibraryHeader) - 3*header->count*sizeof(ChannelRecord))
+		error = path + " is truncated.";
+	else{
+		opcodes = reinterpret_cast<const Opcode*>(records + 3*header->count);
+
+		for(size_t i = 0; i < 3*header->count && error.empty(); i++){
+			if(records[i].offset > header->code_size || records[i].size > header->code_size - records[i].offset)
+				error = path + " has a record out of bounds.";
+		}
+	}
+
+	if(!error.empty()){
+		munmap(data, length);
+		data = nullptr;
+		throw std::domain_error("ERROR : " + error);
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Destructor, unmaps the library
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ProgramLibrary::~ProgramLibrary(){
+	if(data != nullptr)
+		munmap(data, length);
+}
+
+
+
+/********************************************************************************************************************************
+* Number of scenes
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t ProgramLibrary::size() const{
+	return header->count;
+}
+
+
+
+/********************************************************************************************************************************
+* Record of a colour component
+*
+* ARGUMENTS :
+*	- scene is the index of the scene
+*	- channel is the colour component (0 = red, 1 = green, 2 = blue)
+**********************************************************************************************************************************/
+const ChannelRecord& ProgramLibrary::record(size_t scene, int channel) const{
+
+	if(scene >= header->count || channel < 0 || channel > 2)
+		throw std::domain_error("ERROR : No such program in the library.");
+
+	return records[3*scene + channel];
+}
+
+
+
+/********************************************************************************************************************************
+* Opcodes of a colour component, pointing into the mapping
+*
+* ARGUMENTS :
+*	- scene is the index of the scene
+*	- channel is the colour component (0 = red, 1 = green, 2 = blue)
+**********************************************************************************************************************************/
+const Opcode* ProgramLibrary::code(size_t scene, int channel) const{
+	return opcodes + record(scene, channel).offset;
+}
+
+
+
+/********************************************************************************************************************************
+* Initialise the expressions of a scene. A scene whose expressions couldn't be written back in infix notation is rejected, the
+* operand of each sin and cos having to be a product by pi (see ProgramInfo::infix).
+*
+* ARGUMENTS :
+*	- scene is the index of the scene
+*	- red, green and blue are the expressions to initialise
+**********************************************************************************************************************************/
+void ProgramLibrary::load(size_t scene, ColorExpression& red, ColorExpression& green, ColorExpression& blue) const{
+
+	ColorExpression* exps[3] = {&red, &green, &blue};
+
+	for(int i = 0; i < 3; i++){
+		Program program(code(scene, i), record(scene, i).size);
+		if(!program.info().infix)
+			throw std::domain_error("ERROR : scene " + std::to_string(scene) + " has an operand of sin or cos which isn't a product by pi.");
+		exps[i]->new_exp(program);
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Write the expressions as a library
+*
+* ARGUMENTS :
+*	- path is the path of the library to write
+*	- expressions are the red, green and blue expressions of each scene, one scene after the other
+**********************************************************************************************************************************/
+void write_program_library(const string& path, const vector<ColorExpression>& expressions){
+
+	if(expressions.size() % 3 != 0)
+		throw std::domain_error("ERROR : A scene is made of three expressions.");
+
+	LibraryHeader header;
+	std::memcpy(header.magic, LIBRARY_MAGIC, sizeof(LIBRARY_MAGIC));
+	header.version = LIBRARY_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.count = expressions.size() / 3;
+	header.code_size = 0;
+
+	vector<ChannelRecord> records(expressions.size());
+
+	for(size_t i = 0; i < expressions.size(); i++){
+
+		const Program& program = expressions[i].compiled();
+
+		records[i].offset = header.code_size;
+		records[i].hash = expressions[i].hash();
+		records[i].size = program.code().size();
+		records[i].depth = expressions[i].calculate_depth();
+		records[i].stack_height = program.stack_height();
+		records[i].reserved = 0;
+
+		header.code_size += program.code().size();
+	}
+
+	std::ofstream out(path.c_str(), std::ios::binary);
+	if(!out)
+		throw std::domain_error("ERROR : Can't create " + path + ".");
+
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(records.data()), records.size()*sizeof(ChannelRecord));
+
+	for(size_t i = 0; i < expressions.size(); i++){
+		const vector<Opcode>& code = expressions[i].compiled().code();
+		out.write(reinterpret_cast<const char*>(code.data()), code.size());
+	}
+
+	if(!out)
+		throw std::domain_error("ERROR : Can't write " + path + ".");
+}
@@ -0,0 +1,80 @@
+#ifndef GUARD_programLibrary_h
+#define GUARD_programLibrary_h
+
+#include "program.hpp"
+#include "colorExpression.hpp"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+
+/********************************************************************************************************************************
+* Binary program library (version 1). All the integers are stored in the byte order of the writer, which is checked on load.
+*
+*	- header : magic "MARTPRG\0", version (uint32), byte order mark 0x01020304 (uint32), number of scenes (uint64),
+*	  size of the opcode area (uint64)
+*	- one ChannelRecord per colour component of each scene (red, green, blue, then the next scene)
+*	- the opcode area : the opcodes of every channel, one byte each, in reverse polish notation
+*
+* The records are 8-byte aligned, so the library is used in place once mapped : loading it does not parse nor allocate anything.
+**********************************************************************************************************************************/
+
+struct LibraryHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t count;
+	uint64_t code_size;
+};
+
+struct ChannelRecord
+{
+	uint64_t offset; // Offset of the opcodes in the opcode area
+	uint64_t hash; // Hash of the canonical form (see ColorExpression::hash)
+	uint32_t size; // Number of opcodes
+	uint32_t depth;
+	uint32_t stack_height;
+	uint32_t reserved;
+};
+
+
+
+class ProgramLibrary // Program library mapped read-only in memory (the pages are shared by every process mapping the file)
+{
+
+public:
+
+	explicit ProgramLibrary(const std::string& path); // Constructor, maps and checks the library
+
+	~ProgramLibrary(); // Destructor, unmaps the library
+
+	size_t size() const; // Number of scenes
+
+	const ChannelRecord& record(size_t scene, int channel) const; // Record of a colour component (0 = red, 1 = green, 2 = blue)
+
+	const Opcode* code(size_t scene, int channel) const; // Opcodes of a colour component, pointing into the mapping
+
+	void load(size_t scene, ColorExpression& red, ColorExpression& green, ColorExpression& blue) const; // Initialise the expressions of a scene
+
+
+private:
+
+	void* data;
+	size_t length;
+	const LibraryHeader* header;
+	const ChannelRecord* records;
+	const Opcode* opcodes;
+
+	ProgramLibrary(const ProgramLibrary&) = delete;
+	ProgramLibrary& operator=(const ProgramLibrary&) = delete;
+
+};
+
+
+
+void write_program_library(const std::string& path, const std::vector<ColorExpression>& expressions); // Write the expressions (red, green and blue of each scene) as a library
+
+#endif
@@ -0,0 +1,738 @@
+#include "renderServer.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "image.hpp"
+#include "png.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm> //std::sort, std::max, std::min
+#include <sstream>
+#include <iostream>
+#include <iomanip> //std::setprecision
+#include <cerrno>
+#include <cstring> //memcpy
+#include <stdint.h>
+#include <stdexcept> //domain_error
+#include <unistd.h> //read, write, close, unlink
+#include <sys/socket.h> //send, MSG_NOSIGNAL
+#include <sys/un.h>
+
+
+using std::string;
+using std::vector;
+using std::unique_ptr;
+
+typedef vector<unsigned char> Bytes;
+typedef std::chrono::steady_clock Clock;
+
+
+static const size_t LATENCY_WINDOW = 4096; // Number of the last requests whose latencies give the percentiles
+static const int SOCKET_BACKLOG = 16; // Connections waiting to be accepted
+
+
+
+/********************************************************************************************************************************
+* Default settings : 2 workers, 64 pending requests per connection, images of at most 16 Mpixels, requests of at most 1 MB and
+* 1024 compiled expressions
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ServerOptions default_server_options(){
+
+	ServerOptions options;
+	options.workers = 2;
+	options.max_pending = 64;
+	options.max_pixels = 16 << 20;
+	options.max_frame = 1 << 20;
+	options.programs = 1024;
+	return options;
+}
+
+
+
+/********************************************************************************************************************************
+* Name of the encoding of a request, as in the protocol
+*
+* ARGUMENT :
+*	- request is the request
+**********************************************************************************************************************************/
+static const char* encoding_name(const RenderRequest& request){
+
+	switch(request.encoding){
+		case ENCODING_RAW:
+			return "raw";
+		case ENCODING_PPM:
+			return "ppm";
+		default:
+			return (request.png_mode == PNG_FAST) ? "png-fast" : (request.png_mode == PNG_STORED) ? "png-stored" : "png";
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Parse the payload of a request (see renderServer.hpp)
+*
+* ARGUMENT :
+*	- payload is the text of the request
+*
+* RETURN : the request, the viewport being [-1,1] x [-1,1] and the encoding raw unless they are given
+**********************************************************************************************************************************/
+RenderRequest parse_request(const string& payload){
+
+	RenderRequest request;
+	request.width = 0;
+	request.height = 0;
+	request.viewport = {-1.0, 1.0, -1.0, 1.0};
+	request.encoding = ENCODING_RAW;
+	request.png_mode = PNG_DEFAULT;
+
+	std::istringstream lines(payload);
+	string line;
+
+	while(std::getline(lines, line)){
+
+		if(line.empty())
+			continue;
+
+		const size_t space = line.find(' ');
+		const string key = line.substr(0, space);
+		const string value = (space == string::npos) ? "" : line.substr(space + 1);
+		std::istringstream in(value);
+		bool valid = true;
+
+		if(key == "id")
+			request.id = value;
+		else if(key == "size")
+			valid = (in >> request.width >> request.height) && (in >> std::ws).eof();
+		else if(key == "viewport"){
+			Viewport& v = request.viewport;
+			valid = (in >> v.x_min >> v.x_max >> v.y_min >> v.y_max) && (in >> std::ws).eof();
+		}
+		else if(key == "encoding"){
+			if(value == "raw")
+				request.encoding = ENCODING_RAW;
+			else if(value == "ppm")
+				request.encoding = ENCODING_PPM;
+			else if(value == "png" || value == "png-fast" || value == "png-stored"){
+				request.encoding = ENCODING_PNG;
+				request.png_mode = (value == "png-fast") ? PNG_FAST : (value == "png-stored") ? PNG_STORED : PNG_DEFAULT;
+			}
+			else
+				throw std::domain_error("ERROR : Unknown encoding " + value + ".");
+		}
+		else if(key == "red")
+			request.red = value;
+		else if(key == "green")
+			request.green = value;
+		else if(key == "blue")
+			request.blue = value;
+		else
+			throw std::domain_error("ERROR : Unknown request field " + key + ".");
+
+		if(!valid)
+			throw std::domain_error("ERROR : Invalid " + key + " of request.");
+	}
+
+	if(request.width == 0 || request.height == 0)
+		throw std::domain_error("ERROR : Request without size.");
+
+	if(request.red.empty() || request.green.empty() || request.blue.empty())
+		throw std::domain_error("ERROR : Request without its three expressions.");
+
+	return request;
+}
+
+
+
+/********************************************************************************************************************************
+* Payload of a request
+*
+* ARGUMENT :
+*	- request is the request, its id and expressions holding no line break
+**********************************************************************************************************************************/
+string format_request(const RenderRequest& request){
+
+	std::ostringstream out;
+	out << std::setprecision(17);
+	out << "id " << request.id << '\n'
+		<< "size " << request.width << ' ' << request.height << '\n'
+		<< "viewport " << request.viewport.x_min << ' ' << request.viewport.x_max << ' '
+			<< request.viewport.y_min << ' ' << request.viewport.y_max << '\n'
+		<< "encoding " << encoding_name(request) << '\n'
+		<< "red " << request.red << '\n'
+		<< "green " << request.green << '\n'
+		<< "blue " << request.blue << '\n';
+	return out.str();
+}
+
+
+
+/********************************************************************************************************************************
+* Read or write exactly size bytes, the interrupted calls being resumed
+*
+* ARGUMENTS :
+*	- fd is the file descriptor
+*	- data is the buffer
+*	- size is the number of bytes
+*
+* RETURN : the number of bytes read, less than size at the end of the file
+**********************************************************************************************************************************/
+static size_t read_all(int fd, char* data, size_t size){
+
+	size_t done = 0;
+	while(done < size){
+		ssize_t n = ::read(fd, data + done, size - done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n < 0)
+			throw std::domain_error("ERROR : Can't read the frame.");
+		if(n == 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static void write_all(int fd, const char* data, size_t size){
+
+	for(size_t done = 0; done < size;){
+		// A socket whose peer is gone gives EPIPE rather than SIGPIPE, other files are written as usual
+		ssize_t n = ::send(fd, data + done, size - done, MSG_NOSIGNAL);
+		if(n < 0 && errno == ENOTSOCK)
+			n = ::write(fd, data + done, size - done);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			throw std::domain_error("ERROR : Can't write the frame.");
+		done += n;
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Read a frame : a length of 4 bytes (little endian) and the payload
+*
+* ARGUMENTS :
+*	- fd is the file descriptor
+*	- payload receives the payload
+*	- max_size is the largest payload accepted
+*
+* RETURN : false at the end of the file, between two frames
+**********************************************************************************************************************************/
+bool read_frame(int fd, string& payload, size_t max_size){
+
+	unsigned char length[4];
+	const size_t got = read_all(fd, (char*)length, 4);
+	if(got == 0)
+		return false;
+	if(got < 4)
+		throw std::domain_error("ERROR : Truncated frame.");
+
+	const size_t size = length[0] | (length[1] << 8) | (length[2] << 16) | ((size_t)length[3] << 24);
+	if(size > max_size)
+		throw std::domain_error("ERROR : Frame is too large.");
+
+	payload.resize(size);
+	if(read_all(fd, &payload[0], size) < size)
+		throw std::domain_error("ERROR : Truncated frame.");
+
+	return true;
+}
+
+
+
+/********************************************************************************************************************************
+* Write a frame made of a header and a body. On a socket whose peer is gone it throws a domain_error without raising SIGPIPE;
+* on a pipe, SIGPIPE is raised as by write unless the process ignores it.
+*
+* ARGUMENTS :
+*	- fd is the file descriptor
+*	- header and body are written one after the other as the payload
+**********************************************************************************************************************************/
+void write_frame(int fd, const string& header, const Bytes& body){
+
+	const uint64_t size = header.size() + body.size();
+	if(size > 0xffffffffu)
+		throw std::domain_error("ERROR : Frame is too large.");
+
+	string head(4, '\0');
+	for(int i = 0; i < 4; i++)
+		head[i] = (char)(size >> (8*i));
+	head += header;
+
+	write_all(fd, head.data(), head.size());
+	if(!body.empty())
+		write_all(fd, (const char*)body.data(), body.size());
+}
+
+
+
+/********************************************************************************************************************************
+* Print the metrics of a server
+*
+* ARGUMENTS :
+*	- out is the output stream
+*	- stats are the metrics
+**********************************************************************************************************************************/
+std::ostream& operator<<(std::ostream& out, const ServerStats& stats){
+
+	out << stats.requests << " request(s) in " << std::fixed << std::setprecision(3) << stats.seconds << " s";
+	if(stats.seconds > 0)
+		out << " : " << std::setprecision(1) << stats.requests/stats.seconds << " requests/s";
+	if(stats.errors > 0)
+		out << ", " << stats.errors << " failed";
+	out << std::endl;
+
+	out << "  latency : " << std::setprecision(0) << stats.total_us << " us on average (queue " << stats.queue_us
+		<< ", render " << stats.render_us << ", encode " << stats.encode_us << "), median " << stats.total_p50_us << " us, 99th percentile "
+		<< stats.total_p99_us << " us" << std::endl;
+	out << "  backpressure : at most " << stats.max_pending << " pending request(s) per connection" << std::endl;
+	out << "  expressions : " << stats.programs.hits << " hit(s), " << stats.programs.misses << " miss(es), "
+		<< stats.programs.evictions << " eviction(s)" << std::endl;
+
+	out.unsetf(std::ios::floatfield);
+	return out;
+}
+
+
+
+/********************************************************************************************************************************
+* A stream of requests and responses. The responses are written whole by one worker at a time.
+**********************************************************************************************************************************/
+struct RenderServer::Connection
+{
+	int out;
+	std::mutex write_mutex;
+	bool broken; // A response couldn't be written : the next ones are dropped
+	size_t pending; // Requests read but not answered yet, guarded by the mutex of the server
+	std::condition_variable answered;
+	Metrics metrics;
+};
+
+
+
+/********************************************************************************************************************************
+* A worker thread and its warm state : the Martist keeps the tuning profile of the machine, the buffers keep their capacity
+**********************************************************************************************************************************/
+struct RenderServer::Worker
+{
+	Bytes pixels;
+	Bytes encoded;
+	Martist martist;
+
+	Worker() : pixels(3), encoded(), martist(pixels.data(), 1, 1, 0, 0, 0){}
+};
+
+
+
+/********************************************************************************************************************************
+* Metrics without request
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+RenderServer::Metrics::Metrics() : stats(), totals(), start(){}
+
+
+
+/********************************************************************************************************************************
+* Add an answered request to the metrics
+*
+* ARGUMENTS :
+*	- latency are its latencies
+*	- error tells whether it failed
+*	- read is the time its frame was read
+**********************************************************************************************************************************/
+void RenderServer::Metrics::record(const Latency& latency, bool error, Clock::time_point read){
+
+	if(stats.requests == 0 || read < start)
+		start = read;
+
+	if(totals.size() < LATENCY_WINDOW)
+		totals.push_back(latency.total);
+	else
+		totals[stats.requests % LATENCY_WINDOW] = latency.total;
+
+	stats.requests++;
+	stats.errors += error;
+	stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+	stats.queue_us += latency.queue;
+	stats.render_us += latency.render;
+	stats.encode_us += latency.encode;
+	stats.total_us += latency.total;
+}
+
+
+
+/********************************************************************************************************************************
+* Metrics with their averages and the percentiles of the last LATENCY_WINDOW requests
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ServerStats RenderServer::Metrics::summary() const{
+
+	ServerStats summary = stats;
+	if(summary.requests == 0)
+		return summary;
+
+	summary.queue_us /= summary.requests;
+	summary.render_us /= summary.requests;
+	summary.encode_us /= summary.requests;
+	summary.total_us /= summary.requests;
+
+	vector<double> sorted = totals;
+	std::sort(sorted.begin(), sorted.end());
+	summary.total_p50_us = sorted[(sorted.size() - 1)/2];
+	summary.total_p99_us = sorted[(sorted.size() - 1)*99/100];
+
+	return summary;
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor, starts the workers
+*
+* ARGUMENTS :
+*	- options are the settings of the server
+**********************************************************************************************************************************/
+RenderServer::RenderServer(const ServerOptions& options) :
+	options(options),
+	programs(options.programs),
+	workers(),
+	threads(),
+	jobs(),
+	stopping(false),
+	mutex(),
+	job_ready(),
+	metrics()
+{
+	if(options.workers == 0 || options.workers > 256)
+		throw std::domain_error("ERROR : Number of workers must be in [1,256].");
+
+	if(options.max_pending == 0)
+		throw std::domain_error("ERROR : Number of pending requests can't be 0.");
+
+	if(options.programs == 0)
+		throw std::domain_error("ERROR : Capacity of the expression cache can't be 0.");
+
+	for(size_t i = 0; i < options.workers; i++)
+		workers.emplace_back(new Worker());
+
+	for(size_t i = 0; i < options.workers; i++)
+		threads.emplace_back(&RenderServer::work, this, std::ref(*workers[i]));
+}
+
+
+
+/********************************************************************************************************************************
+* Destructor, waits for the requests in flight and stops the workers
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+RenderServer::~RenderServer(){
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	job_ready.notify_all();
+
+	for(std::thread& thread : threads)
+		thread.join();
+}
+
+
+
+/********************************************************************************************************************************
+* Answer the requests read from in until its end. A request is read only while fewer than max_pending of the connection wait for
+* their response, so a client sending faster than the server renders is slowed down by its socket or pipe. A frame larger than
+* max_frame, or truncated, ends the connection after an error response.
+*
+* ARGUMENTS :
+*	- in is the file descriptor of the requests
+*	- out is the file descriptor of the responses
+*
+* RETURN : the metrics of the requests of the connection
+**********************************************************************************************************************************/
+ServerStats RenderServer::serve(int in, int out){
+
+	Connection connection;
+	connection.out = out;
+	connection.broken = false;
+	connection.pending = 0;
+
+	while(true){
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			connection.answered.wait(lock, [&]{return connection.pending < options.max_pending;});
+		}
+
+		Job job;
+		try{
+			if(!read_frame(in, job.payload, options.max_frame))
+				break;
+		}
+		catch(std::domain_error& e){
+			std::lock_guard<std::mutex> lock(connection.write_mutex);
+			try{
+				write_frame(out, string("status error\nmessage ") + e.what() + "\n\n", Bytes());
+			}catch(std::domain_error&){
+			}
+			break;
+		}
+
+		job.connection = &connection;
+		job.read = Clock::now();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			connection.pending++;
+			connection.metrics.stats.max_pending = std::max(connection.metrics.stats.max_pending, connection.pending);
+			metrics.stats.max_pending = std::max(metrics.stats.max_pending, connection.pending);
+			jobs.push_back(std::move(job));
+		}
+		job_ready.notify_one();
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	connection.answered.wait(lock, [&]{return connection.pending == 0;});
+
+	ServerStats stats = connection.metrics.summary();
+	stats.programs = programs.stats();
+	return stats;
+}
+
+
+
+/********************************************************************************************************************************
+* Metrics of all the requests since the construction
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ServerStats RenderServer::stats() const{
+
+	std::lock_guard<std::mutex> lock(mutex);
+	ServerStats stats = metrics.summary();
+	stats.programs = programs.stats();
+	return stats;
+}
+
+
+
+/********************************************************************************************************************************
+* Serve the connections of a Unix domain socket, each in its thread, all of them sharing the workers. The file of the socket is
+* replaced if it exists and removed at the end.
+*
+* ARGUMENTS :
+*	- path is the file of the socket
+*	- connections is the number of connections to serve before returning (0 for no limit)
+**********************************************************************************************************************************/
+void RenderServer::listen(const string& path, size_t connections){
+
+	sockaddr_un address;
+	if(path.size() >= sizeof(address.sun_path))
+		throw std::domain_error("ERROR : Socket path is too long.");
+
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	int server = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if(server < 0)
+		throw std::domain_error("ERROR : Can't create the socket.");
+
+	::unlink(path.c_str());
+	if(::bind(server, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(server, SOCKET_BACKLOG) < 0){
+		::close(server);
+		throw std::domain_error("ERROR : Can't listen on " + path + ".");
+	}
+
+	// The threads of the connections are joined as they end
+	struct Client
+	{
+		std::thread thread;
+		std::shared_ptr<std::atomic<bool> > done;
+	};
+	vector<Client> clients;
+
+	for(size_t served = 0; connections == 0 || served < connections;){
+
+		int client = ::accept(server, nullptr, nullptr);
+		if(client < 0){
+			if(errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+		served++;
+
+		for(size_t i = 0; i < clients.size();){
+			if(*clients[i].done){
+				clients[i].thread.join();
+				clients[i] = std::move(clients.back());
+				clients.pop_back();
+			}
+			else
+				i++;
+		}
+
+		std::shared_ptr<std::atomic<bool> > done = std::make_shared<std::atomic<bool> >(false);
+		clients.push_back({std::thread([this, client, done]{
+			serve(client, client);
+			::close(client);
+			*done = true;
+		}), done});
+	}
+
+	for(Client& client : clients)
+		client.thread.join();
+
+	::close(server);
+	::unlink(path.c_str());
+}
+
+
+
+/********************************************************************************************************************************
+* Loop of a worker thread : answer the requests of all the connections in the order they were read
+*
+* ARGUMENT :
+*	- worker is the state of the thread
+**********************************************************************************************************************************/
+void RenderServer::work(Worker& worker){
+
+	while(true){
+
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			job_ready.wait(lock, [&]{return stopping || !jobs.empty();});
+			if(jobs.empty())
+				return;
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+
+		answer(worker, job);
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Microseconds elapsed since start
+*
+* ARGUMENT :
+*	- start is the beginning of the measure
+**********************************************************************************************************************************/
+static double microseconds(Clock::time_point start){
+	return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+
+
+/********************************************************************************************************************************
+* Id of a request whose payload can't be parsed, so that the error response still names it
+*
+* ARGUMENT :
+*	- payload is the text of the request
+**********************************************************************************************************************************/
+static string request_id(const string& payload){
+
+	size_t start = (payload.compare(0, 3, "id ") == 0) ? 0 : payload.find("\nid ");
+	if(start == string::npos)
+		return "";
+	if(start > 0)
+		start++;
+
+	const size_t end = payload.find('\n', start);
+	return payload.substr(start + 3, (end == string::npos) ? string::npos : end - start - 3);
+}
+
+
+
+/********************************************************************************************************************************
+* Render and encode a request with the warm state of a worker and the compiled expressions of the server, then write its
+* response. The errors of the request are sent back in the response.
+*
+* ARGUMENTS :
+*	- worker is the state of the thread
+*	- job is the request
+**********************************************************************************************************************************/
+void RenderServer::answer(Worker& worker, Job& job){
+
+	Latency latency = {microseconds(job.read), 0.0, 0.0, 0.0};
+	std::ostringstream header;
+	const Bytes* body = &worker.encoded;
+	bool error = false;
+
+	try{
+		RenderRequest request = parse_request(job.payload);
+
+		if(request.width > options.max_pixels/request.height)
+			throw std::domain_error("ERROR : Image is too large.");
+
+		uint64_t hash;
+		std::shared_ptr<const ColorExpression> red = programs.get(request.red, hash);
+		std::shared_ptr<const ColorExpression> green = programs.get(request.green, hash);
+		std::shared_ptr<const ColorExpression> blue = programs.get(request.blue, hash);
+
+		Clock::time_point start = Clock::now();
+		worker.pixels.resize(3*request.width*request.height);
+		worker.martist.changeBuffer(worker.pixels.data(), request.width, request.height);
+		worker.martist.viewport(request.viewport);
+		worker.martist.draw(*red, *green, *blue);
+		latency.render = microseconds(start);
+
+		start = Clock::now();
+		if(request.encoding == ENCODING_RAW)
+			body = &worker.pixels;
+		else if(request.encoding == ENCODING_PPM)
+			encode_ppm(worker.pixels.data(), request.width, request.height, worker.encoded);
+		else
+			encode_png(worker.pixels.data(), request.width, request.height, RGB8, worker.encoded, request.png_mode);
+		latency.encode = microseconds(start);
+		latency.total = microseconds(job.read);
+
+		header << "id " << request.id << "\nstatus ok\nsize " << request.width << ' ' << request.height
+			<< "\nencoding " << encoding_name(request) << "\nbytes " << body->size() << '\n';
+	}
+	catch(std::exception& e){
+		error = true;
+		worker.encoded.clear();
+		body = &worker.encoded;
+		latency.total = microseconds(job.read);
+		header.str("");
+		header << "id " << request_id(job.payload) << "\nstatus error\nmessage " << e.what() << "\nbytes 0\n";
+	}
+
+	header << std::fixed << std::setprecision(0) << "queue_us " << latency.queue << "\nrender_us " << latency.render
+		<< "\nencode_us " << latency.encode << "\ntotal_us " << latency.total << "\n\n";
+
+	Connection& connection = *job.connection;
+	{
+		std::lock_guard<std::mutex> lock(connection.write_mutex);
+		if(!connection.broken){
+			try{
+				write_frame(connection.out, header.str(), *body);
+			}catch(std::domain_error&){
+				connection.broken = true;
+			}
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		connection.metrics.record(latency, error, job.read);
+		metrics.record(latency, error, job.read);
+		connection.pending--;
+		connection.answered.notify_all(); // Under the lock : serve() may return and free the connection right after
+	}
+}
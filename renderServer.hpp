@@ -0,0 +1,180 @@
+#ifndef GUARD_renderServer_h
+#define GUARD_renderServer_h
+
+#include "martist.hpp"
+#include "cache.hpp"
+#include "png.hpp"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <iostream>
+#include <cstddef>
+
+
+/********************************************************************************************************************************
+* Resident render server. A request and its response are frames : a length of 4 bytes (little endian) followed by the payload.
+*
+* The payload of a request is made of text lines, the size and the three expressions being required :
+*	id <any text, copied to the response>
+*	size <width> <height>
+*	viewport <x_min> <x_max> <y_min> <y_max>
+*	encoding raw|ppm|png|png-fast|png-stored
+*	red <expression in infix notation>
+*	green <expression>
+*	blue <expression>
+*
+* The payload of a response is made of text lines ended by an empty line, followed by the pixels (interleaved 8-bit RGB for
+* raw, the encoded image otherwise) :
+*	id <id of the request>
+*	status ok|error
+*	message <error message>			(errors only)
+*	size <width> <height>
+*	encoding <encoding>
+*	bytes <number of bytes after the empty line>
+*	queue_us, render_us, encode_us, total_us <microseconds waiting, rendering, encoding and between the read and the response>
+*
+* A client may send any number of requests without waiting for the responses, which come in the order they are finished.
+*
+* A client closing its connection before reading its responses only ends its connection : the responses are sent on the sockets
+* with MSG_NOSIGNAL, so no SIGPIPE is raised. Other files (the pipes given to serve) are written with write, so a process serving
+* pipes must ignore SIGPIPE, as the serve tool does.
+**********************************************************************************************************************************/
+
+enum RequestEncoding // Pixels of a response
+{
+	ENCODING_RAW,
+	ENCODING_PPM,
+	ENCODING_PNG
+};
+
+struct RenderRequest // A parsed request
+{
+	std::string id;
+	size_t width;
+	size_t height;
+	Viewport viewport;
+	RequestEncoding encoding;
+	PngMode png_mode;
+	std::string red; // Expressions in infix notation
+	std::string green;
+	std::string blue;
+};
+
+RenderRequest parse_request(const std::string& payload); // Parse the payload of a request (throws domain_error)
+
+std::string format_request(const RenderRequest& request); // Payload of a request
+
+
+
+bool read_frame(int fd, std::string& payload, size_t max_size); // Read a frame, returns false at the end of the file (throws domain_error)
+
+void write_frame(int fd, const std::string& header, const std::vector<unsigned char>& body); // Write a frame made of a header and a body (throws domain_error; a socket whose peer is gone never raises SIGPIPE, a pipe may)
+
+
+
+struct ServerOptions // Settings of a render server
+{
+	size_t workers; // Requests rendered at once, each render using the thread pool of the library
+	size_t max_pending; // Requests of a connection read but not answered yet : it isn't read any further until one is answered
+	size_t max_pixels; // Largest image of a request
+	size_t max_frame; // Largest request, in bytes
+	size_t programs; // Capacity of the cache of compiled expressions
+};
+
+ServerOptions default_server_options(); // Default settings : 2 workers, 64 pending requests, 16 Mpixels, 1 MB requests
+
+
+
+struct ServerStats // Metrics of the requests served
+{
+	size_t requests;
+	size_t errors;
+	double seconds; // Time between the first request and the last response
+	double queue_us; // Averages, in microseconds
+	double render_us;
+	double encode_us;
+	double total_us;
+	double total_p50_us; // Median and 99th percentile of the total latency
+	double total_p99_us;
+	size_t max_pending; // Largest number of requests of a connection waiting at once
+	CacheStats programs; // Cache of the compiled expressions
+};
+
+std::ostream& operator<<(std::ostream& out, const ServerStats& stats); // Print the metrics of a server
+
+
+
+class RenderServer // Workers, compiled expressions and buffers kept warm between the requests of all the connections
+{
+
+public:
+
+	explicit RenderServer(const ServerOptions& options); // Constructor, starts the workers
+
+	~RenderServer(); // Destructor, waits for the requests in flight and stops the workers
+
+	ServerStats serve(int in, int out); // Answer the requests read from in until its end, returns the metrics of the connection
+
+	ServerStats stats() const; // Metrics of all the requests since the construction
+
+	void listen(const std::string& path, size_t connections = 0); // Serve the connections of a Unix domain socket, each in its thread (0 for no limit) : a client leaving early never raises SIGPIPE
+
+
+private:
+
+	struct Connection; // A stream of requests and responses
+	struct Worker; // A worker thread and its warm state
+
+	struct Latency // Latencies of a request, in microseconds
+	{
+		double queue;
+		double render;
+		double encode;
+		double total;
+	};
+
+	struct Metrics // Metrics of a connection or of the server
+	{
+		ServerStats stats; // The latencies are summed until summary()
+		std::vector<double> totals; // Total latencies of the last requests
+		std::chrono::steady_clock::time_point start; // Read of the first request
+
+		Metrics();
+		void record(const Latency& latency, bool error, std::chrono::steady_clock::time_point read); // Add an answered request, read at read
+		ServerStats summary() const; // Metrics with their averages and percentiles
+	};
+
+	struct Job // A request waiting for a worker
+	{
+		Connection* connection;
+		std::string payload;
+		std::chrono::steady_clock::time_point read;
+	};
+
+	void work(Worker& worker); // Loop of a worker thread
+	void answer(Worker& worker, Job& job); // Render and encode a request, then write its response
+
+	ServerOptions options;
+	ProgramCache programs;
+	std::vector<std::unique_ptr<Worker> > workers;
+	std::vector<std::thread> threads;
+
+	std::deque<Job> jobs;
+	bool stopping;
+	mutable std::mutex mutex;
+	std::condition_variable job_ready;
+
+	Metrics metrics;
+
+	RenderServer(const RenderServer&) = delete;
+	RenderServer& operator=(const RenderServer&) = delete;
+
+};
+
+#endif
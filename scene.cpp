@@ -0,0 +1,199 @@
+#include "scene.hpp"
+#include "colorExpression.hpp"
+
+#include <string>
+#include <vector>
+#include <stdexcept> //domain_error
+#include <algorithm> //std::all_of
+#include <cctype> //isspace
+#include <cstring> //memchr, strlen, strncmp
+
+#include <fcntl.h> //open
+#include <unistd.h> //close
+#include <sys/mman.h> //mmap
+#include <sys/stat.h> //fstat
+
+
+using std::string;
+using std::vector;
+
+
+
+/********************************************************************************************************************************
+* Read a line "name= exp" into exp. An empty expression gives an expression of depth 0.
+*
+* ARGUMENTS :
+*	- first and last delimit the line (without the '\n')
+*	- name is the name of the colour component ("red", "green" or "blue")
+*	- exp is the expression to initialise
+**********************************************************************************************************************************/
+void read_channel(const char* first, const char* last, const char* name, ColorExpression& exp){
+
+	size_t size = std::strlen(name);
+
+	//Skip the whitespaces before the name
+	while(first != last && isspace((unsigned char)*first))
+		first++;
+
+	//Check if we have "name="
+	if((size_t)(last - first) <= size || std::strncmp(first, name, size) != 0 || first[size] != '=')
+		throw std::domain_error("ERROR : bad argument entered.");
+	first += size + 1;
+
+	//If the string is full of whitespaces only or empty, make an expression of depth 0
+	if(std::all_of(first, last, [](char c){ return isspace((unsigned char)c) != 0; }))
+		exp.new_exp(0);
+	//Otherwise, make an expression with the input string
+	else
+		exp.new_exp(first, last);
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor, maps the file
+*
+* ARGUMENTS :
+*	- path is the path of the scene file
+**********************************************************************************************************************************/
+SceneFile::SceneFile(const string& path) : data(nullptr), length(0){
+
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::domain_error("ERROR : Can't open " + path + ".");
+
+	struct stat info;
+	if(fstat(fd, &info) != 0){
+		close(fd);
+		throw std::domain_error("ERROR : Can't read " + path + ".");
+	}
+	length = info.st_size;
+
+	// An empty file can't be mapped, it simply has no scene
+	if(length > 0){
+		data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED){
+			close(fd);
+			throw std::domain_error("ERROR : Can't map " + path + ".");
+		}
+		madvise(data, length, MADV_SEQUENTIAL);
+	}
+
+	close(fd);
+}
+
+
+
+/********************************************************************************************************************************
+* Destructor, unmaps the file
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+SceneFile::~SceneFile(){
+	if(data != nullptr)
+		munmap(data, length);
+}
+
+
+
+/********************************************************************************************************************************
+* First character of the file
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const char* SceneFile::begin() const{
+	return static_cast<const char*>(data);
+}
+
+
+
+/********************************************************************************************************************************
+* Past-the-end character of the file
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+const char* SceneFile::end() const{
+	return begin() + length;
+}
+
+
+
+/********************************************************************************************************************************
+* Cut the file in scenes of three lines. Lines which are empty, only made of whitespaces or starting with '#' are skipped.
+* Only the line boundaries are looked for here, the expressions are parsed later on (see parse_scene).
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+vector<SceneText> SceneFile::split() const{
+
+	vector<SceneText> scenes;
+	SceneText scene;
+	int channel = 0;
+	size_t line = 0;
+
+	const char* pos = begin();
+	const char* stop = end();
+
+	while(pos != stop){
+
+		const char* eol = static_cast<const char*>(std::memchr(pos, '\n', stop - pos));
+		if(eol == nullptr)
+			eol = stop;
+		line++;
+
+		//Look for the first non blank character of the line
+		const char* c = pos;
+		while(c != eol && isspace((unsigned char)*c))
+			c++;
+
+		if(c != eol && *c != '#'){
+			if(channel == 0)
+				scene.line = line;
+			scene.first[channel] = pos;
+			scene.last[channel] = eol;
+
+			if(++channel == 3){
+				scenes.push_back(scene);
+				channel = 0;
+			}
+		}
+
+		pos = (eol == stop) ? stop : eol + 1;
+	}
+
+	//Incomplete last scene
+	if(channel != 0){
+		for(; channel < 3; channel++)
+			scene.first[channel] = scene.last[channel] = nullptr;
+		scenes.push_back(scene);
+	}
+
+	return scenes;
+}
+
+
+
+/********************************************************************************************************************************
+* Parse the three expressions of a scene. The domain_error thrown tells which colour component is wrong.
+*
+* ARGUMENTS :
+*	- text is the scene in the file
+*	- red, green and blue are the expressions to initialise
+**********************************************************************************************************************************/
+void parse_scene(const SceneText& text, ColorExpression& red, ColorExpression& green, ColorExpression& blue){
+
+	const char* names[3] = {"red", "green", "blue"};
+	ColorExpression* exps[3] = {&red, &green, &blue};
+
+	for(int i = 0; i < 3; i++){
+
+		if(text.first[i] == nullptr)
+			throw std::domain_error("ERROR : incomplete scene, \"" + string(names[i]) + "=\" is missing.");
+
+		try{
+			read_channel(text.first[i], text.last[i], names[i], *exps[i]);
+		}catch(std::domain_error& e){
+			throw std::domain_error(string(names[i]) + " : " + e.what());
+		}
+	}
+}
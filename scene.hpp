@@ -0,0 +1,54 @@
+#ifndef GUARD_scene_h
+#define GUARD_scene_h
+
+#include "colorExpression.hpp"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+
+void read_channel(const char* first, const char* last, const char* name, ColorExpression& exp); // Read a line "name= exp" into exp
+
+
+
+struct SceneText // The three lines "red=", "green=" and "blue=" of a scene, pointing into the file
+{
+	size_t line; // Line of the "red=" line in the file (starting at 1)
+	const char* first[3];
+	const char* last[3]; // first[i] == nullptr if the file ends before the line
+};
+
+
+
+class SceneFile // Scene file mapped read-only in memory
+{
+
+public:
+
+	explicit SceneFile(const std::string& path); // Constructor, maps the file
+
+	~SceneFile(); // Destructor, unmaps the file
+
+	const char* begin() const; // First character of the file
+
+	const char* end() const; // Past-the-end character of the file
+
+	std::vector<SceneText> split() const; // Cut the file in scenes of three lines, skipping empty lines and '#' comments
+
+
+private:
+
+	void* data;
+	size_t length;
+
+	SceneFile(const SceneFile&) = delete;
+	SceneFile& operator=(const SceneFile&) = delete;
+
+};
+
+
+
+void parse_scene(const SceneText& text, ColorExpression& red, ColorExpression& green, ColorExpression& blue); // Parse the three expressions of a scene
+
+#endif
@@ -0,0 +1,291 @@
+#include "renderServer.hpp"
+#include "scene.hpp"
+#include "image.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <algorithm> //std::sort
+#include <sstream>
+#include <iomanip> //std::setprecision
+#include <cstdlib> //strtoul
+#include <cstring> //memcpy
+#include <csignal> //signal
+#include <stdexcept> //domain_error
+#include <unistd.h> //close
+#include <sys/socket.h>
+#include <sys/un.h>
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+
+
+/********************************************************************************************************************************
+* Connect to the Unix domain socket of a server
+*
+* ARGUMENT :
+*	- path is the file of the socket
+**********************************************************************************************************************************/
+static int connect_socket(const string& path){
+
+	sockaddr_un address;
+	if(path.size() >= sizeof(address.sun_path))
+		throw std::domain_error("ERROR : Socket path is too long.");
+
+	address.sun_family = AF_UNIX;
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+	if(fd < 0 || ::connect(fd, (sockaddr*)&address, sizeof(address)) < 0){
+		if(fd >= 0)
+			::close(fd);
+		throw std::domain_error("ERROR : Can't connect to " + path + ".");
+	}
+	return fd;
+}
+
+
+
+/********************************************************************************************************************************
+* Expression of a line "name= exp" of a scene, in infix notation
+*
+* ARGUMENTS :
+*	- first and last delimit the line
+**********************************************************************************************************************************/
+static string scene_expression(const char* first, const char* last){
+
+	if(first == nullptr)
+		throw std::domain_error("ERROR : Scene is incomplete.");
+
+	string line(first, last);
+	size_t equal = line.find('=');
+	if(equal == string::npos)
+		throw std::domain_error("ERROR : bad argument entered.");
+
+	size_t begin = line.find_first_not_of(" \t", equal + 1);
+	size_t end = line.find_last_not_of(" \t\r");
+	return (begin == string::npos) ? "" : line.substr(begin, end - begin + 1);
+}
+
+
+
+/********************************************************************************************************************************
+* Client of a server : sends the scenes of a file repeat times without waiting for the responses, then reads the responses and
+* prints the round trips and the latencies reported by the server
+*
+* ARGUMENTS :
+*	- path is the socket of the server
+*	- request is the request sent, its id and expressions replaced by the ones of each scene
+*	- scenes is the scene file
+*	- repeat is the number of times the scenes are sent
+*	- prefix, if not empty, is where the bodies of the responses are written (<prefix><id>.rgb, .ppm or .png)
+**********************************************************************************************************************************/
+static int client(const string& path, RenderRequest request, const string& scenes, size_t repeat, const string& prefix){
+
+	SceneFile file(scenes);
+	vector<SceneText> texts = file.split();
+	vector<RenderRequest> requests;
+	for(size_t r = 0; r < repeat; r++){
+		for(const SceneText& text : texts){
+			request.id = std::to_string(requests.size() + 1);
+			request.red = scene_expression(text.first[0], text.last[0]);
+			request.green = scene_expression(text.first[1], text.last[1]);
+			request.blue = scene_expression(text.first[2], text.last[2]);
+			requests.push_back(request);
+		}
+	}
+
+	int fd = connect_socket(path);
+	vector<std::atomic<long long> > sent(requests.size());
+	Clock::time_point begin = Clock::now();
+
+	std::thread sender([&]{
+		try{
+			for(size_t i = 0; i < requests.size(); i++){
+				sent[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - begin).count();
+				write_frame(fd, format_request(requests[i]), vector<unsigned char>());
+			}
+		}
+		catch(std::domain_error& e){
+			cerr << e.what() << endl;
+		}
+		::shutdown(fd, SHUT_WR);
+	});
+
+	vector<double> round_trips, server_totals;
+	size_t errors = 0, bytes = 0;
+	string payload;
+
+	while(read_frame(fd, payload, (size_t)-1)){
+
+		const double now = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+		const size_t end = payload.find("\n\n");
+		std::istringstream header(payload.substr(0, end));
+		string line, id, status, message;
+		double total = 0;
+
+		while(std::getline(header, line)){
+			const size_t space = line.find(' ');
+			const string key = line.substr(0, space), value = (space == string::npos) ? "" : line.substr(space + 1);
+			if(key == "id")
+				id = value;
+			else if(key == "status")
+				status = value;
+			else if(key == "message")
+				message = value;
+			else if(key == "total_us")
+				total = std::atof(value.c_str());
+		}
+
+		const size_t index = std::strtoul(id.c_str(), nullptr, 10);
+		if(index >= 1 && index <= requests.size())
+			round_trips.push_back(now - sent[index - 1]/1000.0);
+		server_totals.push_back(total);
+
+		if(status != "ok"){
+			cerr << "request " << id << " : " << message << endl;
+			errors++;
+			continue;
+		}
+
+		const size_t body = (end == string::npos) ? payload.size() : end + 2;
+		bytes += payload.size() - body;
+		if(!prefix.empty()){
+			const string extension = (request.encoding == ENCODING_RAW) ? ".rgb" : (request.encoding == ENCODING_PPM) ? ".ppm" : ".png";
+			write_file(prefix + id + extension, vector<unsigned char>(payload.begin() + body, payload.end()));
+		}
+	}
+
+	sender.join();
+	::close(fd);
+
+	const double seconds = std::chrono::duration<double>(Clock::now() - begin).count();
+	std::sort(round_trips.begin(), round_trips.end());
+	std::sort(server_totals.begin(), server_totals.end());
+
+	cout << round_trips.size() << " response(s) to " << requests.size() << " request(s) in " << std::fixed << std::setprecision(3)
+		<< seconds << " s : " << std::setprecision(1) << round_trips.size()/seconds << " requests/s, " << bytes << " bytes";
+	if(errors > 0)
+		cout << ", " << errors << " failed";
+	cout << endl;
+	if(!round_trips.empty()){
+		cout << std::setprecision(0) << "  round trip : median " << round_trips[(round_trips.size() - 1)/2] << " us, 99th percentile "
+			<< round_trips[(round_trips.size() - 1)*99/100] << " us (server : median " << server_totals[(server_totals.size() - 1)/2]
+			<< " us)" << endl;
+	}
+
+	return (errors == 0 && round_trips.size() == requests.size()) ? 0 : 1;
+}
+
+
+
+/********************************************************************************************************************************
+* Resident render server : the requests are read from the standard input (or the connections of a Unix domain socket) and the
+* responses written to the standard output (or the same connection), the workers, compiled expressions and buffers staying warm
+* between them. See renderServer.hpp for the protocol. The client mode sends the scenes of a file to a server, pipelined.
+*
+*	serve [--socket PATH [--connections N]] [--workers N] [--pending N] [--max-pixels N] [--max-frame N] [--programs N]
+*	serve --client PATH <scene file> <width> <height> [--repeat N] [--encoding E] [--viewport X0 X1 Y0 Y1] [--prefix P]
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	// A client of the standard streams leaving without reading its responses must not kill the server (the sockets never raise
+	// SIGPIPE, see write_frame)
+	std::signal(SIGPIPE, SIG_IGN);
+
+	try{
+		if(argc >= 6 && string(argv[1]) == "--client"){
+
+			RenderRequest request;
+			request.width = std::strtoul(argv[4], nullptr, 10);
+			request.height = std::strtoul(argv[5], nullptr, 10);
+			request.viewport = {-1.0, 1.0, -1.0, 1.0};
+			request.encoding = ENCODING_RAW;
+			request.png_mode = PNG_DEFAULT;
+			size_t repeat = 1;
+			string prefix;
+
+			for(int i = 6; i < argc; i++){
+
+				string option = argv[i];
+				int left = argc - i - 1;
+
+				if(option == "--repeat" && left >= 1)
+					repeat = std::strtoul(argv[++i], nullptr, 10);
+				else if(option == "--encoding" && left >= 1){
+					string encoding = argv[++i];
+					request.encoding = (encoding == "raw") ? ENCODING_RAW : (encoding == "ppm") ? ENCODING_PPM : ENCODING_PNG;
+					request.png_mode = (encoding == "png-fast") ? PNG_FAST : (encoding == "png-stored") ? PNG_STORED : PNG_DEFAULT;
+				}
+				else if(option == "--viewport" && left >= 4){
+					request.viewport.x_min = std::atof(argv[++i]);
+					request.viewport.x_max = std::atof(argv[++i]);
+					request.viewport.y_min = std::atof(argv[++i]);
+					request.viewport.y_max = std::atof(argv[++i]);
+				}
+				else if(option == "--prefix" && left >= 1)
+					prefix = argv[++i];
+				else{
+					cerr << "ERROR : Unknown option " << option << "." << endl;
+					return 2;
+				}
+			}
+
+			return client(argv[2], request, argv[3], repeat, prefix);
+		}
+
+		ServerOptions options = default_server_options();
+		string socket;
+		size_t connections = 0;
+
+		for(int i = 1; i < argc; i++){
+
+			string option = argv[i];
+			int left = argc - i - 1;
+
+			if(option == "--socket" && left >= 1)
+				socket = argv[++i];
+			else if(option == "--connections" && left >= 1)
+				connections = std::strtoul(argv[++i], nullptr, 10);
+			else if(option == "--workers" && left >= 1)
+				options.workers = std::strtoul(argv[++i], nullptr, 10);
+			else if(option == "--pending" && left >= 1)
+				options.max_pending = std::strtoul(argv[++i], nullptr, 10);
+			else if(option == "--max-pixels" && left >= 1)
+				options.max_pixels = std::strtoul(argv[++i], nullptr, 10);
+			else if(option == "--max-frame" && left >= 1)
+				options.max_frame = std::strtoul(argv[++i], nullptr, 10);
+			else if(option == "--programs" && left >= 1)
+				options.programs = std::strtoul(argv[++i], nullptr, 10);
+			else{
+				cerr << "Usage : " << argv[0] << " [--socket PATH [--connections N]] [--workers N] [--pending N] [--max-pixels N]"
+					<< " [--max-frame N] [--programs N]" << endl
+					<< "        " << argv[0] << " --client PATH <scene file> <width> <height> [--repeat N] [--encoding E]"
+					<< " [--viewport X0 X1 Y0 Y1] [--prefix P]" << endl;
+				return 2;
+			}
+		}
+
+		RenderServer server(options);
+		if(socket.empty())
+			server.serve(0, 1);
+		else
+			server.listen(socket, connections);
+
+		cerr << server.stats();
+		return 0;
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 2;
+	}
+}
@@ -0,0 +1,228 @@
+#include "threadPool.hpp"
+#include "kernels.hpp"
+
+#include <atomic>
+#include <exception> //std::exception_ptr
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <map>
+
+
+/********************************************************************************************************************************
+* A call to run() : the tasks are handed out one index at a time to every thread working on the job, with the floating-point
+* control of the thread calling run()
+**********************************************************************************************************************************/
+struct ThreadPool::Job
+{
+	const std::function<void(size_t)>* task;
+	size_t count;
+	unsigned int control; // Floating-point control of the thread calling run() (see float_control)
+
+	std::atomic<size_t> next; // Next index to hand out
+	std::atomic<size_t> done; // Number of finished tasks
+
+	std::mutex mutex;
+	std::condition_variable finished;
+	std::exception_ptr error; // First exception thrown by a task
+};
+
+
+
+/********************************************************************************************************************************
+* Constructor
+*
+* ARGUMENTS :
+*	- threads is the number of threads working on each run, the calling thread included (0 means one thread per core)
+**********************************************************************************************************************************/
+ThreadPool::ThreadPool(size_t threads) : stopping(false){
+
+	if(threads == 0)
+		threads = std::thread::hardware_concurrency();
+	if(threads == 0)
+		threads = 1;
+
+	// The thread calling run() always works too
+	for(size_t i = 1; i < threads; i++)
+		workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+
+
+/********************************************************************************************************************************
+* Destructor, joins the workers
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ThreadPool::~ThreadPool(){
+
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		stopping = true;
+	}
+	jobs_cond.notify_all();
+
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+
+
+/********************************************************************************************************************************
+* Number of threads taking part in a run, the calling thread included
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t ThreadPool::size() const{
+	return workers.size() + 1;
+}
+
+
+
+/********************************************************************************************************************************
+* Call task(0), ..., task(count-1) in parallel and wait for all of them. The calling thread works on its own job, so run()
+* may be called from inside a task without dead-locking the pool. The first exception thrown by a task is rethrown. The tasks
+* run with the floating-point control of the calling thread (flush-to-zero for instance, see DenormalFlush).
+*
+* ARGUMENTS :
+*	- count is the number of tasks
+*	- task is the function to call with the index of each task
+**********************************************************************************************************************************/
+void ThreadPool::run(size_t count, const std::function<void(size_t)>& task){
+
+	if(count == 0)
+		return;
+
+	std::shared_ptr<Job> job = std::make_shared<Job>();
+	job->task = &task;
+	job->count = count;
+	job->control = float_control();
+	job->next = 0;
+	job->done = 0;
+
+	if(count > 1 && !workers.empty()){
+		{
+			std::lock_guard<std::mutex> lock(jobs_mutex);
+			jobs.push_back(job);
+		}
+		jobs_cond.notify_all();
+	}
+
+	execute(*job);
+
+	{
+		std::unique_lock<std::mutex> lock(job->mutex);
+		job->finished.wait(lock, [&job]{ return job->done == job->count; });
+	}
+
+	if(job->error)
+		std::rethrow_exception(job->error);
+}
+
+
+
+/********************************************************************************************************************************
+* Run the tasks of a job until there is none left, with the floating-point control of the job (the one of the thread being
+* restored after)
+*
+* ARGUMENTS :
+*	- job is the job to work on
+**********************************************************************************************************************************/
+void ThreadPool::execute(Job& job){
+
+	const unsigned int control = float_control();
+	if(control != job.control)
+		set_float_control(job.control);
+
+	size_t i;
+
+	while((i = job.next++) < job.count){
+
+		try{
+			(*job.task)(i);
+		}catch(...){
+			std::lock_guard<std::mutex> lock(job.mutex);
+			if(!job.error)
+				job.error = std::current_exception();
+		}
+
+		if(++job.done == job.count){
+			std::lock_guard<std::mutex> lock(job.mutex);
+			job.finished.notify_all();
+		}
+	}
+
+	if(control != job.control)
+		set_float_control(control);
+}
+
+
+
+/********************************************************************************************************************************
+* Loop of a worker thread : take the oldest job which still has tasks to hand out
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+void ThreadPool::work(){
+
+	std::unique_lock<std::mutex> lock(jobs_mutex);
+
+	while(true){
+
+		// Forget the jobs whose tasks have all been handed out
+		while(!jobs.empty() && jobs.front()->next >= jobs.front()->count)
+			jobs.pop_front();
+
+		if(jobs.empty()){
+			if(stopping)
+				return;
+			jobs_cond.wait(lock);
+			continue;
+		}
+
+		std::shared_ptr<Job> job = jobs.front();
+
+		lock.unlock();
+		execute(*job);
+		lock.lock();
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Pool shared by the whole library (one thread per core)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+ThreadPool& ThreadPool::global(){
+	static ThreadPool pool;
+	return pool;
+}
+
+
+
+/********************************************************************************************************************************
+* Pool shared by the whole library with the given number of threads, made the first time it is asked for and kept until the
+* end of the program, so that the renders limited to some threads don't create their own threads each time
+*
+* ARGUMENTS :
+*	- threads is the number of threads working on each run, the calling thread included (0 for global())
+**********************************************************************************************************************************/
+ThreadPool& ThreadPool::sized(size_t threads){
+
+	if(threads == 0)
+		return global();
+
+	static std::mutex mutex;
+	static std::map<size_t, std::unique_ptr<ThreadPool> > pools;
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	std::unique_ptr<ThreadPool>& pool = pools[threads];
+	if(!pool)
+		pool.reset(new ThreadPool(threads));
+
+	return *pool;
+}
@@ -0,0 +1,50 @@
+#ifndef GUARD_threadPool_h
+#define GUARD_threadPool_h
+
+#include <cstddef>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <vector>
+#include <memory>
+
+
+class ThreadPool
+{
+
+public:
+
+	explicit ThreadPool(size_t threads = 0); // Constructor (0 means one thread per core)
+
+	~ThreadPool(); // Destructor, joins the workers
+
+	size_t size() const; // Number of threads taking part in a run, the calling thread included
+
+	void run(size_t count, const std::function<void(size_t)>& task); // Call task(0), ..., task(count-1) in parallel and wait for all of them
+
+	static ThreadPool& global(); // Pool shared by the whole library
+
+	static ThreadPool& sized(size_t threads); // Pool shared by the whole library with the given number of threads (0 for global())
+
+
+private:
+
+	struct Job; // A call to run()
+
+	std::vector<std::thread> workers;
+	std::deque<std::shared_ptr<Job> > jobs;
+	std::mutex jobs_mutex;
+	std::condition_variable jobs_cond;
+	bool stopping;
+
+	void work(); // Loop of a worker thread
+	static void execute(Job& job); // Run the tasks of a job until there is none left
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+};
+
+#endif
@@ -0,0 +1,403 @@
+#include "tilePyramid.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "program.hpp"
+#include "image.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <algorithm> //std::min, std::max
+#include <cmath> //std::floor, std::ldexp, std::log2, std::ceil
+#include <cstdio> //snprintf, remove
+#include <fstream>
+#include <atomic>
+#include <stdexcept> //domain_error
+
+
+using std::string;
+using std::vector;
+
+typedef vector<unsigned char> Bytes;
+
+
+static const int MIN_LEVEL = -30; // Coarsest level : a tile covers 2^31 on a side
+static const int MAX_LEVEL = 40; // Finest level : with tiles of 256 pixels, a pixel is about 1e-14 wide, near the precision of a double
+static const size_t MIN_TILE_SIZE = 16;
+static const size_t MAX_TILE_SIZE = 4096;
+
+static std::atomic<uint64_t> spill_serial(0); // Numbers the spilled files, so that tiles whose hashes collide never share one
+
+
+
+/********************************************************************************************************************************
+* Equality and hash of the tile keys
+**********************************************************************************************************************************/
+bool TileKey::operator==(const TileKey& other) const{
+	if(hash != other.hash || level != other.level || x != other.x || y != other.y)
+		return false;
+
+	for(int c = 0; c < 3; c++)
+		if(canonical[c] != other.canonical[c] && *canonical[c] != *other.canonical[c])
+			return false;
+
+	return true;
+}
+
+size_t TileKeyHash::operator()(const TileKey& key) const{
+	return (size_t)hash_combine(hash_combine(hash_combine(key.hash, (uint64_t)key.level), (uint64_t)key.x), (uint64_t)key.y);
+}
+
+
+
+/********************************************************************************************************************************
+* Constructor
+*
+* ARGUMENTS :
+*	- memory is the size of the tiles kept in memory, in bytes
+*	- tile_size is the number of pixels on a side of a tile, a power of two in [16,4096]
+*	- spill_directory, if not empty, is an existing directory where the tiles evicted from memory are written, to be read back
+*	  rather than rendered again
+**********************************************************************************************************************************/
+TilePyramid::TilePyramid(size_t memory, size_t tile_size, const string& spill_directory) :
+	tile_size(tile_size),
+	spill_directory(spill_directory),
+	tiles(memory),
+	spilled(),
+	counters(),
+	mutex()
+{
+	if(tile_size < MIN_TILE_SIZE || tile_size > MAX_TILE_SIZE || (tile_size & (tile_size - 1)) != 0)
+		throw std::domain_error("ERROR : Tile size must be a power of two in [16,4096].");
+
+	if(memory < 3*tile_size*tile_size)
+		throw std::domain_error("ERROR : Memory of the pyramid can't hold a tile.");
+}
+
+
+
+/********************************************************************************************************************************
+* Destructor, removes the spilled tiles
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+TilePyramid::~TilePyramid(){
+
+	for(const std::pair<const TileKey, uint64_t>& entry : spilled)
+		std::remove(spill_path(entry.first, entry.second).c_str());
+}
+
+
+
+/********************************************************************************************************************************
+* Level whose pixels are at least as fine as the ones of a viewport, so that no detail is lost
+*
+* ARGUMENTS :
+*	- viewport is the part of the domain drawn
+*	- width and height are the dimensions of the buffer
+*
+* RETURN : the level, in [-30,40]
+**********************************************************************************************************************************/
+int TilePyramid::level(const Viewport& viewport, size_t width, size_t height) const{
+
+	// Distance between two pixels of the viewport (the pixels of a Martist are at both ends of the viewport)
+	const double dx = (viewport.x_max - viewport.x_min)/std::max<size_t>(width - 1, 1);
+	const double dy = (viewport.y_max - viewport.y_min)/std::max<size_t>(height - 1, 1);
+
+	// A pixel of the level is 2^(1-level)/tile_size wide
+	const double level = std::ceil(std::log2(2.0/(tile_size*std::min(dx, dy))));
+
+	return (int)std::max<double>(MIN_LEVEL, std::min<double>(MAX_LEVEL, level));
+}
+
+
+
+/********************************************************************************************************************************
+* Draw a viewport in a buffer from the tiles of the level of its pixels, rendering only the missing ones. Each pixel takes the
+* one of the tile containing it, so the image matches the one of a Martist up to the offset between the two grids, less than a
+* pixel of the level.
+*
+* ARGUMENTS :
+*	- red, green and blue are the colour expressions
+*	- viewport is the part of the domain drawn, the first row being drawn at y_min as in a Martist
+*	- buffer is an interleaved RGB8 buffer of width*height pixels
+**********************************************************************************************************************************/
+void TilePyramid::draw(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue, const Viewport& viewport,
+	unsigned char* buffer, size_t width, size_t height){
+
+	if(buffer == nullptr)
+		throw std::domain_error("ERROR : Buffer is empty.");
+
+	if((int)width <= 0 || (int)height <= 0)
+		throw std::domain_error("ERROR : Width or height can't be negative.");
+
+	if(!(viewport.x_min < viewport.x_max) || !(viewport.y_min < viewport.y_max))
+		throw std::domain_error("ERROR : Viewport is empty.");
+
+	const ColorExpression* const exps[3] = {&red, &green, &blue};
+	TileKey key;
+	key.hash = hash_combine(hash_combine(red.hash(), green.hash()), blue.hash());
+	for(int c = 0; c < 3; c++)
+		key.canonical[c] = std::make_shared<const vector<Opcode> >(exps[c]->compiled().canonical().code());
+	const int lod = level(viewport, width, height);
+	const double pixel = std::ldexp(2.0/tile_size, -lod);
+	const int64_t size = tile_size;
+
+	// Pixel of the level under each column and row of the buffer
+	vector<int64_t> columns(width), rows(height);
+	for(size_t i = 0; i < width; i++)
+		columns[i] = (int64_t)std::floor((viewport_x(viewport, grid_coordinate(i, width)) + 1.0)/pixel);
+	for(size_t j = 0; j < height; j++)
+		rows[j] = (int64_t)std::floor((viewport_y(viewport, grid_coordinate(j, height)) + 1.0)/pixel);
+
+	auto tile_index = [size](int64_t p){ return (p >= 0) ? p/size : -((-p - 1)/size) - 1; };
+	const int64_t first_x = tile_index(columns.front()), last_x = tile_index(columns.back());
+	const int64_t first_y = tile_index(rows.front()), last_y = tile_index(rows.back());
+	const int64_t count_x = last_x - first_x + 1;
+
+	vector<Tile> needed((size_t)(count_x*(last_y - first_y + 1)));
+	for(int64_t ty = first_y; ty <= last_y; ty++){
+		for(int64_t tx = first_x; tx <= last_x; tx++){
+			key.level = lod;
+			key.x = tx;
+			key.y = ty;
+			needed[(ty - first_y)*count_x + (tx - first_x)] = tile(exps, key);
+		}
+	}
+
+	for(size_t j = 0; j < height; j++){
+		const int64_t ty = tile_index(rows[j]);
+		const int64_t v = rows[j] - ty*size;
+		for(size_t i = 0; i < width; i++){
+			const int64_t tx = tile_index(columns[i]);
+			const int64_t u = columns[i] - tx*size;
+			const unsigned char* pixels = needed[(ty - first_y)*count_x + (tx - first_x)]->data() + 3*(v*size + u);
+			unsigned char* out = buffer + 3*(j*width + i);
+			out[0] = pixels[0];
+			out[1] = pixels[1];
+			out[2] = pixels[2];
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	counters.requests++;
+	counters.tiles += needed.size();
+}
+
+
+
+/********************************************************************************************************************************
+* Returns a tile : from memory, read back from the spill directory, averaged from its four children if they are in memory, or
+* rendered
+*
+* ARGUMENTS :
+*	- exps are the three colour expressions, whose hash and canonical forms are the ones of the key
+*	- key is the tile
+**********************************************************************************************************************************/
+Tile TilePyramid::tile(const ColorExpression* const exps[3], const TileKey& key){
+
+	Tile tile;
+	if(tiles.find(key, tile)){
+		std::lock_guard<std::mutex> lock(mutex);
+		counters.hits++;
+		return tile;
+	}
+
+	tile = read_spilled(key);
+	if(!tile){
+		tile = downsample(key);
+		if(!tile)
+			tile = render(exps, key);
+	}
+
+	keep(key, tile);
+	return tile;
+}
+
+
+
+/********************************************************************************************************************************
+* Pixels on a side of a tile
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+size_t TilePyramid::tileSize() const{
+	return tile_size;
+}
+
+
+
+/********************************************************************************************************************************
+* Counters since the construction
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+PyramidStats TilePyramid::stats() const{
+
+	std::lock_guard<std::mutex> lock(mutex);
+	return counters;
+}
+
+
+
+/********************************************************************************************************************************
+* Hit, miss and eviction counters of the tiles in memory (the children looked for by the downsampling included)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+CacheStats TilePyramid::cacheStats() const{
+	return tiles.stats();
+}
+
+
+
+/********************************************************************************************************************************
+* File of a spilled tile : <directory>/<hash>_<serial>_<level>_<x>_<y>.rgb
+*
+* ARGUMENTS :
+*	- key is the tile
+*	- serial is the number given to its file when it was spilled
+**********************************************************************************************************************************/
+string TilePyramid::spill_path(const TileKey& key, uint64_t serial) const{
+
+	char name[128];
+	std::snprintf(name, sizeof(name), "/%016llx_%llu_%d_%lld_%lld.rgb", (unsigned long long)key.hash, (unsigned long long)serial,
+		key.level, (long long)key.x, (long long)key.y);
+	return spill_directory + name;
+}
+
+
+
+/********************************************************************************************************************************
+* Insert a tile in memory. The tiles it evicts are written to the spill directory, if there is one and they aren't there yet.
+*
+* ARGUMENTS :
+*	- key is the tile
+*	- tile are its pixels
+**********************************************************************************************************************************/
+void TilePyramid::keep(const TileKey& key, const Tile& tile){
+
+	vector<std::pair<TileKey, Tile> > evicted;
+	tiles.insert(key, tile, tile->size(), spill_directory.empty() ? nullptr : &evicted);
+
+	for(const std::pair<TileKey, Tile>& entry : evicted){
+		uint64_t serial;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if(spilled.count(entry.first) != 0)
+				continue;
+			serial = spill_serial++;
+			spilled.insert(std::make_pair(entry.first, serial));
+			counters.spilled++;
+		}
+		write_file(spill_path(entry.first, serial), *entry.second);
+	}
+}
+
+
+
+/********************************************************************************************************************************
+* Read a spilled tile back
+*
+* ARGUMENT :
+*	- key is the tile
+*
+* RETURN : its pixels, nullptr if it isn't in the spill directory
+**********************************************************************************************************************************/
+Tile TilePyramid::read_spilled(const TileKey& key){
+
+	uint64_t serial;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<TileKey, uint64_t, TileKeyHash>::const_iterator found = spilled.find(key);
+		if(found == spilled.end())
+			return Tile();
+		serial = found->second;
+	}
+
+	std::shared_ptr<Bytes> pixels = std::make_shared<Bytes>(3*tile_size*tile_size);
+	std::ifstream in(spill_path(key, serial).c_str(), std::ios::binary);
+	if(!in.read((char*)pixels->data(), pixels->size()))
+		return Tile();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	counters.disk_reads++;
+	return pixels;
+}
+
+
+
+/********************************************************************************************************************************
+* Average the four children of a tile (the 2x2 box filter : a pixel covers exactly four pixels of the next level). The children
+* read back from the spill directory aren't kept in memory.
+*
+* ARGUMENT :
+*	- key is the tile
+*
+* RETURN : its pixels, nullptr if one of its children is neither in memory nor spilled
+**********************************************************************************************************************************/
+Tile TilePyramid::downsample(const TileKey& key){
+
+	if(key.level >= MAX_LEVEL)
+		return Tile();
+
+	Tile children[4];
+	for(int c = 0; c < 4; c++){
+		TileKey child = key;
+		child.level = key.level + 1;
+		child.x = 2*key.x + (c & 1);
+		child.y = 2*key.y + (c >> 1);
+		if(!tiles.find(child, children[c]) && !(children[c] = read_spilled(child)))
+			return Tile();
+	}
+
+	const size_t size = tile_size, half = tile_size/2;
+	std::shared_ptr<Bytes> pixels = std::make_shared<Bytes>(3*size*size);
+
+	for(size_t j = 0; j < size; j++){
+		const Bytes& child = *children[(j >= half)*2];
+		const Bytes& right = *children[(j >= half)*2 + 1];
+		const size_t v = 2*(j % half);
+		for(size_t i = 0; i < size; i++){
+			const Bytes& source = (i >= half) ? right : child;
+			const size_t u = 2*(i % half);
+			const unsigned char* top = source.data() + 3*(v*size + u);
+			const unsigned char* bottom = top + 3*size;
+			for(int c = 0; c < 3; c++)
+				(*pixels)[3*(j*size + i) + c] = (unsigned char)((top[c] + top[3 + c] + bottom[c] + bottom[3 + c] + 2)/4);
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	counters.downsampled++;
+	return pixels;
+}
+
+
+
+/********************************************************************************************************************************
+* Render a tile with a Martist, its pixels being at the centres of a tile_size x tile_size grid over its square so that the tiles
+* of a level neither overlap nor leave gaps
+*
+* ARGUMENTS :
+*	- exps are the three colour expressions
+*	- key is the tile
+**********************************************************************************************************************************/
+Tile TilePyramid::render(const ColorExpression* const exps[3], const TileKey& key){
+
+	const double side = std::ldexp(2.0, -key.level);
+	const double pixel = side/tile_size;
+	const double x0 = -1.0 + key.x*side, y0 = -1.0 + key.y*side;
+
+	std::shared_ptr<Bytes> pixels = std::make_shared<Bytes>(3*tile_size*tile_size);
+
+	Martist martist(pixels->data(), tile_size, tile_size, 0, 0, 0);
+	martist.viewport({x0 + pixel/2, x0 + side - pixel/2, y0 + pixel/2, y0 + side - pixel/2});
+	martist.draw(*exps[0], *exps[1], *exps[2]);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	counters.rendered++;
+	return pixels;
+}
@@ -0,0 +1,96 @@
+#ifndef GUARD_tilePyramid_h
+#define GUARD_tilePyramid_h
+
+#include "martist.hpp"
+#include "cache.hpp"
+#include "colorExpression.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <cstddef>
+#include <stdint.h>
+
+
+struct TileKey // Identifies a tile of the pyramid
+{
+	uint64_t hash; // Hash of the three colour expressions
+	std::shared_ptr<const std::vector<Opcode> > canonical[3]; // Canonical forms of the three colour expressions, compared when the hashes are equal
+	int level; // A tile covers a square of side 2^(1-level) : the domain [-1,1] x [-1,1] is one tile at level 0, 4 at level 1...
+	int64_t x; // Column and row of the tile, the tile (0,0) starting at (-1,-1)
+	int64_t y;
+
+	bool operator==(const TileKey& other) const;
+};
+
+struct TileKeyHash
+{
+	size_t operator()(const TileKey& key) const;
+};
+
+typedef std::shared_ptr<const std::vector<unsigned char> > Tile; // Interleaved RGB8 pixels of a tile
+
+typedef LruCache<TileKey, Tile, TileKeyHash> TileCache; // Tiles, bounded by their size in bytes
+
+
+
+struct PyramidStats // Counters of a tile pyramid
+{
+	size_t requests; // Viewports drawn
+	size_t tiles; // Tiles used by the viewports
+	size_t hits; // Tiles found in memory
+	size_t disk_reads; // Tiles read back from the spill directory
+	size_t downsampled; // Tiles made from their four cached children
+	size_t rendered;
+	size_t spilled; // Tiles evicted from memory and written to the spill directory
+};
+
+
+
+class TilePyramid // Tiles of power-of-two levels of detail over the expression domain, rendered on demand and cached
+{
+
+public:
+
+	explicit TilePyramid(size_t memory, size_t tile_size = 256, const std::string& spill_directory = ""); // Constructor (memory in bytes, no spill without directory)
+
+	~TilePyramid(); // Destructor, removes the spilled tiles
+
+	void draw(const ColorExpression& red, const ColorExpression& green, const ColorExpression& blue, const Viewport& viewport,
+		unsigned char* buffer, size_t width, size_t height); // Draw a viewport in an RGB8 buffer from the tiles, rendering the missing ones
+
+	Tile tile(const ColorExpression* const exps[3], const TileKey& key); // Returns a tile, from memory, from the disk, from its children or rendered
+
+	int level(const Viewport& viewport, size_t width, size_t height) const; // Level whose pixels are at least as fine as the ones of the viewport
+
+	size_t tileSize() const; // Pixels on a side of a tile
+
+	PyramidStats stats() const; // Counters since the construction
+
+	CacheStats cacheStats() const; // Hit, miss and eviction counters of the tiles in memory
+
+
+private:
+
+	size_t tile_size;
+	std::string spill_directory;
+	TileCache tiles;
+
+	std::unordered_map<TileKey, uint64_t, TileKeyHash> spilled; // Tiles written to the spill directory, with the serial number of their file
+	PyramidStats counters;
+	mutable std::mutex mutex; // Guards spilled and counters
+
+	std::string spill_path(const TileKey& key, uint64_t serial) const; // File of a spilled tile
+	void keep(const TileKey& key, const Tile& tile); // Insert a tile in memory, spilling the evicted ones
+	Tile read_spilled(const TileKey& key); // Read a spilled tile back (nullptr if it isn't on the disk)
+	Tile downsample(const TileKey& key); // Average the four children of a tile, if they are all cached (nullptr otherwise)
+	Tile render(const ColorExpression* const exps[3], const TileKey& key); // Render a tile, its pixels at the centres of a grid
+
+	TilePyramid(const TilePyramid&) = delete;
+	TilePyramid& operator=(const TilePyramid&) = delete;
+
+};
+
+#endif
@@ -0,0 +1,58 @@
+#include "tuner.hpp"
+#include "kernels.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <cstdlib> //strtoul, atoi
+#include <stdexcept> //domain_error
+
+using std::cout;
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+
+
+/********************************************************************************************************************************
+* Tuning of the rendering strategy of this machine : every strategy measured is printed, the fastest one is written to the
+* profile of the machine (see tuning_profile_path), which the Martists load at their construction.
+*
+*	tune [width height depth]
+**********************************************************************************************************************************/
+int main(int argc, char* argv[]){
+
+	if(argc != 1 && argc != 4){
+		cerr << "Usage : " << argv[0] << " [width height depth]" << endl;
+		return 2;
+	}
+
+	const size_t width = (argc == 4) ? std::strtoul(argv[1], nullptr, 10) : 512;
+	const size_t height = (argc == 4) ? std::strtoul(argv[2], nullptr, 10) : 512;
+	const int depth = (argc == 4) ? std::atoi(argv[3]) : 8;
+
+	try{
+		vector<TuningTrial> trials;
+		TuningProfile best = tune_rendering(width, height, depth, &trials);
+
+		cout << "kernels  tile rows  batch  threads  ms/render" << endl;
+		for(size_t i = 0; i < trials.size(); i++){
+			const TuningProfile& p = trials[i].profile;
+			cout << std::setw(7) << kernel_isa_name(p.isa) << "  " << std::setw(9) << p.tile_rows << "  " << std::setw(5) << p.batch
+				<< "  " << std::setw(7) << p.threads << "  " << std::fixed << std::setprecision(3) << std::setw(9)
+				<< 1000*trials[i].seconds << endl;
+		}
+
+		save_machine_tuning_profile(best);
+
+		cout << "\nProfile written to " << tuning_profile_path() << " :\n" << best;
+	}
+	catch(std::domain_error& e){
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,419 @@
+#include "tuner.hpp"
+#include "martist.hpp"
+#include "colorExpression.hpp"
+#include "kernels.hpp"
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept> //domain_error
+#include <algorithm> //std::min, std::max
+#include <cstdlib> //getenv
+#include <chrono>
+#include <random>
+#include <mutex>
+#include <thread>
+
+using std::string;
+using std::vector;
+
+typedef std::chrono::steady_clock Clock;
+
+
+static const size_t MAX_TUNING_SIDE = 512; // Largest side of the image rendered by the benchmark
+static const int TUNING_SCENES = 2; // Colour expressions rendered by each measure of the benchmark
+static const double MIN_SECONDS = 0.02; // Shortest duration of a measure, repeating the renders if they are faster
+static const int MEASURES = 3; // Measures of each strategy, the fastest one is kept
+static const double MIN_GAIN = 0.02; // Smallest relative gain for a strategy to replace the current best one
+
+static const size_t BATCHES[] = {16, 32, 64, 128, 256, 512};
+static const size_t TILE_ROWS[] = {1, 4, 8, 16, 32, 64};
+
+
+
+/********************************************************************************************************************************
+* Default rendering strategy : the best kernels of the processor (or the ones of the MARTIST_KERNELS environment variable),
+* tiles of 16 rows, batches of 64 pixels and the pool of the library
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+TuningProfile default_tuning_profile(){
+
+	TuningProfile profile;
+
+	if(!kernels_from_environment(&profile.isa))
+		profile.isa = best_kernel_isa();
+	profile.tile_rows = 16;
+	profile.batch = 64;
+	profile.threads = 0;
+
+	return profile;
+}
+
+
+
+/********************************************************************************************************************************
+* Kernels the renders of a profile use : the ones of the profile, unless the MARTIST_KERNELS environment variable chose them
+*
+* ARGUMENTS :
+*	- profile is the rendering strategy
+**********************************************************************************************************************************/
+KernelIsa profile_kernel_isa(const TuningProfile& profile){
+
+	KernelIsa isa = profile.isa;
+	kernels_from_environment(&isa);
+
+	return isa;
+}
+
+
+
+/********************************************************************************************************************************
+* Write a profile as "key value" lines, as in a profile file
+*
+* ARGUMENTS :
+*	- out is the output stream
+*	- profile is the profile to write
+**********************************************************************************************************************************/
+std::ostream& operator<<(std::ostream& out, const TuningProfile& profile){
+
+	out << "kernels " << kernel_isa_name(profile.isa) << "\n";
+	out << "tile_rows " << profile.tile_rows << "\n";
+	out << "batch " << profile.batch << "\n";
+	out << "threads " << profile.threads << "\n";
+
+	return out;
+}
+
+
+
+/********************************************************************************************************************************
+* File of the profile of the machine : the MARTIST_PROFILE environment variable, or .martist_profile in the home directory
+* (in the current directory without home directory)
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+string tuning_profile_path(){
+
+	const char* path = std::getenv("MARTIST_PROFILE");
+	if(path != nullptr && *path != '\0')
+		return path;
+
+	const char* home = std::getenv("HOME");
+	if(home != nullptr && *home != '\0')
+		return string(home) + "/.martist_profile";
+
+	return ".martist_profile";
+}
+
+
+
+/********************************************************************************************************************************
+* Read a profile file : "key value" lines (kernels, tile_rows, batch, threads), empty lines and lines starting with '#' are
+* skipped. The missing keys keep their value.
+*
+* ARGUMENTS :
+*	- path is the file to read
+*	- profile receives the values of the file
+*
+* RETURN : false if the file can't be opened
+**********************************************************************************************************************************/
+bool load_tuning_profile(const string& path, TuningProfile& profile){
+
+	std::ifstream in(path.c_str());
+	if(!in)
+		return false;
+
+	TuningProfile read = profile;
+	string line;
+	size_t number = 0;
+
+	while(std::getline(in, line)){
+
+		number++;
+
+		std::istringstream fields(line);
+		string key, value, extra;
+
+		if(!(fields >> key) || key[0] == '#')
+			continue;
+
+		const string where = " at line " + std::to_string(number) + " of " + path + ".";
+
+		if(!(fields >> value) || (fields >> extra))
+			throw std::domain_error("ERROR : Expected \"key value\"" + where);
+
+		if(key == "kernels"){
+			if(!parse_kernel_isa(value.c_str(), read.isa))
+				throw std::domain_error("ERROR : Unknown kernels " + value + where);
+			continue;
+		}
+
+		size_t* field = nullptr;
+		if(key == "tile_rows")
+			field = &read.tile_rows;
+		else if(key == "batch")
+			field = &read.batch;
+		else if(key == "threads")
+			field = &read.threads;
+		else
+			throw std::domain_error("ERROR : Unknown key " + key + where);
+
+		if(value.find_first_not_of("0123456789") != string::npos || value.size() > 9)
+			throw std::domain_error("ERROR : Bad value " + value + where);
+		*field = std::stoul(value);
+	}
+
+	profile = read;
+
+	return true;
+}
+
+
+
+/********************************************************************************************************************************
+* Write a profile file
+*
+* ARGUMENTS :
+*	- path is the file to write
+*	- profile is the profile to write
+**********************************************************************************************************************************/
+void save_tuning_profile(const string& path, const TuningProfile& profile){
+
+	std::ofstream out(path.c_str());
+
+	out << "# Rendering profile of this machine, written by the tuner of martist\n" << profile;
+
+	if(!out)
+		throw std::domain_error("ERROR : Can't write the profile " + path + ".");
+}
+
+
+
+/********************************************************************************************************************************
+* Profile of the machine, cached for the whole program
+**********************************************************************************************************************************/
+static std::mutex& machine_mutex(){
+	static std::mutex mutex;
+	return mutex;
+}
+
+static TuningProfile& machine_profile(){
+
+	static TuningProfile profile = []{
+
+		TuningProfile read = default_tuning_profile();
+		try{
+			load_tuning_profile(tuning_profile_path(), read);
+		}catch(std::domain_error&){
+			//A damaged profile only costs speed : the defaults render the same images
+			read = default_tuning_profile();
+		}
+		return read;
+	}();
+
+	return profile;
+}
+
+
+
+/********************************************************************************************************************************
+* Profile of the machine, read from tuning_profile_path() the first time it is asked for (the default strategy if there is no
+* valid profile file), so that the Martists made one after the other don't read the file each time
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+TuningProfile machine_tuning_profile(){
+
+	std::lock_guard<std::mutex> lock(machine_mutex());
+	return machine_profile();
+}
+
+
+
+/********************************************************************************************************************************
+* Write the profile of the machine to tuning_profile_path(), the Martists made from now on use it
+*
+* ARGUMENTS :
+*	- profile is the new profile of the machine
+**********************************************************************************************************************************/
+void save_machine_tuning_profile(const TuningProfile& profile){
+
+	std::lock_guard<std::mutex> lock(machine_mutex());
+
+	save_tuning_profile(tuning_profile_path(), profile);
+	machine_profile() = profile;
+}
+
+
+
+/********************************************************************************************************************************
+* Benchmark of the tuner : a Martist rendering a few fixed random colour expressions with one strategy after the other
+**********************************************************************************************************************************/
+class TuningBenchmark
+{
+
+public:
+
+	TuningBenchmark(size_t width, size_t height, int depth);
+
+	double measure(const TuningProfile& profile); // Best time of a render with the strategy, in seconds
+
+
+private:
+
+	vector<unsigned char> buffer;
+	Martist martist;
+	vector<ColorExpression> scenes;
+
+	void render(); // Render all the scenes once
+
+};
+
+
+
+/********************************************************************************************************************************
+* Constructor
+*
+* ARGUMENTS :
+*	- width and height are the dimensions of the rendered image
+*	- depth is the depth of the colour expressions
+**********************************************************************************************************************************/
+TuningBenchmark::TuningBenchmark(size_t width, size_t height, int depth) :
+	buffer(3*width*height),
+	martist(buffer.data(), width, height, depth, depth, depth),
+	scenes(3*TUNING_SCENES)
+{
+	std::mt19937 generator(20240611);
+	RandomSource random = [&generator]{ return (int)(generator() >> 1); };
+
+	for(size_t i = 0; i < scenes.size(); i++)
+		scenes[i].new_exp(depth, random);
+}
+
+
+
+/********************************************************************************************************************************
+* Render all the scenes once
+*
+* ARGUMENT : /
+**********************************************************************************************************************************/
+void TuningBenchmark::render(){
+
+	for(int i = 0; i < TUNING_SCENES; i++)
+		martist.draw(scenes[3*i], scenes[3*i+1], scenes[3*i+2]);
+}
+
+
+
+/********************************************************************************************************************************
+* Best time of a render with the strategy. The first render calibrates the number of renders of each measure, so that a
+* measure lasts at least MIN_SECONDS whatever the speed of the machine.
+*
+* ARGUMENTS :
+*	- profile is the strategy to measure
+*
+* RETURN : the time of one render of all the scenes, in seconds
+**********************************************************************************************************************************/
+double TuningBenchmark::measure(const TuningProfile& profile){
+
+	martist.tuning(profile);
+
+	Clock::time_point start = Clock::now();
+	render();
+	double best = std::chrono::duration<double>(Clock::now() - start).count();
+
+	const int repeat = std::max(1, (int)(MIN_SECONDS/std::max(best, 1e-6)));
+
+	for(int m = 0; m < MEASURES; m++){
+
+		start = Clock::now();
+		for(int r = 0; r < repeat; r++)
+			render();
+
+		best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count()/repeat);
+	}
+
+	return best;
+}
+
+
+
+/********************************************************************************************************************************
+* Measure the rendering strategies and return the fastest one. The choices are made one after the other, starting from the
+* default strategy : the kernels, the number of pixels evaluated at once, the rows of a tile, then the number of threads. A
+* choice replaces the current one only if it is faster by MIN_GAIN at least, so that the noise doesn't move the profile. The
+* benchmark renders random expressions of the given depth on an image of the given size (at most 512 pixels per side).
+* The kernels chosen by the MARTIST_KERNELS environment variable are not questioned.
+*
+* ARGUMENTS :
+*	- width and height are the dimensions of the images to render
+*	- depth is the depth of their colour expressions
+*	- trials receives every strategy measured, with its time (nullptr if not needed)
+*
+* RETURN : the fastest strategy
+**********************************************************************************************************************************/
+TuningProfile tune_rendering(size_t width, size_t height, int depth, vector<TuningTrial>* trials){
+
+	if(width == 0 || height == 0)
+		throw std::domain_error("ERROR : Width or height can't be negative.");
+	if(depth < 0)
+		throw std::domain_error("ERROR : Depth of expressions can't be negative.");
+
+	TuningBenchmark benchmark(std::min(width, MAX_TUNING_SIDE), std::min(height, MAX_TUNING_SIDE), depth);
+
+	TuningProfile best = default_tuning_profile();
+	double best_seconds = 0;
+
+	auto consider = [&](const TuningProfile& candidate){
+
+		TuningTrial trial;
+		trial.profile = candidate;
+		trial.seconds = benchmark.measure(candidate);
+
+		if(trials != nullptr)
+			trials->push_back(trial);
+
+		if(best_seconds == 0 || trial.seconds < best_seconds*(1 - MIN_GAIN)){
+			best = candidate;
+			best_seconds = trial.seconds;
+		}
+	};
+
+	consider(best);
+
+	if(!kernels_from_environment()){
+		const KernelIsa isas[4] = {ISA_GENERIC, ISA_SSE4, ISA_AVX2, ISA_AVX512};
+		TuningProfile candidate = best;
+		for(int i = 0; i < 4; i++){
+			candidate.isa = isas[i];
+			if(isas[i] != best.isa && kernel_isa_supported(isas[i]))
+				consider(candidate);
+		}
+	}
+
+	TuningProfile candidate = best;
+	for(size_t i = 0; i < sizeof(BATCHES)/sizeof(BATCHES[0]); i++){
+		candidate.batch = BATCHES[i];
+		if(candidate.batch != default_tuning_profile().batch)
+			consider(candidate);
+	}
+
+	candidate = best;
+	for(size_t i = 0; i < sizeof(TILE_ROWS)/sizeof(TILE_ROWS[0]); i++){
+		candidate.tile_rows = TILE_ROWS[i];
+		if(candidate.tile_rows != default_tuning_profile().tile_rows)
+			consider(candidate);
+	}
+
+	// Fewer threads than cores (the default pool has one thread per core)
+	const size_t cores = std::max(1u, std::thread::hardware_concurrency());
+	candidate = best;
+	for(size_t threads = 1; threads < cores; threads *= 2){
+		candidate.threads = threads;
+		consider(candidate);
+	}
+
+	return best;
+}
@@ -0,0 +1,47 @@
+#ifndef GUARD_tuner_h
+#define GUARD_tuner_h
+
+#include "kernels.hpp"
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <cstddef>
+
+
+struct TuningProfile // Rendering strategy of a machine (all the strategies give the same images)
+{
+	KernelIsa isa; // Kernels of the evaluation
+	size_t tile_rows; // Rows of a tile, the unit of parallelism, progress and cancellation of a render
+	size_t batch; // Pixels evaluated at once
+	size_t threads; // Threads of a render, the calling one included (0 for the pool of the library, one thread per core)
+};
+
+TuningProfile default_tuning_profile(); // Best kernels of the processor, tiles of 16 rows, batches of 64 pixels, pool of the library
+
+KernelIsa profile_kernel_isa(const TuningProfile& profile); // Kernels the renders of a profile use : its own, unless the MARTIST_KERNELS environment variable chose them
+
+std::ostream& operator<<(std::ostream& out, const TuningProfile& profile); // "key value" lines, as in a profile file
+
+std::string tuning_profile_path(); // File of the profile of the machine : $MARTIST_PROFILE, or ~/.martist_profile
+
+bool load_tuning_profile(const std::string& path, TuningProfile& profile); // Read a profile file (false if there is none)
+
+void save_tuning_profile(const std::string& path, const TuningProfile& profile); // Write a profile file
+
+TuningProfile machine_tuning_profile(); // Profile of the machine, read once (defaults without a valid profile file)
+
+void save_machine_tuning_profile(const TuningProfile& profile); // Write the profile of the machine and use it from now on
+
+
+
+struct TuningTrial // One strategy measured by the tuner
+{
+	TuningProfile profile;
+	double seconds; // Best time of a render of the benchmark
+};
+
+TuningProfile tune_rendering(size_t width, size_t height, int depth,
+	std::vector<TuningTrial>* trials = nullptr); // Measure the rendering strategies and return the fastest one
+
+#endif